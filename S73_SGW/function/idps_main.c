@@ -362,13 +362,22 @@ static void initNetConnect(void)
 }
 
 
-int main(){
+int main(int argc, char *argv[]){
 	//step 0:获取基础配置
 	char spdlog[256] = {0};
 	int ret = 0;
 
 	idpsStatusInfo_t statusInfo;
 
+#if MODULE_NETWORKMONITOR
+	// 离线压测: IDPS --replay <pcap|syn_flood[:包数[:输出.pcap]]> [local_ip] [realtime]
+	if(argc > 2 && strcmp(argv[1], "--replay") == 0)
+	{
+		ret = NetWorkMonitorMethodObj.replayCapture(argv[2], (argc > 3) ? argv[3] : NULL, (argc > 4) ? atoi(argv[4]) : 0);
+		return (ret == 0) ? 0 : 1;
+	}
+#endif
+
 	conf_rw_path_init();
 	SetIDSVersion();
 	getLocalConfig(&configObj, 0);  //获取common配置
@@ -33,6 +33,8 @@ extern "C" {
 #define IDPS_FULL_FUNCTION_       0
 #define MODULE_FUNCMONITOR		  0
 #define MODULE_MQTTMANAGER		  0
+/*networkfirewall backend:0 iptables commands, 1 one nf_tables transaction (falls back to iptables when refused)*/
+#define NETFIREWALL_NFTABLES      0
 
 typedef struct _commonModule{
 	char dataBaseDir[256];
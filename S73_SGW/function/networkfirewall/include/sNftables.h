@@ -0,0 +1,36 @@
+#ifndef __SNFTABLES__H_
+#define __SNFTABLES__H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+#include "idps_main.h"
+#include "util.h"
+#if NETFIREWALL_NFTABLES
+
+#define NFT_IDPS_TABLE          "idps"          //table ip idps, owned by the IDPS and replaced as a whole
+
+/**
+ * whole firewall policy, applied in one nf_tables transaction:either all of it is in the kernel or none
+ * rules    :char*, iptables arguments ("-A INPUT -s 1.2.3.4 -j DROP"), filter table only
+ * redirect :dnatstruct (NetworkSql_queryDirectMap), daddr -> redirect address map in prerouting/output
+ * ipBlack  :char*, XXX.XXX.XXX.XXX or XXX.XXX.XXX.XXX/MASK dropped in both directions
+ * portBlack:char*, tcp/udp port dropped on input
+ * any list may be NULL
+ */
+typedef struct _nftPolicy{
+    list *rules;
+    list *redirect;
+    list *ipBlack;
+    list *portBlack;
+    void (*unsupported)(char *rule);            //rules nf_tables can not take from here, e.g. run through iptables
+}nftPolicy;
+
+/*0 applied, -1 the kernel refused (no nf_tables...), the previous policy stays*/
+int nftApplyPolicy(nftPolicy *policy);
+int nftRemovePolicy(void);
+
+#endif
+#ifdef __cplusplus
+}
+#endif
+#endif
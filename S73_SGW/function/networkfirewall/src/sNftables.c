@@ -0,0 +1,992 @@
+/*
+ * nf_tables backend of the networkfirewall module.
+ * the policy goes to the kernel as one nfnetlink batch (the messages libnftnl would build), the
+ * kernel swaps table ip idps as a whole or refuses all of it.  consecutive address only rules of a
+ * chain become one interval verdict map, so a long black list costs one lookup per packet
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter_ipv4.h>
+#include <linux/netfilter/nf_tables.h>
+#include "spdloglib.h"
+#include "sNftables.h"
+#if MODULE_NETWORKMONITOR
+#include "Adt_networkmonitor.h"
+#endif
+#if NETFIREWALL_NFTABLES
+
+#define NFT_BATCH_INIT          (16 * 1024)
+#define NFT_ELEMS_PER_MSG       64
+#define NFT_VMAP_MIN            2               //shorter runs stay plain rules
+#define NFT_VMAP_MAX            4096            //bounds the overlap check of one run
+#define NFT_ACK_TIMEOUT         2               //seconds
+#define NFT_TYPE_IPADDR         7               //nft userspace datatypes, only used by "nft list"
+#define NFT_TYPE_INETSERVICE    13
+#define NFT_VERDICT_REJECT      (-1)
+
+enum nftChain{
+    NFT_INPUT,
+    NFT_OUTPUT,
+    NFT_FORWARD,
+    NFT_CHAINS
+};
+static const struct{
+    const char *name;
+    const char *iptname;
+    unsigned int hook;
+}nftchains[NFT_CHAINS] = {
+    {"input",   "INPUT",   NF_INET_LOCAL_IN},
+    {"output",  "OUTPUT",  NF_INET_LOCAL_OUT},
+    {"forward", "FORWARD", NF_INET_FORWARD},
+};
+
+typedef struct _nftBatch{
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t last;                                //last content message, carries the ack
+    uint32_t seq;
+    uint32_t setid;
+    bool nomem;
+}nftBatch;
+
+typedef struct _nftRule{
+    int chain;
+    int verdict;                                //NF_ACCEPT NF_DROP NFT_VERDICT_REJECT
+    char iif[IFNAMSIZ];
+    char oif[IFNAMSIZ];
+    bool hassrc;
+    bool hasdst;
+    uint32_t src, srcmask;                      //network order
+    uint32_t dst, dstmask;
+    int proto;                                  //-1 any
+    uint16_t sport, dport;                      //0 any
+}nftRule;
+
+typedef struct _nftRange{
+    uint32_t start;                             //host order
+    uint64_t end;                               //exclusive, 1 << 32 for the top of the space
+    int verdict;
+}nftRange;
+
+typedef struct _nftElemWriter{
+    const char *name;
+    uint32_t id;
+    size_t msg;
+    size_t list;
+    int count;
+}nftElemWriter;
+
+/*************************** netlink message building ***************************/
+static bool nftReserve(nftBatch *b, size_t need)
+{
+    size_t cap;
+    char *buf;
+
+    if(b->nomem)
+        return false;
+    if(b->len + need <= b->cap)
+        return true;
+    cap = (b->cap) ? (b->cap) : (NFT_BATCH_INIT);
+    while(cap < b->len + need)
+        cap *= 2;
+    buf = (char *)realloc(b->buf, cap);
+    if(buf == NULL){
+        b->nomem = true;
+        return false;
+    }
+    memset(buf + b->cap, 0, cap - b->cap);
+    b->buf = buf;
+    b->cap = cap;
+    return true;
+}
+/*offsets instead of pointers:the buffer moves when it grows*/
+static size_t nftAttr(nftBatch *b, uint16_t type, const void *data, uint16_t len)
+{
+    size_t off = b->len;
+    struct nlattr *attr;
+
+    if(!nftReserve(b, NLA_ALIGN(NLA_HDRLEN + len)))
+        return off;
+    attr = (struct nlattr *)(b->buf + off);
+    attr->nla_type = type;
+    attr->nla_len = NLA_HDRLEN + len;
+    if(len)
+        memcpy(b->buf + off + NLA_HDRLEN, data, len);
+    b->len += NLA_ALIGN(NLA_HDRLEN + len);
+    return off;
+}
+
+static void nftU32(nftBatch *b, uint16_t type, uint32_t value)
+{
+    uint32_t nvalue = htonl(value);
+    nftAttr(b, type, &nvalue, sizeof(nvalue));
+}
+
+static void nftStr(nftBatch *b, uint16_t type, const char *str)
+{
+    nftAttr(b, type, str, strlen(str) + 1);
+}
+
+static size_t nftNest(nftBatch *b, uint16_t type)
+{
+    return nftAttr(b, type | NLA_F_NESTED, NULL, 0);
+}
+
+static void nftNestEnd(nftBatch *b, size_t nest)
+{
+    if(!b->nomem)
+        ((struct nlattr *)(b->buf + nest))->nla_len = b->len - nest;
+}
+
+static size_t nftMsg(nftBatch *b, uint16_t type, uint16_t flags, uint8_t family, uint16_t resid)
+{
+    size_t off = b->len;
+    struct nlmsghdr *nlh;
+    struct nfgenmsg *nfg;
+
+    if(!nftReserve(b, NLMSG_SPACE(sizeof(struct nfgenmsg))))
+        return off;
+    nlh = (struct nlmsghdr *)(b->buf + off);
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+    nlh->nlmsg_seq = ++ b->seq;
+    nfg = NLMSG_DATA(nlh);
+    nfg->nfgen_family = family;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons(resid);
+    b->len += NLMSG_SPACE(sizeof(struct nfgenmsg));
+    return off;
+}
+
+static void nftMsgEnd(nftBatch *b, size_t msg)
+{
+    if(!b->nomem)
+        ((struct nlmsghdr *)(b->buf + msg))->nlmsg_len = b->len - msg;
+}
+
+static size_t nftObj(nftBatch *b, uint16_t type, uint16_t flags)
+{
+    b->last = nftMsg(b, (NFNL_SUBSYS_NFTABLES << 8) | type, flags, NFPROTO_IPV4, 0);
+    return b->last;
+}
+
+static void nftBatchMark(nftBatch *b, uint16_t type)
+{
+    nftMsgEnd(b, nftMsg(b, type, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES));
+}
+/*
+* batch frame:begin, the table emptied by create + delete (the create keeps the delete from failing
+* on the first run), content, end.  only the last content message is acked:its ack tells the whole
+* batch went through, errors of any message before it are reported on their own
+*/
+static void nftBatchOpen(nftBatch *b, bool recreate)
+{
+    size_t msg;
+
+    nftBatchMark(b, NFNL_MSG_BATCH_BEGIN);
+    msg = nftObj(b, NFT_MSG_NEWTABLE, NLM_F_CREATE);
+    nftStr(b, NFTA_TABLE_NAME, NFT_IDPS_TABLE);
+    nftMsgEnd(b, msg);
+    msg = nftObj(b, NFT_MSG_DELTABLE, 0);
+    nftStr(b, NFTA_TABLE_NAME, NFT_IDPS_TABLE);
+    nftMsgEnd(b, msg);
+    if(recreate){
+        msg = nftObj(b, NFT_MSG_NEWTABLE, NLM_F_CREATE);
+        nftStr(b, NFTA_TABLE_NAME, NFT_IDPS_TABLE);
+        nftMsgEnd(b, msg);
+    }
+}
+
+static void nftBatchClose(nftBatch *b)
+{
+    if(!b->nomem)
+        ((struct nlmsghdr *)(b->buf + b->last))->nlmsg_flags |= NLM_F_ACK;
+    nftBatchMark(b, NFNL_MSG_BATCH_END);
+}
+/**
+ * @name:   nftSend
+ * @msg:    send the batch and wait for the ack of its last message, the kernel reports every
+ *          failed message before it and applies nothing when one failed
+ * @return: 0 applied, -1 refused
+ */
+static int nftSend(nftBatch *b)
+{
+    struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+    struct timeval timeout = {NFT_ACK_TIMEOUT, 0};
+    char reply[32 * 1024], logbuf[128];
+    int fd, len, size = b->len, ret = -1;
+    bool done = false;
+
+    if(b->nomem){
+        log_e("networkfirewall", "nftables:out of memory building the batch");
+        return -1;
+    }
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+    if(fd < 0){
+        log_e("networkfirewall", "nftables:no netfilter netlink socket");
+        return -1;
+    }
+    if(setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size)) < 0)//the batch is one datagram
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if(sendto(fd, b->buf, b->len, 0, (struct sockaddr *)&addr, sizeof(addr)) != (ssize_t)b->len){
+        snprintf(logbuf, sizeof(logbuf), "nftables:send %zu bytes: %s", b->len, strerror(errno));
+        log_e("networkfirewall", logbuf);
+        close(fd);
+        return -1;
+    }
+    ret = 0;
+    while(!done && (len = recv(fd, reply, sizeof(reply), 0)) > 0){
+        struct nlmsghdr *nlh = (struct nlmsghdr *)reply;
+        for(; NLMSG_OK(nlh, (unsigned int)len); nlh = NLMSG_NEXT(nlh, len)){
+            struct nlmsgerr *err = NLMSG_DATA(nlh);
+            if(nlh->nlmsg_type != NLMSG_ERROR)
+                continue;
+            if(err->error){
+                snprintf(logbuf, sizeof(logbuf), "nftables:message %u type 0x%x: %s", nlh->nlmsg_seq, err->msg.nlmsg_type, strerror(-err->error));
+                log_e("networkfirewall", logbuf);
+                ret = -1;
+            }
+            if((nlh->nlmsg_seq == b->seq - 1) || (err->error && (nlh->nlmsg_seq == 1)))//last content message, or the batch itself refused
+                done = true;
+        }
+    }
+    if(!done){
+        log_e("networkfirewall", "nftables:no answer to the batch");
+        ret = -1;
+    }
+    close(fd);
+    return ret;
+}
+
+/*************************** expressions ***************************/
+static size_t nftExprStart(nftBatch *b, const char *name, size_t *data)
+{
+    size_t elem = nftNest(b, NFTA_LIST_ELEM);
+    nftStr(b, NFTA_EXPR_NAME, name);
+    *data = nftNest(b, NFTA_EXPR_DATA);
+    return elem;
+}
+
+static void nftExprEnd(nftBatch *b, size_t elem, size_t data)
+{
+    nftNestEnd(b, data);
+    nftNestEnd(b, elem);
+}
+
+static void nftExprPayload(nftBatch *b, uint32_t base, uint32_t offset, uint32_t len)
+{
+    size_t data, elem = nftExprStart(b, "payload", &data);
+    nftU32(b, NFTA_PAYLOAD_DREG, NFT_REG_1);
+    nftU32(b, NFTA_PAYLOAD_BASE, base);
+    nftU32(b, NFTA_PAYLOAD_OFFSET, offset);
+    nftU32(b, NFTA_PAYLOAD_LEN, len);
+    nftExprEnd(b, elem, data);
+}
+
+static void nftExprMeta(nftBatch *b, uint32_t key)
+{
+    size_t data, elem = nftExprStart(b, "meta", &data);
+    nftU32(b, NFTA_META_DREG, NFT_REG_1);
+    nftU32(b, NFTA_META_KEY, key);
+    nftExprEnd(b, elem, data);
+}
+
+static void nftExprCmp(nftBatch *b, const void *value, uint16_t len)
+{
+    size_t nest, data, elem = nftExprStart(b, "cmp", &data);
+    nftU32(b, NFTA_CMP_SREG, NFT_REG_1);
+    nftU32(b, NFTA_CMP_OP, NFT_CMP_EQ);
+    nest = nftNest(b, NFTA_CMP_DATA);
+    nftAttr(b, NFTA_DATA_VALUE, value, len);
+    nftNestEnd(b, nest);
+    nftExprEnd(b, elem, data);
+}
+
+static void nftExprMask(nftBatch *b, uint32_t mask)
+{
+    uint32_t zero = 0;
+    size_t nest, data, elem = nftExprStart(b, "bitwise", &data);
+    nftU32(b, NFTA_BITWISE_SREG, NFT_REG_1);
+    nftU32(b, NFTA_BITWISE_DREG, NFT_REG_1);
+    nftU32(b, NFTA_BITWISE_LEN, sizeof(mask));
+    nest = nftNest(b, NFTA_BITWISE_MASK);
+    nftAttr(b, NFTA_DATA_VALUE, &mask, sizeof(mask));
+    nftNestEnd(b, nest);
+    nest = nftNest(b, NFTA_BITWISE_XOR);
+    nftAttr(b, NFTA_DATA_VALUE, &zero, sizeof(zero));
+    nftNestEnd(b, nest);
+    nftExprEnd(b, elem, data);
+}
+/*dreg:NFT_REG_VERDICT verdict map, NFT_REG_1 data map, -1 plain set*/
+static void nftExprLookup(nftBatch *b, const char *set, uint32_t setid, int dreg)
+{
+    size_t data, elem = nftExprStart(b, "lookup", &data);
+    nftStr(b, NFTA_LOOKUP_SET, set);
+    nftU32(b, NFTA_LOOKUP_SET_ID, setid);
+    nftU32(b, NFTA_LOOKUP_SREG, NFT_REG_1);
+    if(dreg >= 0)
+        nftU32(b, NFTA_LOOKUP_DREG, dreg);
+    nftExprEnd(b, elem, data);
+}
+
+static void nftExprVerdict(nftBatch *b, int verdict)
+{
+    size_t data, elem;
+
+    if(verdict == NFT_VERDICT_REJECT){
+        uint8_t code = ICMP_PORT_UNREACH;       //what iptables -j REJECT sends by default
+        elem = nftExprStart(b, "reject", &data);
+        nftU32(b, NFTA_REJECT_TYPE, NFT_REJECT_ICMP_UNREACH);
+        nftAttr(b, NFTA_REJECT_ICMP_CODE, &code, sizeof(code));
+        nftExprEnd(b, elem, data);
+    }
+    else{
+        size_t value, code;
+        elem = nftExprStart(b, "immediate", &data);
+        nftU32(b, NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT);
+        value = nftNest(b, NFTA_IMMEDIATE_DATA);
+        code = nftNest(b, NFTA_DATA_VERDICT);
+        nftU32(b, NFTA_VERDICT_CODE, verdict);
+        nftNestEnd(b, code);
+        nftNestEnd(b, value);
+        nftExprEnd(b, elem, data);
+    }
+}
+
+static void nftExprDnat(nftBatch *b)
+{
+    size_t data, elem = nftExprStart(b, "nat", &data);
+    nftU32(b, NFTA_NAT_TYPE, NFT_NAT_DNAT);
+    nftU32(b, NFTA_NAT_FAMILY, NFPROTO_IPV4);
+    nftU32(b, NFTA_NAT_REG_ADDR_MIN, NFT_REG_1);
+    nftExprEnd(b, elem, data);
+}
+
+static size_t nftRuleStart(nftBatch *b, const char *chain, size_t *exprs)
+{
+    size_t msg = nftObj(b, NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND);
+    nftStr(b, NFTA_RULE_TABLE, NFT_IDPS_TABLE);
+    nftStr(b, NFTA_RULE_CHAIN, chain);
+    *exprs = nftNest(b, NFTA_RULE_EXPRESSIONS);
+    return msg;
+}
+
+static void nftRuleEnd(nftBatch *b, size_t msg, size_t exprs)
+{
+    nftNestEnd(b, exprs);
+    nftMsgEnd(b, msg);
+}
+
+/*************************** objects ***************************/
+static void nftChainAdd(nftBatch *b, const char *name, const char *type, unsigned int hook, int priority)
+{
+    size_t nest, msg = nftObj(b, NFT_MSG_NEWCHAIN, NLM_F_CREATE);
+    nftStr(b, NFTA_CHAIN_TABLE, NFT_IDPS_TABLE);
+    nftStr(b, NFTA_CHAIN_NAME, name);
+    nest = nftNest(b, NFTA_CHAIN_HOOK);
+    nftU32(b, NFTA_HOOK_HOOKNUM, hook);
+    nftU32(b, NFTA_HOOK_PRIORITY, (uint32_t)priority);
+    nftNestEnd(b, nest);
+    nftU32(b, NFTA_CHAIN_POLICY, NF_ACCEPT);
+    nftStr(b, NFTA_CHAIN_TYPE, type);
+    nftMsgEnd(b, msg);
+}
+/*datatype NFT_DATA_VERDICT:verdict map, 0:plain set*/
+static uint32_t nftSetAdd(nftBatch *b, const char *name, uint32_t flags, uint32_t keytype, uint32_t keylen, uint32_t datatype, uint32_t datalen)
+{
+    uint32_t id = ++ b->setid;
+    size_t msg = nftObj(b, NFT_MSG_NEWSET, NLM_F_CREATE);
+    nftStr(b, NFTA_SET_TABLE, NFT_IDPS_TABLE);
+    nftStr(b, NFTA_SET_NAME, name);
+    nftU32(b, NFTA_SET_FLAGS, flags | ((datatype) ? (NFT_SET_MAP) : (0)));
+    nftU32(b, NFTA_SET_KEY_TYPE, keytype);
+    nftU32(b, NFTA_SET_KEY_LEN, keylen);
+    if(datatype){
+        nftU32(b, NFTA_SET_DATA_TYPE, datatype);
+        if(datatype != NFT_DATA_VERDICT)
+            nftU32(b, NFTA_SET_DATA_LEN, datalen);
+    }
+    nftU32(b, NFTA_SET_ID, id);
+    nftMsgEnd(b, msg);
+    return id;
+}
+
+static void nftElemFlush(nftBatch *b, nftElemWriter *w)
+{
+    if(w->count == 0)
+        return;
+    nftNestEnd(b, w->list);
+    nftMsgEnd(b, w->msg);
+    w->count = 0;
+}
+/*opens the element and writes its key, the caller adds data/flags and closes it with nftNestEnd*/
+static size_t nftElemStart(nftBatch *b, nftElemWriter *w, const void *key, uint16_t keylen)
+{
+    size_t elem, nest;
+
+    if(w->count == NFT_ELEMS_PER_MSG)
+        nftElemFlush(b, w);
+    if(w->count == 0){
+        w->msg = nftObj(b, NFT_MSG_NEWSETELEM, NLM_F_CREATE);
+        nftStr(b, NFTA_SET_ELEM_LIST_TABLE, NFT_IDPS_TABLE);
+        nftStr(b, NFTA_SET_ELEM_LIST_SET, w->name);
+        nftU32(b, NFTA_SET_ELEM_LIST_SET_ID, w->id);
+        w->list = nftNest(b, NFTA_SET_ELEM_LIST_ELEMENTS);
+    }
+    w->count ++;
+    elem = nftNest(b, NFTA_LIST_ELEM);
+    nest = nftNest(b, NFTA_SET_ELEM_KEY);
+    nftAttr(b, NFTA_DATA_VALUE, key, keylen);
+    nftNestEnd(b, nest);
+    return elem;
+}
+
+static int nftRangeCompare(const void *a, const void *b)
+{
+    const nftRange *ra = a, *rb = b;
+    return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+static bool nftRangeOverlap(const nftRange *ranges, int count, const nftRange *range)
+{
+    for(int loop = 0; loop < count; loop ++){
+        if((range->start < ranges[loop].end) && (ranges[loop].start < range->end))
+            return true;
+    }
+    return false;
+}
+/**
+ * @name:   nftVmapAdd
+ * @msg:    interval verdict map of disjoint ranges. an interval is a start element carrying the
+ *          verdict and an end element (first address after it), the kernel takes two starts in a
+ *          row as an overlap even for adjacent ranges.  a range up to 255.255.255.255 has no end
+ * @return: set id
+ */
+static uint32_t nftVmapAdd(nftBatch *b, const char *name, nftRange *ranges, int count)
+{
+    nftElemWriter w = {0};
+
+    w.name = name;
+    w.id = nftSetAdd(b, name, NFT_SET_INTERVAL, NFT_TYPE_IPADDR, sizeof(uint32_t), NFT_DATA_VERDICT, 0);
+    qsort(ranges, count, sizeof(nftRange), nftRangeCompare);
+    for(int loop = 0; loop < count; loop ++){
+        uint32_t key = htonl(ranges[loop].start);
+        size_t elem = nftElemStart(b, &w, &key, sizeof(key));
+        size_t data = nftNest(b, NFTA_SET_ELEM_DATA);
+        size_t code = nftNest(b, NFTA_DATA_VERDICT);
+        nftU32(b, NFTA_VERDICT_CODE, ranges[loop].verdict);
+        nftNestEnd(b, code);
+        nftNestEnd(b, data);
+        nftNestEnd(b, elem);
+        if(ranges[loop].end > 0xFFFFFFFFull)
+            continue;
+        key = htonl((uint32_t)ranges[loop].end);
+        elem = nftElemStart(b, &w, &key, sizeof(key));
+        nftU32(b, NFTA_SET_ELEM_FLAGS, NFT_SET_ELEM_INTERVAL_END);
+        nftNestEnd(b, elem);
+    }
+    nftElemFlush(b, &w);
+    return w.id;
+}
+/*ip saddr/daddr vmap @name*/
+static void nftVmapRule(nftBatch *b, int chain, bool source, const char *name, uint32_t id)
+{
+    size_t exprs, msg = nftRuleStart(b, nftchains[chain].name, &exprs);
+    nftExprPayload(b, NFT_PAYLOAD_NETWORK_HEADER, (source) ? (12) : (16), sizeof(uint32_t));
+    nftExprLookup(b, name, id, NFT_REG_VERDICT);
+    nftRuleEnd(b, msg, exprs);
+}
+
+/*************************** iptables arguments ***************************/
+/*XXX.XXX.XXX.XXX or XXX.XXX.XXX.XXX/MASK, network order*/
+static bool nftParseNet(const char *net, uint32_t *addr, uint32_t *mask)
+{
+    char ip[INET_ADDRSTRLEN] = {0};
+    const char *slash = strchr(net, '/');
+    size_t len = (slash != NULL) ? ((size_t)(slash - net)) : (strlen(net));
+    struct in_addr ipv4;
+    int bits = 32;
+
+    if(len >= sizeof(ip))
+        return false;
+    memcpy(ip, net, len);
+    if(inet_pton(AF_INET, ip, &ipv4) != 1)
+        return false;
+    if(slash != NULL){
+        char *end = NULL;
+        bits = strtol(slash + 1, &end, 10);
+        if((end == slash + 1) || (*end != '\0') || (bits < 0) || (bits > 32))
+            return false;
+    }
+    *mask = (bits) ? (htonl(0xFFFFFFFFu << (32 - bits))) : (0);
+    *addr = ipv4.s_addr & *mask;
+    return true;
+}
+
+static void nftNetRange(uint32_t addr, uint32_t mask, nftRange *range, int verdict)
+{
+    range->start = ntohl(addr);
+    range->end = (uint64_t)range->start + ((uint64_t)(~ntohl(mask)) + 1);
+    range->verdict = verdict;
+}
+
+static bool nftParsePort(const char *text, uint16_t *port)
+{
+    char *end = NULL;
+    long value = strtol(text, &end, 10);
+    if((end == text) || (*end != '\0') || (value <= 0) || (value > 65535))
+        return false;
+    *port = value;
+    return true;
+}
+/**
+ * @name:   nftParseRule
+ * @msg:    the iptables subset the filter policy uses:-t filter -A/-I chain [pos] -s -d -p
+ *          --sport --dport -i -o -j ACCEPT/DROP/REJECT.  anything else is left to iptables
+ * @param:  position:-1 append, else the 0 based insert position
+ */
+static bool nftParseRule(const char *text, nftRule *rule, int *position)
+{
+    char buf[512], *save = NULL, *token, *value;
+    bool ok = true, haveverdict = false;
+
+    memset(rule, 0, sizeof(nftRule));
+    rule->chain = -1;
+    rule->proto = -1;
+    *position = -1;
+    if(strlen(text) >= sizeof(buf))
+        return false;
+    strcpy(buf, text);
+    for(token = strtok_r(buf, " ", &save); ok && (token != NULL); token = strtok_r(NULL, " ", &save)){
+        if((strcmp(token, "-m") == 0)||(strcmp(token, "--match") == 0)){
+            value = strtok_r(NULL, " ", &save);//-m tcp/udp only repeats -p
+            ok = (value != NULL) && ((strcmp(value, "tcp") == 0) || (strcmp(value, "udp") == 0));
+            continue;
+        }
+        if((value = strtok_r(NULL, " ", &save)) == NULL){
+            ok = false;
+            break;
+        }
+        if(value[0] == '"' && strlen(value) >= 2 && value[strlen(value) - 1] == '"'){
+            value[strlen(value) - 1] = '\0';
+            value ++;
+        }
+        if((strcmp(token, "-t") == 0)||(strcmp(token, "--table") == 0)){
+            ok = (strcmp(value, "filter") == 0);
+        }
+        else if((strcmp(token, "-A") == 0)||(strcmp(token, "--append") == 0)||(strcmp(token, "-I") == 0)||(strcmp(token, "--insert") == 0)){
+            bool insert = (token[1] == 'I') || (token[2] == 'i');
+            ok = (rule->chain < 0);
+            for(int loop = 0; ok && (loop < NFT_CHAINS); loop ++){
+                if(strcmp(value, nftchains[loop].iptname) == 0)
+                    rule->chain = loop;
+            }
+            ok = ok && (rule->chain >= 0);
+            if(ok && insert){
+                char *next = save, *end = NULL;
+                long pos = 1;
+                while(next != NULL && *next == ' ')
+                    next ++;
+                if((next != NULL) && (*next >= '1') && (*next <= '9')){
+                    pos = strtol(strtok_r(NULL, " ", &save), &end, 10);
+                    ok = (*end == '\0');
+                }
+                *position = pos - 1;
+            }
+        }
+        else if((strcmp(token, "-s") == 0)||(strcmp(token, "--source") == 0)){
+            ok = nftParseNet(value, &rule->src, &rule->srcmask);
+            rule->hassrc = ok && rule->srcmask;  //0.0.0.0/0 matches anything
+        }
+        else if((strcmp(token, "-d") == 0)||(strcmp(token, "--destination") == 0)){
+            ok = nftParseNet(value, &rule->dst, &rule->dstmask);
+            rule->hasdst = ok && rule->dstmask;
+        }
+        else if((strcmp(token, "-p") == 0)||(strcmp(token, "--protocol") == 0)){
+            if(strcmp(value, "tcp") == 0)
+                rule->proto = IPPROTO_TCP;
+            else if(strcmp(value, "udp") == 0)
+                rule->proto = IPPROTO_UDP;
+            else if(strcmp(value, "icmp") == 0)
+                rule->proto = IPPROTO_ICMP;
+            else if(strcmp(value, "all") != 0)
+                ok = false;
+        }
+        else if((strcmp(token, "--sport") == 0)||(strcmp(token, "--source-port") == 0)){
+            ok = nftParsePort(value, &rule->sport);
+        }
+        else if((strcmp(token, "--dport") == 0)||(strcmp(token, "--destination-port") == 0)){
+            ok = nftParsePort(value, &rule->dport);
+        }
+        else if((strcmp(token, "-i") == 0)||(strcmp(token, "--in-interface") == 0)){
+            ok = (strlen(value) < IFNAMSIZ) && (strchr(value, '+') == NULL);
+            if(ok)
+                strcpy(rule->iif, value);
+        }
+        else if((strcmp(token, "-o") == 0)||(strcmp(token, "--out-interface") == 0)){
+            ok = (strlen(value) < IFNAMSIZ) && (strchr(value, '+') == NULL);
+            if(ok)
+                strcpy(rule->oif, value);
+        }
+        else if((strcmp(token, "-j") == 0)||(strcmp(token, "--jump") == 0)){
+            haveverdict = true;
+            if(strcmp(value, "ACCEPT") == 0)
+                rule->verdict = NF_ACCEPT;
+            else if(strcmp(value, "DROP") == 0)
+                rule->verdict = NF_DROP;
+            else if(strcmp(value, "REJECT") == 0)
+                rule->verdict = NFT_VERDICT_REJECT;
+            else
+                ok = false;
+        }
+        else{
+            ok = false;
+        }
+    }
+    if(!ok || !haveverdict || (rule->chain < 0))
+        return false;
+    if((rule->sport || rule->dport) && (rule->proto != IPPROTO_TCP) && (rule->proto != IPPROTO_UDP))
+        return false;
+    if((rule->iif[0] && (rule->chain == NFT_OUTPUT)) || (rule->oif[0] && (rule->chain == NFT_INPUT)))
+        return false;
+    return true;
+}
+/*one address, nothing else:can go into a verdict map*/
+static bool nftRuleSimple(const nftRule *rule)
+{
+    return (rule->hassrc != rule->hasdst) && (rule->iif[0] == '\0') && (rule->oif[0] == '\0') && (rule->proto < 0)
+        && (rule->verdict != NFT_VERDICT_REJECT);
+}
+
+static void nftRuleAdd(nftBatch *b, const nftRule *rule)
+{
+    size_t exprs, msg = nftRuleStart(b, nftchains[rule->chain].name, &exprs);
+    char name[IFNAMSIZ];
+
+    if(rule->iif[0]){
+        memset(name, 0, sizeof(name));
+        strcpy(name, rule->iif);
+        nftExprMeta(b, NFT_META_IIFNAME);
+        nftExprCmp(b, name, sizeof(name));
+    }
+    if(rule->oif[0]){
+        memset(name, 0, sizeof(name));
+        strcpy(name, rule->oif);
+        nftExprMeta(b, NFT_META_OIFNAME);
+        nftExprCmp(b, name, sizeof(name));
+    }
+    if(rule->hassrc){
+        nftExprPayload(b, NFT_PAYLOAD_NETWORK_HEADER, 12, sizeof(uint32_t));
+        if(rule->srcmask != 0xFFFFFFFFu)
+            nftExprMask(b, rule->srcmask);
+        nftExprCmp(b, &rule->src, sizeof(uint32_t));
+    }
+    if(rule->hasdst){
+        nftExprPayload(b, NFT_PAYLOAD_NETWORK_HEADER, 16, sizeof(uint32_t));
+        if(rule->dstmask != 0xFFFFFFFFu)
+            nftExprMask(b, rule->dstmask);
+        nftExprCmp(b, &rule->dst, sizeof(uint32_t));
+    }
+    if(rule->proto >= 0){
+        uint8_t proto = rule->proto;
+        nftExprMeta(b, NFT_META_L4PROTO);
+        nftExprCmp(b, &proto, sizeof(proto));
+    }
+    if(rule->sport){
+        uint16_t port = htons(rule->sport);
+        nftExprPayload(b, NFT_PAYLOAD_TRANSPORT_HEADER, 0, sizeof(port));
+        nftExprCmp(b, &port, sizeof(port));
+    }
+    if(rule->dport){
+        uint16_t port = htons(rule->dport);
+        nftExprPayload(b, NFT_PAYLOAD_TRANSPORT_HEADER, 2, sizeof(port));
+        nftExprCmp(b, &port, sizeof(port));
+    }
+    nftExprVerdict(b, rule->verdict);
+    nftRuleEnd(b, msg, exprs);
+}
+/**
+ * @name:   nftChainRules
+ * @msg:    rules of one chain in iptables order. a run of consecutive single address rules that
+ *          test the same field and do not overlap is one vmap, first match semantics are kept
+ */
+static void nftChainRules(nftBatch *b, int chain, nftRule **rules, int count, nftRange *ranges)
+{
+    int loop = 0, vmaps = 0;
+
+    while(loop < count){
+        int run = 0;
+        bool source = rules[loop]->hassrc;
+        while((loop + run < count) && (run < NFT_VMAP_MAX) && nftRuleSimple(rules[loop + run]) && (rules[loop + run]->hassrc == source)){
+            const nftRule *rule = rules[loop + run];
+            nftNetRange((source) ? (rule->src) : (rule->dst), (source) ? (rule->srcmask) : (rule->dstmask), &ranges[run], rule->verdict);
+            if(nftRangeOverlap(ranges, run, &ranges[run]))
+                break;
+            run ++;
+        }
+        if(run >= NFT_VMAP_MIN){
+            char name[32];
+            uint32_t id;
+            snprintf(name, sizeof(name), "%s_%d", nftchains[chain].name, ++ vmaps);
+            id = nftVmapAdd(b, name, ranges, run);
+            nftVmapRule(b, chain, source, name, id);
+            loop += run;
+        }
+        else{
+            nftRuleAdd(b, rules[loop]);
+            loop ++;
+        }
+    }
+}
+
+/*************************** policy ***************************/
+/*ip black list:one vmap checked first in every chain, overlapping entries become plain rules*/
+static void nftBlackList(nftBatch *b, list *ipBlack)
+{
+    int count = 0, extra = 0;
+    nftRange *ranges;
+    nftRule *rules;
+    uint32_t id = 0;
+    list_elmt *elmt;
+
+    if((ipBlack == NULL) || (list_size(ipBlack) == 0))
+        return;
+    ranges = (nftRange *)malloc(sizeof(nftRange) * list_size(ipBlack));
+    rules = (nftRule *)calloc(list_size(ipBlack), sizeof(nftRule));
+    if((ranges == NULL) || (rules == NULL)){
+        b->nomem = true;
+        free(ranges);
+        free(rules);
+        return;
+    }
+    for(elmt = list_head(ipBlack); elmt != NULL; elmt = elmt->next){
+        uint32_t addr, mask;
+        if(!nftParseNet((char *)elmt->data, &addr, &mask) || (mask == 0)){
+            log_e("networkfirewall", "nftables:black ip skipped");
+            continue;
+        }
+        nftNetRange(addr, mask, &ranges[count], NF_DROP);
+        if(nftRangeOverlap(ranges, count, &ranges[count])){
+            rules[extra].src = rules[extra].dst = addr;
+            rules[extra].srcmask = rules[extra].dstmask = mask;
+            rules[extra].verdict = NF_DROP;
+            rules[extra].proto = -1;
+            extra ++;
+            continue;
+        }
+        count ++;
+    }
+    if(count)
+        id = nftVmapAdd(b, "black", ranges, count);
+    for(int chain = 0; chain < NFT_CHAINS; chain ++){
+        if(count && (chain != NFT_OUTPUT))
+            nftVmapRule(b, chain, true, "black", id);
+        if(count && (chain != NFT_INPUT))
+            nftVmapRule(b, chain, false, "black", id);
+        for(int loop = 0; loop < extra; loop ++){
+            nftRule rule = rules[loop];
+            rule.chain = chain;
+            if(chain != NFT_OUTPUT){
+                rule.hassrc = true;
+                rule.hasdst = false;
+                nftRuleAdd(b, &rule);
+            }
+            if(chain != NFT_INPUT){
+                rule.hassrc = false;
+                rule.hasdst = true;
+                nftRuleAdd(b, &rule);
+            }
+        }
+    }
+    free(ranges);
+    free(rules);
+}
+/*port black list:tcp/udp destination ports refused on input*/
+static void nftPortBlackList(nftBatch *b, list *portBlack)
+{
+    static const uint8_t protos[] = {IPPROTO_TCP, IPPROTO_UDP};
+    nftElemWriter w = {0};
+    uint8_t *seen;
+    list_elmt *elmt;
+    int count = 0;
+
+    if((portBlack == NULL) || (list_size(portBlack) == 0))
+        return;
+    if((seen = (uint8_t *)calloc(65536 / 8, 1)) == NULL){
+        b->nomem = true;
+        return;
+    }
+    w.name = "blackport";
+    w.id = nftSetAdd(b, w.name, 0, NFT_TYPE_INETSERVICE, sizeof(uint16_t), 0, 0);
+    for(elmt = list_head(portBlack); elmt != NULL; elmt = elmt->next){
+        uint16_t port, nport;
+        if(!nftParsePort((char *)elmt->data, &port) || (seen[port / 8] & (1 << (port % 8))))
+            continue;
+        seen[port / 8] |= 1 << (port % 8);
+        nport = htons(port);
+        nftNestEnd(b, nftElemStart(b, &w, &nport, sizeof(nport)));
+        count ++;
+    }
+    nftElemFlush(b, &w);
+    free(seen);
+    for(int loop = 0; count && (loop < (int)sizeof(protos)); loop ++){
+        size_t exprs, msg = nftRuleStart(b, nftchains[NFT_INPUT].name, &exprs);
+        nftExprMeta(b, NFT_META_L4PROTO);
+        nftExprCmp(b, &protos[loop], sizeof(protos[loop]));
+        nftExprPayload(b, NFT_PAYLOAD_TRANSPORT_HEADER, 2, sizeof(uint16_t));
+        nftExprLookup(b, w.name, w.id, -1);
+        nftExprVerdict(b, NF_DROP);
+        nftRuleEnd(b, msg, exprs);
+    }
+}
+/*redirect map:dnat to ip daddr map @redirect, for forwarded and local traffic*/
+static void nftRedirect(nftBatch *b, list *redirect)
+{
+#if MODULE_NETWORKMONITOR
+    static const struct{
+        const char *name;
+        unsigned int hook;
+    }natchains[] = {{"prerouting", NF_INET_PRE_ROUTING}, {"natoutput", NF_INET_LOCAL_OUT}};
+    nftElemWriter w = {0};
+    uint32_t *keys;
+    list_elmt *elmt;
+    int count = 0;
+
+    if((redirect == NULL) || (list_size(redirect) == 0))
+        return;
+    if((keys = (uint32_t *)malloc(sizeof(uint32_t) * list_size(redirect))) == NULL){
+        b->nomem = true;
+        return;
+    }
+    w.name = "redirect";
+    w.id = nftSetAdd(b, w.name, 0, NFT_TYPE_IPADDR, sizeof(uint32_t), NFT_TYPE_IPADDR, sizeof(uint32_t));
+    for(elmt = list_head(redirect); elmt != NULL; elmt = elmt->next){
+        dnatstruct *dnat = (dnatstruct *)elmt->data;
+        struct in_addr from, to;
+        bool dup = false;
+        size_t elem, data;
+        if((inet_pton(AF_INET, dnat->dstip, &from) != 1) || (inet_pton(AF_INET, dnat->redirectIP, &to) != 1)){
+            log_e("networkfirewall", "nftables:redirect entry skipped");
+            continue;
+        }
+        for(int loop = 0; !dup && (loop < count); loop ++)
+            dup = (keys[loop] == from.s_addr);//one address maps to one target
+        if(dup)
+            continue;
+        keys[count ++] = from.s_addr;
+        elem = nftElemStart(b, &w, &from.s_addr, sizeof(from.s_addr));
+        data = nftNest(b, NFTA_SET_ELEM_DATA);
+        nftAttr(b, NFTA_DATA_VALUE, &to.s_addr, sizeof(to.s_addr));
+        nftNestEnd(b, data);
+        nftNestEnd(b, elem);
+    }
+    nftElemFlush(b, &w);
+    free(keys);
+    for(int loop = 0; count && (loop < (int)(sizeof(natchains) / sizeof(natchains[0]))); loop ++){
+        size_t exprs, msg;
+        nftChainAdd(b, natchains[loop].name, "nat", natchains[loop].hook, NF_IP_PRI_NAT_DST);
+        msg = nftRuleStart(b, natchains[loop].name, &exprs);
+        nftExprPayload(b, NFT_PAYLOAD_NETWORK_HEADER, 16, sizeof(uint32_t));
+        nftExprLookup(b, w.name, w.id, NFT_REG_1);
+        nftExprDnat(b);
+        nftRuleEnd(b, msg, exprs);
+    }
+#endif
+}
+/**
+ * @name:   nftApplyPolicy
+ * @msg:    table ip idps rebuilt from the policy in one transaction
+ * @return: 0 applied, -1 the kernel refused and the previous table is untouched
+ */
+int nftApplyPolicy(nftPolicy *policy)
+{
+    nftBatch batch = {0};
+    nftRule *parsed = NULL, **order[NFT_CHAINS] = {NULL};
+    nftRange *ranges = NULL;
+    char **unsupported = NULL;
+    int total = 0, counts[NFT_CHAINS] = {0}, skipped = 0, ret = -1;
+    list_elmt *elmt;
+
+    if(policy == NULL)
+        return -1;
+    total = (policy->rules != NULL) ? (list_size(policy->rules)) : (0);
+    parsed = (nftRule *)calloc(total + 1, sizeof(nftRule));
+    ranges = (nftRange *)calloc(total + 1, sizeof(nftRange));
+    unsupported = (char **)calloc(total + 1, sizeof(char *));
+    for(int chain = 0; chain < NFT_CHAINS; chain ++)
+        order[chain] = (nftRule **)calloc(total + 1, sizeof(nftRule *));
+    if((parsed == NULL) || (ranges == NULL) || (unsupported == NULL) || (order[NFT_INPUT] == NULL) || (order[NFT_OUTPUT] == NULL) || (order[NFT_FORWARD] == NULL))
+        goto out;
+    total = 0;
+    for(elmt = (policy->rules != NULL) ? (list_head(policy->rules)) : (NULL); elmt != NULL; elmt = elmt->next){
+        nftRule *rule = &parsed[total];
+        int position, chain;
+        if(!nftParseRule((char *)elmt->data, rule, &position)){
+            unsupported[skipped ++] = (char *)elmt->data;
+            continue;
+        }
+        total ++;
+        chain = rule->chain;
+        if((position < 0) || (position > counts[chain]))
+            position = counts[chain];
+        memmove(&order[chain][position + 1], &order[chain][position], sizeof(nftRule *) * (counts[chain] - position));
+        order[chain][position] = rule;
+        counts[chain] ++;
+    }
+
+    nftBatchOpen(&batch, true);
+    for(int chain = 0; chain < NFT_CHAINS; chain ++)
+        nftChainAdd(&batch, nftchains[chain].name, "filter", nftchains[chain].hook, NF_IP_PRI_FILTER);
+    nftBlackList(&batch, policy->ipBlack);      //ahead of the rules, like the INPUTBLACK jumps
+    nftPortBlackList(&batch, policy->portBlack);
+    for(int chain = 0; chain < NFT_CHAINS; chain ++)
+        nftChainRules(&batch, chain, order[chain], counts[chain], ranges);
+    nftRedirect(&batch, policy->redirect);
+    nftBatchClose(&batch);
+    ret = nftSend(&batch);
+    if(ret == 0){
+        char logbuf[128];
+        snprintf(logbuf, sizeof(logbuf), "nftables:policy applied, %d rules, %d left to iptables", total, skipped);
+        log_v("networkfirewall", logbuf);
+        for(int loop = 0; (policy->unsupported != NULL) && (loop < skipped); loop ++)
+            policy->unsupported(unsupported[loop]);
+    }
+out:
+    for(int chain = 0; chain < NFT_CHAINS; chain ++)
+        free(order[chain]);
+    free(unsupported);
+    free(ranges);
+    free(parsed);
+    free(batch.buf);
+    return ret;
+}
+
+int nftRemovePolicy(void)
+{
+    nftBatch batch = {0};
+    int ret;
+
+    nftBatchOpen(&batch, false);
+    nftBatchClose(&batch);
+    ret = nftSend(&batch);
+    free(batch.buf);
+    return ret;
+}
+#endif
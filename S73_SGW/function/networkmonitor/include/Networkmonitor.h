@@ -24,6 +24,14 @@ typedef struct _NetWorkMonitorMethod{
     void (*updateIpWhiteList)(char*);
     void (*updatePortWhiteList)(char*);
     void (*updateDNSWhiteList)(char*);
+    void (*updateDnsResponseReport)(bool);
+    void (*updateConnTrackSource)(char*, int);
+    int  (*replayCapture)(char*, char*, int);
+    void (*updateSnifferConfig)(int, int, int, int, char*);
+    void (*updateFlowAccounting)(int);
+    int  (*addArpStaticBinding)(char*, char*);
+    void (*updateCaptureInterfaces)(char*);
+    void (*getCaptureInterfaceInfo)(char*, int);
 }NetWorkMonitorMethod;
 extern NetWorkMonitorMethod NetWorkMonitorMethodObj;
 
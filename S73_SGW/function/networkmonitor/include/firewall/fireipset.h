@@ -0,0 +1,18 @@
+#ifndef _FIRE_IPSET_H
+#define _FIRE_IPSET_H
+#include <stdbool.h>
+/**
+ * kernel ip sets over nfnetlink, no ipset binary or libipset needed.
+ * one set is matched by one rule, so lookups and updates do not grow with the list
+ */
+#define FIREIPSET_HASHSIZE      1024
+#define FIREIPSET_MAXELEM       65536
+/*type:"hash:ip" "hash:net" "hash:net,port", an existing set of the same type is kept.
+  timeout:seconds an entry lives unless added with its own, 0 entries never expire*/
+int fireipset_create(const char *name,const char *type,unsigned int timeout);
+int fireipset_flush(const char *name);
+int fireipset_destroy(const char *name);
+/*net:XXX.XXX.XXX.XXX or XXX.XXX.XXX.XXX/MASK   proto/port:0 for hash:ip hash:net.  timeout:0 the set default.
+  adding twice (which restarts the timeout) or deleting a missing entry is not an error*/
+int fireipset_entry(const char *name,bool add,const char *net,unsigned char proto,unsigned short port,unsigned int timeout);
+#endif
@@ -0,0 +1,21 @@
+#ifndef _FIRE_STATE_H
+#define _FIRE_STATE_H
+#include "util.h"
+/**
+ * index of the rules the IDPS owns:rule key -> element of the shadow list (owner) holding it.
+ * existence checks and deletes stop scanning the lists
+ */
+#define FIRESTATE_BUCKETS       1024            //power of two
+#define FIRESTATE_KEY_MAX       160
+
+list_elmt *firestate_find(const list *owner,const char *key);
+/*-1 out of memory or key already there*/
+int  firestate_add(const list *owner,const char *key,list_elmt *elmt);
+/*the data of a listed rule moved to another element*/
+void firestate_set(const list *owner,const char *key,list_elmt *elmt);
+list_elmt *firestate_del(const list *owner,const char *key);
+/*before the owner list is destroyed*/
+void firestate_clear(const list *owner);
+/*keyed rules of one owner*/
+int  firestate_count(const list *owner);
+#endif
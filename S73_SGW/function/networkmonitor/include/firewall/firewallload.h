@@ -36,6 +36,7 @@ struct stringmatch{
 	char srcip[32];
 	char chain[32];
 	char eth[32];
+	char inset;//1:resolved addresses go to the dns ip set of eth instead of a string rule
 };
 struct iplist{
 	char target[32];
@@ -46,6 +47,7 @@ struct iplist{
 	int dstport;
 	int srcport;
 	char eth[32];
+	char inset;//1:kept in the black ip set of eth instead of a rule
 };
 struct dnatlist{
 	char prot[8];
@@ -0,0 +1,30 @@
+/*
+ * @Author: idps members
+ * @Description: in-kernel per-peer byte accounting, eBPF socket filter + hash maps
+ * @FilePath: \idps_networkmonitor\includes\flow_count\flow_bpf.h
+ */
+#ifndef __FLOW_BPF__
+#define __FLOW_BPF__
+
+/* where flow statistics come from, read when the flow module starts */
+#define FLOW_ACCT_PCAP        0
+#define FLOW_ACCT_BPF         1
+/* entries per map, peers beyond this are not counted until the next upload */
+#ifndef FLOW_BPF_MAP_ENTRIES
+	#define FLOW_BPF_MAP_ENTRIES  4096
+#endif
+/**
+ * @description: one drained counter
+ * @param      : remote/device in network byte order, direction 0:incoming 1:leaving
+ */
+typedef void (*flow_bpf_hook)(unsigned int remote,unsigned int device,int direction,
+	unsigned long long bytes,unsigned long long packets);
+
+/* -1 when eBPF is unavailable (old kernel, no CAP_SYS_ADMIN, verifier), pcap stays in use */
+int  flow_bpf_start(const char* interface);
+void flow_bpf_stop(void);
+int  flow_bpf_active(void);
+/* upload thread only: retire the active map and drain it, returns the pairs drained */
+int  flow_bpf_collect(flow_bpf_hook hook);
+
+#endif
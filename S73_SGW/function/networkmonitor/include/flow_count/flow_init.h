@@ -22,6 +22,8 @@
 #include <stdbool.h>
 #include <pthread.h>
 #include "util.h"
+#include "flow_table.h"
+#include "pkt_decode.h"
 
 #ifndef IFNAMSIZ
 	#define IFNAMSIZ 32
@@ -34,8 +36,6 @@
  */
 //#define THREAD_MODULE 
 typedef struct{
-    long long 		total_sent;
-    long long 		total_recv;
 	char            interface[IFNAMSIZ];
 	int             have_hw_addr;
 	unsigned char   if_hw_addr[6];  
@@ -43,8 +43,8 @@ typedef struct{
 	struct in_addr  if_ip_addr;
 	struct in_addr  netmask;
 	pcap_t* 		pd; 
-	pthread_mutex_t mtx;
-	list* 			list_flow_packet;
+	int             linktype;//pcap_datalink(pd), handed to pkt_decode
+	flow_worker     worker;//per capture thread counters, no lock on the packet path
 //#ifdef THREAD_MODULE
 	pthread_t 		ip_dispatcher_thd;
 //#endif
@@ -75,6 +75,11 @@ void flowmoduleinit(char *watchNicDevice);
 void addmoduledevice(char* _ip);
 // 设置统计上报时间间隔
 void setflowinterval(int interval);
+// 流量计数来源 0:抓包 1:eBPF(内核累加, 不可用时仍走抓包)
+void setflowaccounting(int mode);
+// 离线回放，报文由回放侧解码一次
+void flow_replay_init(unsigned int local_ip,unsigned int netmask);
+void flow_replay_decoded(const pkt_decoded *pkt);
 
 #ifndef THREAD_MODULE
 void api_data(unsigned char* args, const struct pcap_pkthdr* pkthdr, const unsigned char* packet);
@@ -0,0 +1,64 @@
+/*
+ * @Author: idps members
+ * @Description: fixed size per-worker flow counter tables
+ * @FilePath: \idps_networkmonitor\includes\flow_count\flow_table.h
+ */
+#ifndef __FLOW_TABLE__
+#define __FLOW_TABLE__
+#include <stdbool.h>
+
+/* open addressing slots per table, must be a power of two */
+#ifndef FLOW_TABLE_SLOTS
+	#define FLOW_TABLE_SLOTS  1024
+#endif
+/* load limit(75%), peers seen after the table is full are summed into "other" */
+#define FLOW_TABLE_LIMIT      (FLOW_TABLE_SLOTS / 4 * 3)
+/* peers reported per interval, the rest are folded into "other" */
+#ifndef FLOW_TOPK
+	#define FLOW_TOPK         64
+#endif
+/**
+ * @description: one (remote ip, device ip) counter
+ * @param      : remote/device in network byte order
+ */
+typedef struct{
+	unsigned int       remote;
+	unsigned int       device;
+	unsigned long long sent;
+	unsigned long long recv;
+	unsigned int       used;
+}flow_slot;
+/**
+ * @description: counter table, written by exactly one thread at a time
+ */
+typedef struct{
+	flow_slot          slot[FLOW_TABLE_SLOTS];
+	unsigned int       used;
+	unsigned long long total_sent;
+	unsigned long long total_recv;
+	unsigned long long other_sent;
+	unsigned long long other_recv;
+}flow_table;
+/**
+ * @description: double buffered tables of one capture thread
+ * @notify     : the capture thread only touches table[active], the upload
+ *               thread flips active and owns the retired table until the
+ *               next flip, so the packet path never takes a lock
+ */
+typedef struct{
+	flow_table         table[2];
+	unsigned int       active;
+	unsigned int       seq;//odd while the capture thread is inside an update
+}flow_worker;
+
+void flow_worker_init(flow_worker* worker);
+// capture thread only, direction 0:incoming 1:leaving
+void flow_worker_add(flow_worker* worker,unsigned int remote,unsigned int device,int direction,unsigned long long len);
+// upload thread only, returns the retired table; clear it once merged
+flow_table* flow_worker_swap(flow_worker* worker);
+
+void flow_table_clear(flow_table* table);
+void flow_table_merge(flow_table* dst,const flow_table* src);
+int  flow_table_topk(const flow_table* table,flow_slot* out,int k,flow_slot* other);
+
+#endif
@@ -14,6 +14,8 @@ extern "C" {
 
 #define		LINUX_COOKED_CAPTURE 						0
 #define 	BLACK_LIST_CHECK_OPTION						1
+// 1:端口扫描/泛洪检测使用固定内存的概率数据结构(scan_sketch) 0:原链表方式
+#define 	SKETCH_SCAN_DETECTION						1
 /**
  * decla :基本回调函数的声明 
  * notify:请注意参数类型的一致性
@@ -24,7 +26,7 @@ typedef struct _invokefunction{
 	void (*onPortOpenEvent)(unsigned int port, char* uid);
 	void (*onDnsInquireEvent)(char* dns);
 	void (*onDnsResponseEvent)(char* dns, char* ip_list);
-	void (*onIpConnectEvent)(int ip_version,char *src_ip,int src_port,char *dst_ip,int dst_port,int protocol);
+	void (*onIpConnectEvent)(int ip_version,char *src_ip,int src_port,char *dst_ip,int dst_port,int protocol,char *domain);//domain:"" if unknown
 	void (*onTcpConnectEvent)(char* srcIp, int srcPort,char* desIp, int desPort);
 	void (*onUdpConnectEvent)(char* srcIp, int srcPort,char* desIp, int desPort);
 	void (*onUserLoginEvent)(char* loginAddress);
@@ -91,6 +93,13 @@ void StopMonitor(void);
  * decla   :(0)设置pcap文件的保存位置
  */
 void SetSnifferFilePath(char* path);
+ /*
+ * function:SetSnifferConfig
+ * input   :snaplen:0整包 rotateMB/rotateSeconds:0不按该条件轮转 maxFiles:保留的分段数 filter:BPF,NULL不过滤
+ * output  :void
+ * decla   :(0)pcapng分段轮转配置，下一次StartSniffer生效
+ */
+void SetSnifferConfig(int snaplen, int rotateMB, int rotateSeconds, int maxFiles, char* filter);
  /*
  * function:StartSniffer
  * input   :void
@@ -105,6 +114,14 @@ void StartSniffer(void);
  * decla   :(0)pcap文件数据保存停止
  */
 void StopSniffer(void);
+ /*
+ * function:ReplayCapture
+ * input   :source:pcap文件或"syn_flood|udp_scan|ping_of_death|arp_spoof|dns_storm[:包数[:输出.pcap]]"
+ *          local_ip:被监测地址 realtime:1按原始时间间隔 0尽快
+ * output  :0成功 -1无法打开
+ * decla   :离线压测, 不能与实时抓包同时运行
+ */
+int ReplayCapture(char *source, char *local_ip, int realtime);
  /*
  * function:GetIMEI
  * input   :imeistring:待保存数据的数据指针 imeistring_maxsize:该指针的的最大容量,防止数组溢出 
@@ -119,6 +136,20 @@ void GetIMEI(char* imeistring,int imeistring_maxsize);
  * decla   :获取当前网卡信息
  */
 void NetworkInterfaceInfo(char* outstring,int out_string_maxlen);
+ /*
+ * function:CaptureInterfaceInfo
+ * input   :outstring:待保存数据的数据指针 out_string_maxlen:该指针的的最大容量,防止数组溢出 
+ * output  :void 
+ * decla   :各抓包网卡的地址和报文/丢包计数
+ */
+void CaptureInterfaceInfo(char* outstring,int out_string_maxlen);
+ /*
+ * function:SetCaptureInterfaces
+ * input   :if_list:主网卡之外同时监测的网卡, 逗号分隔
+ * output  :void 
+ * decla   :下次StartMonitor生效
+ */
+void SetCaptureInterfaces(char* if_list);
  /*
  * function:getTrafficUsageInfo
  * input   :outstring:待保存数据的数据指针 out_string_maxlen:该指针的的最大容量,防止数组溢出 
@@ -148,6 +179,15 @@ void on_UdpConnectEvent_callback(char* srcIp, int srcPort,char* desIp, int desPo
 void on_onDnsInquireEvent_callback(char* dns);
 
 void on_onDnsResponseEvent_callback(char* dns, char* ip_list);
+// 0:不再上报DNS响应事件(带宽受限)，解析结果仍进入DNS缓存
+void set_DnsResponseReport(boolean on);
+boolean get_DnsResponseReport(void);
+// mode: CT_SOURCE_CONNECT|CT_SOURCE_FLOW, 0恢复抓包
+void set_ConnTrackSource(char *if_name, int mode);
+// mode: FLOW_ACCT_PCAP 0 / FLOW_ACCT_BPF 1
+void set_FlowAccounting(int mode);
+// ip:点分十进制 mac:"aa:bb:cc:dd:ee:ff", 0成功
+int set_ArpStaticBinding(char *ip, char *mac);
 
 void on_onPortOpenEvent_callback(unsigned int port, char* uid);
 
@@ -157,6 +197,8 @@ void on_onUserLoginEvent_callback(char *address);
 // arp参数设置
 void setArpFloodThreshold(long para);
 void setArpAttackThreshold(long para);
+void setArpGratuitousThreshold(long para);
+void setArpBindingAge(long para);
 void setIcmpFloodThreshold(long para);
 // icmp参数设置
 void setDeathPingSizeThreshold(long para);
@@ -1,7 +1,12 @@
 #ifndef __ARP_DETECTION_H__
 #define __ARP_DETECTION_H__
+#include "typedef.h"
+
+struct arphdr;
 
 void arp_parser_proc(void);
 void arp_parser(struct arphdr *arpinput);
+void arp_table_init(boolean seed_system);
+int  arp_static_binding_add(const s8 *ip, const s8 *mac);
 
 #endif
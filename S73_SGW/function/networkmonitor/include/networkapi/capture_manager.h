@@ -0,0 +1,70 @@
+/*
+ * @Descripttion: live capture on every watched NIC, one epoll loop feeding the detectors
+ * @version: V0.0
+ * @Author: idps members
+ */
+#ifndef __CAPTURE_MANAGER_H__
+#define __CAPTURE_MANAGER_H__
+#include <pcap.h>
+#include "typedef.h"
+#include "pkt_decode.h"
+
+#define CAPTURE_IF_MAX				(8)
+#define CAPTURE_IF_NAME_MAX			(0x40)
+#define CAPTURE_ADDR_MAX			(8)			//addresses kept per family per NIC
+#define CAPTURE_SNAPLEN				(65535)
+#define CAPTURE_TIMEOUT_MS			(100)		//pcap read timeout and epoll wait
+#define CAPTURE_BATCH				(64)		//packets per NIC per wakeup, a busy NIC cannot starve the rest
+#define CAPTURE_LIST_MAX			(256)
+
+// per packet hook of the flow counter, capture thread
+typedef void (*capture_flow_hook)(const pkt_decoded *pkt);
+
+typedef struct{
+	unsigned long long packets;
+	unsigned long long bytes;			//wire length
+	unsigned long long undecoded;		//datalink unsupported or headers truncated
+	unsigned long long ipv4;
+	unsigned long long ipv6;
+	unsigned long long arp;
+}capture_counter;
+
+typedef struct{
+	s8   name[CAPTURE_IF_NAME_MAX];
+	pcap_t *pd;
+	int  fd;
+	int  linktype;
+	u8   mac[6];
+	u32  ip4[CAPTURE_ADDR_MAX];			//network order
+	u32  mask4[CAPTURE_ADDR_MAX];
+	int  ip4_count;
+	u8   ip6[CAPTURE_ADDR_MAX][16];
+	int  ip6_count;
+	capture_flow_hook flow;
+	capture_counter counter;			//written by the capture thread only
+}capture_iface;
+
+/*
+ * extra NICs captured next to the one given to capture_manager_open, "eth1,usb0".
+ * read at the next start, NULL or "" captures the primary NIC only
+ */
+void capture_manager_config(const s8 *extra_list);
+/* opens the primary NIC and the configured extras, -1 when the primary cannot be opened */
+int  capture_manager_open(const s8 *primary,pcap_handler handler);
+/* capture thread: epoll over every NIC until capture_manager_break */
+void capture_manager_loop(void);
+void capture_manager_break(void);
+/* after the capture thread is joined */
+void capture_manager_close(void);
+
+int  capture_manager_count(void);
+capture_iface *capture_manager_get(int index);		//0 is the primary NIC
+/* flow counter takes decoded packets of its NIC instead of a second pcap handle; 0 attached,
+ * kept across capture restarts. -1 the NIC is not captured, the caller opens its own */
+int  capture_manager_attach_flow(const s8 *if_name,capture_flow_hook hook);
+boolean capture_is_local4(u32 addr);
+boolean capture_is_local6(const u8 *addr);
+/* per NIC counters as json, caller frees */
+char *capture_manager_stats(void);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __CONN_TABLE_H__
+#define __CONN_TABLE_H__
+#include <pthread.h>
+#include "typedef.h"
+
+/* lock stripes, power of two */
+#ifndef CONN_SHARDS
+	#define CONN_SHARDS				(16)
+#endif
+/* slab entries and hash buckets of one shard, powers of two */
+#ifndef CONN_SHARD_ENTRIES
+	#define CONN_SHARD_ENTRIES		(512)
+#endif
+#define CONN_SHARD_BUCKETS			(CONN_SHARD_ENTRIES / 2)
+/* idle timeout in seconds */
+#define CONN_IDLE_TCP				(300)
+#define CONN_IDLE_UDP				(60)
+#define CONN_IDLE_OTHER				(30)
+
+#define CONN_NIL					(0xFFFF)
+
+typedef struct{
+	u32 srcip;
+	u32 dstip;
+	u16 sport;
+	u16 dport;
+	u8  type;
+}conn_key;
+
+typedef struct{
+	conn_key key;
+	u32 last_seen;
+	u16 next;	//bucket chain or free list
+	u8  used;
+	u8  ref;	//clock bit, set on every hit
+}conn_entry;
+
+typedef struct{
+	pthread_mutex_t lock;
+	u16        bucket[CONN_SHARD_BUCKETS];
+	conn_entry entry[CONN_SHARD_ENTRIES];
+	u16        free_head;
+	u16        hand;
+	u32        used;
+	u32        evicted;	//reclaimed while still active, table too small
+}conn_shard;
+
+void conn_table_init(void);
+// true if the tuple was already present, otherwise it is inserted
+boolean conn_table_touch(const conn_key *key);
+// drop idle entries, call about once per second
+void conn_table_expire(void);
+void conn_table_stats(u32 *used,u32 *evicted);
+
+#endif
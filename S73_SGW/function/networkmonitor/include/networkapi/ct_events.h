@@ -0,0 +1,41 @@
+#ifndef __CT_EVENTS_H__
+#define __CT_EVENTS_H__
+#include "typedef.h"
+
+/* what conntrack replaces pcap for, per interface */
+#define CT_SOURCE_NONE				(0)
+#define CT_SOURCE_CONNECT			(1)		//ip/tcp/udp connect events from NEW
+#define CT_SOURCE_FLOW				(2)		//flow statistics from DESTROY counters
+#define CT_SOURCE_IF_MAX			(8)
+#define CT_EVENTS_RCVBUF			(1024 * 1024)
+
+typedef struct{
+	u8  l4proto;
+	u32 src;		//original direction, network order
+	u32 dst;
+	u16 sport;		//host order
+	u16 dport;
+	unsigned long long orig_packets;
+	unsigned long long orig_bytes;
+	unsigned long long reply_packets;
+	unsigned long long reply_bytes;
+}ct_flow;
+
+typedef void (*ct_flow_hook)(const ct_flow *flow);
+
+// configuration, read when the interface is started
+void ct_source_set(const char *if_name,int mode);
+int  ct_source_get(const char *if_name);
+/*
+ * subscribe one consumer, the listener thread starts with the first one.
+ * connect events need the original source inside the subnet of if_name (the
+ * device itself or hosts behind its NAT), flow counters either end of the flow.
+ * hook is only used for CT_SOURCE_FLOW. -1 if conntrack events are unavailable
+ */
+int  ct_events_start(int mode,const char *if_name,ct_flow_hook hook);
+void ct_events_stop(int mode);
+int  ct_events_active(void);
+// events the kernel dropped because the socket was full
+u32  ct_events_lost(void);
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef		__DATA_DISPATCHER_H__
 #define		__DATA_DISPATCHER_H__
 
+#include <pcap.h>
 #include "util.h"
+#include "pkt_decode.h"
 
 void data_dispatcher_init(s8 *interface_name);
 void  stop_pcap(void);
@@ -11,7 +13,15 @@ void sniffer_stop();
 char* getnetinfoforpcap();
 char* getnettxrx();
 void ipWhiteCheckInit(list *listName);
-void updateNetConnectReportInterval(int interval);
+void updateNetConnectReportInterval(int interval);
 void DNSWhiteCheckInit(list *listName);
+void report_connect_event(u32 saddr,u16 sport,u32 daddr,u16 dport,u8 protocol);
+void report_connect_event6(const u8 *saddr,u16 sport,const u8 *daddr,u16 dport,u8 protocol);
+// pcap回调, 先pkt_decode再分发
+void call(u_char *argument,const struct pcap_pkthdr* pack,const u_char *content);
+// 已解码报文分发, 抓包线程和离线回放共用
+void data_dispatcher_decoded(const pkt_decoded *pkt,const struct pcap_pkthdr* pack);
+void data_dispatcher_tick(void);
+void data_dispatcher_replay_init(const s8 *local_ip, const u8 *local_mac);
 
 #endif
@@ -0,0 +1,43 @@
+#ifndef __DNS_CACHE_H__
+#define __DNS_CACHE_H__
+#include "typedef.h"
+
+/* resolved address -> queried name, power of two */
+#ifndef DNS_CACHE_ENTRIES
+	#define DNS_CACHE_ENTRIES		(1024)
+#endif
+#define DNS_CACHE_BUCKETS			(DNS_CACHE_ENTRIES)
+#define DNS_CACHE_NAME_MAX			(128)
+/* answer ttl is clamped into this range, seconds */
+#define DNS_CACHE_TTL_MIN			(30)
+#define DNS_CACHE_TTL_MAX			(3600)
+
+#define DNS_CACHE_NIL				(0xFFFF)
+
+/* every A/AAAA answer learned, capture thread, ttl as received */
+typedef void (*dns_cache_hook)(int family,const void *addr,const char *name,u32 ttl);
+
+typedef struct{
+	u8  family;		//AF_INET or AF_INET6
+	u8  addr[16];
+	u32 expire;		//monotonic seconds
+	u16 hnext;		//bucket chain or free list
+	u16 prev;		//lru, head is the most recent
+	u16 next;
+	u8  used;
+	char name[DNS_CACHE_NAME_MAX];
+}dns_cache_entry;
+
+void dns_cache_init(void);
+void dns_cache_put(int family,const void *addr,const char *name,u32 ttl);
+// TRUE and the name copied out if the address was resolved and has not expired
+boolean dns_cache_get(int family,const void *addr,char *name,int name_len);
+// parse a dns response (bounds checked, compression aware), cache every A/AAAA answer
+// under the queried name, returns the number of addresses learned or -1 if malformed
+int  dns_cache_learn(const u8 *msg,u32 len);
+// one listener (the firewall address sets), NULL removes it
+void dns_cache_set_hook(dns_cache_hook hook);
+// every unexpired answer once more, ttl is what is left of it. not from inside a hook
+void dns_cache_replay(dns_cache_hook hook);
+
+#endif
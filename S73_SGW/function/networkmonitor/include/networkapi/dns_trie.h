@@ -0,0 +1,43 @@
+#ifndef __DNS_TRIE_H__
+#define __DNS_TRIE_H__
+#include "typedef.h"
+
+#define DNS_TRIE_NAME_MAX		(256)
+#define DNS_TRIE_LABEL_MAX		(63)
+
+/*
+ * compiled domain matcher, labels stored right to left:
+ *   "vendor.com"    matches vendor.com only
+ *   "*.vendor.com"  matches any name below vendor.com
+ *   "*"             matches everything
+ * exact beats wildcard, the deepest wildcard wins. read only once compiled.
+ */
+typedef struct{
+	u32 label;			//offset in pool
+	u16 label_len;
+	u16 child_count;
+	u32 child_start;	//children are contiguous and sorted
+	u32 exact;			//value of the name ending here, 0:none
+	u32 wildcard;		//value of names below this node, 0:none
+}dns_trie_node;
+
+typedef struct{
+	dns_trie_node *node;	//node[0] is the root
+	u32            nodes;
+	char          *pool;
+	u32            patterns;
+}dns_trie;
+
+typedef struct dns_trie_builder dns_trie_builder;
+
+dns_trie_builder *dns_trie_builder_new(void);
+// value must be non zero, returns -1 for a malformed pattern
+int  dns_trie_builder_add(dns_trie_builder *builder,const char *pattern,u32 value);
+// consumes the builder, NULL on allocation failure
+dns_trie *dns_trie_compile(dns_trie_builder *builder);
+void dns_trie_builder_free(dns_trie_builder *builder);
+void dns_trie_free(dns_trie *trie);
+// O(label count), returns the value of the best pattern or 0
+u32  dns_trie_match(const dns_trie *trie,const char *name);
+
+#endif
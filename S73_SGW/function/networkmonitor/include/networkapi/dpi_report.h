@@ -53,6 +53,9 @@
 #define ARP_ATTACK_0				70
 #define ARP_ATTACK_1				71
 #define ARP_ATTACK_2				72
+#define ARP_BIND_SPOOF				73	//静态绑定被其他MAC声明
+#define ARP_IP_CONFLICT				74	//存活的动态绑定换了MAC
+#define ARP_GRATUITOUS_STORM		75
 
 #define IP_PACK_WITH_OPTION			80
 #define IP_PACK_WITH_TIMESTAMP		81
@@ -69,6 +72,8 @@ extern unsigned int thresholdLog;//攻击值记录
 
 void value_log(int index, int value, int threshold);
 void report_log(u8 event,s8 *s_addr,s32 port, s8 *net_info);
+u32  report_log_count(u8 event);
+void report_log_count_reset(void);
 void startlog(void);
 void dpi_report_log_free(void);
 void report_user_login_log(char *address);
@@ -9,6 +9,10 @@
 	SNAT
 };
 void inputprocessstring(char* processstring);
+/*batch:rules between begin and commit are applied in memory, each table is committed once*/
+void firewall_batch_begin(void);
+int  firewall_batch_commit(void);
+void firewall_batch_abort(void);
 bool  controlprocessbyandroid(bool status,char* processname,int pidnumber);
 void dnsrulesadd(char *chain,char *dns,char status,char *ethdevice,char action);
 void destionaddressconvert(char* protocol,char* beforeip,int beforport,char* afterip,int afterport,char* ethdevice,char action);
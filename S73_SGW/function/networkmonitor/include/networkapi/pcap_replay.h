@@ -0,0 +1,59 @@
+/*
+ * @Descripttion: offline pcap replay and synthetic attack traffic for measuring the packet pipeline
+ * @version: V0.0
+ * @Author: idps members
+ */
+#ifndef __PCAP_REPLAY_H__
+#define __PCAP_REPLAY_H__
+#include "typedef.h"
+
+#define REPLAY_AS_FAST			(0)		//ignore capture timestamps
+#define REPLAY_REALTIME			(1)		//keep the original inter-packet gaps
+#define REPLAY_LOCAL_IP			"192.168.1.10"
+#define REPLAY_NETMASK			"255.255.255.0"
+#define REPLAY_GEN_PACKETS		(100000)
+#define REPLAY_SNAPLEN			(65535)
+#define REPLAY_EVENT_MAX		(100)		//same range as the report switches
+
+/* where a packet's time is charged, by what call() dispatches it to */
+enum{
+	REPLAY_DET_TCP = 0,
+	REPLAY_DET_UDP,
+	REPLAY_DET_DNS,
+	REPLAY_DET_ICMP,
+	REPLAY_DET_IGMP,
+	REPLAY_DET_ARP,
+	REPLAY_DET_OTHER,
+	REPLAY_DET_DECODE,		//pkt_decode, once per packet for both pipelines
+	REPLAY_DET_FLOW,		//flow_init handler, every packet
+	REPLAY_DET_TICK,		//1S consumers, driven by capture time
+	REPLAY_DET_MAX
+};
+
+typedef struct{
+	unsigned long long packets;
+	unsigned long long bytes;
+	unsigned long long skipped;			//pkt_decode rejected: l2/l3 header truncated
+	unsigned long long wall_ns;			//whole run, sleeps included in realtime mode
+	unsigned long long busy_ns;			//inside the pipeline only
+	unsigned long long span_us;			//capture time covered
+	unsigned long long det_calls[REPLAY_DET_MAX];
+	unsigned long long det_ns[REPLAY_DET_MAX];
+	u32 attack_events[REPLAY_EVENT_MAX];
+	u32 ip_connect;
+	u32 tcp_connect;
+	u32 udp_connect;
+	u32 dns_inquire;
+	u32 dns_response;
+}replay_stats;
+
+/*
+ * source is a capture file, or a generator "syn_flood|udp_scan|ping_of_death|
+ * arp_spoof|dns_storm[:packets[:out.pcap]]". local_ip NULL uses REPLAY_LOCAL_IP.
+ * Resets and reuses the detector state, so it must not run next to a live capture.
+ * 0 ok, -1 source could not be opened
+ */
+int  pcap_replay_run(const char *source,const char *local_ip,int mode,replay_stats *stats);
+void pcap_replay_print(const char *source,const replay_stats *stats);
+
+#endif
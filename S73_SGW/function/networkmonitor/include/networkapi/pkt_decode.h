@@ -0,0 +1,51 @@
+/*
+ * @Descripttion: one L2-L4 decode per packet, shared by call() and the flow counter
+ * @version: V0.0
+ * @Author: idps members
+ */
+#ifndef __PKT_DECODE_H__
+#define __PKT_DECODE_H__
+#include "typedef.h"
+
+#define PKT_VLAN_MAX			(4)		//802.1Q/802.1ad tags peeled before giving up
+#define PKT_IPV6_EXT_MAX		(8)		//extension headers walked before giving up
+
+#define PKT_DIR_UNKNOWN			(-1)
+#define PKT_DIR_IN				(0)
+#define PKT_DIR_OUT				(1)
+
+typedef struct{
+	int  linktype;			//DLT_*
+	int  hw_dir;			//PKT_DIR_*, only the cooked header knows it
+	const u8 *src_mac;		//NULL when the link has no MAC header
+	const u8 *dst_mac;
+	u8   vlan_depth;
+	u16  vlan_id[PKT_VLAN_MAX];		//outermost first
+	u16  ether_type;		//innermost, host order, 0 for non-ethernet payloads we cannot name
+	const u8 *l3;			//ip/arp header
+	u32  l3_caplen;			//captured bytes from l3 on
+	u8   ip_version;		//4/6, 0 not ip
+	u8   l4proto;			//ipv6: after the extension headers
+	u16  l3_hlen;			//ipv4 ihl*4 with options, ipv6 40 + extension headers
+	u32  ip_len;			//whole datagram from the header, not the capture
+	u8   fragment;			//part of a fragmented datagram
+	u8   more_frags;
+	u16  frag_off;			//bytes, l4 header only in offset 0
+	u8   src[16];			//network order, ipv4 in the first 4 bytes
+	u8   dst[16];
+	const u8 *l4;			//l3 + l3_hlen, NULL when nothing after it was captured
+	u32  l4_caplen;
+	u16  sport;				//host order, tcp/udp of the first fragment only
+	u16  dport;
+}pkt_decoded;
+
+/*
+ * data/caplen as delivered by pcap. 0 ok (pkt->ip_version tells what was found),
+ * -1 datalink not supported or l2/l3 header truncated
+ */
+int  pkt_decode(int linktype,const u8 *data,u32 caplen,pkt_decoded *pkt);
+boolean pkt_decode_supported(int linktype);
+u32  pkt_addr4(const u8 *addr);		//network order
+void pkt_addr_str(const pkt_decoded *pkt,const u8 *addr,char *buf,int len);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __SCAN_SKETCH_H__
+#define __SCAN_SKETCH_H__
+#include "typedef.h"
+
+/* count-min sketch, per packet rates keyed by port or source */
+#define SKETCH_CMS_DEPTH		(4)
+#define SKETCH_CMS_WIDTH_BITS	(10)
+#define SKETCH_CMS_WIDTH		(1 << SKETCH_CMS_WIDTH_BITS)
+/* sources tracked individually per window, power of two */
+#define SKETCH_SOURCES			(64)
+#define SKETCH_SOURCES_LIMIT	(SKETCH_SOURCES / 4 * 3)
+/* a source gets a slot once the sketch has seen it this many times */
+#define SKETCH_SOURCE_ADMIT		(2)
+/* hyperloglog registers for ports above SKETCH_LOW_PORTS */
+#define SKETCH_HLL_REGS			(64)
+/* privileged ports are tracked exactly with a bitmap */
+#define SKETCH_LOW_PORTS		(1024)
+/* ports over the flood threshold kept for the consumer */
+#define SKETCH_CANDIDATES		(16)
+/* per source counters, meaning defined by the detector */
+#define SKETCH_COUNTERS			(8)
+
+/* cms key kinds */
+#define SKETCH_KEY_SRC			(0)
+#define SKETCH_KEY_PORT			(1)
+#define SKETCH_KEY(kind,value)	(((unsigned long long)(kind) << 32) | (u32)(value))
+
+typedef struct{
+	u32 addr;
+	u32 used;
+	u32 packets;
+	u32 counter[SKETCH_COUNTERS];
+	u8  hll[SKETCH_HLL_REGS];
+	u8  lowport[SKETCH_LOW_PORTS / 8];
+}sketch_source;
+
+typedef struct{
+	u32 port;
+	u32 src_addr;
+}sketch_candidate;
+
+typedef struct{
+	u32              cms[SKETCH_CMS_DEPTH][SKETCH_CMS_WIDTH];
+	sketch_source    source[SKETCH_SOURCES];
+	u32              source_used;
+	sketch_source    global;//all sources together, catches spread scans
+	sketch_candidate candidate[SKETCH_CANDIDATES];
+	u32              candidate_used;
+	u32              packets;
+}sketch_window;
+
+/* double buffered windows, capture thread writes, parser thread swaps */
+typedef struct{
+	sketch_window    window[2];
+	u32              active;
+	u32              seq;
+}sketch_detector;
+
+void sketch_init(sketch_detector *detector);
+// capture thread: every update happens between begin and end
+sketch_window *sketch_begin(sketch_detector *detector);
+void sketch_end(sketch_detector *detector);
+// parser thread: returns the retired window, clear it once evaluated
+sketch_window *sketch_swap(sketch_detector *detector);
+void sketch_window_clear(sketch_window *window);
+
+u32  sketch_cms_add(sketch_window *window,unsigned long long key,u32 inc);
+u32  sketch_cms_query(const sketch_window *window,unsigned long long key);
+sketch_source *sketch_source_get(sketch_window *window,u32 addr);
+void sketch_source_port(sketch_source *source,u16 port);
+u32  sketch_source_ports(const sketch_source *source);
+sketch_source *sketch_source_top(sketch_window *window);
+void sketch_candidate_add(sketch_window *window,u16 port,u32 src_addr);
+
+#endif
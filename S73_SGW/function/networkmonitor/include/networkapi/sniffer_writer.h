@@ -0,0 +1,40 @@
+/*
+ * @Descripttion: sniffer writer thread, capture thread only copies into a ring
+ * @version: V0.0
+ * @Author: idps members
+ */
+#ifndef __SNIFFER_WRITER_H__
+#define __SNIFFER_WRITER_H__
+#include <pcap.h>
+#include "typedef.h"
+
+#define SNIFFER_RING_BYTES			(4 * 1024 * 1024)	//power of two
+#define SNIFFER_FILTER_MAX			(256)
+#define SNIFFER_FILES_MAX			(64)
+#define SNIFFER_ROTATE_MB			(16)
+#define SNIFFER_ROTATE_FILES		(8)
+#define SNIFFER_IDLE_US				(10000)
+
+typedef struct{
+	unsigned long long pushed;		//accepted by the ring
+	unsigned long long dropped;		//ring full, the capture thread never waits
+	unsigned long long filtered;	//rejected by the BPF filter
+	unsigned long long written;
+	unsigned long long bytes;		//pcapng bytes on flash
+	u32 files;
+}sniffer_writer_stats;
+
+/*
+ * read at the next start. snaplen 0 keeps whole packets, rotate_mb/rotate_seconds
+ * 0 disables that trigger, both 0 writes one file at the configured path.
+ * max_files rotated segments are kept, the oldest is deleted
+ */
+void sniffer_writer_config(int snaplen,int rotate_mb,int rotate_seconds,int max_files,const char *filter);
+int  sniffer_writer_start(const char *path,int linktype);	//0 ok, -1 bad filter or no memory
+void sniffer_writer_stop(void);								//drains the ring first
+boolean sniffer_writer_active(void);
+// capture thread only
+void sniffer_writer_push(const struct pcap_pkthdr *hdr,const u8 *data);
+void sniffer_writer_get_stats(sniffer_writer_stats *stats);
+
+#endif
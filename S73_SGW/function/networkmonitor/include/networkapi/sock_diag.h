@@ -0,0 +1,54 @@
+#ifndef __NETWORK_SOCK_DIAG_H__
+#define __NETWORK_SOCK_DIAG_H__
+#include "typedef.h"
+
+/* inode -> pid cache, open addressing, power of two */
+#ifndef SOCKPID_SLOTS
+	#define SOCKPID_SLOTS			(2048)
+// remote address 4 or 16 bytes network order, port host order
+typedef void (*sockdiag_walk_cb)(u8 family,u8 state,const u8 *dst,u16 dst_port,void *arg);
+// dump AF_INET and AF_INET6 tcp sockets whose state bit (1 << TCP_xxx) is set in states,
+// returns the number of sockets walked or SOCKDIAG_UNSUPPORTED
+int  sockdiag_tcp_walk(u32 states,sockdiag_walk_cb cb,void *arg);
+
+#endif
+#define SOCKPID_LIMIT				(SOCKPID_SLOTS / 4 * 3)
+#define SOCKPID_NAME_MAX			(40)
+/* /proc/<pid>/fd rescans on a miss: one token every SOCKPID_RESCAN_MS, burst of SOCKPID_RESCAN_BURST */
+#define SOCKPID_RESCAN_MS			(50)
+#define SOCKPID_RESCAN_BURST		(4)
+/* an inode no process owned is not rescanned for this long, ms */
+#define SOCKPID_NEGATIVE_MS			(1000)
+
+#define SOCKDIAG_OK					(0)
+#define SOCKDIAG_NOT_FOUND			(-1)
+#define SOCKDIAG_UNSUPPORTED		(-2)
+
+typedef struct{
+	u32  inode;
+	s32  pid;		//-1:forgotten 0:no owner found at stamp
+	u32  stamp;		//ms
+	u8   used;
+	char name[SOCKPID_NAME_MAX];
+}sockpid_slot;
+
+/*
+ * exact 5-tuple lookup through NETLINK_SOCK_DIAG, either direction of the tuple
+ * ip in network order, port in host order, protocol IPPROTO_TCP/IPPROTO_UDP/IPPROTO_RAW
+ */
+int  sockdiag_find_inode(u8 protocol,u32 src_ip,u16 src_port,u32 dst_ip,u16 dst_port,u32 *inode,u32 *uid);
+// inode -> pid/process name, /proc is scanned only on a miss
+boolean sockpid_lookup(u32 inode,s32 *pid,char *name,int name_len);
+// process exit/exec, drop everything cached for pid
+void sockpid_forget_pid(s32 pid);
+void sockpid_clear(void);
+// both steps, SOCKDIAG_UNSUPPORTED if the kernel has no sock_diag
+int  sockdiag_attribute(u8 protocol,u32 src_ip,u16 src_port,u32 dst_ip,u16 dst_port,s32 *pid,char *name,int name_len);
+
+// remote address 4 or 16 bytes network order, port host order
+typedef void (*sockdiag_walk_cb)(u8 family,u8 state,const u8 *dst,u16 dst_port,void *arg);
+// dump AF_INET and AF_INET6 tcp sockets whose state bit (1 << TCP_xxx) is set in states,
+// returns the number of sockets walked or SOCKDIAG_UNSUPPORTED
+int  sockdiag_tcp_walk(u32 states,sockdiag_walk_cb cb,void *arg);
+
+#endif
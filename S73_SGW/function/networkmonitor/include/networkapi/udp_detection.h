@@ -4,7 +4,8 @@
 void udp_scanner_init();
 void udpport_value_consumer(void);
 void udp_parser(u32 src_addr,u32 dest_addr,struct udphdr* udp,u32 pack_length);
-void dns_parser(char* src_addr,char* dest_addr,struct udphdr* udp,int action);
+// cap_len:udp header onwards, bytes actually captured
+void dns_parser(char* src_addr,char* dest_addr,struct udphdr* udp,int action,int cap_len);
 
 #endif
 
@@ -334,6 +334,8 @@ void updateDNSWhiteList(char* whiteDNSList)
 		char*  dns_str = cJSON_GetObjectItem(child,"name")->valuestring;
 		addDNSWhiteList(dns_str);
 	}
+	// 重新编译白名单，替换后抓包线程立即生效
+	DNSWhiteCheckInit(mDNSWhiteList);
 	cJSON_Delete(cJSONList);
 }
 
@@ -491,7 +493,7 @@ __attribute__((unused)) static void onPortopenEvent(unsigned int port, char* uid
 }
 
 // 6、Ip连接上报
-__attribute__((unused)) static void onIpConnectEvent(int ip_version,char* srcIp, int srcPort,char* desIp, int desPort, int protocol)
+__attribute__((unused)) static void onIpConnectEvent(int ip_version,char* srcIp, int srcPort,char* desIp, int desPort, int protocol, char* domain)
 {
 	long long timestamp = clockobj.get_current_time();
 	cJSON *cjson_data = cJSON_CreateObject();
@@ -504,6 +506,7 @@ __attribute__((unused)) static void onIpConnectEvent(int ip_version,char* srcIp,
 	cJSON_AddStringToObject(cjson_data,"remote_ip",desIp);
 	cJSON_AddNumberToObject(cjson_data,"remote_port",desPort);
 	cJSON_AddNumberToObject(cjson_data,"protocol",protocol);
+	cJSON_AddStringToObject(cjson_data,"domain",(domain != NULL)?(domain):(""));
 	cJSON_AddNumberToObject(cjson_data,"timestamp",timestamp);
     char *s = cJSON_PrintUnformatted(cjson_data);
 	//printNetEventformatted("[IP event]",s);
@@ -649,6 +652,24 @@ void setNetAttackThreshold(char *attackThreshold)
 	}
 }
 
+// 带宽受限模式：关闭DNS响应事件，域名随IP连接事件上报
+void updateDnsResponseReport(bool on)
+{
+	set_DnsResponseReport(on);
+}
+
+// 网卡的连接事件(1)/流量统计(2)改用conntrack事件，不可用时仍走抓包
+void updateConnTrackSource(char* if_name, int mode)
+{
+	set_ConnTrackSource(if_name, mode);
+}
+
+// 离线回放pcap或生成的攻击流量, 输出吞吐和各检测器耗时
+int replayCapture(char* source, char* local_ip, int realtime)
+{
+	return ReplayCapture(source, local_ip, realtime);
+}
+
 // 解析更新流量配置
 void updateNetFlowEvent(int interval, bool on)
 {
@@ -699,6 +720,36 @@ void stopSniffer_Base(void)
 	StopSniffer();
 }
 
+// 抓包文件截断长度、按大小/时间轮转、BPF过滤
+void updateSnifferConfig(int snaplen, int rotateMB, int rotateSeconds, int maxFiles, char* filter)
+{
+	SetSnifferConfig(snaplen, rotateMB, rotateSeconds, maxFiles, filter);
+}
+
+// 流量统计计数来源 0:抓包 1:eBPF内核计数，加载失败仍走抓包
+void updateFlowAccounting(int mode)
+{
+	set_FlowAccounting(mode);
+}
+
+// 网关下发的静态ip-mac绑定，用于ARP欺骗检测
+int addArpStaticBinding(char* ip, char* mac)
+{
+	return set_ArpStaticBinding(ip, mac);
+}
+
+// 主网卡之外同时监测的网卡，逗号分隔，下次启动监测生效
+void updateCaptureInterfaces(char* ifList)
+{
+	SetCaptureInterfaces(ifList);
+}
+
+// 各抓包网卡的地址和计数
+void getCaptureInterfaceInfo(char* outstring, int maxlen)
+{
+	CaptureInterfaceInfo(outstring, maxlen);
+}
+
 // 建立监测
 void newNetworkMonitor(char *watchNicDevicePolicy, char *watchNicDeviceBase, bool attackSwitch, char* attackList, char* attackThreshold,
 							bool flowSwitch, int flowInterval, bool connectSwitch, int connectInterval)
@@ -771,5 +822,13 @@ NetWorkMonitorMethod NetWorkMonitorMethodObj = {
 	updateIpWhiteList,
 	updatePortWhiteList,
 	updateDNSWhiteList,
+	updateDnsResponseReport,
+	updateConnTrackSource,
+	replayCapture,
+	updateSnifferConfig,
+	updateFlowAccounting,
+	addArpStaticBinding,
+	updateCaptureInterfaces,
+	getCaptureInterfaceInfo,
 };
 #endif
@@ -41,7 +41,12 @@
 #include <pthread.h>
 #include "cJSON.h"
 #include "firewallload.h"
+#include "fireipset.h"
+#include "firestate.h"
+#include "dns_trie.h"
+#include "dns_cache.h"
 #include <ctype.h>
+#include <arpa/inet.h>
 #include "util.h"
 
 extern void loadstring_init();
@@ -52,6 +57,11 @@ extern void icmpload_init();
 extern void tcpload_init();
 extern void udpload_init();
 extern void pkttypeload_init();
+extern void setload_init();
+void init_source();
+void inputprocessstring(char* processstring);
+static bool firebatchmine(void);
+bool check_dnatrules_black_list(list *listchain,char* protocol,char* beforeip,int beforport,char* afterip,int afterport,char* ethdevice);
 /*Maximum number of input characters       example:firewall -L -n  is 3*/
 #define MAXCMDLEN           							50 
 /*pthread mutex  lock*/
@@ -85,21 +95,452 @@ enum headrules {
   * argc:cmd count  argv:save string
   * decla:Because there are too many commands, we use character matching, which is more easy to understand and basically consistent with iptable
   * modify:20200104 frre()delete
+  *        the lock covers the read of the table too, a commit replaces the whole table
   */
  static int stringprocess(int argc, char *argv[])
  {
      int ret;
      char *table = "filter";
      struct xtc_handle *handle = NULL;
+     bool locked = !firebatchmine();//the batch owner already holds it
   
+     if (locked)
+         pthread_mutex_lock(&mutexmodifyfire);
      ret = do_command4(argc, argv, &table, &handle, false);
      if (ret) {
-         pthread_mutex_lock(&mutexmodifyfire);
          ret = iptc_commit(handle);
+     }
+     if (handle != NULL)
          iptc_free(handle);
+     if (locked)
          pthread_mutex_unlock(&mutexmodifyfire);
-     }
+     return ret;
+ }
+ /**
+  * decla:read only command (-L), the table is read through libiptc and never committed
+  *       caller holds mutexmodifyfire, list_firerules is filled by the print path
+  */
+ static int queryprocess(int argc, char *argv[])
+ {
+     int ret;
+     char *table = "filter";
+     struct xtc_handle *handle = NULL;
+
+     ret = do_command4(argc, argv, &table, &handle, false);
+     if (handle != NULL)
+         iptc_free(handle);
+     return ret;
  }
+/*
+* batch:every rule between firewall_batch_begin and firewall_batch_commit goes into one
+* libiptc handle per table in memory, each table is committed once at the end.
+* the owner thread holds mutexmodifyfire for the whole batch
+*/
+#define FIREBATCHTABLES         4               //filter nat mangle raw
+struct firebatch{
+	char  table[FIREBATCHTABLES][XT_TABLE_MAXNAMELEN];
+	struct xtc_handle *handle[FIREBATCHTABLES];
+	int   depth;                                //nested begin on the owner thread
+	int   applied;
+	int   failed;
+};
+static struct firebatch firebatchstate;
+static bool firebatchactive = false;
+static pthread_t firebatchowner;
+
+static bool firebatchmine(void)
+{
+	return (__atomic_load_n(&firebatchactive,__ATOMIC_ACQUIRE) && pthread_equal(firebatchowner,pthread_self()))?(true):(false);
+}
+/*slot of the table in the batch, -1 all slots taken by other tables*/
+static int firebatchslot(const char *table)
+{
+	int slot;
+
+	for(slot = 0;slot < FIREBATCHTABLES;slot ++){
+		if(firebatchstate.table[slot][0] == '\0' || strcmp(firebatchstate.table[slot],table) == 0)
+			break;
+	}
+	if(slot == FIREBATCHTABLES)
+		return -1;
+	strncpy(firebatchstate.table[slot],table,XT_TABLE_MAXNAMELEN - 1);
+	return slot;
+}
+/*
+* one command into the handle of its table, the handle is created on first use
+*/
+static int firebatchcommand(int argc, char *argv[])
+{
+	char *table = "filter";
+	int slot,ret;
+
+	for(int loop = 0;loop + 1 < argc;loop ++){
+		if(strcmp(argv[loop],"-t") == 0)
+			table = argv[loop + 1];
+	}
+	if((slot = firebatchslot(table)) < 0){
+		firebatchstate.failed ++;
+		return 0;
+	}
+	ret = do_command4(argc, argv, &table, &(firebatchstate.handle[slot]), false);
+	if(ret)
+		firebatchstate.applied ++;
+	else
+		firebatchstate.failed ++;
+	return ret;
+}
+/**
+ * declaration:start a batch on this thread, rules are applied in memory until firewall_batch_commit
+ */
+void firewall_batch_begin(void)
+{
+	if(firebatchmine()){
+		firebatchstate.depth ++;
+		return;
+	}
+	init_source();
+	pthread_mutex_lock(&mutexmodifyfire);
+	memset(&firebatchstate,0,sizeof(firebatchstate));
+	firebatchowner = pthread_self();
+	__atomic_store_n(&firebatchactive,true,__ATOMIC_RELEASE);
+}
+/**
+ * declaration:commit every table touched by the batch once
+ * return     :commands that could not be applied (e.g. deleting a rule that is not there), -1 a commit failed
+ */
+int firewall_batch_commit(void)
+{
+	int ret = 0;
+
+	if(!firebatchmine())
+		return -1;
+	if(firebatchstate.depth > 0){
+		firebatchstate.depth --;
+		return 0;
+	}
+	ret = firebatchstate.failed;
+	for(int slot = 0;slot < FIREBATCHTABLES;slot ++){
+		if(firebatchstate.handle[slot] == NULL)
+			continue;
+		if(!iptc_commit(firebatchstate.handle[slot])){
+			printf("firewall batch commit %s: %s\n",firebatchstate.table[slot],iptc_strerror(errno));
+			ret = -1;
+		}
+		iptc_free(firebatchstate.handle[slot]);
+		firebatchstate.handle[slot] = NULL;
+	}
+	__atomic_store_n(&firebatchactive,false,__ATOMIC_RELEASE);
+	pthread_mutex_unlock(&mutexmodifyfire);
+	return ret;
+}
+/**
+ * declaration:filter chain lookup in the batch handle, so chains the batch created count too
+ * return     :false outside a batch or the table can not be read
+ */
+static bool firechainexists(const char *chain)
+{
+	int slot;
+
+	if((!firebatchmine())||((slot = firebatchslot("filter")) < 0))
+		return false;
+	if(firebatchstate.handle[slot] == NULL)
+		firebatchstate.handle[slot] = iptc_init("filter");
+	if(firebatchstate.handle[slot] == NULL)
+		return false;
+	return (iptc_is_chain(chain,firebatchstate.handle[slot]))?(true):(false);
+}
+/**
+ * declaration:drop everything applied since firewall_batch_begin, the kernel tables are untouched
+ */
+void firewall_batch_abort(void)
+{
+	if(!firebatchmine())
+		return;
+	for(int slot = 0;slot < FIREBATCHTABLES;slot ++){
+		if(firebatchstate.handle[slot] != NULL)
+			iptc_free(firebatchstate.handle[slot]);
+		firebatchstate.handle[slot] = NULL;
+	}
+	firebatchstate.depth = 0;
+	__atomic_store_n(&firebatchactive,false,__ATOMIC_RELEASE);
+	pthread_mutex_unlock(&mutexmodifyfire);
+}
+/*
+* set backed black list:an entry with any local address and at most one port is kept in a
+* kernel ip set of its device, one rule per set in INPUTBLACK/OUTPUTBLACK matches all of them.
+* BLACKNET<eth> hash:net       remote net, every protocol
+* BLACKDPT<eth> hash:net,port  remote net + tcp/udp destination port
+* BLACKSPT<eth> hash:net,port  remote net + tcp/udp source port
+* other entries and kernels without ip_set keep one rule per entry
+*/
+#define FIRESETDEVICEMAX        8
+#define FIREBLACKSETKINDS       3
+struct firesetdevice{
+	char eth[32];
+	bool ready;                                 //black sets exist and their rules are in the chains
+	bool dnsready[2];                           //DNSBLACK DNSWHITE, indexed by colour
+};
+static struct firesetdevice firesetdevices[FIRESETDEVICEMAX];
+static const char *blacksetkind[FIREBLACKSETKINDS][4] = {
+	/*name  type             INPUT dirs  OUTPUT dirs*/
+	{"NET", "hash:net",      "src",      "dst"},
+	{"DPT", "hash:net,port", "src,dst",  "dst,dst"},
+	{"SPT", "hash:net,port", "src,src",  "dst,src"},
+};
+
+static struct firesetdevice *setdevicefind(const char *eth,bool create)
+{
+	for(int loop = 0;loop < FIRESETDEVICEMAX;loop ++){
+		if(strcmp(firesetdevices[loop].eth,eth) == 0)
+			return &firesetdevices[loop];
+	}
+	if(!create)
+		return NULL;
+	for(int loop = 0;loop < FIRESETDEVICEMAX;loop ++){
+		if(firesetdevices[loop].eth[0] == '\0'){
+			strncpy(firesetdevices[loop].eth,eth,sizeof(firesetdevices[loop].eth) - 1);
+			return &firesetdevices[loop];
+		}
+	}
+	return NULL;
+}
+
+static bool blacksetwildcard(const char *ip)
+{
+	return ((ip == NULL)||(ip[0] == '\0')||(strcmp(ip,"0.0.0.0/0") == 0)||(strcmp(ip,"0.0.0.0") == 0))?(true):(false);
+}
+/**
+ * declaration:create (or empty) the black sets of one device and hook them into its black chains.
+ *             called after createlist flushed the chains, so the old entries are gone from both
+ */
+static void blacksetinit(char *eth)
+{
+	struct firesetdevice *set = setdevicefind(eth,true);
+	char name[32],stringpool[160];
+
+	if(set == NULL)
+		return;
+	set->ready = false;
+	for(int kind = 0;kind < FIREBLACKSETKINDS;kind ++){
+		snprintf(name,sizeof(name),"BLACK%s%s",blacksetkind[kind][0],eth);
+		if(fireipset_create(name,blacksetkind[kind][1],0) != 0)
+			return;//no ip_set in this kernel
+		fireipset_flush(name);
+	}
+	firewall_batch_begin();
+	for(int kind = 0;kind < FIREBLACKSETKINDS;kind ++){
+		snprintf(name,sizeof(name),"BLACK%s%s",blacksetkind[kind][0],eth);
+		snprintf(stringpool,sizeof(stringpool),"iptables -A INPUTBLACK%s -i %s -m set --match-set %s %s -j DROP",eth,eth,name,blacksetkind[kind][2]);
+		inputprocessstring(stringpool);
+		snprintf(stringpool,sizeof(stringpool),"iptables -A OUTPUTBLACK%s -o %s -m set --match-set %s %s -j DROP",eth,eth,name,blacksetkind[kind][3]);
+		inputprocessstring(stringpool);
+	}
+	set->ready = (firewall_batch_commit() == 0)?(true):(false);//no set match in the kernel:keep rules per entry
+}
+/*
+* dns policy by address:a listed name and the names below it are not string matched in every packet.
+* the dns answers the capture already parses put their addresses into DNSWHITE<eth>/DNSBLACK<eth>
+* (hash:ip), each entry expires with the answer ttl. one rule per direction matches the set
+*/
+#define FIREDNSTTLMIN           300             //a connection usually outlives a short cdn ttl
+#define FIREDNSTTLMAX           86400
+#define FIREDNSSETTIMEOUT       3600
+struct firednsname{
+	char dns[64];
+	char eth[32];
+	char colour;
+};
+static list list_firedns;                       //names in sets, api thread only
+static bool firednsinit = false;
+static bool firednsdirty = false;
+static dns_trie *firednstrie = NULL;            //name -> bit (device slot*2 + colour)
+static pthread_mutex_t mutexfiredns = PTHREAD_MUTEX_INITIALIZER;
+
+static void dnssetname(char *name,size_t size,const char *eth,char colour)
+{
+	snprintf(name,size,"DNS%s%s",(colour == white)?("WHITE"):("BLACK"),eth);
+}
+/**
+ * declaration:dns answer hook, capture thread.  addresses of listed names go into the sets
+ */
+static void firednsresolved(int family,const void *addr,const char *name,u32 ttl)
+{
+	char ip[INET_ADDRSTRLEN],setname[32];
+	u32 mask = 0;
+
+	if(family != AF_INET)//the firewall is ipv4 only
+		return;
+	pthread_mutex_lock(&mutexfiredns);
+	if(firednstrie != NULL)
+		mask = dns_trie_match(firednstrie,name);
+	pthread_mutex_unlock(&mutexfiredns);
+	if(mask == 0)
+		return;
+	ttl = (ttl < FIREDNSTTLMIN)?(FIREDNSTTLMIN):((ttl > FIREDNSTTLMAX)?(FIREDNSTTLMAX):(ttl));
+	inet_ntop(AF_INET,addr,ip,sizeof(ip));
+	for(int bit = 0;bit < FIRESETDEVICEMAX * 2;bit ++){
+		if(!(mask & (1u << bit)))
+			continue;
+		dnssetname(setname,sizeof(setname),firesetdevices[bit / 2].eth,bit % 2);
+		fireipset_entry(setname,true,ip,0,0,ttl);
+	}
+}
+/**
+ * declaration:create (or empty) DNSWHITE/DNSBLACK of one device after createlist flushed its chains.
+ *             white accepts before the closing DROP, black drops, both directions
+ */
+static void dnssetinit(char *eth,char colour)
+{
+	struct firesetdevice *set = setdevicefind(eth,true);
+	char name[32],stringpool[160];
+	const char *color = (colour == white)?("WHITE"):("BLACK");
+	const char *target = (colour == white)?("ACCEPT"):("DROP");
+
+	if(set == NULL)
+		return;
+	set->dnsready[(int)colour] = false;
+	dnssetname(name,sizeof(name),eth,colour);
+	if(fireipset_create(name,"hash:ip",FIREDNSSETTIMEOUT) != 0)
+		return;
+	fireipset_flush(name);
+	firewall_batch_begin();
+	snprintf(stringpool,sizeof(stringpool),"iptables -I INPUT%s%s 1 -i %s -m set --match-set %s src -j %s",color,eth,eth,name,target);
+	inputprocessstring(stringpool);
+	snprintf(stringpool,sizeof(stringpool),"iptables -I OUTPUT%s%s 1 -o %s -m set --match-set %s dst -j %s",color,eth,eth,name,target);
+	inputprocessstring(stringpool);
+	if(firewall_batch_commit() != 0)
+		return;
+	set->dnsready[(int)colour] = true;
+	if(!firednsinit){
+		list_init(&list_firedns,free);
+		firednsinit = true;
+		dns_cache_set_hook(firednsresolved);
+	}
+	firednsdirty = true;//the set was emptied, names already listed fill it again
+}
+/**
+ * declaration:list (add) or unlist (!add) a dns name of a device in its set
+ * return     :false the device has no dns set of this colour, the caller uses a string rule
+ */
+static bool dnssetentry(struct stringmatch *stringget,char colour,bool add)
+{
+	struct firesetdevice *set = setdevicefind(stringget->eth,false);
+	list_elmt *old_elmt = NULL;
+
+	if(add){
+		if((set == NULL)||(!set->dnsready[(int)colour]))
+			return false;
+		for(list_elmt *cur_elmt = list_head(&list_firedns);cur_elmt != NULL;cur_elmt = cur_elmt->next){
+			struct firednsname *dnsname = cur_elmt->data;
+			if((strcmp(dnsname->dns,stringget->dnsstring) == 0)&&(strcmp(dnsname->eth,stringget->eth) == 0)&&(dnsname->colour == colour))
+				return true;//restored after createlist
+		}
+		struct firednsname *dnsname = (struct firednsname *)malloc(sizeof(struct firednsname));
+		memset(dnsname,0,sizeof(struct firednsname));
+		strncpy(dnsname->dns,stringget->dnsstring,sizeof(dnsname->dns) - 1);
+		strncpy(dnsname->eth,stringget->eth,sizeof(dnsname->eth) - 1);
+		dnsname->colour = colour;
+		list_ins_next(&list_firedns,NULL,dnsname);
+		return true;
+	}
+	if(!firednsinit)
+		return false;
+	for(list_elmt *cur_elmt = list_head(&list_firedns);cur_elmt != NULL;cur_elmt = cur_elmt->next){
+		struct firednsname *dnsname = cur_elmt->data;
+		if((strcmp(dnsname->dns,stringget->dnsstring) == 0)&&(strcmp(dnsname->eth,stringget->eth) == 0)&&(dnsname->colour == colour)){
+			list_delindex(&list_firedns,old_elmt);
+			firednsdirty = true;//addresses of this name have to leave the set
+			return true;
+		}
+		old_elmt = cur_elmt;
+	}
+	return false;
+}
+/**
+ * declaration:after a list change:recompile the name matcher, refill the sets from the answers
+ *             the dns cache still holds (the name may have been resolved before it was listed)
+ */
+static void dnssetcommit(void)
+{
+	dns_trie_builder *builder = NULL;
+	dns_trie *trie = NULL,*old = NULL;
+	char pattern[72],name[32];
+
+	if(!firednsinit)
+		return;
+	if((builder = dns_trie_builder_new()) == NULL)
+		return;
+	for(list_elmt *cur_elmt = list_head(&list_firedns);cur_elmt != NULL;cur_elmt = cur_elmt->next){
+		struct firednsname *dnsname = cur_elmt->data;
+		u32 mask = 0;
+		//one value per name:the bits of every device/colour listing it
+		for(list_elmt *same = list_head(&list_firedns);same != NULL;same = same->next){
+			struct firednsname *other = same->data;
+			struct firesetdevice *set = setdevicefind(other->eth,false);
+			if((set != NULL)&&(set->dnsready[(int)other->colour])&&(strcmp(other->dns,dnsname->dns) == 0))
+				mask |= 1u << ((set - firesetdevices) * 2 + other->colour);
+		}
+		if(mask == 0)
+			continue;
+		dns_trie_builder_add(builder,dnsname->dns,mask);
+		if(strncmp(dnsname->dns,"*.",2) != 0){
+			snprintf(pattern,sizeof(pattern),"*.%s",dnsname->dns);//the string match hit names below it too
+			dns_trie_builder_add(builder,pattern,mask);
+		}
+	}
+	if((trie = dns_trie_compile(builder)) == NULL)
+		return;
+	pthread_mutex_lock(&mutexfiredns);
+	old = firednstrie;
+	firednstrie = trie;
+	pthread_mutex_unlock(&mutexfiredns);
+	dns_trie_free(old);
+	if(firednsdirty){
+		for(int slot = 0;slot < FIRESETDEVICEMAX;slot ++){
+			for(char colour = black;colour <= white;colour ++){
+				if(!firesetdevices[slot].dnsready[(int)colour])
+					continue;
+				dnssetname(name,sizeof(name),firesetdevices[slot].eth,colour);
+				fireipset_flush(name);
+			}
+		}
+		firednsdirty = false;
+	}
+	dns_cache_replay(firednsresolved);
+}
+/**
+ * declaration:put a black entry into (add) or take it out of (!add) the sets of its device
+ * return     :false the entry does not fit a set or the device has none, the caller uses a rule
+ */
+static bool blacksetentry(struct iplist *ipinfo,bool add)
+{
+	struct firesetdevice *set = setdevicefind(ipinfo->eth,false);
+	unsigned char proto = 0;
+	unsigned short port = 0;
+	int kind = 0;
+	char name[32];
+
+	if((set == NULL)||(!set->ready))
+		return false;
+	if(!blacksetwildcard(ipinfo->source)||blacksetwildcard(ipinfo->destination))
+		return false;
+	if(ipinfo->srcport && ipinfo->dstport)
+		return false;
+	if(ipinfo->srcport || ipinfo->dstport){
+		if(strcmp(ipinfo->prot,"tcp") == 0)
+			proto = IPPROTO_TCP;
+		else if(strcmp(ipinfo->prot,"udp") == 0)
+			proto = IPPROTO_UDP;
+		else
+			return false;
+		kind = (ipinfo->dstport)?(1):(2);
+		port = (ipinfo->dstport)?(ipinfo->dstport):(ipinfo->srcport);
+	}
+	else if(strcmp(ipinfo->prot,"all") != 0)
+		return false;
+	snprintf(name,sizeof(name),"BLACK%s%s",blacksetkind[kind][0],ipinfo->eth);
+	return (fireipset_entry(name,add,ipinfo->destination,proto,port,0) == 0)?(true):(false);
+}
 
  /*
 * delete head space
@@ -123,20 +564,20 @@ char *ltrim(char *str)
  */
  bool iptablescheck(void)
  {
-	 char iptablesversion[32];
+	 static int iptablesexist = -1;//the binary does not come or go at runtime, ask once
+	 char iptablesversion[32] = {0};
 	 FILE *pIptables = NULL;
+	 if(iptablesexist >= 0)
+		 return (iptablesexist)?(true):(false);
 	 pIptables = popen("iptables --version","r");
 	 if(pIptables == NULL){
 		 perror("open fd error");
 		 return false;
 	 }
 	 fgets(iptablesversion,sizeof("iptables v1.6.7"),pIptables);
-	 if(!memcmp(iptablesversion,"iptables v1.6.7",sizeof("iptables"))){
-		 pclose(pIptables);
-		 return true;
-	 }
+	 iptablesexist = (!memcmp(iptablesversion,"iptables v1.6.7",sizeof("iptables")))?(1):(0);
 	pclose(pIptables);
-	return false;
+	return (iptablesexist)?(true):(false);
  }
  /*
 * split string function
@@ -149,65 +590,22 @@ void splitinputstring(char* strinput)
 	strcpy(str,strinput);//reason:strinput may function("string"),so we copy 
    	token = strtok(str," ");
     while( token != NULL ) {
+	  size_t len = strlen( token );
+	  if(len >= 2 && token[0] == '"' && token[len - 1] == '"'){//the shell would have taken the quotes off
+		  token[len - 1] = '\0';
+		  token ++;
+	  }
 	  argv[ argc ] = (arg_t* )malloc(strlen( token ) +2);
 	  strcpy(argv[ argc ] ->data,token);
 	  argc = (argc + 1)%MAXCMDLEN;
       token = strtok(NULL, " ");
     }
-	stringprocess(argc,(char**)argv);
+	if(firebatchmine())
+		firebatchcommand(argc,(char**)argv);
+	else
+		stringprocess(argc,(char**)argv);
 	for(int loop = 0; loop < argc; loop ++)
 		free(argv[loop]);
-}
- /*
-* split cmd response
-*/
-void queryrulessplit(FILE *ptr){
-	struct firerule *pfirerule = NULL;
-	char buffer[512],chain[32],policy[32],rulescount = ZERORULES;
-	rewind(ptr);
-	while(!feof(ptr))
-	{
-		memset(buffer,0,sizeof(buffer));
-		if(NULL != fgets(buffer, 512, ptr)){
-			if((strlen(buffer) <= 5))
-				continue;
-			if((NULL != strstr(buffer,"num   pkts bytes target     prot opt in"))){
-				rulescount = JUSTHAVEHEAD;
-				continue;
-			}
-			if((NULL != strstr(buffer,"Chain"))&&(NULL != strstr(buffer,"policy"))){
-				if(rulescount == JUSTHAVEHEAD){
-					pfirerule = (struct firerule *)malloc(sizeof(struct firerule));		
-					memset(pfirerule,0,sizeof(struct firerule));
-					memcpy(pfirerule->Chain,chain,strlen(chain));
-					memcpy(pfirerule->policy,policy,strlen(policy));
-					pfirerule->num = 0;
-					list_ins_next(&list_firerules,NULL,pfirerule);
-				}
-				rulescount == ZERORULES;
-				memset(chain,0,sizeof(chain));
-				memset(policy,0,sizeof(policy));
-				sscanf(buffer,"Chain %[A-Z] (policy %[A-z][^ ]",chain,policy);
-				rulescount = 0;
-				continue;
-			}
-			rulescount = HAVERULES;
-			pfirerule = (struct firerule *)malloc(sizeof(struct firerule));		
-			memset(pfirerule,0,sizeof(struct firerule));
-			memcpy(pfirerule->Chain,chain,strlen(chain));
-			memcpy(pfirerule->policy,policy,strlen(policy));
-			int matchnumber = sscanf(buffer,"%d %*[0-9A-Z] %*[0-9A-Z] %32[A-Z] %[a-z] %s %s %s %s %s %128[^\n]",&(pfirerule->num),pfirerule->target,pfirerule->prot,pfirerule->opt,pfirerule->devicein,pfirerule->deviceout,pfirerule->source,pfirerule->destination,pfirerule->expand);
-			list_ins_next(&list_firerules,NULL,pfirerule);
-		}
-	}
-	if(rulescount == JUSTHAVEHEAD){
-		pfirerule = (struct firerule *)malloc(sizeof(struct firerule));		
-		memset(pfirerule,0,sizeof(struct firerule));
-		memcpy(pfirerule->Chain,chain,strlen(chain));
-		memcpy(pfirerule->policy,policy,strlen(policy));
-		pfirerule->num = 0;
-		list_ins_next(&list_firerules,NULL,pfirerule);
-	}
 }
 //init modul  just once
 void init_source(){
@@ -230,6 +628,7 @@ void init_source(){
 	tcpload_init();
 	udpload_init();
 	pkttypeload_init();
+	setload_init();
 	 
 }
 
@@ -241,13 +640,19 @@ void inputprocessstring(char* processstring)
 {
 	FILE* pIptables = NULL;
  
-	if(true == iptablescheck()){
+	if(firebatchmine()){
+		 splitinputstring(processstring);//in memory, committed with the batch
+	 }
+	else if(true == iptablescheck()){
+		 pthread_mutex_lock(&mutexmodifyfire);//wait for a batch in flight
 		 pIptables = popen(processstring,"r");
 		 if(pIptables == NULL){
 			 perror("open fd error");
+			 pthread_mutex_unlock(&mutexmodifyfire);
 			 return;
 		 }
 		 pclose(pIptables);
+		 pthread_mutex_unlock(&mutexmodifyfire);
 	 }
 	 else{
 		 splitinputstring(processstring);
@@ -381,37 +786,32 @@ void inputprocessstring(char* processstring)
 * size: data size     data:copy space
 * table:if no set ,chain:filter
 */
-char* queryallrules(char *chain)    
+char* queryallrules(char *chain)
 {
 	uint8_t argc = 0,loop = 0;
 	char *token  = NULL,*s = NULL;
-	FILE *piptables = NULL;
 	char str[256];
-	list_init(&list_firerules,free);//malloc rules
+	arg_t *args[MAXCMDLEN];
+	bool locked = !firebatchmine();
 	strcpy(str,"iptables -vL -n --line-number");
 	if((chain != NULL)&&(chain != "")){
 		strcat(str," -t ");
 		strcat(str,chain);
 	}
-	 
-	if(true == iptablescheck()){
-		piptables = popen(str,"r");
-		queryrulessplit(piptables); 
-		if(piptables != NULL)
-			pclose(piptables);
-	}
-	else{
-		token = strtok(str," ");
-		while( token != NULL ) {
-			argv[ argc ] = (arg_t* )malloc(strlen( token ) +2);
-			strcpy(argv[ argc ] ->data,token);
-			argc = (argc + 1)%MAXCMDLEN;
-			token = strtok(NULL, " ");
-		}
-		stringprocess(argc,(char**)argv);	
-		for(int loop = 0; loop < argc; loop ++)
-			free(argv[loop]);		
+	init_source();
+	if(locked)
+		pthread_mutex_lock(&mutexmodifyfire);//list_firerules is shared
+	list_init(&list_firerules,free);//malloc rules
+	token = strtok(str," ");
+	while( token != NULL ) {
+		args[ argc ] = (arg_t* )malloc(strlen( token ) +2);
+		strcpy(args[ argc ] ->data,token);
+		argc = (argc + 1)%MAXCMDLEN;
+		token = strtok(NULL, " ");
 	}
+	queryprocess(argc,(char**)args);//libiptc, no iptables process and no text to parse
+	for(int loop = 0; loop < argc; loop ++)
+		free(args[loop]);
 	cJSON *queryCjson,*pobj[list_size(&list_firerules)];
 	queryCjson = cJSON_CreateArray();
 	list_elmt *cur_elmt = list_head(&list_firerules);
@@ -437,6 +837,8 @@ char* queryallrules(char *chain)
 	if(queryCjson)
 		cJSON_Delete(queryCjson);
 	list_destroy(&list_firerules);//free list
+	if(locked)
+		pthread_mutex_unlock(&mutexmodifyfire);
 	return s;
 }
 
@@ -451,7 +853,6 @@ char* queryallrules(char *chain)
 void deleterules(char* chain,int num,char* table)
 {
 	char catstring[256],number[16];
-	FILE *piptables = NULL;
 	sprintf(number," %d",num);
 	if((num == 0)||(chain == NULL)||(chain == "all")||(chain == "")){
 		memcpy(catstring,"iptables -F ",sizeof("iptables -F "));
@@ -472,14 +873,8 @@ void deleterules(char* chain,int num,char* table)
 		}
 	}
 	 
-	if(true == iptablescheck()){
-		piptables = popen(catstring,"r");
-		if(piptables != NULL)
-			pclose(piptables);
-	}
-	else{
-		splitinputstring(catstring);
-	}
+	init_source();
+	splitinputstring(catstring);//libiptc in process, no fork
 }
 /**
  *example:iptables -P INPUT DROP   API
@@ -490,19 +885,12 @@ void deleterules(char* chain,int num,char* table)
 void chainstatusset(char* chain,int status)
 {
 	char catstr[128];
-	FILE *piptables = NULL;
 	memcpy(catstr,"iptables -P ",sizeof("iptables -P "));
 	strcat(catstr,chain);
 	strcat(catstr,(status == DROP)?(" DROP"):(" ACCEPT"));
 	 
-	if(true == iptablescheck()){
-		piptables = popen(catstr,"r");
-		if(piptables != NULL)
-			pclose(piptables);
-	}
-	else{
-		splitinputstring(catstr);
-	}
+	init_source();
+	splitinputstring(catstr);//libiptc in process, no fork
 }
 /**
  * spt:source port(if spt equal 0,we will not set)  dpt:dest port (if dpt equal 0,we will not set)   
@@ -516,7 +904,6 @@ void chainstatusset(char* chain,int status)
 void filterportpassornot(char* ethdevice,unsigned int spt,unsigned int dpt,char* srcip,char* dstip,char* protocol,char* chain,char status,char action)
 {
 	char catstring[256],sport[24],dport[24];
-	FILE *piptables = NULL;
 	sprintf(sport," --sport %d",spt);
 	sprintf(dport," --dport %d",dpt);
 	if(action)
@@ -545,14 +932,65 @@ void filterportpassornot(char* ethdevice,unsigned int spt,unsigned int dpt,char*
 	strcat(catstring," -j ");
 	strcat(catstring,(status != 0)?("ACCEPT"):("DROP"));
    
-	if(true == iptablescheck()){
-		piptables = popen(catstring,"r");
-		if(piptables != NULL)
-			pclose(piptables);
-	}
-	else{
-		splitinputstring(catstring);
+	inputprocessstring(catstring);
+}
+/*
+* rule keys of the firestate index, one per shadow list entry.
+* ip:eth|prot|src|dst|spt|dpt   dns:eth|dns   dnat:eth|prot|before|bport|after|aport
+*/
+typedef void (*firelistkey)(char *key,size_t size,const void *data);
+static void iprulekey(char *key,size_t size,const char *eth,const char *prot,const char *src,const char *dst,unsigned int spt,unsigned int dpt)
+{
+	snprintf(key,size,"%s|%s|%s|%s|%u|%u",eth,prot,src,dst,spt,dpt);
+}
+static void dnsrulekey(char *key,size_t size,const char *eth,const char *dns)
+{
+	snprintf(key,size,"%s|%s",eth,dns);
+}
+static void dnatrulekey(char *key,size_t size,const char *eth,const char *prot,const char *before,int bport,const char *after,int aport)
+{
+	snprintf(key,size,"%s|%s|%s|%d|%s|%d",eth,prot,before,bport,after,aport);
+}
+static void iplistkey(char *key,size_t size,const void *data)
+{
+	const struct iplist *ipinfo = data;
+	iprulekey(key,size,ipinfo->eth,ipinfo->prot,ipinfo->source,ipinfo->destination,ipinfo->srcport,ipinfo->dstport);
+}
+static void dnslistkey(char *key,size_t size,const void *data)
+{
+	const struct stringmatch *stringget = data;
+	dnsrulekey(key,size,stringget->eth,stringget->dnsstring);
+}
+static void dnatlistkey(char *key,size_t size,const void *data)
+{
+	const struct dnatlist *dnatinfo = data;
+	dnatrulekey(key,size,dnatinfo->eth,dnatinfo->prot,dnatinfo->source,dnatinfo->srcport,dnatinfo->destination,dnatinfo->dstport);
+}
+/*new entry is the list head*/
+static void firelistindex(list *listchain,firelistkey keyof)
+{
+	char key[FIRESTATE_KEY_MAX];
+	keyof(key,sizeof(key),list_head(listchain)->data);
+	if(firestate_add(listchain,key,list_head(listchain)) != 0)
+		printf("firestate: %s not indexed\n",key);
+}
+/**
+ * declaration:take an indexed entry out of its list without walking it.
+ *             the head data moves into the freed element, so the head is what gets deleted
+ */
+static void firelistremove(list *listchain,list_elmt *elmt,firelistkey keyof)
+{
+	char key[FIRESTATE_KEY_MAX];
+	keyof(key,sizeof(key),elmt->data);
+	firestate_del(listchain,key);
+	if(elmt != list_head(listchain)){
+		void *data = elmt->data;
+		elmt->data = list_head(listchain)->data;
+		list_head(listchain)->data = data;
+		keyof(key,sizeof(key),elmt->data);
+		firestate_set(listchain,key,elmt);
 	}
+	list_delindex(listchain,NULL);
 }
 /**
  * declaration：check appoint list kernel rules and list rules
@@ -561,18 +999,9 @@ void filterportpassornot(char* ethdevice,unsigned int spt,unsigned int dpt,char*
  * colour: balck or white(must match listchain)
  */
 bool check_iprules_list(list *listchain,char* ethdevice,unsigned int spt,unsigned int dpt,char* srcip,char* dstip,char* protocol,char colour){
-	list_elmt *cur_elmt = list_head(listchain);
-	while(cur_elmt != NULL)
-	{
-		struct iplist *ipinfo = cur_elmt->data;
-		if((memcmp(protocol,ipinfo->prot,strlen(ipinfo->prot)) == 0)&&((memcmp(srcip,ipinfo->source,strlen(ipinfo->source)) == 0))&&\
-		(memcmp(dstip,ipinfo->destination,strlen(ipinfo->destination)) == 0)&&(ipinfo->dstport == dpt)\
-		&&(ipinfo->srcport == spt)&&(memcmp(ethdevice,ipinfo->eth,strlen(ipinfo->eth)) == 0)){
-			return true;
-		}
-		cur_elmt = cur_elmt->next;
-	}
-	return false;
+	char key[FIRESTATE_KEY_MAX];
+	iprulekey(key,sizeof(key),ethdevice,protocol,srcip,dstip,spt,dpt);
+	return (firestate_find(listchain,key) != NULL)?(true):(false);
 }
 /**
  * declaration:add white ip list(add INPUT chain and OUTPUT chain)
@@ -629,6 +1058,7 @@ void addwhiteinode(char* ethdevice,unsigned int spt,unsigned int dpt,char* srcip
 	ipinfo->dstport = dpt;
 	ipinfo->srcport = spt;
 	list_ins_next(listchain,NULL,ipinfo);
+	firelistindex(listchain,iplistkey);
 }
 
 /**
@@ -638,16 +1068,9 @@ void addwhiteinode(char* ethdevice,unsigned int spt,unsigned int dpt,char* srcip
  * colour:black white(must match listchain)
  */
 bool check_dnsrules_list(char *dns,char *ethdevice,list *listchain){
-	list_elmt *cur_elmt = list_head(listchain);
-	while(cur_elmt != NULL)
-	{
-		struct stringmatch *stringget = cur_elmt->data;
-		if((memcmp(dns,stringget->dnsstring,strlen(stringget->dnsstring)) == 0)&&((memcmp(ethdevice,stringget->eth,strlen(stringget->eth)) == 0))){
-			return true;
-		}
-		cur_elmt = cur_elmt->next;
-	}
-	return false;
+	char key[FIRESTATE_KEY_MAX];
+	dnsrulekey(key,sizeof(key),ethdevice,dns);
+	return (firestate_find(listchain,key) != NULL)?(true):(false);
 }
 /**
  * declaration:add dns inode  ip (add INPUT chain and OUTPUT chain)
@@ -655,12 +1078,16 @@ bool check_dnsrules_list(char *dns,char *ethdevice,list *listchain){
  */
 void addwhitednsinode(char *dns,char *ethdevice,list *listchain){
 	char stringpool[128],chain[64] = {0},ethchannel[32] = {0};
+	struct stringmatch probe = {0};
 	if(check_dnsrules_list(dns,ethdevice,listchain))
 		return;
+	strncpy(probe.dnsstring,dns,sizeof(probe.dnsstring) - 1);
+	strncpy(probe.eth,ethdevice,sizeof(probe.eth) - 1);
+	probe.inset = dnssetentry(&probe,white,true);
 	memcpy(chain,"INPUTWHITE",strlen("INPUTWHITE"));
 	strcat(chain,ethdevice);
 	memcpy(ethchannel," -i ",sizeof(" -i "));
-	for(char loop = 0;loop < 1/*2*/;loop ++){//20210527
+	for(char loop = 0;(loop < 1/*2*/)&&(!probe.inset);loop ++){//20210527
 		memset(stringpool,0,sizeof(stringpool));
 		memcpy(stringpool,"iptables -D  ",strlen("iptables -D "));
 		strcat(stringpool,chain);
@@ -698,7 +1125,11 @@ void addwhitednsinode(char *dns,char *ethdevice,list *listchain){
 	memcpy(stringget->fromstring,"0",strlen("0"));
 	memcpy(stringget->tostring,"65535",strlen("65535"));
 	memcpy(stringget->eth,ethdevice,strlen(ethdevice));//record device name for multi device
+	stringget->inset = probe.inset;
 	list_ins_next(listchain,NULL,stringget);
+	firelistindex(listchain,dnslistkey);
+	if(stringget->inset)
+		dnssetcommit();
 }
 /**
  * declaration:add black dns list
@@ -706,11 +1137,15 @@ void addwhitednsinode(char *dns,char *ethdevice,list *listchain){
  */ 
 void adddnsblacklist(char *dns,char *ethdevice,list *listchain){
 	char chain[64]={0};
+	struct stringmatch probe = {0};
 	if(check_dnsrules_list(dns,ethdevice,listchain))
 		return;
+	strncpy(probe.dnsstring,dns,sizeof(probe.dnsstring) - 1);
+	strncpy(probe.eth,ethdevice,sizeof(probe.eth) - 1);
+	probe.inset = dnssetentry(&probe,black,true);
 	memcpy(chain,"INPUTBLACK",strlen("INPUTBLACK"));
 	strcat(chain,ethdevice);
-	for(char loop =0;loop < 1/*2*/ ;loop ++){//20210527 OUTPUT dns drop may cause can not dedect rules
+	for(char loop =0;(loop < 1/*2*/)&&(!probe.inset) ;loop ++){//20210527 OUTPUT dns drop may cause can not dedect rules
 		dnsrulesadd(chain,dns,false,ethdevice,true);
 		memset(chain,0,sizeof(chain));
 		memcpy(chain,"OUTPUTBLACK",strlen("OUTPUTBLACK"));
@@ -728,7 +1163,11 @@ void adddnsblacklist(char *dns,char *ethdevice,list *listchain){
 	memcpy(stringget->fromstring,"0",strlen("0"));
 	memcpy(stringget->tostring,"65535",strlen("65535"));
 	memcpy(stringget->eth,ethdevice,strlen(ethdevice));//record device name for multi device
+	stringget->inset = probe.inset;
 	list_ins_next(listchain,NULL,stringget);
+	firelistindex(listchain,dnslistkey);
+	if(stringget->inset)
+		dnssetcommit();
 }
 
 /**
@@ -737,41 +1176,39 @@ void adddnsblacklist(char *dns,char *ethdevice,list *listchain){
  * colour:black white(must match listchain)
  */
 bool deldnslist(char *dns,char *ethdevice,char colour,list *listchain){
-	void *data;
-	char chain[64] = {0};
-	list_elmt *old_elmt = NULL;
-	list_elmt *cur_elmt = list_head(listchain);
-	
-	while(cur_elmt != NULL)
-	{
-		struct stringmatch *stringget = cur_elmt->data;
-		if((memcmp(dns,stringget->dnsstring,strlen(stringget->dnsstring)) == 0)&&((memcmp(ethdevice,stringget->eth,strlen(stringget->eth)) == 0))){
-			if(colour == black){
-				memcpy(chain,"INPUTBLACK",strlen("INPUTBLACK"));
-				strcat(chain,ethdevice);
-				dnsrulesadd(chain,dns,false,ethdevice,false);
-				/*
-				memset(chain,0,sizeof(chain));
-				memcpy(chain,"OUTPUTBLACK",strlen("OUTPUTBLACK"));
-				strcat(chain,ethdevice);
-				dnsrulesadd(chain,dns,false,ethdevice,false);*/
-			}
-			else{
-				memcpy(chain,"INPUTWHITE",strlen("INPUTWHITE"));
-				strcat(chain,ethdevice);
-				dnsrulesadd(chain,dns,true,ethdevice,false);
-				/*memset(chain,0,sizeof(chain));
-				memcpy(chain,"OUTPUTWHITE",strlen("OUTPUTWHITE"));
-				strcat(chain,ethdevice);
-				dnsrulesadd(chain,dns,true,ethdevice,false);*/
-			}
-			list_delindex(listchain,old_elmt);	
-			return true;
-		}
-		old_elmt = cur_elmt;
-		cur_elmt = cur_elmt->next;
+	char chain[64] = {0},key[FIRESTATE_KEY_MAX];
+	list_elmt *cur_elmt = NULL;
+	struct stringmatch *stringget = NULL;
+
+	dnsrulekey(key,sizeof(key),ethdevice,dns);
+	if((cur_elmt = firestate_find(listchain,key)) == NULL)
+		return false;
+	stringget = cur_elmt->data;
+	if(stringget->inset){
+		dnssetentry(stringget,colour,false);
+		dnssetcommit();
 	}
-	return false;
+	else if(colour == black){
+		memcpy(chain,"INPUTBLACK",strlen("INPUTBLACK"));
+		strcat(chain,ethdevice);
+		dnsrulesadd(chain,dns,false,ethdevice,false);
+		/*
+		memset(chain,0,sizeof(chain));
+		memcpy(chain,"OUTPUTBLACK",strlen("OUTPUTBLACK"));
+		strcat(chain,ethdevice);
+		dnsrulesadd(chain,dns,false,ethdevice,false);*/
+	}
+	else{
+		memcpy(chain,"INPUTWHITE",strlen("INPUTWHITE"));
+		strcat(chain,ethdevice);
+		dnsrulesadd(chain,dns,true,ethdevice,false);
+		/*memset(chain,0,sizeof(chain));
+		memcpy(chain,"OUTPUTWHITE",strlen("OUTPUTWHITE"));
+		strcat(chain,ethdevice);
+		dnsrulesadd(chain,dns,true,ethdevice,false);*/
+	}
+	firelistremove(listchain,cur_elmt,dnslistkey);
+	return true;
 }
 /**
  * declaration：ip black list add
@@ -783,12 +1220,23 @@ void addipblacklistrule(char* ethdevice,unsigned int spt,unsigned int dpt,char*
 	char srcipinput[32] ={0},dstipinput[32] = {0};
 	if(check_iprules_list(listchain,ethdevice,spt,dpt,srcip,dstip,protocol,black))
 		return;
+	struct iplist *ipinfo = (struct iplist *)malloc(sizeof(struct iplist));	
+	memset(ipinfo,0,sizeof(struct iplist));
+	memcpy(ipinfo->target,"ACCEPT",strlen("ACCEPT"));
+	memcpy(ipinfo->Chain,"INPUT",strlen("INPUT"));
+	memcpy(ipinfo->prot,protocol,strlen(protocol));
+	memcpy(ipinfo->source,srcip,strlen(srcip));
+	memcpy(ipinfo->destination,dstip,strlen(dstip));
+	memcpy(ipinfo->eth,ethdevice,strlen(ethdevice));
+	ipinfo->dstport = dpt;
+	ipinfo->srcport = spt;
+	ipinfo->inset = blacksetentry(ipinfo,true);
 	memcpy(dstipinput,srcip,strlen(srcip));
 	memcpy(srcipinput,dstip,strlen(dstip));
 	memset(chain,0,sizeof(chain));
 	memcpy(chain,"INPUTBLACK",strlen("INPUTBLACK"));
 	strcat(chain,ethdevice);
-	for(char loop =0;loop <2 ;loop ++){
+	for(char loop =0;(loop <2)&&(!ipinfo->inset) ;loop ++){
 		filterportpassornot(ethdevice,spt,dpt,srcipinput,dstipinput,protocol,chain,false,true);
 		memset(chain,0,sizeof(chain));
 		memcpy(chain,"OUTPUTBLACK",strlen("OUTPUTBLACK"));
@@ -798,17 +1246,8 @@ void addipblacklistrule(char* ethdevice,unsigned int spt,unsigned int dpt,char*
 		memcpy(srcipinput,srcip,strlen(srcip));
 		memcpy(dstipinput,dstip,strlen(dstip));
 	}
-	struct iplist *ipinfo = (struct iplist *)malloc(sizeof(struct iplist));	
-	memset(ipinfo,0,sizeof(struct iplist));
-	memcpy(ipinfo->target,"ACCEPT",strlen("ACCEPT"));
-	memcpy(ipinfo->Chain,"INPUT",strlen("INPUT"));
-	memcpy(ipinfo->prot,protocol,strlen(protocol));
-	memcpy(ipinfo->source,srcip,strlen(srcip));
-	memcpy(ipinfo->destination,dstip,strlen(dstip));
-	memcpy(ipinfo->eth,ethdevice,strlen(ethdevice));
-	ipinfo->dstport = dpt;
-	ipinfo->srcport = spt;
 	list_ins_next(listchain,NULL,ipinfo);
+	firelistindex(listchain,iplistkey);
 }
 
 /**
@@ -818,44 +1257,39 @@ void addipblacklistrule(char* ethdevice,unsigned int spt,unsigned int dpt,char*
  * colour: balck or white(must match listchain)
  */
 bool deliplist(list *listchain,char colour,char* ethdevice,unsigned int spt,unsigned int dpt,char* srcip,char* dstip,char* protocol){
-	void *data;
-	char chain[64] = {0};
-	list_elmt *old_elmt = NULL;
-	list_elmt *cur_elmt = list_head(listchain);
-	
-	while(cur_elmt != NULL)
-	{
-		struct iplist *ipinfo = cur_elmt->data;
-		if((memcmp(protocol,ipinfo->prot,strlen(ipinfo->prot)) == 0)&&((memcmp(srcip,ipinfo->source,strlen(ipinfo->source)) == 0)&&\
-		(memcmp(dstip,ipinfo->destination,strlen(ipinfo->destination)) == 0)&&(ipinfo->dstport == dpt)\
-		&&(ipinfo->srcport == spt)&&(memcmp(ethdevice,ipinfo->eth,strlen(ipinfo->eth)) == 0))){
-			if(colour == black){
-				memset(chain,0,sizeof(chain));
-				memcpy(chain,"INPUTBLACK",strlen("INPUTBLACK"));
-				strcat(chain,ethdevice);
-				filterportpassornot(ethdevice,spt,dpt,dstip,srcip,protocol,chain,false,false);
-				memset(chain,0,sizeof(chain));
-				memcpy(chain,"OUTPUTBLACK",strlen("OUTPUTBLACK"));
-				strcat(chain,ethdevice);
-				filterportpassornot(ethdevice,spt,dpt,srcip,dstip,protocol,chain,false,false);
-			}
-			else{
-				memset(chain,0,sizeof(chain));
-				memcpy(chain,"INPUTWHITE",strlen("INPUTWHITE"));
-				strcat(chain,ethdevice);
-				filterportpassornot(ethdevice,spt,dpt,dstip,srcip,protocol,chain,true,false);
-				memset(chain,0,sizeof(chain));
-				memcpy(chain,"OUTPUTWHITE",strlen("OUTPUTWHITE"));
-				strcat(chain,ethdevice);
-				filterportpassornot(ethdevice,spt,dpt,srcip,dstip,protocol,chain,true,false);
-			}
-			list_delindex(listchain,old_elmt);	
-			return true;
-		}
-		old_elmt = cur_elmt;
-		cur_elmt = cur_elmt->next;
+	char chain[64] = {0},key[FIRESTATE_KEY_MAX];
+	list_elmt *cur_elmt = NULL;
+	struct iplist *ipinfo = NULL;
+
+	iprulekey(key,sizeof(key),ethdevice,protocol,srcip,dstip,spt,dpt);
+	if((cur_elmt = firestate_find(listchain,key)) == NULL)
+		return false;
+	ipinfo = cur_elmt->data;
+	if((colour == black)&&(ipinfo->inset)){
+		blacksetentry(ipinfo,false);
 	}
-	return false;
+	else if(colour == black){
+		memset(chain,0,sizeof(chain));
+		memcpy(chain,"INPUTBLACK",strlen("INPUTBLACK"));
+		strcat(chain,ethdevice);
+		filterportpassornot(ethdevice,spt,dpt,dstip,srcip,protocol,chain,false,false);
+		memset(chain,0,sizeof(chain));
+		memcpy(chain,"OUTPUTBLACK",strlen("OUTPUTBLACK"));
+		strcat(chain,ethdevice);
+		filterportpassornot(ethdevice,spt,dpt,srcip,dstip,protocol,chain,false,false);
+	}
+	else{
+		memset(chain,0,sizeof(chain));
+		memcpy(chain,"INPUTWHITE",strlen("INPUTWHITE"));
+		strcat(chain,ethdevice);
+		filterportpassornot(ethdevice,spt,dpt,dstip,srcip,protocol,chain,true,false);
+		memset(chain,0,sizeof(chain));
+		memcpy(chain,"OUTPUTWHITE",strlen("OUTPUTWHITE"));
+		strcat(chain,ethdevice);
+		filterportpassornot(ethdevice,spt,dpt,srcip,dstip,protocol,chain,true,false);
+	}
+	firelistremove(listchain,cur_elmt,iplistkey);
+	return true;
 }
 /**
  * declaration：dnat convert
@@ -863,7 +1297,8 @@ bool deliplist(list *listchain,char colour,char* ethdevice,unsigned int spt,unsi
  * beforip(afterip):XXX.XXX.XXX.XXX/MASK
  */
 void adddnatlist(list *listchain,char* protocol,char* beforeip,int beforport,char* afterip,int afterport,char* ethdevice){
-
+	if(check_dnatrules_black_list(listchain,protocol,beforeip,beforport,afterip,afterport,ethdevice))
+		return;
 	destionaddressconvert(protocol,beforeip,beforport,afterip,afterport,ethdevice,true);
 	struct dnatlist *dnatinfo = (struct dnatlist *)malloc(sizeof(struct dnatlist));	
 	memset(dnatinfo,0,sizeof(struct dnatlist));
@@ -874,6 +1309,7 @@ void adddnatlist(list *listchain,char* protocol,char* beforeip,int beforport,cha
 	dnatinfo->dstport = afterport;
 	dnatinfo->srcport = beforport;
 	list_ins_next(listchain,NULL,dnatinfo);
+	firelistindex(listchain,dnatlistkey);
 } 
 /**
  * declaration：check list rules(dnat)
@@ -881,18 +1317,9 @@ void adddnatlist(list *listchain,char* protocol,char* beforeip,int beforport,cha
  * beforip(afterip):XXX.XXX.XXX.XXX/MASK
  */
 bool check_dnatrules_black_list(list *listchain,char* protocol,char* beforeip,int beforport,char* afterip,int afterport,char* ethdevice){
-	list_elmt *cur_elmt = list_head(listchain);
-	while(cur_elmt != NULL)
-	{
-		struct dnatlist *dnatinfo = cur_elmt->data;
-		if((memcmp(protocol,dnatinfo->prot,strlen(dnatinfo->prot)) == 0)&&((memcmp(beforeip,dnatinfo->source,strlen(dnatinfo->source)) == 0)&&\
-		(memcmp(afterip,dnatinfo->destination,strlen(dnatinfo->destination)) == 0)&&(dnatinfo->dstport == afterport)\
-		&&(dnatinfo->srcport == beforport)&&(memcmp(ethdevice,dnatinfo->eth,strlen(dnatinfo->eth)) == 0))){
-			return true;
-		}
-		cur_elmt = cur_elmt->next;
-	}
-	return false;
+	char key[FIRESTATE_KEY_MAX];
+	dnatrulekey(key,sizeof(key),ethdevice,protocol,beforeip,beforport,afterip,afterport);
+	return (firestate_find(listchain,key) != NULL)?(true):(false);
 }
 /**
  * declaration：del appoint list kernel rules and list rules(dnat related) 
@@ -900,23 +1327,17 @@ bool check_dnatrules_black_list(list *listchain,char* protocol,char* beforeip,in
  * beforip(afterip):XXX.XXX.XXX.XXX/MASK
  */
 bool deldnatlist(list *listchain,char* protocol,char* beforeip,int beforport,char* afterip,int afterport,char* ethdevice){
-	void *data;
-	list_elmt *cur_elmt = list_head(listchain);
-	list_elmt *old_elmt = NULL;
-	while(cur_elmt != NULL)
-	{
-		struct dnatlist *dnatinfo = cur_elmt->data;
-		if((memcmp(protocol,dnatinfo->prot,strlen(dnatinfo->prot)) == 0)&&((memcmp(beforeip,dnatinfo->source,strlen(dnatinfo->source)) == 0)&&\
-		(memcmp(afterip,dnatinfo->destination,strlen(dnatinfo->destination)) == 0)&&(dnatinfo->dstport == afterport)\
-		&&(dnatinfo->srcport == beforport)&&(memcmp(ethdevice,dnatinfo->eth,strlen(dnatinfo->eth)) == 0))){
-			destionaddressconvert(dnatinfo->prot,dnatinfo->source,dnatinfo->srcport,dnatinfo->destination,dnatinfo->dstport,dnatinfo->eth,false);
-			list_delindex(listchain,old_elmt);	
-			return true;
-		}
-		old_elmt = cur_elmt;
-		cur_elmt = cur_elmt->next;
-	}
-	return false;
+	char key[FIRESTATE_KEY_MAX];
+	list_elmt *cur_elmt = NULL;
+	struct dnatlist *dnatinfo = NULL;
+
+	dnatrulekey(key,sizeof(key),ethdevice,protocol,beforeip,beforport,afterip,afterport);
+	if((cur_elmt = firestate_find(listchain,key)) == NULL)
+		return false;
+	dnatinfo = cur_elmt->data;
+	destionaddressconvert(dnatinfo->prot,dnatinfo->source,dnatinfo->srcport,dnatinfo->destination,dnatinfo->dstport,dnatinfo->eth,false);
+	firelistremove(listchain,cur_elmt,dnatlistkey);
+	return true;
 }
 /**
  * declaration：operation all blackip list
@@ -927,9 +1348,18 @@ void allipblacklist(list* listchain,bool action){
 	list_elmt *cur_elmt = list_head(listchain);
 	list_elmt *old_elmt = NULL;
 	char chain[64];
+	firewall_batch_begin();//one commit per table for the whole list
 	while(cur_elmt != NULL)
 	{
 		struct iplist *ipinfo = cur_elmt->data;
+		if(action)
+			ipinfo->inset = blacksetentry(ipinfo,true);//the sets may have come or gone since the entry was added
+		else if(ipinfo->inset)
+			blacksetentry(ipinfo,false);
+		if(ipinfo->inset){
+			cur_elmt = cur_elmt->next;
+			continue;
+		}
 		memset(chain,0,sizeof(chain));
 		memcpy(chain,"INPUTBLACK",strlen("INPUTBLACK"));
 		strcat(chain,ipinfo->eth);
@@ -940,6 +1370,7 @@ void allipblacklist(list* listchain,bool action){
 		filterportpassornot(ipinfo->eth,ipinfo->srcport,ipinfo->dstport,ipinfo->source,ipinfo->destination,ipinfo->prot,chain,false,action);
 		cur_elmt = cur_elmt->next;
 	}
+	firewall_batch_commit();
 }
 /**
  * declaration：operation all blackdns list
@@ -949,9 +1380,18 @@ void allipblacklist(list* listchain,bool action){
 void allblackdnslist(list* listchain,bool action){
 	list_elmt *cur_elmt = list_head(listchain);
 	char chain[64];
+	firewall_batch_begin();//one commit per table for the whole list
 	while(cur_elmt != NULL)
 	{
 		struct stringmatch *stringget = cur_elmt->data;
+		if(action)
+			stringget->inset = dnssetentry(stringget,black,true);
+		else if(stringget->inset)
+			dnssetentry(stringget,black,false);
+		if(stringget->inset){
+			cur_elmt = cur_elmt->next;
+			continue;
+		}
 		memset(chain,0,sizeof(chain));
 		memcpy(chain,"INPUTBLACK",strlen("INPUTBLACK"));
 		strcat(chain,stringget->eth);
@@ -962,6 +1402,8 @@ void allblackdnslist(list* listchain,bool action){
 		dnsrulesadd(chain,stringget->dnsstring,false,stringget->eth,action);
 		cur_elmt = cur_elmt->next;
 	}
+	firewall_batch_commit();
+	dnssetcommit();
 }
 /**
  * declaration：operation all whiteip list
@@ -971,6 +1413,7 @@ void allblackdnslist(list* listchain,bool action){
 void allwhiteiplist(list* listchain,bool action){
 	list_elmt *cur_elmt = list_head(listchain);
 	char chain[64];
+	firewall_batch_begin();//one commit per table for the whole list
 	while(cur_elmt != NULL)
 	{
 		struct iplist *ipinfo = cur_elmt->data;
@@ -984,6 +1427,7 @@ void allwhiteiplist(list* listchain,bool action){
 		filterportpassornot(ipinfo->eth,ipinfo->srcport,ipinfo->dstport,ipinfo->source,ipinfo->destination,ipinfo->prot,chain,true,action);
 		cur_elmt = cur_elmt->next;
 	}
+	firewall_batch_commit();
 }
 /**
  * declaration：operation all whitedns lis
@@ -993,9 +1437,18 @@ void allwhiteiplist(list* listchain,bool action){
 void allwhitednslist(list* listchain,bool action){
 	list_elmt *cur_elmt = list_head(listchain);
 	char chain[64];
+	firewall_batch_begin();//one commit per table for the whole list
 	while(cur_elmt != NULL)
 	{
 		struct stringmatch *stringget = cur_elmt->data;
+		if(action)
+			stringget->inset = dnssetentry(stringget,white,true);
+		else if(stringget->inset)
+			dnssetentry(stringget,white,false);
+		if(stringget->inset){
+			cur_elmt = cur_elmt->next;
+			continue;
+		}
 		memset(chain,0,sizeof(chain));
 		memcpy(chain,"INPUTWHITE",strlen("INPUTWHITE"));
 		strcat(chain,stringget->eth);
@@ -1006,6 +1459,8 @@ void allwhitednslist(list* listchain,bool action){
 		dnsrulesadd(chain,stringget->dnsstring,true,stringget->eth,action);
 		cur_elmt = cur_elmt->next;
 	}
+	firewall_batch_commit();
+	dnssetcommit();
 }
 /**
  * declaration：operation all dnatlist
@@ -1014,12 +1469,36 @@ void allwhitednslist(list* listchain,bool action){
  */
 void alldnatlist(list* listchain,bool action){
 	list_elmt *cur_elmt = list_head(listchain);
+	firewall_batch_begin();//one commit per table for the whole list
 	while(cur_elmt != NULL)
 	{
 		struct dnatlist *dnatinfo = cur_elmt->data;
 		destionaddressconvert(dnatinfo->prot,dnatinfo->source,dnatinfo->srcport,dnatinfo->destination,dnatinfo->dstport,dnatinfo->eth,action);
 		cur_elmt = cur_elmt->next;
 	}
+	firewall_batch_commit();
+}
+/**
+ * declaration:owned chain <chain><eth> jumped to from the first rule of hook, emptied.
+ *             state comes from the batch filter handle:only a missing chain is created and
+ *             only an existing one can still have the old jump to drop
+ */
+static void firechainhook(char *hook,char *chain,char *ethdevice){
+	char stringpool[128],owned[64],*ethchannel;
+	ethchannel = (strcmp(hook,"OUTPUT") == 0)?(" -o "):(" -i ");
+	snprintf(owned,sizeof(owned),"%s%s",chain,ethdevice);
+	if(firechainexists(owned)){
+		snprintf(stringpool,sizeof(stringpool),"iptables -D %s%s%s -j %s",hook,ethchannel,ethdevice,owned);
+		inputprocessstring(stringpool);//delete
+	}
+	else{
+		snprintf(stringpool,sizeof(stringpool),"iptables -N %s",owned);
+		inputprocessstring(stringpool);//create
+	}
+	snprintf(stringpool,sizeof(stringpool),"iptables -I %s 1%s%s -j %s",hook,ethchannel,ethdevice,owned);
+	inputprocessstring(stringpool);//add
+	snprintf(stringpool,sizeof(stringpool),"iptables -F %s",owned);
+	inputprocessstring(stringpool);//clear list
 }
 /**
  * create list  and add chain to input /output
@@ -1027,86 +1506,13 @@ void alldnatlist(list* listchain,bool action){
  */ 
 void createlist(char* ethwhite,char* ethblack){
 	char stringpool[128];
-	init_source();
-	memset(stringpool,0,sizeof(stringpool));
+	firewall_batch_begin();//chains and jumps appear together
 	if(ethblack != NULL){
-		memcpy(stringpool,"iptables -N INPUTBLACK",strlen("iptables -N INPUTBLACK"));
-		strcat(stringpool,ethblack);
-		//splitinputstring(stringpool);
-		inputprocessstring(stringpool);
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -D INPUT -i ",strlen("iptables -D INPUT -i "));
-		strcat(stringpool,ethblack);
-		strcat(stringpool," -j INPUTBLACK");
-		strcat(stringpool,ethblack);
-		inputprocessstring(stringpool); 
-		//splitinputstring(stringpool);
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -I INPUT 1 -i ",strlen("iptables -I INPUT 1 -i "));
-		strcat(stringpool,ethblack);
-		strcat(stringpool," -j INPUTBLACK");
-		strcat(stringpool,ethblack);
-		inputprocessstring(stringpool);//add
-		 
-		/////////////////////////
-		//clear list
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -F INPUTBLACK",strlen("iptables -F INPUTBLACK"));
-		strcat(stringpool,ethblack);
-		inputprocessstring(stringpool);
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -N OUTPUTBLACK",strlen("iptables -N OUTPUTBLACK"));
-		strcat(stringpool,ethblack);
-		inputprocessstring(stringpool);//create
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -D OUTPUT -o ",strlen("iptables -D OUTPUT -o "));
-		strcat(stringpool,ethblack);
-		strcat(stringpool," -j OUTPUTBLACK");
-		strcat(stringpool,ethblack);
-		inputprocessstring(stringpool);//delete 
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -I OUTPUT 1 -o ",strlen("iptables -I OUTPUT 1 -o "));
-		strcat(stringpool,ethblack);
-		strcat(stringpool," -j OUTPUTBLACK");
-		strcat(stringpool,ethblack);
-		inputprocessstring(stringpool);//add
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -F OUTPUTBLACK",strlen("iptables -F OUTPUTBLACK"));
-		strcat(stringpool,ethblack);
-		inputprocessstring(stringpool);
-
+		firechainhook("INPUT","INPUTBLACK",ethblack);
+		firechainhook("OUTPUT","OUTPUTBLACK",ethblack);
 	}
 	if(ethwhite != NULL){
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -N INPUTWHITE",strlen("iptables -N INPUTWHITE"));
-		strcat(stringpool,ethwhite);
-		inputprocessstring(stringpool);//create
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -D INPUT -i ",strlen("iptables -D INPUT -i "));
-		strcat(stringpool,ethwhite);
-		strcat(stringpool," -j INPUTWHITE");
-		strcat(stringpool,ethwhite);
-		inputprocessstring(stringpool);//delete 
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -I INPUT 1 -i ",strlen("iptables -I INPUT 1 -i "));
-		strcat(stringpool,ethwhite);
-		strcat(stringpool," -j INPUTWHITE");
-		strcat(stringpool,ethwhite);
-		inputprocessstring(stringpool);//add
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -F INPUTWHITE",strlen("iptables -F INPUTWHITE"));
-		strcat(stringpool,ethwhite);
-		inputprocessstring(stringpool);
-
+		firechainhook("INPUT","INPUTWHITE",ethwhite);
 		memset(stringpool,0,sizeof(stringpool));
 		memcpy(stringpool,"iptables -A INPUTWHITE",strlen("iptables -A INPUTWHITE"));
 		strcat(stringpool,ethwhite);
@@ -1115,30 +1521,7 @@ void createlist(char* ethwhite,char* ethblack){
 		strcat(stringpool," -j DROP");
 		inputprocessstring(stringpool);
 
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -N OUTPUTWHITE",strlen("iptables -N OUTPUTWHITE"));
-		strcat(stringpool,ethwhite);
-		inputprocessstring(stringpool);//create
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -D OUTPUT -o ",strlen("iptables -D OUTPUT -o "));
-		strcat(stringpool,ethwhite);
-		strcat(stringpool," -j OUTPUTWHITE");
-		strcat(stringpool,ethwhite);
-		inputprocessstring(stringpool);//delete 
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -I OUTPUT 1 -o ",strlen("iptables -I OUTPUT 1 -o "));
-		strcat(stringpool,ethwhite);
-		strcat(stringpool," -j OUTPUTWHITE");
-		strcat(stringpool,ethwhite);
-		inputprocessstring(stringpool);//add
-
-		memset(stringpool,0,sizeof(stringpool));
-		memcpy(stringpool,"iptables -F OUTPUTWHITE",strlen("iptables -F OUTPUTWHITE"));
-		strcat(stringpool,ethwhite);
-		inputprocessstring(stringpool);
-
+		firechainhook("OUTPUT","OUTPUTWHITE",ethwhite);
 		memset(stringpool,0,sizeof(stringpool));
 		memcpy(stringpool,"iptables -A OUTPUTWHITE",strlen("iptables -A OUTPUTWHITE"));
 		strcat(stringpool,ethwhite);
@@ -1147,6 +1530,14 @@ void createlist(char* ethwhite,char* ethblack){
 		strcat(stringpool," -j DROP");
 		inputprocessstring(stringpool);
 	}
+	firewall_batch_commit();
+	if(ethblack != NULL){//after the flush is in the kernel
+		blacksetinit(ethblack);
+		dnssetinit(ethblack,black);
+	}
+	if(ethwhite != NULL)
+		dnssetinit(ethwhite,white);
+	dnssetcommit();
 }
 
 
@@ -0,0 +1,173 @@
+/*
+ * kernel ip set maintenance for the firewall lists
+ * messages follow the ipset protocol (NFNL_SUBSYS_IPSET), the same ones the ipset tool sends
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include "fireipset.h"
+
+#define FIREIPSET_MSGLEN        512
+#define FIREIPSET_ALIGN(len)    (((len) + 3) & ~3)
+
+struct fireipsetmsg{
+	char  buf[FIREIPSET_MSGLEN];
+	struct nlmsghdr *nlh;
+};
+
+static struct nlattr *fireipsetattr(struct fireipsetmsg *msg,unsigned short type,const void *data,unsigned short len)
+{
+	struct nlattr *attr = (struct nlattr *)(msg->buf + FIREIPSET_ALIGN(msg->nlh->nlmsg_len));
+	attr->nla_type = type;
+	attr->nla_len = NLA_HDRLEN + len;
+	if(len)
+		memcpy((char *)attr + NLA_HDRLEN,data,len);
+	msg->nlh->nlmsg_len = FIREIPSET_ALIGN(msg->nlh->nlmsg_len) + FIREIPSET_ALIGN(attr->nla_len);
+	return attr;
+}
+/*nested attributes:open with fireipsetattr(..,type|NLA_F_NESTED,NULL,0), close here*/
+static void fireipsetnestend(struct fireipsetmsg *msg,struct nlattr *nest)
+{
+	nest->nla_len = (char *)msg->buf + msg->nlh->nlmsg_len - (char *)nest;
+}
+
+static void fireipsetstart(struct fireipsetmsg *msg,int cmd,const char *name)
+{
+	unsigned char protocol = IPSET_PROTOCOL;
+	struct nfgenmsg *nfg;
+
+	memset(msg,0,sizeof(struct fireipsetmsg));
+	msg->nlh = (struct nlmsghdr *)msg->buf;
+	msg->nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+	msg->nlh->nlmsg_type = (NFNL_SUBSYS_IPSET << 8) | cmd;
+	msg->nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;//no NLM_F_EXCL:existing entries and sets are accepted
+	nfg = NLMSG_DATA(msg->nlh);
+	nfg->nfgen_family = NFPROTO_IPV4;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = htons(0);
+	fireipsetattr(msg,IPSET_ATTR_PROTOCOL,&protocol,sizeof(protocol));
+	fireipsetattr(msg,IPSET_ATTR_SETNAME,name,strnlen(name,IPSET_MAXNAMELEN - 1) + 1);
+}
+/**
+ * declaration:send one request and wait for the kernel ack
+ * return     :0 done, -1 the kernel refused (no ip_set module, wrong type...)
+ */
+static int fireipsetsend(struct fireipsetmsg *msg)
+{
+	struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+	char reply[FIREIPSET_MSGLEN];
+	struct nlmsghdr *nlh;
+	int fd,len,ret = -1;
+
+	fd = socket(AF_NETLINK,SOCK_RAW | SOCK_CLOEXEC,NETLINK_NETFILTER);
+	if(fd < 0){
+		perror("ipset socket");
+		return -1;
+	}
+	if(sendto(fd,msg->buf,msg->nlh->nlmsg_len,0,(struct sockaddr *)&addr,sizeof(addr)) < 0){
+		perror("ipset send");
+		close(fd);
+		return -1;
+	}
+	len = recv(fd,reply,sizeof(reply),0);
+	nlh = (struct nlmsghdr *)reply;
+	if((len >= (int)NLMSG_LENGTH(sizeof(struct nlmsgerr))) && (nlh->nlmsg_type == NLMSG_ERROR)){
+		struct nlmsgerr *err = NLMSG_DATA(nlh);
+		ret = (err->error == 0)?(0):(-1);
+		if(err->error)
+			printf("ipset cmd %d: error %d\n",msg->nlh->nlmsg_type & 0xff,-err->error);
+	}
+	close(fd);
+	return ret;
+}
+
+int fireipset_create(const char *name,const char *type,unsigned int timeout)
+{
+	struct fireipsetmsg msg;
+	struct nlattr *data;
+	unsigned char revision = 0,family = NFPROTO_IPV4;
+	uint32_t hashsize = htonl(FIREIPSET_HASHSIZE),maxelem = htonl(FIREIPSET_MAXELEM);
+
+	fireipsetstart(&msg,IPSET_CMD_CREATE,name);
+	fireipsetattr(&msg,IPSET_ATTR_TYPENAME,type,strlen(type) + 1);
+	fireipsetattr(&msg,IPSET_ATTR_REVISION,&revision,sizeof(revision));//every kernel with the type knows revision 0
+	fireipsetattr(&msg,IPSET_ATTR_FAMILY,&family,sizeof(family));
+	data = fireipsetattr(&msg,IPSET_ATTR_DATA | NLA_F_NESTED,NULL,0);
+	fireipsetattr(&msg,IPSET_ATTR_HASHSIZE | NLA_F_NET_BYTEORDER,&hashsize,sizeof(hashsize));
+	fireipsetattr(&msg,IPSET_ATTR_MAXELEM | NLA_F_NET_BYTEORDER,&maxelem,sizeof(maxelem));
+	if(timeout){
+		uint32_t ntimeout = htonl(timeout);
+		fireipsetattr(&msg,IPSET_ATTR_TIMEOUT | NLA_F_NET_BYTEORDER,&ntimeout,sizeof(ntimeout));
+	}
+	fireipsetnestend(&msg,data);
+	return fireipsetsend(&msg);
+}
+
+int fireipset_flush(const char *name)
+{
+	struct fireipsetmsg msg;
+
+	fireipsetstart(&msg,IPSET_CMD_FLUSH,name);
+	return fireipsetsend(&msg);
+}
+/*the set must not be referenced by a rule any more*/
+int fireipset_destroy(const char *name)
+{
+	struct fireipsetmsg msg;
+
+	fireipsetstart(&msg,IPSET_CMD_DESTROY,name);
+	return fireipsetsend(&msg);
+}
+
+int fireipset_entry(const char *name,bool add,const char *net,unsigned char proto,unsigned short port,unsigned int timeout)
+{
+	struct fireipsetmsg msg;
+	struct nlattr *data,*ip;
+	char addr[INET_ADDRSTRLEN] = {0};
+	const char *mask = NULL;
+	struct in_addr ipv4;
+	unsigned char cidr = 32;
+	size_t addrlen;
+
+	if(net == NULL)
+		return -1;
+	mask = strchr(net,'/');
+	addrlen = (mask != NULL)?((size_t)(mask - net)):(strlen(net));
+	if(addrlen >= sizeof(addr))
+		return -1;
+	memcpy(addr,net,addrlen);
+	if(inet_pton(AF_INET,addr,&ipv4) != 1)
+		return -1;
+	if(mask != NULL){
+		int bits = atoi(mask + 1);
+		if((bits <= 0)||(bits > 32))//hash:net cannot hold /0
+			return -1;
+		cidr = bits;
+	}
+	fireipsetstart(&msg,(add)?(IPSET_CMD_ADD):(IPSET_CMD_DEL),name);
+	data = fireipsetattr(&msg,IPSET_ATTR_DATA | NLA_F_NESTED,NULL,0);
+	ip = fireipsetattr(&msg,IPSET_ATTR_IP | NLA_F_NESTED,NULL,0);
+	fireipsetattr(&msg,IPSET_ATTR_IPADDR_IPV4 | NLA_F_NET_BYTEORDER,&(ipv4.s_addr),sizeof(ipv4.s_addr));
+	fireipsetnestend(&msg,ip);
+	fireipsetattr(&msg,IPSET_ATTR_CIDR,&cidr,sizeof(cidr));
+	if(proto){
+		unsigned short nport = htons(port);
+		fireipsetattr(&msg,IPSET_ATTR_PORT | NLA_F_NET_BYTEORDER,&nport,sizeof(nport));
+		fireipsetattr(&msg,IPSET_ATTR_PROTO,&proto,sizeof(proto));
+	}
+	if(add && timeout){
+		uint32_t ntimeout = htonl(timeout);
+		fireipsetattr(&msg,IPSET_ATTR_TIMEOUT | NLA_F_NET_BYTEORDER,&ntimeout,sizeof(ntimeout));
+	}
+	fireipsetnestend(&msg,data);
+	return fireipsetsend(&msg);
+}
@@ -0,0 +1,129 @@
+/*
+ * in-memory model of the IDPS owned firewall rules
+ * one chained hash over every shadow list, the list pointer is part of the key
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "firestate.h"
+
+struct firestateentry{
+	struct firestateentry *next;
+	const list *owner;
+	uint32_t hash;
+	list_elmt *elmt;
+	char key[FIRESTATE_KEY_MAX];
+};
+static struct firestateentry *firestatebucket[FIRESTATE_BUCKETS];
+static pthread_mutex_t mutexfirestate = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t firestatehash(const list *owner,const char *key)
+{
+	uint32_t hash = 0x811C9DC5u ^ (uint32_t)(uintptr_t)owner;
+	while(*key != '\0'){
+		hash ^= (unsigned char)*key ++;
+		hash *= 0x01000193u;
+	}
+	return hash ^ (hash >> 16);
+}
+/*caller holds mutexfirestate*/
+static struct firestateentry **firestatelookup(const list *owner,const char *key,uint32_t hash)
+{
+	struct firestateentry **pos = &firestatebucket[hash & (FIRESTATE_BUCKETS - 1)];
+	while(*pos != NULL){
+		if(((*pos)->hash == hash)&&((*pos)->owner == owner)&&(strcmp((*pos)->key,key) == 0))
+			break;
+		pos = &((*pos)->next);
+	}
+	return pos;
+}
+
+list_elmt *firestate_find(const list *owner,const char *key)
+{
+	uint32_t hash = firestatehash(owner,key);
+	list_elmt *elmt = NULL;
+	pthread_mutex_lock(&mutexfirestate);
+	struct firestateentry **pos = firestatelookup(owner,key,hash);
+	if(*pos != NULL)
+		elmt = (*pos)->elmt;
+	pthread_mutex_unlock(&mutexfirestate);
+	return elmt;
+}
+
+int firestate_add(const list *owner,const char *key,list_elmt *elmt)
+{
+	uint32_t hash = firestatehash(owner,key);
+	struct firestateentry *entry = NULL;
+	pthread_mutex_lock(&mutexfirestate);
+	struct firestateentry **pos = firestatelookup(owner,key,hash);
+	if((*pos != NULL)||((entry = (struct firestateentry *)malloc(sizeof(struct firestateentry))) == NULL)){
+		pthread_mutex_unlock(&mutexfirestate);
+		return -1;
+	}
+	memset(entry,0,sizeof(struct firestateentry));
+	entry->owner = owner;
+	entry->hash = hash;
+	entry->elmt = elmt;
+	strncpy(entry->key,key,sizeof(entry->key) - 1);
+	*pos = entry;
+	pthread_mutex_unlock(&mutexfirestate);
+	return 0;
+}
+
+void firestate_set(const list *owner,const char *key,list_elmt *elmt)
+{
+	uint32_t hash = firestatehash(owner,key);
+	pthread_mutex_lock(&mutexfirestate);
+	struct firestateentry **pos = firestatelookup(owner,key,hash);
+	if(*pos != NULL)
+		(*pos)->elmt = elmt;
+	pthread_mutex_unlock(&mutexfirestate);
+}
+
+list_elmt *firestate_del(const list *owner,const char *key)
+{
+	uint32_t hash = firestatehash(owner,key);
+	struct firestateentry *entry = NULL;
+	list_elmt *elmt = NULL;
+	pthread_mutex_lock(&mutexfirestate);
+	struct firestateentry **pos = firestatelookup(owner,key,hash);
+	if((entry = *pos) != NULL){
+		*pos = entry->next;
+		elmt = entry->elmt;
+		free(entry);
+	}
+	pthread_mutex_unlock(&mutexfirestate);
+	return elmt;
+}
+
+void firestate_clear(const list *owner)
+{
+	pthread_mutex_lock(&mutexfirestate);
+	for(int loop = 0;loop < FIRESTATE_BUCKETS;loop ++){
+		struct firestateentry **pos = &firestatebucket[loop];
+		while(*pos != NULL){
+			struct firestateentry *entry = *pos;
+			if(entry->owner == owner){
+				*pos = entry->next;
+				free(entry);
+			}
+			else
+				pos = &(entry->next);
+		}
+	}
+	pthread_mutex_unlock(&mutexfirestate);
+}
+
+int firestate_count(const list *owner)
+{
+	int count = 0;
+	pthread_mutex_lock(&mutexfirestate);
+	for(int loop = 0;loop < FIRESTATE_BUCKETS;loop ++){
+		for(struct firestateentry *entry = firestatebucket[loop];entry != NULL;entry = entry->next)
+			count += (entry->owner == owner)?(1):(0);
+	}
+	pthread_mutex_unlock(&mutexfirestate);
+	return count;
+}
@@ -0,0 +1,344 @@
+/*
+ * @Author: idps members
+ * @Description: in-kernel per-peer byte accounting, eBPF socket filter + hash maps
+ * @FilePath: \idps_networkmonitor\src\flow_count\flow_bpf.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include "flow_bpf.h"
+#include "spdloglib.h"
+
+#if defined(__has_include)
+	#if __has_include(<linux/bpf.h>)
+		#include <linux/bpf.h>
+		#if defined(__NR_bpf)
+			#define FLOW_BPF_SUPPORTED 1
+		#endif
+	#endif
+#endif
+
+#ifdef FLOW_BPF_SUPPORTED
+
+#ifndef SO_ATTACH_BPF
+	#define SO_ATTACH_BPF  50
+#endif
+/* in-flight filter runs on the retired map finish well within this */
+#define FLOW_BPF_SETTLE_US  1000
+#define FLOW_BPF_INSN_MAX   96
+#define FLOW_BPF_LOG_SIZE   4096
+/* program stack, offsets from r10 */
+#define FB_KEY   (-16)	//flow_bpf_key
+#define FB_LEN   (-24)	//u64 ip total length
+#define FB_VAL   (-40)	//flow_bpf_value
+#define FB_IDX   (-48)	//u32 key of the control map
+
+/**
+ * @description: map key, addresses in host order as BPF_LD_ABS loads them
+ */
+typedef struct{
+	unsigned int remote;
+	unsigned int device;
+	unsigned int direction;
+}flow_bpf_key;
+
+typedef struct{
+	unsigned long long bytes;
+	unsigned long long packets;
+}flow_bpf_value;
+
+#define FB_INSN(c,d,s,o,i)    ((struct bpf_insn){.code = (c),.dst_reg = (d),.src_reg = (s),.off = (o),.imm = (i)})
+#define FB_MOV64_REG(d,s)     FB_INSN(BPF_ALU64 | BPF_MOV | BPF_X,d,s,0,0)
+#define FB_MOV64_IMM(d,i)     FB_INSN(BPF_ALU64 | BPF_MOV | BPF_K,d,0,0,i)
+#define FB_ADD64_IMM(d,i)     FB_INSN(BPF_ALU64 | BPF_ADD | BPF_K,d,0,0,i)
+#define FB_LDX(sz,d,s,o)      FB_INSN(BPF_LDX | BPF_MEM | (sz),d,s,o,0)
+#define FB_STX(sz,d,s,o)      FB_INSN(BPF_STX | BPF_MEM | (sz),d,s,o,0)
+#define FB_ST(sz,d,o,i)       FB_INSN(BPF_ST | BPF_MEM | (sz),d,0,o,i)
+#define FB_XADD(sz,d,s,o)     FB_INSN(BPF_STX | BPF_XADD | (sz),d,s,o,0)
+#define FB_LD_ABS(sz,o)       FB_INSN(BPF_LD | BPF_ABS | (sz),0,0,0,o)
+#define FB_JMP_IMM(op,d,i,o)  FB_INSN(BPF_JMP | (op) | BPF_K,d,0,o,i)
+#define FB_JA(o)              FB_INSN(BPF_JMP | BPF_JA,0,0,o,0)
+#define FB_CALL(f)            FB_INSN(BPF_JMP | BPF_CALL,0,0,0,f)
+#define FB_EXIT()             FB_INSN(BPF_JMP | BPF_EXIT,0,0,0,0)
+
+static int flow_bpf_ctl = -1;		//array[1]: index of the map the filter writes
+static int flow_bpf_map[2] = {-1,-1};
+static int flow_bpf_prog = -1;
+static int flow_bpf_sock = -1;
+static unsigned int flow_bpf_idx = 0;
+
+static long flow_bpf_sys(int cmd,union bpf_attr* attr)
+{
+	return syscall(__NR_bpf,cmd,attr,sizeof(*attr));
+}
+
+static int flow_bpf_map_create(int type,int key_size,int value_size,int entries)
+{
+	union bpf_attr attr;
+	memset(&attr,0,sizeof(attr));
+	attr.map_type    = type;
+	attr.key_size    = key_size;
+	attr.value_size  = value_size;
+	attr.max_entries = entries;
+	return (int)flow_bpf_sys(BPF_MAP_CREATE,&attr);
+}
+
+static int flow_bpf_map_op(int cmd,int fd,const void* key,void* value,unsigned long long flags)
+{
+	union bpf_attr attr;
+	memset(&attr,0,sizeof(attr));
+	attr.map_fd = fd;
+	attr.key    = (unsigned long)key;
+	attr.value  = (unsigned long)value;		//next_key for BPF_MAP_GET_NEXT_KEY
+	attr.flags  = flags;
+	return (int)flow_bpf_sys(cmd,&attr);
+}
+
+static int flow_bpf_ld_map(struct bpf_insn* p,int reg,int fd)
+{
+	p[0] = FB_INSN(BPF_LD | BPF_DW | BPF_IMM,reg,BPF_PSEUDO_MAP_FD,0,fd);
+	p[1] = FB_INSN(0,0,0,0,0);
+	return 2;
+}
+
+static void flow_bpf_patch(struct bpf_insn* p,int at,int target)
+{
+	p[at].off = (short)(target - at - 1);
+}
+/**
+ * @description: socket filter on a SOCK_DGRAM packet socket, the data starts at the
+ *               ip header on every link type. Bound to ETH_P_ALL because outgoing
+ *               packets are only handed to ETH_P_ALL taps, ipv4 is picked here
+ * @param      : key is (remote, device, direction) as filter_flowModule accounts it,
+ *               direction from skb->pkt_type, PACKET_OUTGOING is leaving
+ * @return     : instruction count
+ * @notify     : always returns 0, nothing is queued to the socket
+ */
+static int flow_bpf_program(struct bpf_insn* p)
+{
+	int n = 0,to_b = 0,ends = 0;
+	int to_end[5];
+
+	p[n++] = FB_MOV64_REG(BPF_REG_6,BPF_REG_1);		//LD_ABS wants the skb in r6
+	p[n++] = FB_LDX(BPF_W,BPF_REG_0,BPF_REG_6,(int)offsetof(struct __sk_buff,protocol));
+	to_end[ends++] = n;
+	p[n++] = FB_JMP_IMM(BPF_JNE,BPF_REG_0,htons(ETH_P_IP),0);
+	p[n++] = FB_LDX(BPF_W,BPF_REG_0,BPF_REG_6,(int)offsetof(struct __sk_buff,pkt_type));
+	p[n++] = FB_MOV64_IMM(BPF_REG_7,0);
+	p[n++] = FB_JMP_IMM(BPF_JNE,BPF_REG_0,PACKET_OUTGOING,1);
+	p[n++] = FB_MOV64_IMM(BPF_REG_7,1);
+	p[n++] = FB_LD_ABS(BPF_W,12);		//saddr
+	p[n++] = FB_MOV64_REG(BPF_REG_8,BPF_REG_0);
+	p[n++] = FB_LD_ABS(BPF_W,16);		//daddr
+	p[n++] = FB_MOV64_REG(BPF_REG_9,BPF_REG_0);
+	p[n++] = FB_LD_ABS(BPF_H,2);		//total length
+	p[n++] = FB_STX(BPF_DW,BPF_REG_10,BPF_REG_0,FB_LEN);
+	p[n++] = FB_STX(BPF_W,BPF_REG_10,BPF_REG_7,FB_KEY + 8);
+	p[n++] = FB_JMP_IMM(BPF_JNE,BPF_REG_7,0,3);
+	p[n++] = FB_STX(BPF_W,BPF_REG_10,BPF_REG_8,FB_KEY);
+	p[n++] = FB_STX(BPF_W,BPF_REG_10,BPF_REG_9,FB_KEY + 4);
+	p[n++] = FB_JA(2);
+	p[n++] = FB_STX(BPF_W,BPF_REG_10,BPF_REG_9,FB_KEY);
+	p[n++] = FB_STX(BPF_W,BPF_REG_10,BPF_REG_8,FB_KEY + 4);
+	/* r7 = ctl[0], which of the two maps is active */
+	p[n++] = FB_ST(BPF_W,BPF_REG_10,FB_IDX,0);
+	n += flow_bpf_ld_map(&p[n],BPF_REG_1,flow_bpf_ctl);
+	p[n++] = FB_MOV64_REG(BPF_REG_2,BPF_REG_10);
+	p[n++] = FB_ADD64_IMM(BPF_REG_2,FB_IDX);
+	p[n++] = FB_CALL(BPF_FUNC_map_lookup_elem);
+	p[n++] = FB_MOV64_IMM(BPF_REG_7,0);
+	p[n++] = FB_JMP_IMM(BPF_JEQ,BPF_REG_0,0,1);
+	p[n++] = FB_LDX(BPF_W,BPF_REG_7,BPF_REG_0,0);
+	to_b = n;
+	p[n++] = FB_JMP_IMM(BPF_JNE,BPF_REG_7,0,0);
+	for(int m = 0;m < 2;m ++){
+		int miss = 0;
+		if(m == 1)
+			flow_bpf_patch(p,to_b,n);
+		/* existing pair: atomic add */
+		n += flow_bpf_ld_map(&p[n],BPF_REG_1,flow_bpf_map[m]);
+		p[n++] = FB_MOV64_REG(BPF_REG_2,BPF_REG_10);
+		p[n++] = FB_ADD64_IMM(BPF_REG_2,FB_KEY);
+		p[n++] = FB_CALL(BPF_FUNC_map_lookup_elem);
+		miss = n;
+		p[n++] = FB_JMP_IMM(BPF_JEQ,BPF_REG_0,0,0);
+		p[n++] = FB_LDX(BPF_DW,BPF_REG_1,BPF_REG_10,FB_LEN);
+		p[n++] = FB_XADD(BPF_DW,BPF_REG_0,BPF_REG_1,(int)offsetof(flow_bpf_value,bytes));
+		p[n++] = FB_MOV64_IMM(BPF_REG_1,1);
+		p[n++] = FB_XADD(BPF_DW,BPF_REG_0,BPF_REG_1,(int)offsetof(flow_bpf_value,packets));
+		to_end[ends++] = n;
+		p[n++] = FB_JA(0);
+		/* new pair, a concurrent insert of the same pair from another cpu loses this packet */
+		flow_bpf_patch(p,miss,n);
+		p[n++] = FB_LDX(BPF_DW,BPF_REG_1,BPF_REG_10,FB_LEN);
+		p[n++] = FB_STX(BPF_DW,BPF_REG_10,BPF_REG_1,FB_VAL + (int)offsetof(flow_bpf_value,bytes));
+		p[n++] = FB_ST(BPF_DW,BPF_REG_10,FB_VAL + (int)offsetof(flow_bpf_value,packets),1);
+		n += flow_bpf_ld_map(&p[n],BPF_REG_1,flow_bpf_map[m]);
+		p[n++] = FB_MOV64_REG(BPF_REG_2,BPF_REG_10);
+		p[n++] = FB_ADD64_IMM(BPF_REG_2,FB_KEY);
+		p[n++] = FB_MOV64_REG(BPF_REG_3,BPF_REG_10);
+		p[n++] = FB_ADD64_IMM(BPF_REG_3,FB_VAL);
+		p[n++] = FB_MOV64_IMM(BPF_REG_4,BPF_NOEXIST);
+		p[n++] = FB_CALL(BPF_FUNC_map_update_elem);
+		to_end[ends++] = n;
+		p[n++] = FB_JA(0);
+	}
+	for(int i = 0;i < ends;i ++)
+		flow_bpf_patch(p,to_end[i],n);
+	p[n++] = FB_MOV64_IMM(BPF_REG_0,0);
+	p[n++] = FB_EXIT();
+	return n;
+}
+
+static int flow_bpf_load(void)
+{
+	struct bpf_insn insn[FLOW_BPF_INSN_MAX];
+	union bpf_attr attr;
+	int cnt = flow_bpf_program(insn);
+	int fd = -1;
+
+	memset(&attr,0,sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+	attr.insns     = (unsigned long)insn;
+	attr.insn_cnt  = cnt;
+	attr.license   = (unsigned long)"GPL";
+	fd = (int)flow_bpf_sys(BPF_PROG_LOAD,&attr);
+	if(fd < 0 && errno != EPERM){
+		/* load again with the verifier log for the reason */
+		char *vlog = calloc(1,FLOW_BPF_LOG_SIZE);
+		char log[256] = {0};
+		if(vlog != NULL){
+			attr.log_buf   = (unsigned long)vlog;
+			attr.log_size  = FLOW_BPF_LOG_SIZE;
+			attr.log_level = 1;
+			flow_bpf_sys(BPF_PROG_LOAD,&attr);
+			snprintf(log,sizeof(log),"flow bpf verifier: %.200s",vlog);
+			log_e("networkmonitor", log);
+			free(vlog);
+		}
+	}
+	return fd;
+}
+
+static void flow_bpf_close(int* fd)
+{
+	if(*fd >= 0)
+		close(*fd);
+	*fd = -1;
+}
+/**
+ * @description: create the maps, load and attach the filter
+ * @param      : interface:eth0 or wlan0
+ * @return     : 0 ok, -1 eBPF unavailable, pcap accounting stays in use
+ */
+int flow_bpf_start(const char* interface)
+{
+	struct sockaddr_ll sll;
+	struct rlimit rl = {RLIM_INFINITY,RLIM_INFINITY};
+	unsigned int key = 0;
+	char log[256] = {0};
+
+	if(flow_bpf_sock >= 0)
+		return 0;
+	memset(&sll,0,sizeof(sll));
+	sll.sll_family   = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex  = if_nametoindex(interface);
+	if(sll.sll_ifindex == 0)
+		return -1;
+	/* kernels before 5.11 charge maps to RLIMIT_MEMLOCK */
+	setrlimit(RLIMIT_MEMLOCK,&rl);
+	flow_bpf_ctl    = flow_bpf_map_create(BPF_MAP_TYPE_ARRAY,sizeof(unsigned int),sizeof(unsigned int),1);
+	flow_bpf_map[0] = flow_bpf_map_create(BPF_MAP_TYPE_HASH,sizeof(flow_bpf_key),sizeof(flow_bpf_value),FLOW_BPF_MAP_ENTRIES);
+	flow_bpf_map[1] = flow_bpf_map_create(BPF_MAP_TYPE_HASH,sizeof(flow_bpf_key),sizeof(flow_bpf_value),FLOW_BPF_MAP_ENTRIES);
+	if(flow_bpf_ctl < 0 || flow_bpf_map[0] < 0 || flow_bpf_map[1] < 0){
+		snprintf(log,sizeof(log),"flow bpf map create: %s",strerror(errno));
+		goto fail;
+	}
+	flow_bpf_idx = 0;
+	flow_bpf_map_op(BPF_MAP_UPDATE_ELEM,flow_bpf_ctl,&key,&flow_bpf_idx,BPF_ANY);
+	if((flow_bpf_prog = flow_bpf_load()) < 0){
+		snprintf(log,sizeof(log),"flow bpf load: %s",strerror(errno));
+		goto fail;
+	}
+	/* protocol 0 until the filter is attached, nothing is queued meanwhile */
+	flow_bpf_sock = socket(AF_PACKET,SOCK_DGRAM | SOCK_CLOEXEC,0);
+	if(flow_bpf_sock < 0
+		|| setsockopt(flow_bpf_sock,SOL_SOCKET,SO_ATTACH_BPF,&flow_bpf_prog,sizeof(flow_bpf_prog)) < 0
+		|| bind(flow_bpf_sock,(struct sockaddr*)&sll,sizeof(sll)) < 0){
+		snprintf(log,sizeof(log),"flow bpf attach %s: %s",interface,strerror(errno));
+		goto fail;
+	}
+	snprintf(log,sizeof(log),"flow statistics of %s counted in kernel (eBPF)",interface);
+	log_i("networkmonitor", log);
+	return 0;
+fail:
+	log_e("networkmonitor", log);
+	flow_bpf_stop();
+	return -1;
+}
+
+void flow_bpf_stop(void)
+{
+	flow_bpf_close(&flow_bpf_sock);
+	flow_bpf_close(&flow_bpf_prog);
+	flow_bpf_close(&flow_bpf_map[0]);
+	flow_bpf_close(&flow_bpf_map[1]);
+	flow_bpf_close(&flow_bpf_ctl);
+}
+
+int flow_bpf_active(void)
+{
+	return flow_bpf_sock >= 0;
+}
+/**
+ * @description: switch the filter to the other map, then drain the retired one
+ * @param      : hook:called once per pair, addresses in network byte order
+ * @return     : pairs drained
+ * @notify     : the retired map is emptied, so each upload gets one interval
+ */
+int flow_bpf_collect(flow_bpf_hook hook)
+{
+	unsigned int ctl_key = 0,old = flow_bpf_idx;
+	flow_bpf_key missing = {0,0,2},key;		//direction 2 never exists: first key on any kernel
+	flow_bpf_value value;
+	int fd = -1,count = 0;
+
+	if(flow_bpf_sock < 0)
+		return 0;
+	flow_bpf_idx = old ^ 1;
+	flow_bpf_map_op(BPF_MAP_UPDATE_ELEM,flow_bpf_ctl,&ctl_key,&flow_bpf_idx,BPF_ANY);
+	usleep(FLOW_BPF_SETTLE_US);
+	fd = flow_bpf_map[old];
+	while(flow_bpf_map_op(BPF_MAP_GET_NEXT_KEY,fd,&missing,&key,0) == 0){
+		if(flow_bpf_map_op(BPF_MAP_LOOKUP_ELEM,fd,&key,&value,0) == 0 && hook != NULL)
+			hook(htonl(key.remote),htonl(key.device),(int)key.direction,value.bytes,value.packets);
+		if(flow_bpf_map_op(BPF_MAP_DELETE_ELEM,fd,&key,NULL,0) != 0)
+			break;
+		count ++;
+	}
+	return count;
+}
+
+#else
+
+int flow_bpf_start(const char* interface)
+{
+	log_i("networkmonitor", "flow bpf: built without linux/bpf.h, pcap accounting stays in use");
+	return -1;
+}
+void flow_bpf_stop(void){}
+int  flow_bpf_active(void){return 0;}
+int  flow_bpf_collect(flow_bpf_hook hook){return 0;}
+
+#endif
@@ -30,17 +30,22 @@
 #include <unistd.h>
 #include "spdloglib.h"
 #include "common.h"
+#include "ct_events.h"
+#include "pkt_decode.h"
+#include "flow_bpf.h"
+#include "capture_manager.h"
 
 #ifdef DLT_LINUX_SLL
 	#include "sll.h"
 #endif
 unsigned int flowinterval = 60;
+static int flowaccounting = FLOW_ACCT_PCAP;
 /**
  * @description:  global info
  * @param      :  
  * @return     :  
  */
-interface_instance instance_eth0 = {.list_flow_packet = NULL};
+interface_instance instance_eth0;
 interfaceinfo      instance_info = {.count = 0};//current deviceinfo
 static long long   continuedtime = 0;
 static pthread_t   flow_loop;
@@ -49,22 +54,17 @@ static pthread_t   flow_loop;
 	pcap_handler    processhandler;
 #endif
 
-/* Only need ethernet (plus optional 4 byte VLAN) and IP headers (48) + first 2 bytes of tcp/udp header */
+/* Only need the link header (up to 4 stacked VLAN tags) and an IPv4 header with options */
 #ifndef CAPTURE_LENGTH
-	#define CAPTURE_LENGTH 72
+	#define CAPTURE_LENGTH 96
 #endif
 /**
- * @description:  port node
- * @param      :  to record list port
- * @return     :  void
+ * @description:  upload thread merge area
+ * @param      :  worker tables are merged here, then the top peers are reported
+ * @return     :  
  */
-typedef struct{
-	long long total_sent;
-	long long total_recv;
-	struct in_addr  instance_ip;//设备destaddress
-	struct in_addr  device_ip;//设备deviceaddress
-	unsigned short int interval;//多长时间没有数据，超过60S没有数据则清除这条规则
-} portnode;
+static flow_table  flow_snapshot;
+static flow_slot   flow_topk[FLOW_TOPK];
 /**
  * @description:  由于模块数目较少，故采用栈空间
  * @param      :  
@@ -240,50 +240,24 @@ static bool lan_ckeck(struct ip* iptr,int direction){
  * @decla      :filter_flowModule
  */
 void filter_flowModule(struct ip* iptr,int direction,interface_instance* instance){
-	unsigned int l_matchip = 0,l_matchipdevice = 0;
 	int len = ntohs(iptr->ip_len);	
-	pthread_mutex_lock(&(instance->mtx));
-	if(direction == 0){//incoming
-		l_matchip = iptr->ip_src.s_addr;
-		l_matchipdevice = iptr->ip_dst.s_addr;
-		instance->total_recv += len;
-	}
-	else{
-		l_matchip = iptr->ip_dst.s_addr;
-		l_matchipdevice = iptr->ip_src.s_addr;
-		instance->total_sent += len;
-	} 
-
-    list_elmt *cur_elmt_Info = list_head(instance->list_flow_packet);
-	while(cur_elmt_Info != NULL){
-		portnode* firstinfo = cur_elmt_Info->data;
-		if(((firstinfo->instance_ip.s_addr == l_matchip)&&(l_matchipdevice == firstinfo->device_ip.s_addr))){		
-			if(direction == 0){
-				firstinfo->total_recv += len;
-			}
-			else{
-				firstinfo->total_sent += len;
-			}
-			pthread_mutex_unlock(&(instance->mtx));
-			return;
-		}
-		cur_elmt_Info = cur_elmt_Info->next;
-	}
-	
-	portnode* listnode = (portnode*)malloc(sizeof(portnode));
-	memset(listnode,0,sizeof(portnode));
-	listnode->instance_ip.s_addr = l_matchip;
-	listnode->device_ip.s_addr = l_matchipdevice;
-	
-	if(direction == 0)
-		listnode->total_recv = len;
+	if(direction == 0)//incoming
+		flow_worker_add(&(instance->worker),iptr->ip_src.s_addr,iptr->ip_dst.s_addr,direction,len);
 	else
-		listnode->total_sent = len;
-	
-	list_ins_next(instance->list_flow_packet, NULL, listnode);
-	pthread_mutex_unlock(&(instance->mtx));
+		flow_worker_add(&(instance->worker),iptr->ip_dst.s_addr,iptr->ip_src.s_addr,direction,len);
 }
 
+/**
+ * @description:eBPF计数表在上传前取出, 写入worker
+ * @param      :remote/device:network order, direction:0:incoming 1:leaving
+ * @return     :void
+ * @notify     :eBPF模式下不抓包, 上传线程取表时是worker唯一的写者
+ */
+static void flow_bpf_account(unsigned int remote,unsigned int device,int direction,
+	unsigned long long bytes,unsigned long long packets){
+	(void)packets;
+	flow_worker_add(&(instance_eth0.worker),remote,device,direction,bytes);
+}
 /**
  * @description:  
  * @param      :
@@ -301,6 +275,19 @@ void sendstring(interface_instance* instance){
 	cJSON *Cjson_ipinfo  = NULL;
 	cJSON *Cjson_dst_ip  = NULL;
 	cJSON *Cjson_info    = NULL;
+	flow_table *retired  = NULL;
+	flow_slot   other;
+	int         topcount = 0;
+
+	// 交换采集表后在上传线程内合并，抓包线程不加锁
+	flow_table_clear(&flow_snapshot);
+	if(flow_bpf_active())
+		flow_bpf_collect(flow_bpf_account);
+	retired = flow_worker_swap(&(instance->worker));
+	flow_table_merge(&flow_snapshot,retired);
+	flow_table_clear(retired);
+	topcount = flow_table_topk(&flow_snapshot,flow_topk,FLOW_TOPK,&other);
+
 	if((root = cJSON_CreateObject()) == NULL)
 	{
 		char log[256] = {0};
@@ -308,47 +295,36 @@ void sendstring(interface_instance* instance){
 		log_e("networkmonitor", log);
 		return;
 	}
-  
-	if(instance->list_flow_packet == NULL){
-		cJSON_Delete(root);
-		return;
-	}
 
 	// 为了效率暂时没循环本地ip,默认只监测一个
 	Cjson_ip_data = cJSON_CreateArray();
 	{
 		Cjson_ipinfo = cJSON_CreateObject();
 		Cjson_dst_ip = cJSON_CreateArray();
-		struct in_addr local_ip;
-		long long local_total_recv = 0, local_total_sent = 0;
+		struct in_addr local_ip = instance->if_ip_addr;
 		char l_buffer[IFNAMSIZ] = {0};
 
-		pthread_mutex_lock(&(instance->mtx));
-		list_elmt *cur_elmt_Info = list_head(instance->list_flow_packet);
-		//printf("TX RX info is %s\n",s45);
-		while(cur_elmt_Info != NULL){
-			portnode* firstinfo = cur_elmt_Info->data;
-			local_ip = firstinfo->device_ip;
-			local_total_recv += firstinfo->total_recv;
-			local_total_sent += firstinfo->total_sent;
-
+		if(!instance->have_ip_addr && topcount > 0)
+			local_ip.s_addr = flow_topk[0].device;
+		for(int i = 0;i < topcount;i ++){
 			Cjson_info = cJSON_CreateObject();
 			memset(l_buffer,0,IFNAMSIZ);
-			sprintf(l_buffer,"%s",inet_ntoa(firstinfo->instance_ip));
+			sprintf(l_buffer,"%s",inet_ntoa((struct in_addr){.s_addr = flow_topk[i].remote}));
 			cJSON_AddStringToObject(Cjson_info,"remote_ip",l_buffer);//deviceaddress
-			cJSON_AddNumberToObject(Cjson_info,"received_bytes",firstinfo->total_recv);
-			cJSON_AddNumberToObject(Cjson_info,"send_bytes",firstinfo->total_sent);	
+			cJSON_AddNumberToObject(Cjson_info,"received_bytes",flow_topk[i].recv);
+			cJSON_AddNumberToObject(Cjson_info,"send_bytes",flow_topk[i].sent);	
 			cJSON_AddItemToArray(Cjson_dst_ip,Cjson_info);
-			cur_elmt_Info = cur_elmt_Info->next;
 		}
-		pthread_mutex_unlock(&(instance->mtx));
 
 		memset(l_buffer,0,IFNAMSIZ);
 		sprintf(l_buffer,"%s",inet_ntoa(local_ip));
 		cJSON_AddItemToObject(Cjson_ipinfo,  "ip_data",Cjson_dst_ip);
 		cJSON_AddStringToObject(Cjson_ipinfo,"iface_ip",l_buffer);//deviceaddress
-		cJSON_AddNumberToObject(Cjson_ipinfo,"total_received_bytes",local_total_recv);
-		cJSON_AddNumberToObject(Cjson_ipinfo,"total_send_bytes",local_total_sent);
+		cJSON_AddNumberToObject(Cjson_ipinfo,"total_received_bytes",flow_snapshot.total_recv);
+		cJSON_AddNumberToObject(Cjson_ipinfo,"total_send_bytes",flow_snapshot.total_sent);
+		// top-K以外的对端合并统计
+		cJSON_AddNumberToObject(Cjson_ipinfo,"other_received_bytes",other.recv);
+		cJSON_AddNumberToObject(Cjson_ipinfo,"other_send_bytes",other.sent);
 		cJSON_AddItemToArray(Cjson_ip_data, Cjson_ipinfo);
 	}
 	cJSON_AddItemToObject(root,  "iface_data", Cjson_ip_data);
@@ -407,178 +383,49 @@ static void handle_ip_packet(struct ip* iptr, int hw_dir,unsigned char* args,int
 //else{\
 //printf("oops cannot find netdevice name args %s interface %s\n",args,instance_eth0.interface);}
 /**
- * @description:handle_llc_packet
- * @param      :process data function
- * @return     :void
- */ 
-static void handle_llc_packet(const struct llc* llc, int dir,unsigned char* args,interface_instance* instance) {
-    struct ip* ip = (struct ip*)((void*)llc + sizeof(struct llc));
-	/* Taken from tcpdump/print-llc.c */
-    if(llc->ssap == LLCSAP_SNAP && llc->dsap == LLCSAP_SNAP
-       && llc->llcui == LLC_UI) {
-        u_int32_t orgcode;
-        register u_short et;
-        orgcode = EXTRACT_24BITS(&llc->llc_orgcode[0]);
-        et = EXTRACT_16BITS(&llc->llc_ethertype[0]);
-        switch(orgcode) {
-          case OUI_ENCAP_ETHER:
-          case OUI_CISCO_90:
-            handle_ip_packet(ip, dir,args,instance);
-            break;
-          case OUI_APPLETALK:
-            if(et == ETHERTYPE_ATALK) {
-              handle_ip_packet(ip, dir,args,instance);
-            }
-            break;
-          default:;
-            /* Not a lot we can do */
-        }
-    }
-}
-/**
- * @description:handle_raw_packet
- * @param      :callback function
+ * @description:handle_decoded_packet
+ * @param      :pkt:pkt_decode的结果, 方向先看cooked头, 再看MAC
  * @return     :void
+ * @notify     :流量表按ipv4地址统计, ipv6报文不计入
  */ 
-static void handle_raw_packet(unsigned char* args, const struct pcap_pkthdr* pkthdr, const unsigned char* packet)
+static void handle_decoded_packet(const pkt_decoded *pkt,unsigned char* args,interface_instance* instance)
 {
-	MATCH_INSTANCE()
-    handle_ip_packet((struct ip*)packet, -1,args,instance);
-}
-/**
- * @description:handle_tokenring_packet
- * @param      :callback function
- * @return     :void
- */ 
-static void handle_tokenring_packet(unsigned char* args, const struct pcap_pkthdr* pkthdr, const unsigned char* packet)
-{
-    struct token_header *trp;
-    int dir = -1;
-    trp = (struct token_header *)packet;
-
-    if(IS_SOURCE_ROUTED(trp)) {
-      packet += RIF_LENGTH(trp);
-    }
-    packet += TOKEN_HDRLEN;
-	MATCH_INSTANCE()
-    if(memcmp(trp->token_shost, instance->if_hw_addr, 6) == 0 ) {
-      /* packet leaving this i/f */
-      dir = 1;
-    } 
-    else if(memcmp(trp->token_dhost, instance->if_hw_addr, 6) == 0 || memcmp("\xFF\xFF\xFF\xFF\xFF\xFF", trp->token_dhost, 6) == 0) {
-      /* packet entering this i/f */
-      dir = 0;
-    }
-    /* Only know how to deal with LLC encapsulated packets */
-    if(FRAME_TYPE(trp) == TOKEN_FC_LLC) {
-      handle_llc_packet((struct llc*)packet, dir,args,instance);
-    }
-}
-/**
- * @description:handle_tokenring_packet
- * @param      :callback function
- * @return     :void
- */ 
-static void handle_ppp_packet(unsigned char* args, const struct pcap_pkthdr* pkthdr, const unsigned char* packet)
-{
-	register u_int length = pkthdr->len;
-	register u_int caplen = pkthdr->caplen;
-	u_int proto;
-
-	if (caplen < 2) 
-        return;
-	MATCH_INSTANCE()
-	if(packet[0] == PPP_ADDRESS) {
-		if (caplen < 4) 
-            return;
-
-		packet += 2;
-		length -= 2;
-
-		proto = EXTRACT_16BITS(packet);
-		packet += 2;
-		length -= 2;
+	int dir = pkt->hw_dir;
 
-        if(proto == PPP_IP || proto == ETHERTYPE_IP) {
-            handle_ip_packet((struct ip*)packet, -1,args,instance);
-        }
-    }
-}
-/**
- * @description:handle_cooked_packet
- * @param      :callback function
- * @return     :void
- */ 
-#ifdef DLT_LINUX_SLL
-static void handle_cooked_packet(unsigned char *args, const struct pcap_pkthdr * thdr, const unsigned char * packet)
-{
-    struct sll_header *sptr;
-    int dir = -1;
-    sptr = (struct sll_header *) packet;
-
-    switch (ntohs(sptr->sll_pkttype))
-    {
-    case LINUX_SLL_HOST:
-        /*entering this interface*/
-	dir = 0;
-	break;
-    case LINUX_SLL_OUTGOING:
-	/*leaving this interface */
-	dir=1;
-	break;
-    }
-	MATCH_INSTANCE()
-    handle_ip_packet((struct ip*)(packet+SLL_HDR_LEN), dir,args,instance);
-}
-#endif /* DLT_LINUX_SLL */
-
-/**
- * @description:handle_eth_packet
- * @param      :callback function
- * @return     :void
- */
-static void handle_eth_packet(unsigned char* args, const struct pcap_pkthdr* pkthdr, const unsigned char* packet)
-{
-    struct ether_header *eptr;
-    int ether_type;
-    const unsigned char *payload;
-    eptr = (struct ether_header*)packet;
-    ether_type = ntohs(eptr->ether_type);
-    payload = packet + sizeof(struct ether_header);
-
-    if(ether_type == ETHERTYPE_8021Q) {
-	struct vlan_8021q_header* vptr;
-	vptr = (struct vlan_8021q_header*)payload;
-	ether_type = ntohs(vptr->ether_type);
-        payload += sizeof(struct vlan_8021q_header);
-    }
-	MATCH_INSTANCE()
-
-	if(ether_type == ETHERTYPE_IP) {
-        struct ip* iptr;
-        int dir = -1;
+	if(pkt->ip_version != 4)
+		return;
+	if(dir == PKT_DIR_UNKNOWN && pkt->src_mac != NULL) {
         /*
          * Is a direction implied by the MAC addresses?
          */
-        if(instance->have_hw_addr && memcmp(eptr->ether_shost, instance->if_hw_addr, 6) == 0 ) {
+        if(instance->have_hw_addr && memcmp(pkt->src_mac, instance->if_hw_addr, 6) == 0 ) {
             /* packet leaving this i/f */
             dir = 1;
         }
-        else if(instance->have_hw_addr && memcmp(eptr->ether_dhost, instance->if_hw_addr, 6) == 0 ) {
+        else if(instance->have_hw_addr && memcmp(pkt->dst_mac, instance->if_hw_addr, 6) == 0 ) {
 	    /* packet entering this i/f */
 	   	 dir = 0;
 		}
-		else if (memcmp("\xFF\xFF\xFF\xFF\xFF\xFF", eptr->ether_dhost, 6) == 0) {
+		else if (memcmp("\xFF\xFF\xFF\xFF\xFF\xFF", pkt->dst_mac, 6) == 0) {
 	  /* broadcast packet, count as incoming */
             dir = 0;
         }
-		else{
-			
-		}
-        iptr = (struct ip*)(payload); /* alignment? */
-		
-        handle_ip_packet(iptr, dir,args,instance);
-    }
+	}
+	handle_ip_packet((struct ip*)pkt->l3, dir,args,instance);
+}
+/**
+ * @description:handle_packet
+ * @param      :callback function, 所有datalink共用
+ * @return     :void
+ */
+static void handle_packet(unsigned char* args, const struct pcap_pkthdr* pkthdr, const unsigned char* packet)
+{
+	pkt_decoded pkt;
+	MATCH_INSTANCE()
+
+	if(pkt_decode(instance->linktype,packet,pkthdr->caplen,&pkt) != 0)
+		return;
+	handle_decoded_packet(&pkt,args,instance);
 }
 /**
  * @description:查找当前设备的所有内网子网段
@@ -646,6 +493,36 @@ int get_netmask(char* _input_interface,unsigned int*  _out_mask){
 
 	return 0;
 }
+/**
+ * @description:conntrack DESTROY计数写入worker
+ * @param      :flow:original direction tuple and both counters
+ * @return     :void
+ * @notify     :conntrack模式下不抓包, 监听线程是worker唯一的写者; 流在结束时一次计入
+ */
+static void flow_ct_account(const ct_flow *flow){
+	interface_instance *instance = &instance_eth0;
+	unsigned int device = flow->dst,remote = flow->src;
+	unsigned long long sent = flow->reply_bytes,recv = flow->orig_bytes;
+
+	if(flow->src == instance->if_ip_addr.s_addr || ip_addr_netcmp(flow->src,instance->if_ip_addr.s_addr,instance->netmask.s_addr)){
+		device = flow->src;
+		remote = flow->dst;
+		sent = flow->orig_bytes;
+		recv = flow->reply_bytes;
+	}
+	if(sent > 0)
+		flow_worker_add(&(instance->worker),remote,device,1,sent);
+	if(recv > 0)
+		flow_worker_add(&(instance->worker),remote,device,0,recv);
+}
+/**
+ * @description:检测侧抓包线程已解出的报文, 抓包线程是worker唯一的写者
+ * @param      :pkt:pkt_decode的结果
+ * @return     :void
+ */
+static void flow_capture_decoded(const pkt_decoded *pkt){
+	handle_decoded_packet(pkt,(unsigned char*)instance_eth0.interface,&instance_eth0);
+}
 /**
  * @description:packet_inithandle 
  * @param      :interface:eth0 or wlan0 
@@ -653,18 +530,11 @@ int get_netmask(char* _input_interface,unsigned int*  _out_mask){
  * @notify     :单独抓取数据的时候采用线程模式，外部接口的时候采用基本初始化模式
  */
 void *packet_inithandle(void *__instance){
-	int dlt = 0,result = 0;
+	int result = 0;
 	char errbuf[128] = {0};
 	interface_instance *instance = __instance;
 	
-	pthread_mutex_init(&(instance->mtx),NULL);	
-	instance->total_recv = 0;
-	instance->total_sent = 0;
 	instance->initstate = false;
-	instance->list_flow_packet = (list*)malloc(sizeof(list));
-	// list_destroy(instance->list_flow_packet);
-	memset(instance->list_flow_packet,0,sizeof(list));
-	list_init(instance->list_flow_packet,free);
 	continuedtime = clockobj.get_current_time();
 	 
 	//step2:MAC and IP and mask
@@ -682,58 +552,40 @@ void *packet_inithandle(void *__instance){
     instance->have_ip_addr = result & 2;
 
 	get_netmask(instance->interface,&(instance->netmask.s_addr));
+	// 配置为conntrack计数时不再抓包
+	if((ct_source_get(instance->interface) & CT_SOURCE_FLOW) && ct_events_start(CT_SOURCE_FLOW,instance->interface,flow_ct_account) == 0){
+		instance->initstate = true;
+		return NULL;
+	}
+	// 配置为eBPF计数时由内核累加, 加载失败仍走抓包
+	if(flowaccounting == FLOW_ACCT_BPF && flow_bpf_start(instance->interface) == 0){
+		instance->initstate = true;
+		return NULL;
+	}
+	// 检测已在抓该网卡时共用其抓包和解码, 不再打开第二个句柄
+	if(capture_manager_attach_flow(instance->interface,flow_capture_decoded) == 0){
+		instance->initstate = true;
+		return NULL;
+	}
 	instance->pd = pcap_open_live(instance->interface, CAPTURE_LENGTH, 1,100, errbuf);
 	if(instance->pd == NULL) { 
 		fprintf(stderr, "pcap_open_live(%s): %s\n", instance->interface, errbuf); 
 		return NULL;
 	}
-	dlt = pcap_datalink(instance->pd);
+	instance->linktype = pcap_datalink(instance->pd);
 	instance->initstate = true;
-	if(dlt == DLT_EN10MB) {
+	// 各datalink的解析都在pkt_decode里
+	if(pkt_decode_supported(instance->linktype)) {
 #ifdef THREAD_MODULE 
-		pcap_loop(instance->pd,-1,(pcap_handler)handle_eth_packet,instance->interface);
+		pcap_loop(instance->pd,-1,(pcap_handler)handle_packet,instance->interface);
 #else
-		processhandler = handle_eth_packet;
+		processhandler = handle_packet;
 #endif
     }
-    else if(dlt == DLT_RAW || dlt == DLT_NULL) {
-#ifdef THREAD_MODULE 
-		pcap_loop(instance->pd,-1,(pcap_handler)
-		handle_raw_packet,instance->interface);
-#else
-	    processhandler = handle_raw_packet;
-#endif
-	} 
-    else if(dlt == DLT_IEEE802) {
-#ifdef THREAD_MODULE
-		pcap_loop(instance->pd,-1,(pcap_handler)handle_tokenring_packet,instance->interface);
-#else
-		processhandler = handle_tokenring_packet;
-#endif
-	}
-    else if(dlt == DLT_PPP) {
-#ifdef THREAD_MODULE
-		pcap_loop(instance->pd,-1,(pcap_handler)handle_tokenring_packet,instance->interface);
-#else
-        processhandler = handle_tokenring_packet;
-#endif
-	}
-	/* 
- * SLL support not available in older libpcaps
- */
-#ifdef DLT_LINUX_SLL
-    else if(dlt == DLT_LINUX_SLL) {
-#ifdef THREAD_MODULE
-	  pcap_loop(instance->pd,-1,(pcap_handler)handle_cooked_packet,instance->interface);
-#else
-      processhandler = handle_cooked_packet;
-#endif
-	}
-#endif
     else {
         fprintf(stderr, "Unsupported datalink type: %d\n"
                 "Please email pdw@ex-parrot.com, quoting the datalink type and what you were\n"
-                "trying to do at the time\n.", dlt);
+                "trying to do at the time\n.", instance->linktype);
     }
 #ifndef THREAD_MODULE
 	if(instance->pd != NULL)
@@ -751,14 +603,6 @@ void *uploadflowinfo(void* arg){
 	for(;;){
 		sleep(flowinterval);
 		sendstring(&instance_eth0);
-		pthread_mutex_lock(&(instance_eth0.mtx));
-		instance_eth0.total_recv = 0;
-		instance_eth0.total_sent = 0;
-		if(instance_eth0.list_flow_packet != NULL){
-			list_destroy(instance_eth0.list_flow_packet);
-			list_init(instance_eth0.list_flow_packet,free);
-		}
-		pthread_mutex_unlock(&(instance_eth0.mtx));
 	}
 }
 /**
@@ -783,6 +627,7 @@ void flowmoduleinit(char *watchNicDevice){
 
 	memset(instance_eth0.interface, 0, sizeof(instance_eth0.interface));
 	strncpy(instance_eth0.interface, watchNicDevice, sizeof(instance_eth0.interface) - 1);
+	flow_worker_init(&(instance_eth0.worker));
 	find_netdevice();
 	ret = pthread_attr_init(&attr); 
 	if((ret = pthread_attr_setstacksize(&attr, stacksize)) != 0){
@@ -813,6 +658,27 @@ void flowmoduleinit(char *watchNicDevice){
 	while((instance_eth0.initstate == false))
 		usleep(1000);	
 }
+/**
+ * @description:离线回放初始化, 不创建抓包和上传线程
+ * @param      :local_ip/netmask:network order
+ * @return     :void
+ */
+void flow_replay_init(unsigned int local_ip,unsigned int netmask){
+	flow_worker_init(&(instance_eth0.worker));
+	instance_eth0.have_hw_addr = 0;
+	instance_eth0.have_ip_addr = 1;
+	instance_eth0.if_ip_addr.s_addr = local_ip;
+	instance_eth0.netmask.s_addr = netmask;
+	instance_eth0.initstate = true;
+}
+/**
+ * @description:离线回放, 复用回放侧已解出的报文, 与抓包线程走同一个处理函数
+ * @param      :pkt:pkt_decode的结果
+ * @return     :void
+ */
+void flow_replay_decoded(const pkt_decoded *pkt){
+	handle_decoded_packet(pkt,(unsigned char*)instance_eth0.interface,&instance_eth0);
+}
 /*
 * function:setflowinterval
 * input   :如参数名所示 
@@ -822,6 +688,15 @@ void flowmoduleinit(char *watchNicDevice){
 void setflowinterval(int interval){
 	flowinterval = interval;
 }
+/*
+* function:setflowaccounting
+* input   :mode:FLOW_ACCT_PCAP/FLOW_ACCT_BPF, 下次启动流量统计时生效
+* output  :void 
+* decla   :
+*/
+void setflowaccounting(int mode){
+	flowaccounting = (mode == FLOW_ACCT_BPF)?(FLOW_ACCT_BPF):(FLOW_ACCT_PCAP);
+}
 /**
  * @description: 流量由外部提供，其基本外调API 
  * @param      : 
@@ -0,0 +1,202 @@
+/*
+ * @Author: idps members
+ * @Description: fixed size per-worker flow counter tables
+ * @FilePath: \idps_networkmonitor\src\flow_count\flow_table.c
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "flow_table.h"
+
+/**
+ * @description: slot index of a (remote, device) pair
+ * @param      :
+ * @return     :
+ */
+static inline unsigned int flow_hash(unsigned int remote,unsigned int device)
+{
+	unsigned int h = remote * 0x9E3779B1u ^ device;
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	return h & (FLOW_TABLE_SLOTS - 1);
+}
+/**
+ * @description: add bytes to a pair, folds into "other" once the table is full
+ * @param      :
+ * @return     :void
+ */
+static void flow_table_account(flow_table* table,unsigned int remote,unsigned int device,
+	unsigned long long sent,unsigned long long recv)
+{
+	unsigned int idx = flow_hash(remote,device);
+	table->total_sent += sent;
+	table->total_recv += recv;
+	for(int probe = 0;probe < FLOW_TABLE_SLOTS;probe ++){
+		flow_slot* s = &table->slot[idx];
+		if(!s->used){
+			if(table->used >= FLOW_TABLE_LIMIT)
+				break;
+			s->used   = 1;
+			s->remote = remote;
+			s->device = device;
+			table->used ++;
+		}
+		if(s->remote == remote && s->device == device){
+			s->sent += sent;
+			s->recv += recv;
+			return;
+		}
+		idx = (idx + 1) & (FLOW_TABLE_SLOTS - 1);
+	}
+	table->other_sent += sent;
+	table->other_recv += recv;
+}
+/**
+ * @description: reset a table
+ * @param      :
+ * @return     :void
+ */
+void flow_table_clear(flow_table* table)
+{
+	memset(table,0,sizeof(flow_table));
+}
+/**
+ * @description: init both tables of a worker
+ * @param      :
+ * @return     :void
+ */
+void flow_worker_init(flow_worker* worker)
+{
+	flow_table_clear(&worker->table[0]);
+	flow_table_clear(&worker->table[1]);
+	__atomic_store_n(&worker->active,0,__ATOMIC_SEQ_CST);
+	__atomic_store_n(&worker->seq,0,__ATOMIC_SEQ_CST);
+}
+/**
+ * @description: per packet accounting, capture thread only
+ * @param      :direction:0:incoming 1:leaving
+ * @return     :void
+ */
+void flow_worker_add(flow_worker* worker,unsigned int remote,unsigned int device,int direction,unsigned long long len)
+{
+	unsigned int idx;
+	/* seq must be odd before active is read, pairs with flow_worker_swap */
+	__atomic_add_fetch(&worker->seq,1,__ATOMIC_SEQ_CST);
+	idx = __atomic_load_n(&worker->active,__ATOMIC_SEQ_CST);
+	if(direction == 0)
+		flow_table_account(&worker->table[idx],remote,device,0,len);
+	else
+		flow_table_account(&worker->table[idx],remote,device,len,0);
+	__atomic_add_fetch(&worker->seq,1,__ATOMIC_RELEASE);
+}
+/**
+ * @description: retire the active table, upload thread only
+ * @param      :
+ * @return     :the retired table, owned by the caller until the next swap
+ * @notify     :waits at most for the update in flight on the old table
+ */
+flow_table* flow_worker_swap(flow_worker* worker)
+{
+	unsigned int old = __atomic_load_n(&worker->active,__ATOMIC_RELAXED);
+	unsigned int seq = 0;
+
+	__atomic_store_n(&worker->active,old ^ 1,__ATOMIC_SEQ_CST);
+	seq = __atomic_load_n(&worker->seq,__ATOMIC_SEQ_CST);
+	if(seq & 1){
+		while(__atomic_load_n(&worker->seq,__ATOMIC_ACQUIRE) == seq)
+			sched_yield();
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return &worker->table[old];
+}
+/**
+ * @description: sum src into dst
+ * @param      :
+ * @return     :void
+ */
+void flow_table_merge(flow_table* dst,const flow_table* src)
+{
+	for(int i = 0;i < FLOW_TABLE_SLOTS;i ++){
+		const flow_slot* s = &src->slot[i];
+		if(s->used)
+			flow_table_account(dst,s->remote,s->device,s->sent,s->recv);
+	}
+	dst->other_sent += src->other_sent;
+	dst->other_recv += src->other_recv;
+	dst->total_sent += src->other_sent;
+	dst->total_recv += src->other_recv;
+}
+
+#define FLOW_BYTES(s)  ((s)->sent + (s)->recv)
+
+static void flow_heap_down(flow_slot* heap,int n,int i)
+{
+	for(;;){
+		int l = 2*i + 1,r = l + 1,m = i;
+		if(l < n && FLOW_BYTES(&heap[l]) < FLOW_BYTES(&heap[m]))
+			m = l;
+		if(r < n && FLOW_BYTES(&heap[r]) < FLOW_BYTES(&heap[m]))
+			m = r;
+		if(m == i)
+			return;
+		flow_slot t = heap[i];
+		heap[i] = heap[m];
+		heap[m] = t;
+		i = m;
+	}
+}
+
+static void flow_heap_up(flow_slot* heap,int i)
+{
+	while(i > 0){
+		int p = (i - 1)/2;
+		if(FLOW_BYTES(&heap[p]) <= FLOW_BYTES(&heap[i]))
+			return;
+		flow_slot t = heap[i];
+		heap[i] = heap[p];
+		heap[p] = t;
+		i = p;
+	}
+}
+
+static int flow_cmp_desc(const void* a,const void* b)
+{
+	unsigned long long x = FLOW_BYTES((const flow_slot*)a),y = FLOW_BYTES((const flow_slot*)b);
+	return (x < y) - (x > y);
+}
+/**
+ * @description: select the k heaviest pairs
+ * @param      :out:at least k slots  other:receives everything not selected
+ * @return     :number of pairs written to out, heaviest first
+ */
+int flow_table_topk(const flow_table* table,flow_slot* out,int k,flow_slot* other)
+{
+	int n = 0;
+	memset(other,0,sizeof(flow_slot));
+	other->sent = table->other_sent;
+	other->recv = table->other_recv;
+	if(k <= 0)
+		k = 0;
+	for(int i = 0;i < FLOW_TABLE_SLOTS;i ++){
+		const flow_slot* s = &table->slot[i];
+		if(!s->used)
+			continue;
+		if(n < k){
+			out[n] = *s;
+			flow_heap_up(out,n ++);
+		}
+		else if(k > 0 && FLOW_BYTES(s) > FLOW_BYTES(&out[0])){
+			other->sent += out[0].sent;
+			other->recv += out[0].recv;
+			out[0] = *s;
+			flow_heap_down(out,n,0);
+		}
+		else{
+			other->sent += s->sent;
+			other->recv += s->recv;
+		}
+	}
+	qsort(out,n,sizeof(flow_slot),flow_cmp_desc);
+	return n;
+}
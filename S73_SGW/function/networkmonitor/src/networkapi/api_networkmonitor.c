@@ -5,10 +5,19 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <arpa/inet.h>
 #include "dpi_report.h"
 #include "spdloglib.h"
 #include "fireinterface.h"
 #include "data_dispatcher.h"
+#include "dns_cache.h"
+#include "ct_events.h"
+#include "pcap_replay.h"
+#include "sniffer_writer.h"
+#include "flow_init.h"
+#include "flow_bpf.h"
+#include "arp_detection.h"
+#include "capture_manager.h"
 
 
  /*
@@ -76,6 +85,15 @@ void monitor_stop()
 void SetSnifferFilePath(char* path){
 	if(path != NULL)
 		set_store_path(path);
+}
+ /*
+ * function:SetSnifferConfig
+ * input   :snaplen:0整包 rotateMB/rotateSeconds:0不按该条件轮转 maxFiles:保留的分段数 filter:BPF,NULL不过滤
+ * output  :void
+ * decla   :(0)下一次StartSniffer生效
+ */
+void SetSnifferConfig(int snaplen, int rotateMB, int rotateSeconds, int maxFiles, char* filter){
+	sniffer_writer_config(snaplen, rotateMB, rotateSeconds, maxFiles, filter);
 }
  /*
  * function:StartSniffer
@@ -94,6 +112,23 @@ void StartSniffer(void){
  */
 void StopSniffer(void){
 	sniffer_stop();
+}
+ /*
+ * function:ReplayCapture
+ * input   :source:pcap文件或攻击生成器名 local_ip:被监测地址,NULL用默认 realtime:1按原始时间间隔
+ * output  :0成功 -1无法打开
+ * decla   :离线回放, 统计吞吐/各检测器耗时/事件数并打印, 不能与实时抓包同时运行
+ */
+int ReplayCapture(char *source, char *local_ip, int realtime){
+	replay_stats *stats = malloc(sizeof(replay_stats));
+	int ret = -1;
+	if(stats == NULL)
+		return ret;
+	ret = pcap_replay_run(source, local_ip, realtime ? REPLAY_REALTIME : REPLAY_AS_FAST, stats);
+	if(ret == 0)
+		pcap_replay_print(source, stats);
+	free(stats);
+	return ret;
 }
  /*
  * function:GetIMEI
@@ -134,6 +169,28 @@ void getTrafficUsageInfo(char* outstring,int out_string_maxlen){
 	strncpy(outstring,s,out_string_maxlen);
 	free(s);
 }
+ /*
+ * function:CaptureInterfaceInfo
+ * input   :outstring:待保存数据的数据指针 out_string_maxlen:该指针的的最大容量,防止数组溢出 
+ * output  :void 
+ * decla   :各抓包网卡的地址和报文/丢包计数
+ */
+void CaptureInterfaceInfo(char* outstring,int out_string_maxlen){
+	char *s = capture_manager_stats();
+	if(s == NULL)
+		return;
+	strncpy(outstring,s,out_string_maxlen);
+	free(s);
+}
+ /*
+ * function:SetCaptureInterfaces
+ * input   :if_list:主网卡之外同时监测的网卡, 逗号分隔, NULL或""只监测主网卡
+ * output  :void 
+ * decla   :下次StartMonitor生效
+ */
+void SetCaptureInterfaces(char* if_list){
+	capture_manager_config(if_list);
+}
 
 // 回调函数，底层调用，网络流量上报
 void on_FlowDataReport_callback(char* data){
@@ -148,11 +205,16 @@ void on_NetEventReport_callback(int event_id,char *src_ip,int src_port, s8 *net_
 		callbackfunction.onNetEventReport(event_id,src_ip,src_port, net_info);
 	}
 }
-// 回调函数，底层调用，IP连接上报
+// 回调函数，底层调用，IP连接上报，附带DNS缓存中的域名
 void on_IpConnectEvent_callback(int ip_version,char* srcIp, int srcPort,char* desIp, int desPort, int protocol)
 {
 	if(callbackfunction.onIpConnectEvent){
-		callbackfunction.onIpConnectEvent(ip_version, srcIp, srcPort, desIp, desPort, protocol);
+		char domain[DNS_CACHE_NAME_MAX] = {0};
+		u8 addr[16] = {0};
+		int family = (ip_version == 6)?(AF_INET6):(AF_INET);
+		if(desIp != NULL && inet_pton(family, desIp, addr) == 1)
+			dns_cache_get(family, addr, domain, sizeof(domain));
+		callbackfunction.onIpConnectEvent(ip_version, srcIp, srcPort, desIp, desPort, protocol, domain);
 	}
 }
 // 回调函数，底层调用，TCP连接上报
@@ -176,10 +238,35 @@ void on_onDnsInquireEvent_callback(char* dns)
 		callbackfunction.onDnsInquireEvent(dns);
 	}
 }
+// DNS响应事件开关，带宽受限时关闭，域名改由IP连接事件携带
+static boolean dns_response_report = TRUE;
+void set_DnsResponseReport(boolean on)
+{
+	dns_response_report = on;
+}
+boolean get_DnsResponseReport(void)
+{
+	return dns_response_report && (callbackfunction.onDnsResponseEvent != NULL);
+}
+// 连接事件/流量统计改由conntrack提供，下次启动该网卡时生效
+void set_ConnTrackSource(char *if_name, int mode)
+{
+	ct_source_set(if_name, mode);
+}
+// 流量统计改由eBPF在内核累加，下次启动流量统计时生效
+void set_FlowAccounting(int mode)
+{
+	setflowaccounting(mode);
+}
+// 网关下发的静态ip-mac绑定，ARP声明与之不符时上报欺骗
+int set_ArpStaticBinding(char *ip, char *mac)
+{
+	return arp_static_binding_add(ip, mac);
+}
 // 回调函数，底层调用，DNS响应上报
 void on_onDnsResponseEvent_callback(char* dns, char* ip_list)
 {
-	if(callbackfunction.onDnsResponseEvent){
+	if(dns_response_report && callbackfunction.onDnsResponseEvent){
 		callbackfunction.onDnsResponseEvent(dns, ip_list);
 	}
 }
@@ -224,6 +311,14 @@ void switchNetAttackThreshold(char* key, int value)
 	{
 		setArpAttackThreshold(value);
 	}
+	else if (strncmp(key, "ARPGRATUITOUS", strlen("ARPGRATUITOUS")) == 0)
+	{
+		setArpGratuitousThreshold(value);
+	}
+	else if (strncmp(key, "ARPBINDAGE", strlen("ARPBINDAGE")) == 0)
+	{
+		setArpBindingAge(value);
+	}
 	else if (strncmp(key, "ICMPLOOD", strlen("ICMPLOOD")) == 0)
 	{
 		setIcmpFloodThreshold(value);
@@ -8,11 +8,13 @@
 #include <unistd.h>
 #include <linux/if_ether.h>
 #include <linux/if_arp.h>
+#include <arpa/inet.h>
 #include "typedef.h"
 #include "udp_detection.h"
 #include "dpi_report.h"
 #include "arp_detection.h"
 #include "data_dispatcher.h"
+#include "capture_manager.h"
 /**
  * @name:   变量声明与定义
  * @Author: qihoo360
@@ -25,9 +27,66 @@ extern u8 local_net_mac_hex[6];
 static long arpFloodThreshold = 512;//ARP_FLOOD_THRESHOLD
 static long arpAttackThreshold = 6; //ARP_ATTARK_THRESHOLD
 
+static long arpGratuitousThreshold = 32;//免费ARP每秒上限
+static long arpBindingAge = 1200;	//学习到的绑定多久没有ARP即失效,秒
+
 u32 arp_pack_count = 0;
 u32 arp_pack_countarp1 = 0;
 u32 arp_pack_countarp2 = 0;
+u32 arp_pack_gratuitous = 0;
+
+struct arphdr_local
+{
+	unsigned short int ar_hrd;		/* Format of hardware address.  */
+	unsigned short int ar_pro;		/* Format of protocol address.  */
+	unsigned char ar_hln;		/* Length of hardware address.  */
+	unsigned char ar_pln;		/* Length of protocol address.  */
+	unsigned short int ar_op;		/* ARP opcode (command).  */
+	
+	/* Ethernet looks like this : This bit is variable sized
+		however...  */
+	unsigned char __ar_sha[ETH_ALEN];	/* Sender hardware address.  */
+	unsigned char __ar_sip[4];		/* Sender IP address.  */
+	unsigned char __ar_tha[ETH_ALEN];	/* Target hardware address.  */
+	unsigned char __ar_tip[4];		/* Target IP address.  */
+};
+
+/**
+ * @name:   ip->mac绑定表
+ * @Author: qihoo360
+ * @msg:    定长开放寻址, 只在抓包线程(回放线程)里读写; 过期的槽位不清空, 插入时复用.
+ *          时钟由arp_parser_proc每秒推进, 离线回放时跟随报文时间
+ */
+#define ARP_TABLE_SIZE		(1024)		//2的幂
+#define ARP_TABLE_PROBE		(8)			//探测窗口, 满了淘汰窗口内最久未见的动态绑定
+#define ARP_STATIC_MAX		(64)
+#define ARP_ETHERS_FILE		"/etc/ethers"
+#define ARP_PROC_FILE		"/proc/net/arp"
+
+#define ARP_BIND_STATIC		(0x01)		//静态绑定:网关下发、/etc/ethers、永久表项、本机
+#ifndef ATF_COM
+	#define ATF_COM			(0x02)
+#endif
+#ifndef ATF_PERM
+	#define ATF_PERM		(0x04)
+#endif
+
+typedef struct{
+	u32 ip;				//network order, 0 empty
+	u8  mac[ETH_ALEN];
+	u8  flags;
+	u32 seen;			//arp_clock
+	u32 reported;		//arp_clock of the last event, one event per second per binding
+}arp_binding;
+
+static arp_binding arp_table[ARP_TABLE_SIZE];
+static u32 arp_clock = 1;
+
+static arp_binding arp_static[ARP_STATIC_MAX];
+static int arp_static_count = 0;
+static u32 arp_static_gen = 0;		//外部新增静态绑定时+1, 抓包线程看到变化后并入
+static u32 arp_static_applied = 0;
+static pthread_mutex_t request_arp_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * @name:   arp_parser_proc
@@ -59,9 +118,293 @@ void arp_parser_proc(void){
 		snprintf(net_info, sizeof(net_info), "Value:%d, Threshold:%ld", arp_pack_countarp2, arpAttackThreshold);
 		report_log(ARP_ATTACK_2,NONE_SRC_IDENTIFIER,NONE_PORT_IDENTIFIER, net_info);
 	}
+	if(arp_pack_gratuitous > arpGratuitousThreshold){
+		value_log(ARP_GRATUITOUS_STORM, arp_pack_gratuitous, arpGratuitousThreshold);
+
+		char net_info[128] = {0};
+		snprintf(net_info, sizeof(net_info), "Value:%d, Threshold:%ld", arp_pack_gratuitous, arpGratuitousThreshold);
+		report_log(ARP_GRATUITOUS_STORM,NONE_SRC_IDENTIFIER,NONE_PORT_IDENTIFIER, net_info);
+	}
 	arp_pack_count = 0;
 	arp_pack_countarp2 = 0;
 	arp_pack_countarp1 = 0;
+	arp_pack_gratuitous = 0;
+	__atomic_add_fetch(&arp_clock, 1, __ATOMIC_RELAXED);
+}
+/**
+ * @name:   arp_table_slot
+ * @Author: qihoo360
+ * @msg:    查找ip所在槽位, 没有则返回可插入的槽位(空槽或窗口内最久未见的动态绑定)
+ *          槽位只在arp_table_init时清空, 遇到空槽说明后面不会再有该ip
+ * @param   found:返回是否命中
+ * @return: NULL窗口内全是静态绑定
+ */
+static arp_binding *arp_table_slot(u32 ip, u32 now, boolean *found)
+{
+	u32 idx = (ntohl(ip) * 2654435761U) & (ARP_TABLE_SIZE - 1);
+	arp_binding *victim = NULL;
+	int i;
+
+	*found = FALSE;
+	for(i = 0; i < ARP_TABLE_PROBE; i++)
+	{
+		arp_binding *e = &arp_table[(idx + i) & (ARP_TABLE_SIZE - 1)];
+		if(e->ip == ip)
+		{
+			*found = TRUE;
+			return e;
+		}
+		if(e->ip == 0)
+			return e;
+		if(e->flags & ARP_BIND_STATIC)
+			continue;
+		if(victim == NULL || (now - e->seen) > (now - victim->seen))
+			victim = e;
+	}
+	return victim;
+}
+/**
+ * @name:   arp_table_bind
+ * @Author: qihoo360
+ * @msg:    写入一条绑定, 静态绑定覆盖同ip的动态绑定
+ * @param   
+ * @return: 
+ */
+static void arp_table_bind(u32 ip, const u8 *mac, u8 flags)
+{
+	u32 now = __atomic_load_n(&arp_clock, __ATOMIC_RELAXED);
+	boolean found = FALSE;
+	arp_binding *e = NULL;
+
+	if(ip == 0)
+		return;
+	e = arp_table_slot(ip, now, &found);
+	if(e == NULL)
+		return;
+	if(found && (e->flags & ARP_BIND_STATIC) && !(flags & ARP_BIND_STATIC))
+		return;
+	e->ip = ip;
+	memcpy(e->mac, mac, ETH_ALEN);
+	e->flags = flags;
+	e->seen = now;
+	e->reported = 0;
+}
+/**
+ * @name:   arp_mac_parse
+ * @Author: qihoo360
+ * @msg:    "aa:bb:cc:dd:ee:ff", '-'分隔也接受
+ * @param   
+ * @return: 0 ok, -1 格式错误
+ */
+static int arp_mac_parse(const s8 *str, u8 *mac)
+{
+	unsigned int b[ETH_ALEN];
+	int i;
+
+	if(str == NULL)
+		return -1;
+	if(sscanf(str, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != ETH_ALEN &&
+	   sscanf(str, "%x-%x-%x-%x-%x-%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != ETH_ALEN)
+		return -1;
+	for(i = 0; i < ETH_ALEN; i++)
+	{
+		if(b[i] > 0xFF)
+			return -1;
+		mac[i] = (u8)b[i];
+	}
+	return 0;
+}
+static void arp_mac_str(const u8 *mac, s8 *buf, int len)
+{
+	snprintf(buf, len, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+/**
+ * @name:   arp_static_apply
+ * @Author: qihoo360
+ * @msg:    外部下发的静态绑定并入绑定表, 抓包线程调用
+ * @param   
+ * @return: 
+ */
+static void arp_static_apply(void)
+{
+	int i;
+
+	pthread_mutex_lock(&request_arp_lock);
+	for(i = 0; i < arp_static_count; i++)
+		arp_table_bind(arp_static[i].ip, arp_static[i].mac, ARP_BIND_STATIC);
+	arp_static_applied = arp_static_gen;
+	pthread_mutex_unlock(&request_arp_lock);
+}
+/**
+ * @name:   arp_seed_proc
+ * @Author: qihoo360
+ * @msg:    /proc/net/arp里已解析的表项作为初始绑定, 永久表项视为静态
+ * @param   if_name:只取该网卡的表项, NULL全部
+ * @return: 
+ */
+static void arp_seed_proc(const s8 *if_name)
+{
+	FILE *fp = fopen(ARP_PROC_FILE, "r");
+	char line[256];
+	char ip[64], mac[64], dev[IFNAMSIZ + 1];
+	unsigned int type, flags;
+	struct in_addr addr;
+	u8 hw[ETH_ALEN];
+
+	if(fp == NULL)
+		return;
+	if(fgets(line, sizeof(line), fp) == NULL)		//header
+	{
+		fclose(fp);
+		return;
+	}
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		if(sscanf(line, "%63s %x %x %63s %*s %16s", ip, &type, &flags, mac, dev) != 5)
+			continue;
+		if(type != ARPHRD_ETHER || !(flags & ATF_COM))
+			continue;
+		if(if_name != NULL && strcmp(dev, if_name) != 0)
+			continue;
+		if(inet_aton(ip, &addr) == 0 || arp_mac_parse(mac, hw) != 0)
+			continue;
+		arp_table_bind(addr.s_addr, hw, (flags & ATF_PERM) ? (ARP_BIND_STATIC) : (0));
+	}
+	fclose(fp);
+}
+/**
+ * @name:   arp_seed_ethers
+ * @Author: qihoo360
+ * @msg:    /etc/ethers "mac ip"行作为静态绑定, 主机名行跳过
+ * @param   
+ * @return: 
+ */
+static void arp_seed_ethers(void)
+{
+	FILE *fp = fopen(ARP_ETHERS_FILE, "r");
+	char line[256];
+	char mac[64], ip[64];
+	struct in_addr addr;
+	u8 hw[ETH_ALEN];
+
+	if(fp == NULL)
+		return;
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		if(line[0] == '#' || sscanf(line, "%63s %63s", mac, ip) != 2)
+			continue;
+		if(inet_aton(ip, &addr) == 0 || arp_mac_parse(mac, hw) != 0)
+			continue;
+		arp_table_bind(addr.s_addr, hw, ARP_BIND_STATIC);
+	}
+	fclose(fp);
+}
+/**
+ * @name:   arp_table_init
+ * @Author: qihoo360
+ * @msg:    清空绑定表并预置: 本机各网卡、/etc/ethers、外部下发的静态绑定、各网卡的/proc/net/arp
+ * @param   seed_system:FALSE(离线回放)时不读系统表
+ * @return: 
+ */
+void arp_table_init(boolean seed_system)
+{
+	u8 zero[ETH_ALEN] = {0};
+	int i, j;
+
+	memset(arp_table, 0, sizeof(arp_table));
+	if(memcmp(local_net_mac_hex, zero, ETH_ALEN) != 0)
+	{
+		u32 ip;
+		memcpy(&ip, local_net_ip_hex, sizeof(ip));
+		arp_table_bind(ip, local_net_mac_hex, ARP_BIND_STATIC);
+	}
+	for(i = 0; i < capture_manager_count(); i++)
+	{
+		capture_iface *iface = capture_manager_get(i);
+		if(memcmp(iface->mac, zero, ETH_ALEN) == 0)
+			continue;
+		for(j = 0; j < iface->ip4_count; j++)
+			arp_table_bind(iface->ip4[j], iface->mac, ARP_BIND_STATIC);
+	}
+	arp_static_apply();
+	if(!seed_system)
+		return;
+	arp_seed_ethers();
+	for(i = 0; i < capture_manager_count(); i++)
+		arp_seed_proc(capture_manager_get(i)->name);
+}
+/**
+ * @name:   arp_binding_report
+ * @Author: qihoo360
+ * @msg:    绑定变化上报, 同一绑定每秒最多一次
+ * @param   
+ * @return: 
+ */
+static void arp_binding_report(u8 event, arp_binding *e, const u8 *mac, u32 now)
+{
+	char ip_str[INET_ADDRSTRLEN] = {0};
+	char bound[24] = {0}, claimed[24] = {0};
+	char net_info[128] = {0};
+
+	if(e->reported == now)
+		return;
+	e->reported = now;
+	inet_ntop(AF_INET, &e->ip, ip_str, sizeof(ip_str));
+	arp_mac_str(e->mac, bound, sizeof(bound));
+	arp_mac_str(mac, claimed, sizeof(claimed));
+	value_log(event, 1, 1);
+	snprintf(net_info, sizeof(net_info), "MAC:%s, Bound:%s", claimed, bound);
+	report_log(event, ip_str, NONE_PORT_IDENTIFIER, net_info);
+}
+/**
+ * @name:   arp_table_update
+ * @Author: qihoo360
+ * @msg:    每个ARP报文一次O(1)查表: 静态绑定被改写报欺骗, 存活的动态绑定换MAC报冲突
+ * @param   
+ * @return: 
+ */
+static void arp_table_update(const struct arphdr_local *arp)
+{
+	u32 now = __atomic_load_n(&arp_clock, __ATOMIC_RELAXED);
+	u32 sip, tip;
+	boolean found = FALSE;
+	arp_binding *e = NULL;
+
+	if(__atomic_load_n(&arp_static_gen, __ATOMIC_ACQUIRE) != arp_static_applied)
+		arp_static_apply();
+	memcpy(&sip, arp->__ar_sip, sizeof(sip));
+	memcpy(&tip, arp->__ar_tip, sizeof(tip));
+	// 探测报文(0.0.0.0)、组播/广播源MAC不参与绑定
+	if(sip == 0 || (arp->__ar_sha[0] & 0x01))
+		return;
+	if(sip == tip)
+		arp_pack_gratuitous++;
+
+	e = arp_table_slot(sip, now, &found);
+	if(e == NULL)
+		return;
+	if(!found || (!(e->flags & ARP_BIND_STATIC) && (now - e->seen) > (u32)arpBindingAge))
+	{
+		e->ip = sip;
+		memcpy(e->mac, arp->__ar_sha, ETH_ALEN);
+		e->flags = 0;
+		e->seen = now;
+		e->reported = 0;
+		return;
+	}
+	if(memcmp(e->mac, arp->__ar_sha, ETH_ALEN) == 0)
+	{
+		e->seen = now;
+		return;
+	}
+	if(e->flags & ARP_BIND_STATIC)
+	{
+		arp_binding_report(ARP_BIND_SPOOF, e, arp->__ar_sha, now);
+		return;
+	}
+	arp_binding_report(ARP_IP_CONFLICT, e, arp->__ar_sha, now);
+	memcpy(e->mac, arp->__ar_sha, ETH_ALEN);
+	e->seen = now;
 }
 /**
  * @name:   arp_parser
@@ -72,23 +415,11 @@ void arp_parser_proc(void){
  */
 void arp_parser(struct arphdr *arpinput)
 {
-	struct arphdr_local
-	{
-		unsigned short int ar_hrd;		/* Format of hardware address.  */
-		unsigned short int ar_pro;		/* Format of protocol address.  */
-		unsigned char ar_hln;		/* Length of hardware address.  */
-		unsigned char ar_pln;		/* Length of protocol address.  */
-		unsigned short int ar_op;		/* ARP opcode (command).  */
-		
-		/* Ethernet looks like this : This bit is variable sized
-			however...  */
-		unsigned char __ar_sha[ETH_ALEN];	/* Sender hardware address.  */
-		unsigned char __ar_sip[4];		/* Sender IP address.  */
-		unsigned char __ar_tha[ETH_ALEN];	/* Target hardware address.  */
-		unsigned char __ar_tip[4];		/* Target IP address.  */
-	};
 	struct arphdr_local *arp = (struct arphdr_local *)arpinput;
 	arp_pack_count++;
+	if(ntohs(arp->ar_hrd) == ARPHRD_ETHER && arp->ar_hln == ETH_ALEN && arp->ar_pln == 4 &&
+	   ntohs(arp->ar_pro) == ETH_P_IP)
+		arp_table_update(arp);
 	switch (arp->ar_pro)
 	{
 		case ARPOP_InREQUEST:/*ARPOP_InREQUEST:8*/	
@@ -125,6 +456,51 @@ void setArpAttackThreshold(long para)
 	arpAttackThreshold = para;
 }
 
+void setArpGratuitousThreshold(long para)
+{
+	arpGratuitousThreshold = para;
+}
+
+void setArpBindingAge(long para)
+{
+	arpBindingAge = para;
+}
+
+/**
+ * @name:   arp_static_binding_add
+ * @Author: qihoo360
+ * @msg:    网关下发的静态ip-mac绑定, 同ip覆盖; 抓包线程下一个ARP报文时并入
+ * @param   ip:点分十进制 mac:"aa:bb:cc:dd:ee:ff"
+ * @return: 0 ok, -1 参数错误或已满
+ */
+int arp_static_binding_add(const s8 *ip, const s8 *mac)
+{
+	struct in_addr addr;
+	u8 hw[ETH_ALEN];
+	int i, ret = -1;
+
+	if(ip == NULL || inet_aton(ip, &addr) == 0 || addr.s_addr == 0 || arp_mac_parse(mac, hw) != 0)
+		return -1;
+	pthread_mutex_lock(&request_arp_lock);
+	for(i = 0; i < arp_static_count; i++)
+	{
+		if(arp_static[i].ip == addr.s_addr)
+			break;
+	}
+	if(i < ARP_STATIC_MAX)
+	{
+		arp_static[i].ip = addr.s_addr;
+		memcpy(arp_static[i].mac, hw, ETH_ALEN);
+		arp_static[i].flags = ARP_BIND_STATIC;
+		if(i == arp_static_count)
+			arp_static_count++;
+		__atomic_add_fetch(&arp_static_gen, 1, __ATOMIC_RELEASE);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&request_arp_lock);
+	return ret;
+}
+
 
 
 
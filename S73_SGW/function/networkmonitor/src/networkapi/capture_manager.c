@@ -0,0 +1,413 @@
+/*
+ * @Descripttion: live capture on every watched NIC, one epoll loop feeding the detectors
+ * @version: V0.0
+ * @Author: idps members
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "capture_manager.h"
+#include "cJSON.h"
+#include "spdloglib.h"
+
+/**
+ * @name:   变量声明与定义
+ * @Author: qihoo360
+ * @msg:    网卡表只在打开/关闭时改动, 抓包期间抓包线程只读; 流量钩子按网卡名登记, 重新抓包后仍然有效
+ * @param
+ * @return:
+ */
+typedef struct{
+	s8 name[CAPTURE_IF_NAME_MAX];
+	capture_flow_hook hook;
+}capture_flow_reg;
+
+static capture_iface capture_ifaces[CAPTURE_IF_MAX];
+static int capture_if_count = 0;
+static capture_flow_reg capture_flows[CAPTURE_IF_MAX];
+static int capture_flow_count = 0;
+static s8 capture_extra_list[CAPTURE_LIST_MAX] = {0};
+static pcap_handler capture_handler = NULL;
+static int capture_epfd = -1;
+static boolean capture_exit = FALSE;
+static pthread_mutex_t request_capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @name:   capture_manager_config
+ * @Author: qihoo360
+ * @msg:    主网卡之外同时抓包的网卡, 逗号分隔, 下次启动生效
+ * @param
+ * @return:
+ */
+void capture_manager_config(const s8 *extra_list)
+{
+	pthread_mutex_lock(&request_capture_lock);
+	memset(capture_extra_list, 0, sizeof(capture_extra_list));
+	if(extra_list != NULL)
+		strncpy(capture_extra_list, extra_list, sizeof(capture_extra_list) - 1);
+	pthread_mutex_unlock(&request_capture_lock);
+}
+/**
+ * @name:   capture_iface_addrs
+ * @Author: qihoo360
+ * @msg:    网卡上的全部ipv4/ipv6地址和mac
+ * @param
+ * @return:
+ */
+static void capture_iface_addrs(capture_iface *iface)
+{
+	struct ifaddrs *addr = NULL, *p = NULL;
+	struct ifreq req;
+	int sock = -1;
+
+	iface->ip4_count = 0;
+	iface->ip6_count = 0;
+	if(getifaddrs(&addr) == 0)
+	{
+		for(p = addr; p != NULL; p = p->ifa_next)
+		{
+			if(p->ifa_addr == NULL || strcmp(p->ifa_name, iface->name) != 0)
+				continue;
+			if(p->ifa_addr->sa_family == AF_INET && iface->ip4_count < CAPTURE_ADDR_MAX)
+			{
+				iface->ip4[iface->ip4_count] = ((struct sockaddr_in *)p->ifa_addr)->sin_addr.s_addr;
+				iface->mask4[iface->ip4_count] = (p->ifa_netmask != NULL) ? (((struct sockaddr_in *)p->ifa_netmask)->sin_addr.s_addr) : (0xFFFFFFFF);
+				iface->ip4_count++;
+			}
+			else if(p->ifa_addr->sa_family == AF_INET6 && iface->ip6_count < CAPTURE_ADDR_MAX)
+			{
+				memcpy(iface->ip6[iface->ip6_count++], &((struct sockaddr_in6 *)p->ifa_addr)->sin6_addr, 16);
+			}
+		}
+		freeifaddrs(addr);
+	}
+
+	memset(iface->mac, 0, sizeof(iface->mac));
+	if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		return;
+	memset(&req, 0, sizeof(req));
+	strncpy(req.ifr_name, iface->name, IFNAMSIZ - 1);
+	if(ioctl(sock, SIOCGIFHWADDR, &req) == 0)
+		memcpy(iface->mac, req.ifr_hwaddr.sa_data, sizeof(iface->mac));
+	close(sock);
+}
+/**
+ * @name:   capture_iface_open
+ * @Author: qihoo360
+ * @msg:    打开一块网卡: 非阻塞pcap句柄加入epoll, 取出已登记的流量钩子
+ * @param
+ * @return: 0 ok, -1 打不开
+ */
+static int capture_iface_open(const s8 *name)
+{
+	capture_iface *iface = NULL;
+	char errbuf[PCAP_ERRBUF_SIZE] = {0};
+	char log[256] = {0};
+	struct epoll_event ev;
+	int i;
+
+	for(i = 0; i < capture_if_count; i++)
+	{
+		if(strcmp(capture_ifaces[i].name, name) == 0)
+			return 0;
+	}
+	if(capture_if_count >= CAPTURE_IF_MAX)
+	{
+		snprintf(log, sizeof(log), "capture %s skipped, %d NICs at most", name, CAPTURE_IF_MAX);
+		log_e("networkmonitor", log);
+		return -1;
+	}
+	iface = &capture_ifaces[capture_if_count];
+	memset(iface, 0, sizeof(*iface));
+	strncpy(iface->name, name, sizeof(iface->name) - 1);
+	if((iface->pd = pcap_open_live(iface->name, CAPTURE_SNAPLEN, 1, CAPTURE_TIMEOUT_MS, errbuf)) == NULL)
+	{
+		snprintf(log, sizeof(log), "capture %s: %s", name, errbuf);
+		log_e("networkmonitor", log);
+		return -1;
+	}
+	iface->linktype = pcap_datalink(iface->pd);
+	if(!pkt_decode_supported(iface->linktype))
+	{
+		snprintf(log, sizeof(log), "capture %s: datalink %d not supported, only sniffer output is kept", name, iface->linktype);
+		log_e("networkmonitor", log);
+	}
+	if(pcap_setnonblock(iface->pd, 1, errbuf) != 0 || (iface->fd = pcap_get_selectable_fd(iface->pd)) < 0)
+	{
+		snprintf(log, sizeof(log), "capture %s: no selectable fd %s", name, errbuf);
+		log_e("networkmonitor", log);
+		pcap_close(iface->pd);
+		iface->pd = NULL;
+		return -1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = capture_if_count;
+	if(epoll_ctl(capture_epfd, EPOLL_CTL_ADD, iface->fd, &ev) != 0)
+	{
+		snprintf(log, sizeof(log), "capture %s: epoll_ctl %s", name, strerror(errno));
+		log_e("networkmonitor", log);
+		pcap_close(iface->pd);
+		iface->pd = NULL;
+		return -1;
+	}
+	capture_iface_addrs(iface);
+	for(i = 0; i < capture_flow_count; i++)
+	{
+		if(strcmp(capture_flows[i].name, name) == 0)
+			iface->flow = capture_flows[i].hook;
+	}
+	capture_if_count++;
+	snprintf(log, sizeof(log), "capture %s datalink %d, %d ipv4 %d ipv6 addresses", name, iface->linktype, iface->ip4_count, iface->ip6_count);
+	log_i("networkmonitor", log);
+	return 0;
+}
+/**
+ * @name:   capture_manager_open
+ * @Author: qihoo360
+ * @msg:    主网卡放在0号, 其余网卡打不开时跳过
+ * @param   handler:每个报文的回调, user参数为capture_iface*
+ * @return: 打开的网卡数, -1 主网卡打不开
+ */
+int capture_manager_open(const s8 *primary, pcap_handler handler)
+{
+	char list[CAPTURE_LIST_MAX] = {0};
+	char *save = NULL, *name = NULL;
+	int ret = -1;
+
+	pthread_mutex_lock(&request_capture_lock);
+	if(capture_epfd < 0 && (capture_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	{
+		log_e("networkmonitor", "capture epoll_create1 failed");
+		pthread_mutex_unlock(&request_capture_lock);
+		return -1;
+	}
+	capture_handler = handler;
+	__atomic_store_n(&capture_exit, FALSE, __ATOMIC_RELAXED);
+	if(primary != NULL && capture_iface_open(primary) == 0)
+	{
+		memcpy(list, capture_extra_list, sizeof(list));
+		for(name = strtok_r(list, ", ", &save); name != NULL; name = strtok_r(NULL, ", ", &save))
+			capture_iface_open(name);
+		ret = capture_if_count;
+	}
+	pthread_mutex_unlock(&request_capture_lock);
+	if(ret < 0)
+		capture_manager_close();
+	return ret;
+}
+/**
+ * @name:   capture_manager_loop
+ * @Author: qihoo360
+ * @msg:    一个线程轮询全部网卡, 检测器状态不需要加锁; 超时时也读一次, 不依赖具体内核的唤醒方式
+ * @param
+ * @return:
+ */
+void capture_manager_loop(void)
+{
+	struct epoll_event ev[CAPTURE_IF_MAX];
+	char log[256] = {0};
+	int n, i;
+
+	while(!__atomic_load_n(&capture_exit, __ATOMIC_RELAXED))
+	{
+		n = epoll_wait(capture_epfd, ev, CAPTURE_IF_MAX, CAPTURE_TIMEOUT_MS);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			snprintf(log, sizeof(log), "capture epoll_wait %s", strerror(errno));
+			log_e("networkmonitor", log);
+			break;
+		}
+		if(n == 0)
+		{
+			for(i = 0; i < capture_if_count; i++)
+				pcap_dispatch(capture_ifaces[i].pd, CAPTURE_BATCH, capture_handler, (u_char *)&capture_ifaces[i]);
+			continue;
+		}
+		for(i = 0; i < n; i++)
+		{
+			capture_iface *iface = &capture_ifaces[ev[i].data.u32];
+			if(pcap_dispatch(iface->pd, CAPTURE_BATCH, capture_handler, (u_char *)iface) < 0)
+			{
+				snprintf(log, sizeof(log), "capture %s: %s", iface->name, pcap_geterr(iface->pd));
+				log_e("networkmonitor", log);
+			}
+		}
+	}
+}
+
+void capture_manager_break(void)
+{
+	__atomic_store_n(&capture_exit, TRUE, __ATOMIC_RELAXED);
+}
+/**
+ * @name:   capture_manager_close
+ * @Author: qihoo360
+ * @msg:    抓包线程退出后调用, 流量钩子的登记保留
+ * @param
+ * @return:
+ */
+void capture_manager_close(void)
+{
+	int i;
+
+	pthread_mutex_lock(&request_capture_lock);
+	for(i = 0; i < capture_if_count; i++)
+	{
+		if(capture_ifaces[i].pd != NULL)
+			pcap_close(capture_ifaces[i].pd);
+	}
+	memset(capture_ifaces, 0, sizeof(capture_ifaces));
+	capture_if_count = 0;
+	if(capture_epfd >= 0)
+	{
+		close(capture_epfd);
+		capture_epfd = -1;
+	}
+	pthread_mutex_unlock(&request_capture_lock);
+}
+
+int capture_manager_count(void)
+{
+	return capture_if_count;
+}
+
+capture_iface *capture_manager_get(int index)
+{
+	return (index >= 0 && index < capture_if_count) ? (&capture_ifaces[index]) : (NULL);
+}
+/**
+ * @name:   capture_manager_attach_flow
+ * @Author: qihoo360
+ * @msg:    流量统计改用该网卡已解码的报文, 不再单独打开pcap; 登记保留, 重新抓包时自动挂上
+ * @param
+ * @return: 0 ok, -1 该网卡未在抓包, 调用者自己抓包
+ */
+int capture_manager_attach_flow(const s8 *if_name, capture_flow_hook hook)
+{
+	int i, ret = -1;
+
+	if(if_name == NULL)
+		return -1;
+	pthread_mutex_lock(&request_capture_lock);
+	for(i = 0; i < capture_if_count; i++)
+	{
+		if(strcmp(capture_ifaces[i].name, if_name) == 0)
+		{
+			__atomic_store_n(&capture_ifaces[i].flow, hook, __ATOMIC_RELEASE);
+			ret = 0;
+		}
+	}
+	for(i = 0; ret == 0 && i < capture_flow_count; i++)
+	{
+		if(strcmp(capture_flows[i].name, if_name) == 0)
+			break;
+	}
+	if(ret == 0 && i < CAPTURE_IF_MAX)
+	{
+		strncpy(capture_flows[i].name, if_name, sizeof(capture_flows[i].name) - 1);
+		capture_flows[i].hook = hook;
+		if(i == capture_flow_count)
+			capture_flow_count++;
+	}
+	pthread_mutex_unlock(&request_capture_lock);
+	return ret;
+}
+/**
+ * @name:   capture_is_local4
+ * @Author: qihoo360
+ * @msg:    本机在任一被监测网卡上的地址, 跨网段转发时目的可能是另一块网卡的地址
+ * @param
+ * @return:
+ */
+boolean capture_is_local4(u32 addr)
+{
+	int i, j;
+
+	for(i = 0; i < capture_if_count; i++)
+	{
+		for(j = 0; j < capture_ifaces[i].ip4_count; j++)
+		{
+			if(capture_ifaces[i].ip4[j] == addr)
+				return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+boolean capture_is_local6(const u8 *addr)
+{
+	int i, j;
+
+	for(i = 0; i < capture_if_count; i++)
+	{
+		for(j = 0; j < capture_ifaces[i].ip6_count; j++)
+		{
+			if(memcmp(capture_ifaces[i].ip6[j], addr, 16) == 0)
+				return TRUE;
+		}
+	}
+	return FALSE;
+}
+/**
+ * @name:   capture_manager_stats
+ * @Author: qihoo360
+ * @msg:    各网卡计数, 内核丢包取自pcap_stats
+ * @param
+ * @return: json字符串, 调用者释放
+ */
+char *capture_manager_stats(void)
+{
+	cJSON *root = cJSON_CreateArray();
+	char *out = NULL;
+	char addr[INET6_ADDRSTRLEN] = {0};
+	int i;
+
+	if(root == NULL)
+		return NULL;
+	pthread_mutex_lock(&request_capture_lock);
+	for(i = 0; i < capture_if_count; i++)
+	{
+		capture_iface *iface = &capture_ifaces[i];
+		cJSON *obj = cJSON_CreateObject();
+		struct pcap_stat ps;
+
+		if(obj == NULL)
+			break;
+		cJSON_AddStringToObject(obj, "name", iface->name);
+		cJSON_AddNumberToObject(obj, "datalink", iface->linktype);
+		if(iface->ip4_count > 0)
+		{
+			inet_ntop(AF_INET, &iface->ip4[0], addr, sizeof(addr));
+			cJSON_AddStringToObject(obj, "ipaddr", addr);
+		}
+		cJSON_AddNumberToObject(obj, "packets", (double)__atomic_load_n(&iface->counter.packets, __ATOMIC_RELAXED));
+		cJSON_AddNumberToObject(obj, "bytes", (double)__atomic_load_n(&iface->counter.bytes, __ATOMIC_RELAXED));
+		cJSON_AddNumberToObject(obj, "ipv4", (double)__atomic_load_n(&iface->counter.ipv4, __ATOMIC_RELAXED));
+		cJSON_AddNumberToObject(obj, "ipv6", (double)__atomic_load_n(&iface->counter.ipv6, __ATOMIC_RELAXED));
+		cJSON_AddNumberToObject(obj, "arp", (double)__atomic_load_n(&iface->counter.arp, __ATOMIC_RELAXED));
+		cJSON_AddNumberToObject(obj, "undecoded", (double)__atomic_load_n(&iface->counter.undecoded, __ATOMIC_RELAXED));
+		if(pcap_stats(iface->pd, &ps) == 0)
+		{
+			cJSON_AddNumberToObject(obj, "kernel_drop", ps.ps_drop);
+			cJSON_AddNumberToObject(obj, "if_drop", ps.ps_ifdrop);
+		}
+		cJSON_AddItemToArray(root, obj);
+	}
+	pthread_mutex_unlock(&request_capture_lock);
+	out = cJSON_PrintUnformatted(root);
+	cJSON_Delete(root);
+	return out;
+}
@@ -0,0 +1,256 @@
+/*
+ * @Descripttion: sharded 5-tuple connection table, fixed memory
+ * @version: V0.0
+ * @Author: idps members
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "typedef.h"
+#include "conn_table.h"
+
+static conn_shard conn_shards[CONN_SHARDS];
+static unsigned long long sip_k0 = 0,sip_k1 = 0;
+static u32 conn_now = 0;//monotonic seconds, refreshed by conn_table_expire
+
+#define ROTL64(x,b)	(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND(v0,v1,v2,v3)	do{\
+	v0 += v1; v1 = ROTL64(v1,13); v1 ^= v0; v0 = ROTL64(v0,32);\
+	v2 += v3; v3 = ROTL64(v3,16); v3 ^= v2;\
+	v0 += v3; v3 = ROTL64(v3,21); v3 ^= v0;\
+	v2 += v1; v1 = ROTL64(v1,17); v1 ^= v2; v2 = ROTL64(v2,32);\
+}while(0)
+/**
+ * @name:   conn_hash
+ * @Author: qihoo360
+ * @msg:    SipHash-1-3 over the whole tuple, keyed so spoofed tuples cannot target one bucket
+ * @param
+ * @return:
+ */
+static unsigned long long conn_hash(const conn_key *key)
+{
+	unsigned long long m[2];
+	unsigned long long v0 = sip_k0 ^ 0x736f6d6570736575ULL;
+	unsigned long long v1 = sip_k1 ^ 0x646f72616e646f6dULL;
+	unsigned long long v2 = sip_k0 ^ 0x6c7967656e657261ULL;
+	unsigned long long v3 = sip_k1 ^ 0x7465646279746573ULL;
+	unsigned long long b = 13ULL << 56;
+
+	m[0] = ((unsigned long long)key->dstip << 32) | key->srcip;
+	m[1] = ((unsigned long long)key->type << 32) | ((u32)key->dport << 16) | key->sport;
+	for(int i = 0;i < 2;i ++){
+		v3 ^= m[i];
+		SIPROUND(v0,v1,v2,v3);
+		v0 ^= m[i];
+	}
+	v3 ^= b;
+	SIPROUND(v0,v1,v2,v3);
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND(v0,v1,v2,v3);
+	SIPROUND(v0,v1,v2,v3);
+	SIPROUND(v0,v1,v2,v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static inline conn_shard *conn_shard_of(unsigned long long h)
+{
+	return &conn_shards[(u32)(h >> 32) & (CONN_SHARDS - 1)];
+}
+
+static inline u32 conn_bucket_of(unsigned long long h)
+{
+	return (u32)h & (CONN_SHARD_BUCKETS - 1);
+}
+
+static inline boolean conn_key_equal(const conn_key *a,const conn_key *b)
+{
+	return a->srcip == b->srcip && a->dstip == b->dstip && a->sport == b->sport
+		&& a->dport == b->dport && a->type == b->type;
+}
+
+static u32 conn_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (u32)ts.tv_sec;
+}
+
+static u32 conn_idle_timeout(u8 type)
+{
+	switch(type){
+		case 6:
+			return CONN_IDLE_TCP;
+		case 17:
+			return CONN_IDLE_UDP;
+		default:
+			return CONN_IDLE_OTHER;
+	}
+}
+/**
+ * @name:   conn_unlink
+ * @Author: qihoo360
+ * @msg:    remove an entry from its chain and give it back to the slab, shard lock held
+ * @param
+ * @return:
+ */
+static void conn_unlink(conn_shard *shard,u16 idx)
+{
+	conn_entry *e = &shard->entry[idx];
+	u16 *p = &shard->bucket[conn_bucket_of(conn_hash(&e->key))];
+	while(*p != CONN_NIL && *p != idx)
+		p = &shard->entry[*p].next;
+	if(*p == idx)
+		*p = e->next;
+	e->used = 0;
+	e->next = shard->free_head;
+	shard->free_head = idx;
+	shard->used --;
+}
+/**
+ * @name:   conn_alloc
+ * @Author: qihoo360
+ * @msg:    take a slab entry, when none is free reclaim one with the clock hand
+ * @param
+ * @return: entry index, shard lock held
+ */
+static u16 conn_alloc(conn_shard *shard)
+{
+	u16 idx;
+	if(shard->free_head == CONN_NIL){
+		// 最多两圈：第一圈清除引用位，第二圈必然找到
+		for(;;){
+			conn_entry *e = &shard->entry[shard->hand];
+			idx = shard->hand;
+			shard->hand = (shard->hand + 1) & (CONN_SHARD_ENTRIES - 1);
+			if(e->ref){
+				e->ref = 0;
+				continue;
+			}
+			conn_unlink(shard,idx);
+			shard->evicted ++;
+			break;
+		}
+	}
+	idx = shard->free_head;
+	shard->free_head = shard->entry[idx].next;
+	shard->used ++;
+	return idx;
+}
+/**
+ * @name:   conn_table_init
+ * @Author: qihoo360
+ * @msg:    reset all shards, the hash key is chosen once per process
+ * @param
+ * @return:
+ */
+void conn_table_init(void)
+{
+	static boolean key_init = FALSE;
+
+	if(!key_init){
+		int fd = open("/dev/urandom",O_RDONLY);
+		unsigned long long seed[2] = {0};
+		if(fd < 0 || read(fd,seed,sizeof(seed)) != sizeof(seed)){
+			seed[0] = (unsigned long long)time(NULL) ^ ((unsigned long long)getpid() << 32);
+			seed[1] = (unsigned long long)(unsigned long)&seed ^ 0x9E3779B97F4A7C15ULL;
+		}
+		if(fd >= 0)
+			close(fd);
+		sip_k0 = seed[0];
+		sip_k1 = seed[1];
+		for(int s = 0;s < CONN_SHARDS;s ++)
+			pthread_mutex_init(&conn_shards[s].lock,NULL);
+		key_init = TRUE;
+	}
+	for(int s = 0;s < CONN_SHARDS;s ++){
+		conn_shard *shard = &conn_shards[s];
+		pthread_mutex_lock(&shard->lock);
+		for(int i = 0;i < CONN_SHARD_BUCKETS;i ++)
+			shard->bucket[i] = CONN_NIL;
+		for(int i = 0;i < CONN_SHARD_ENTRIES;i ++){
+			memset(&shard->entry[i],0,sizeof(conn_entry));
+			shard->entry[i].next = (i + 1 < CONN_SHARD_ENTRIES)?(i + 1):(CONN_NIL);
+		}
+		shard->free_head = 0;
+		shard->hand = 0;
+		shard->used = 0;
+		shard->evicted = 0;
+		pthread_mutex_unlock(&shard->lock);
+	}
+	__atomic_store_n(&conn_now,conn_clock(),__ATOMIC_RELAXED);
+}
+/**
+ * @name:   conn_table_touch
+ * @Author: qihoo360
+ * @msg:    only the shard of this tuple is locked
+ * @param
+ * @return: TRUE:already present FALSE:new, now inserted
+ */
+boolean conn_table_touch(const conn_key *key)
+{
+	unsigned long long h = conn_hash(key);
+	conn_shard *shard = conn_shard_of(h);
+	u16 *head = &shard->bucket[conn_bucket_of(h)];
+	u32 now = __atomic_load_n(&conn_now,__ATOMIC_RELAXED);
+	u16 idx;
+
+	pthread_mutex_lock(&shard->lock);
+	for(idx = *head;idx != CONN_NIL;idx = shard->entry[idx].next){
+		conn_entry *e = &shard->entry[idx];
+		if(conn_key_equal(&e->key,key)){
+			e->last_seen = now;
+			e->ref = 1;
+			pthread_mutex_unlock(&shard->lock);
+			return TRUE;
+		}
+	}
+	idx = conn_alloc(shard);
+	shard->entry[idx].key = *key;
+	shard->entry[idx].last_seen = now;
+	shard->entry[idx].used = 1;
+	shard->entry[idx].ref = 1;
+	shard->entry[idx].next = *head;
+	*head = idx;
+	pthread_mutex_unlock(&shard->lock);
+	return FALSE;
+}
+/**
+ * @name:   conn_table_expire
+ * @Author: qihoo360
+ * @msg:    loop 1S, one shard locked at a time
+ * @param
+ * @return:
+ */
+void conn_table_expire(void)
+{
+	u32 now = conn_clock();
+	__atomic_store_n(&conn_now,now,__ATOMIC_RELAXED);
+	for(int s = 0;s < CONN_SHARDS;s ++){
+		conn_shard *shard = &conn_shards[s];
+		pthread_mutex_lock(&shard->lock);
+		for(u16 i = 0;i < CONN_SHARD_ENTRIES && shard->used > 0;i ++){
+			conn_entry *e = &shard->entry[i];
+			if(e->used && now - e->last_seen > conn_idle_timeout(e->key.type))
+				conn_unlink(shard,i);
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+void conn_table_stats(u32 *used,u32 *evicted)
+{
+	u32 u = 0,ev = 0;
+	for(int s = 0;s < CONN_SHARDS;s ++){
+		pthread_mutex_lock(&conn_shards[s].lock);
+		u  += conn_shards[s].used;
+		ev += conn_shards[s].evicted;
+		pthread_mutex_unlock(&conn_shards[s].lock);
+	}
+	if(used)
+		*used = u;
+	if(evicted)
+		*evicted = ev;
+}
@@ -0,0 +1,372 @@
+/*
+ * @Descripttion: conntrack NEW/DESTROY events as a source of connect events and flow counters
+ * @version: V0.0
+ * @Author: idps members
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include "typedef.h"
+#include "ct_events.h"
+#include "data_dispatcher.h"
+#include "spdloglib.h"
+
+typedef struct{
+	char name[IFNAMSIZ];
+	int  mode;
+}ct_source;
+
+typedef struct{
+	u32 addr;		//network order
+	u32 mask;
+}ct_subnet;
+
+static ct_source ct_sources[CT_SOURCE_IF_MAX];
+static int ct_fd = -1;
+static int ct_mode = CT_SOURCE_NONE;
+static ct_subnet ct_net[3];			//indexed by CT_SOURCE_CONNECT/CT_SOURCE_FLOW
+static ct_flow_hook ct_hook = NULL;
+static u32 ct_lost = 0;
+static pthread_t ct_thread = 0;
+static pthread_mutex_t request_ct_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void ct_source_set(const char *if_name,int mode)
+{
+	int free_slot = -1;
+	if(if_name == NULL || if_name[0] == '\0')
+		return;
+	pthread_mutex_lock(&request_ct_lock);
+	for(int i = 0;i < CT_SOURCE_IF_MAX;i ++){
+		if(ct_sources[i].name[0] == '\0'){
+			if(free_slot < 0)
+				free_slot = i;
+			continue;
+		}
+		if(strncmp(ct_sources[i].name,if_name,sizeof(ct_sources[i].name)) == 0){
+			ct_sources[i].mode = mode;
+			if(mode == CT_SOURCE_NONE)
+				ct_sources[i].name[0] = '\0';
+			pthread_mutex_unlock(&request_ct_lock);
+			return;
+		}
+	}
+	if(free_slot >= 0 && mode != CT_SOURCE_NONE){
+		snprintf(ct_sources[free_slot].name,sizeof(ct_sources[free_slot].name),"%s",if_name);
+		ct_sources[free_slot].mode = mode;
+	}
+	pthread_mutex_unlock(&request_ct_lock);
+}
+
+int ct_source_get(const char *if_name)
+{
+	int mode = CT_SOURCE_NONE;
+	if(if_name == NULL)
+		return mode;
+	pthread_mutex_lock(&request_ct_lock);
+	for(int i = 0;i < CT_SOURCE_IF_MAX;i ++){
+		if(ct_sources[i].name[0] != '\0' && strncmp(ct_sources[i].name,if_name,sizeof(ct_sources[i].name)) == 0){
+			mode = ct_sources[i].mode;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&request_ct_lock);
+	return mode;
+}
+
+static int ct_if_subnet(const char *if_name,ct_subnet *net)
+{
+	struct ifaddrs *ifa = NULL,*ifList = NULL;
+	int ret = -1;
+	if(getifaddrs(&ifList) < 0)
+		return -1;
+	for(ifa = ifList;ifa != NULL;ifa = ifa->ifa_next){
+		if(ifa->ifa_addr == NULL || ifa->ifa_netmask == NULL || ifa->ifa_addr->sa_family != AF_INET)
+			continue;
+		if(strcmp(ifa->ifa_name,if_name) != 0)
+			continue;
+		net->addr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr;
+		net->mask = ((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr.s_addr;
+		ret = 0;
+		break;
+	}
+	freeifaddrs(ifList);
+	return ret;
+}
+
+static inline boolean ct_in_subnet(const ct_subnet *net,u32 addr)
+{
+	return ((addr & net->mask) == (net->addr & net->mask))?(TRUE):(FALSE);
+}
+
+static inline unsigned long long ct_get_be64(const u8 *p)
+{
+	unsigned long long v = 0;
+	for(int i = 0;i < 8;i ++)
+		v = (v << 8) | p[i];
+	return v;
+}
+/**
+ * @name:   ct_attr_next
+ * @Author: qihoo360
+ * @msg:    walk a netlink attribute block, every length is checked
+ * @param   off:in/out offset inside buf
+ * @return: the attribute or NULL at the end
+ */
+static const struct nlattr *ct_attr_next(const u8 *buf,u32 len,u32 *off)
+{
+	const struct nlattr *a = NULL;
+	if(*off + NLA_HDRLEN > len)
+		return NULL;
+	a = (const struct nlattr *)(buf + *off);
+	if(a->nla_len < NLA_HDRLEN || *off + a->nla_len > len)
+		return NULL;
+	*off += NLA_ALIGN(a->nla_len);
+	return a;
+}
+
+#define CT_ATTR_TYPE(a)			((a)->nla_type & NLA_TYPE_MASK)
+#define CT_ATTR_DATA(a)			((const u8 *)(a) + NLA_HDRLEN)
+#define CT_ATTR_LEN(a)			((u32)(a)->nla_len - NLA_HDRLEN)
+
+static int ct_parse_tuple(const u8 *buf,u32 len,ct_flow *flow)
+{
+	const struct nlattr *a = NULL,*b = NULL;
+	u32 off = 0,inner;
+	int got = 0;
+	while((a = ct_attr_next(buf,len,&off)) != NULL){
+		inner = 0;
+		if(CT_ATTR_TYPE(a) == CTA_TUPLE_IP){
+			while((b = ct_attr_next(CT_ATTR_DATA(a),CT_ATTR_LEN(a),&inner)) != NULL){
+				if(CT_ATTR_TYPE(b) == CTA_IP_V4_SRC && CT_ATTR_LEN(b) >= 4){
+					memcpy(&flow->src,CT_ATTR_DATA(b),4);
+					got |= 1;
+				}
+				else if(CT_ATTR_TYPE(b) == CTA_IP_V4_DST && CT_ATTR_LEN(b) >= 4){
+					memcpy(&flow->dst,CT_ATTR_DATA(b),4);
+					got |= 2;
+				}
+			}
+		}
+		else if(CT_ATTR_TYPE(a) == CTA_TUPLE_PROTO){
+			while((b = ct_attr_next(CT_ATTR_DATA(a),CT_ATTR_LEN(a),&inner)) != NULL){
+				const u8 *d = CT_ATTR_DATA(b);
+				if(CT_ATTR_TYPE(b) == CTA_PROTO_NUM && CT_ATTR_LEN(b) >= 1){
+					flow->l4proto = d[0];
+					got |= 4;
+				}
+				else if(CT_ATTR_TYPE(b) == CTA_PROTO_SRC_PORT && CT_ATTR_LEN(b) >= 2)
+					flow->sport = (u16)((d[0] << 8) | d[1]);
+				else if(CT_ATTR_TYPE(b) == CTA_PROTO_DST_PORT && CT_ATTR_LEN(b) >= 2)
+					flow->dport = (u16)((d[0] << 8) | d[1]);
+			}
+		}
+	}
+	return (got == 7)?(0):(-1);//ipv6 tuples are skipped
+}
+
+static void ct_parse_counters(const u8 *buf,u32 len,unsigned long long *packets,unsigned long long *bytes)
+{
+	const struct nlattr *a = NULL;
+	u32 off = 0;
+	while((a = ct_attr_next(buf,len,&off)) != NULL){
+		const u8 *d = CT_ATTR_DATA(a);
+		if(CT_ATTR_TYPE(a) == CTA_COUNTERS_PACKETS && CT_ATTR_LEN(a) >= 8)
+			*packets = ct_get_be64(d);
+		else if(CT_ATTR_TYPE(a) == CTA_COUNTERS_BYTES && CT_ATTR_LEN(a) >= 8)
+			*bytes = ct_get_be64(d);
+		else if(CT_ATTR_TYPE(a) == CTA_COUNTERS32_PACKETS && CT_ATTR_LEN(a) >= 4)
+			*packets = ((u32)d[0] << 24) | ((u32)d[1] << 16) | ((u32)d[2] << 8) | d[3];
+		else if(CT_ATTR_TYPE(a) == CTA_COUNTERS32_BYTES && CT_ATTR_LEN(a) >= 4)
+			*bytes = ((u32)d[0] << 24) | ((u32)d[1] << 16) | ((u32)d[2] << 8) | d[3];
+	}
+}
+/**
+ * @name:   ct_handle
+ * @Author: qihoo360
+ * @msg:    one ctnetlink message, NEW feeds connect events, DELETE feeds flow counters
+ * @param
+ * @return:
+ */
+static void ct_handle(const struct nlmsghdr *h)
+{
+	const u8 *attrs = (const u8 *)NLMSG_DATA(h) + NLMSG_ALIGN(sizeof(struct nfgenmsg));
+	const struct nlattr *a = NULL;
+	u32 len,off = 0;
+	u8 msg = NFNL_MSG_TYPE(h->nlmsg_type);
+	int mode,want;
+	ct_subnet connect_net,flow_net;
+	ct_flow_hook hook = NULL;
+	ct_flow flow;
+
+	if(NFNL_SUBSYS_ID(h->nlmsg_type) != NFNL_SUBSYS_CTNETLINK)
+		return;
+	if(h->nlmsg_len < NLMSG_LENGTH(NLMSG_ALIGN(sizeof(struct nfgenmsg))))
+		return;
+	want = (msg == IPCTNL_MSG_CT_NEW)?(CT_SOURCE_CONNECT):((msg == IPCTNL_MSG_CT_DELETE)?(CT_SOURCE_FLOW):(CT_SOURCE_NONE));
+	pthread_mutex_lock(&request_ct_lock);
+	mode = ct_mode;
+	connect_net = ct_net[CT_SOURCE_CONNECT];
+	flow_net = ct_net[CT_SOURCE_FLOW];
+	hook = ct_hook;
+	pthread_mutex_unlock(&request_ct_lock);
+	if(!(mode & want))
+		return;
+
+	memset(&flow,0,sizeof(flow));
+	len = h->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+	while((a = ct_attr_next(attrs,len,&off)) != NULL){
+		switch(CT_ATTR_TYPE(a)){
+			case CTA_TUPLE_ORIG:
+				if(ct_parse_tuple(CT_ATTR_DATA(a),CT_ATTR_LEN(a),&flow) != 0)
+					return;
+				break;
+			case CTA_COUNTERS_ORIG:
+				ct_parse_counters(CT_ATTR_DATA(a),CT_ATTR_LEN(a),&flow.orig_packets,&flow.orig_bytes);
+				break;
+			case CTA_COUNTERS_REPLY:
+				ct_parse_counters(CT_ATTR_DATA(a),CT_ATTR_LEN(a),&flow.reply_packets,&flow.reply_bytes);
+				break;
+			default:
+				break;
+		}
+	}
+	if(flow.src == 0)
+		return;
+	if(want == CT_SOURCE_CONNECT){
+		if(ct_in_subnet(&connect_net,flow.src))
+			report_connect_event(flow.src,flow.sport,flow.dst,flow.dport,flow.l4proto);
+	}
+	else if(hook != NULL && (ct_in_subnet(&flow_net,flow.src) || ct_in_subnet(&flow_net,flow.dst))){
+		hook(&flow);
+	}
+}
+
+static void *ct_run(void *args)
+{
+	long buf[16384 / sizeof(long)];
+	for(;;){
+		ssize_t len = recv(ct_fd,buf,sizeof(buf),0);
+		struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		if(len < 0){
+			if(errno == ENOBUFS){
+				// the kernel kept going without us, nothing to resync for events
+				__atomic_add_fetch(&ct_lost,1,__ATOMIC_RELAXED);
+				continue;
+			}
+			if(errno == EINTR)
+				continue;
+			if(errno == EBADF)
+				break;
+			usleep(100 * 1000);
+			continue;
+		}
+		for(;NLMSG_OK(h,(u32)len);h = NLMSG_NEXT(h,len)){
+			if(h->nlmsg_type == NLMSG_ERROR || h->nlmsg_type == NLMSG_DONE || h->nlmsg_type == NLMSG_NOOP)
+				continue;
+			ct_handle(h);
+		}
+	}
+	return NULL;
+}
+
+static int ct_group(int mode)
+{
+	return (mode == CT_SOURCE_CONNECT)?(NFNLGRP_CONNTRACK_NEW):(NFNLGRP_CONNTRACK_DESTROY);
+}
+/**
+ * @name:   ct_events_start
+ * @Author: qihoo360
+ * @msg:    needs CAP_NET_ADMIN and nf_conntrack_netlink; counters need
+ *          nf_conntrack_acct, which is switched on here when possible
+ * @param   mode:CT_SOURCE_CONNECT or CT_SOURCE_FLOW
+ * @return: 0:ok -1:keep using pcap
+ */
+int ct_events_start(int mode,const char *if_name,ct_flow_hook hook)
+{
+	struct sockaddr_nl sa;
+	int rcvbuf = CT_EVENTS_RCVBUF,group = ct_group(mode);
+	ct_subnet net;
+
+	if((mode != CT_SOURCE_CONNECT && mode != CT_SOURCE_FLOW) || if_name == NULL)
+		return -1;
+	if(ct_if_subnet(if_name,&net) != 0)
+		return -1;
+	pthread_mutex_lock(&request_ct_lock);
+	if(ct_fd < 0){
+		if((ct_fd = socket(AF_NETLINK,SOCK_RAW | SOCK_CLOEXEC,NETLINK_NETFILTER)) < 0)
+			goto fail;
+		memset(&sa,0,sizeof(sa));
+		sa.nl_family = AF_NETLINK;
+		setsockopt(ct_fd,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf));
+		if(bind(ct_fd,(struct sockaddr *)&sa,sizeof(sa)) < 0)
+			goto fail;
+	}
+	if(setsockopt(ct_fd,SOL_NETLINK,NETLINK_ADD_MEMBERSHIP,&group,sizeof(group)) < 0)
+		goto fail;
+	if(mode == CT_SOURCE_FLOW){
+		int fd = open("/proc/sys/net/netfilter/nf_conntrack_acct",O_WRONLY);
+		if(fd >= 0){
+			if(write(fd,"1",1) != 1)
+				log_i("networkmonitor","nf_conntrack_acct not enabled, flow counters will be zero");
+			close(fd);
+		}
+		ct_hook = hook;
+	}
+	ct_net[mode] = net;
+	ct_mode |= mode;
+	if(ct_thread == 0 && pthread_create(&ct_thread,NULL,ct_run,NULL) != 0){
+		ct_thread = 0;
+		ct_mode &= ~mode;
+		goto fail;
+	}
+	pthread_mutex_unlock(&request_ct_lock);
+	log_i("networkmonitor",(mode == CT_SOURCE_CONNECT)?("connect events from conntrack"):("flow counters from conntrack"));
+	return 0;
+fail:
+	if(ct_fd >= 0 && ct_mode == CT_SOURCE_NONE){
+		close(ct_fd);
+		ct_fd = -1;
+	}
+	pthread_mutex_unlock(&request_ct_lock);
+	log_i("networkmonitor","conntrack events unavailable, keep pcap");
+	return -1;
+}
+
+void ct_events_stop(int mode)
+{
+	int group = ct_group(mode);
+	pthread_mutex_lock(&request_ct_lock);
+	if(ct_fd >= 0 && (ct_mode & mode)){
+		setsockopt(ct_fd,SOL_NETLINK,NETLINK_DROP_MEMBERSHIP,&group,sizeof(group));
+		ct_mode &= ~mode;
+		if(mode == CT_SOURCE_FLOW)
+			ct_hook = NULL;
+	}
+	pthread_mutex_unlock(&request_ct_lock);
+}
+
+int ct_events_active(void)
+{
+	int mode;
+	pthread_mutex_lock(&request_ct_lock);
+	mode = ct_mode;
+	pthread_mutex_unlock(&request_ct_lock);
+	return mode;
+}
+
+u32 ct_events_lost(void)
+{
+	return __atomic_load_n(&ct_lost,__ATOMIC_RELAXED);
+}
@@ -33,19 +33,25 @@
 #include "dpi_report.h"
 #include "data_dispatcher.h"
 #include "pid_detection.h"
+#include "conn_table.h"
+#include "dns_cache.h"
+#include "ct_events.h"
+#include "sniffer_writer.h"
+#include "pkt_decode.h"
+#include "capture_manager.h"
 #include "cJSON.h"
 #include "spdloglib.h"
 
 #define	IPV4_VERSION	(4)
 #define	IPV6_VERSION	(6)
-#define IF_INTERFACE_MAX_SIZE 			(65535)//28800000//65535
 #define	IF_INTERFACE_NAME_MAX_SIZE 		(0x40)
+#define	LOCAL_IP6_MAX					(8)
 s8 local_net_ip[32];
 u8 local_net_ip_hex[4];
 u8 local_net_mac_hex[6];
+static u8 local_net_ip6[LOCAL_IP6_MAX][16];//link-local and global
+static int local_net_ip6_count = 0;
 static pthread_t ip_data_dispatcher_thd = 0;
-static pcap_t *pcap_t_handle = NULL;
-static pcap_dumper_t *pcap_dumper = NULL;
 static s8 *sniffer_path = NULL;
 static pthread_mutex_t network_lock = PTHREAD_MUTEX_INITIALIZER;	
 static boolean pcap_init_flag = FALSE;
@@ -53,6 +59,7 @@ static list *whiteIpName = NULL;
 static pthread_t thread_parser_thd = 0;
 static boolean exit_thread_parser_thd = FALSE;
 static int s_net_connect_report_interval = 30;
+static boolean conn_by_conntrack = FALSE;//connect events come from conntrack, not pcap
 
 typedef struct networkNode{
 	unsigned int dstip;
@@ -88,16 +95,18 @@ boolean set_store_path(s8 *path)
 	memcpy(sniffer_path,path,strnlen(path,256));	
 }
 
+// 写文件在独立线程, 抓包线程只拷贝进环
 void sniffer_start()
 {
-	pcap_dumper = pcap_dump_open(pcap_t_handle,sniffer_path);
+	if(sniffer_path == NULL)
+		return;
+	// 只保存主网卡, 各网卡的datalink可能不同
+	sniffer_writer_start(sniffer_path,(capture_manager_get(0) != NULL)?(capture_manager_get(0)->linktype):(DLT_EN10MB));
 }
 
 void sniffer_stop()
 {
-	if(pcap_dumper)
-		pcap_dump_close(pcap_dumper);
-	pcap_dumper = NULL;
+	sniffer_writer_stop();
 }
 
 // ip字符串转换为十进制数值
@@ -147,6 +156,7 @@ static void get_local_ip(char *if_name)
 	int ret = 0;
 	struct ifaddrs *addr = NULL;
 	struct ifaddrs *temp_addr = NULL;
+	local_net_ip6_count = 0;
 	ret = getifaddrs(&addr);
 	if (ret == 0) {
 		temp_addr = addr;
@@ -167,6 +177,13 @@ static void get_local_ip(char *if_name)
 					transfer_to_dex();
 				}
 			}
+			else if(temp_addr->ifa_addr->sa_family == AF_INET6 && local_net_ip6_count < LOCAL_IP6_MAX)
+			{
+				if(strcmp(temp_addr->ifa_name, if_name)  == 0) 
+				{
+					memcpy(local_net_ip6[local_net_ip6_count++], &((struct sockaddr_in6 *)temp_addr->ifa_addr)->sin6_addr, 16);
+				}
+			}
 			temp_addr = temp_addr->ifa_next;
 		}
 	}
@@ -427,116 +444,25 @@ static void ipNtoA(s8* addr_bytes,uint32_t addr)
 #define  IP_PROTCOL_TCP		6
 #define  IP_PROTCOL_UDP		17
 
-struct linux_cooked_capture_header{
-	u16 pack_type;
-	u16 link_layer_addr_type;
-	u16 link_layer_addr_length;
-	u8 unused[8];
-	u16 ether_type;
-}__attribute__ ((__packed__));
-
-
-#if	LINUX_COOKED_CAPTURE
-	#define 	ETHERNET_FRAME_HEAD		linux_cooked_capture_header
-#else
-	#define 	ETHERNET_FRAME_HEAD		ether_header
-#endif
-
-#define		ETHERNET_HEADER		sizeof(struct ETHERNET_FRAME_HEAD)
-#define		IP_HEADER			sizeof(struct iphdr)
-
-
-// CRC20_key  CRC20算法根据接收数据的ip、port和协议类型，计算成key值
-// 让后利用 桶型hash，装入数据
-//1、CRC20_key的实现
-#define POLY 0x01101 // CRC20生成多项式x^20+x^12+x^8+1即:01101 CRC32:04C11DB7L
-static unsigned int crc_table[256] = {0};
-unsigned int get_sum_poly(unsigned char data)
-{
-	unsigned int sum_poly = data;
-	int j = 0;
-	sum_poly <<= 24;
-	for(j = 0; j < 8; j++)
-	{
-		int hi = sum_poly&0x80000000; // 取得reg的最高位
-		sum_poly <<= 1;
-		if(hi) sum_poly = sum_poly^POLY;
-	}
-	return sum_poly;
-}
-
-void create_crc_table(void)  //在使用CRC20_key函数应该先建立crc表
-{
-	int i;
-	for(i = 0; i < 256; i++)
-	{
-		crc_table[i] = get_sum_poly(i&0xFF);
-	}
-}
 
-unsigned int CRC20_key(unsigned char* data, int len)
-{
-	int i = 0;
-	unsigned int reg = 0xFFFFFFFF;
-	for(i = 0; i < len; i++)
-	{
-		reg = (reg<<8) ^ crc_table[(reg>>24)&0xFF ^ data[i]];
-	}
-	return reg;
-}
-#define  TCPHASHSIZE   255
-static list list_ipdata_packet[TCPHASHSIZE];
+// 5元组连接表：SipHash分片定位，每个分片独立加锁，条目来自固定slab，空闲超时回收
 void hashtableinit(void){
-	for (size_t i = 0; i < TCPHASHSIZE; i++)
-	{
-		/* code */
-		list_destroy(&list_ipdata_packet[i]);
-		list_init(&list_ipdata_packet[i],free);
-	}
+	conn_table_init();
 }
-extern pthread_mutex_t    request_pid_lock;
-//2、说明：hash最好的方式为，建立单个链表，如有相同则进行二次查找匹配
+//返回true:该5元组已经存在，false:新连接，已记录
 bool Tuple_5CalcHash(unsigned int srcip,unsigned short sport,unsigned int dstip,unsigned short dport,unsigned char type){
-	unsigned char source[14] = {0};
-	source[0] = sport;
-	source[1] = sport>>8;
-	source[2] = dport;
-	source[3] = dport>>8;
-
-	source[4] = srcip>>24;
-	source[5] = srcip>>16;
-	source[6] = srcip>>8;
-	source[7] = srcip;
-
-	source[8] = dstip>>24;
-	source[9] = dstip>>16;
-	source[10] = dstip>>8;
-	source[11] = dstip;
-
-	source[12] = type;
-	source[13] = type>>8;
-	unsigned int key = CRC20_key(source,14);
-	unsigned char index = key%TCPHASHSIZE;
-	//printf("Tuple_5CalcHash key %d index %d\n",key,index);
-	pthread_mutex_lock(&request_pid_lock);
-	list_elmt *cur_elmt = list_head(&list_ipdata_packet[index]);
-	while(cur_elmt != NULL){
-		unsigned int *e = cur_elmt->data;
-		if(*e == key){
-			pthread_mutex_unlock(&request_pid_lock);
-			return true;
-		}
-		cur_elmt = cur_elmt->next;
-	}
-	unsigned int *e = (unsigned int *)malloc(sizeof(unsigned int));		
-	*e = key;
-	list_ins_next(&list_ipdata_packet[index],NULL,e);	
-	pthread_mutex_unlock(&request_pid_lock);
-	return false;
+	conn_key key;
+	memset(&key,0,sizeof(key));
+	key.srcip = srcip;
+	key.dstip = dstip;
+	key.sport = sport;
+	key.dport = dport;
+	key.type  = type;
+	return conn_table_touch(&key);
 }
 
 // ip tcp udp三种协议
-// status 0:未找到ip; 2找到ip; 1找到ip且上报过; 3错误;4在白名单内,无需上报
+// status 0:未找到ip; 2找到ip; 1找到ip且上报过; 3错误; 白名单在查表前过滤
 // pthreadNetworkStart 会将建立ip保存一段时间后清空
 static networkNode_t pHeadNetList = {.next=NULL};
 static void append_network_list(networkNode_t *h, unsigned int dstip)
@@ -563,25 +489,26 @@ static void append_network_list(networkNode_t *h, unsigned int dstip)
 	pthread_mutex_unlock(&network_lock);
 }
 
-static int  search_network_list(networkNode_t *h, unsigned int dstip,char flag)
+/*Whitelists are used for filtering*/
+static boolean white_ip_match(const s8 *ip_bytes)
 {
-	s8 ip_bytes[20] = {0};
-
-	/*Whitelists are used for filtering*/
 	if (whiteIpName)
 	{
-		ipNtoA(ip_bytes, dstip);
-		list_elmt *element = whiteIpName->head;
-		while (element)
-		{
-			if(strcmp(element->data, ip_bytes) == 0)
+		list_elmt *element = whiteIpName->head;
+		while (element)
+		{
+			if(strcmp(element->data, ip_bytes) == 0)
 			{
-				return 4;
-			}
-			element = element->next;
+				return TRUE;
+			}
+			element = element->next;
 		}
 	}
-	
+	return FALSE;
+}
+
+static int  search_network_list(networkNode_t *h, unsigned int dstip,char flag)
+{
 	pthread_mutex_lock(&network_lock);
 	networkNode_t *i;
 	i = h->next;
@@ -677,6 +604,89 @@ static void destory_network_list(networkNode_t *h)
 	pthread_mutex_unlock(&network_lock);
 }
 
+/**
+ * @name:   report_connect_key
+ * @Author: qihoo360
+ * @msg:    ip/tcp/udp连接事件, 白名单按目的地址字符串, 按key去重, ipv4的key就是目的ip
+ * @param   key:去重用 sport/dport:host order
+ * @return: 
+ */
+static void report_connect_key(int ip_version,u32 key,s8 *src_bytes,u16 sport,s8 *dst_bytes,u16 dport,u8 protocol)
+{
+	u32 daddr = key;
+	int ret = 0;
+
+	if(white_ip_match(dst_bytes))
+		return;
+	//ip
+	ret = search_network_list(&pHeadNetList,daddr,0);
+	if(ret == 0 || ret == 2)
+	{
+		on_IpConnectEvent_callback(ip_version,src_bytes,sport,dst_bytes,dport,protocol);
+		if(ret == 0)
+		{
+			append_network_list(&pHeadNetList,daddr);
+		}
+		change_network_list_state(&pHeadNetList,daddr,0);
+	}
+	if(protocol == IP_PROTCOL_TCP)
+	{
+		ret = search_network_list(&pHeadNetList,daddr,1);
+		if(ret == 2)
+		{
+			on_TcpConnectEvent_callback(src_bytes,sport,dst_bytes,dport);
+			change_network_list_state(&pHeadNetList,daddr,1);
+		}
+	}
+	else if(protocol == IP_PROTCOL_UDP)
+	{
+		ret = search_network_list(&pHeadNetList,daddr,2);
+		if(ret == 2)
+		{
+			on_UdpConnectEvent_callback(src_bytes,sport,dst_bytes,dport);
+			change_network_list_state(&pHeadNetList,daddr,2);
+		}
+	}
+}
+
+/**
+ * @name:   report_connect_event
+ * @Author: qihoo360
+ * @msg:    ipv4连接事件, 按目的ip去重, pcap与conntrack两种来源共用
+ * @param   saddr/daddr:network order  sport/dport:host order
+ * @return: 
+ */
+void report_connect_event(u32 saddr,u16 sport,u32 daddr,u16 dport,u8 protocol)
+{
+	s8 src_bytes[20] = {0};
+	s8 dst_bytes[20] = {0};
+
+	ipNtoA(src_bytes, saddr);
+	ipNtoA(dst_bytes, daddr);
+	report_connect_key(IPV4_VERSION,daddr,src_bytes,sport,dst_bytes,dport,protocol);
+}
+
+/**
+ * @name:   report_connect_event6
+ * @Author: qihoo360
+ * @msg:    ipv6连接事件, 目的地址折叠成32位后与ipv4共用去重表
+ * @param   saddr/daddr:16字节 network order  sport/dport:host order
+ * @return: 
+ */
+void report_connect_event6(const u8 *saddr,u16 sport,const u8 *daddr,u16 dport,u8 protocol)
+{
+	char src_bytes[INET6_ADDRSTRLEN] = {0};
+	char dst_bytes[INET6_ADDRSTRLEN] = {0};
+	u32 word[4];
+	u32 key = 0;
+
+	memcpy(word, daddr, sizeof(word));
+	key = word[0] ^ word[1] ^ word[2] ^ word[3];
+	inet_ntop(AF_INET6, saddr, src_bytes, sizeof(src_bytes));
+	inet_ntop(AF_INET6, daddr, dst_bytes, sizeof(dst_bytes));
+	report_connect_key(IPV6_VERSION,key,src_bytes,sport,dst_bytes,dport,protocol);
+}
+
 // 刷新记录连接的ip
 static void update_network_list_state(networkNode_t *h)
 {
@@ -698,191 +708,234 @@ static void update_network_list_state(networkNode_t *h)
 	pthread_mutex_unlock(&network_lock);
 }
 
-#include "ethertype.h"
-
-struct vlan_8021q_header {
-	unsigned short	priority_cfi_vid;
-	unsigned short	ether_type;
-};
-
-void call(u_char *argument,const struct pcap_pkthdr* pack,const u_char *content)
-{	
-	// printf("network callback\n\n");
-	int ret = 0;
-	struct ETHERNET_FRAME_HEAD *ethernet;
+// ipv4本机地址, 包括其他被监测网卡上的地址
+static boolean is_local_ip4(u32 addr)
+{
+	if(local_net_ip[0] != '\0' && memcmp(&addr, local_net_ip_hex, sizeof(local_net_ip_hex)) == 0)
+		return TRUE;
+	return capture_is_local4(addr);
+}
 
-	struct iphdr   *ip;
-	struct tcphdr  *tcp;
-	struct udphdr  *udp;
-	struct icmphdr *icmp;
-	struct igmphdr *igmp;
-	struct arphdr  *arp;
+// ipv6本机地址, 网卡上的全部地址
+static boolean is_local_ip6(const u8 *addr)
+{
+	for(int i = 0;i < local_net_ip6_count;i ++){
+		if(memcmp(addr, local_net_ip6[i], 16) == 0)
+			return TRUE;
+	}
+	return capture_is_local6(addr);
+}
 
-	char PID[0x10] = {0};
-	char PIDname[0x80] = {0};
+/**
+ * @name:   dispatch_ipv4
+ * @Author: qihoo360
+ * @msg:    连接事件和攻击检测, l4头按ihl定位, 非首片不再当作l4头解析
+ * @param   
+ * @return: 
+ */
+static void dispatch_ipv4(const pkt_decoded *pkt,const struct pcap_pkthdr* pack)
+{
+	struct iphdr   *ip = (struct iphdr *)pkt->l3;
+	struct tcphdr  *tcp = (pkt->frag_off == 0 && pkt->l4_caplen >= sizeof(struct tcphdr)) ? (struct tcphdr *)pkt->l4 : NULL;
+	struct udphdr  *udp = (pkt->frag_off == 0 && pkt->l4_caplen >= sizeof(struct udphdr)) ? (struct udphdr *)pkt->l4 : NULL;
 	s8 src_bytes[20] = {0};
 	s8 dst_bytes[20] = {0};
-	u16 ether_type = 0;
-	int ether_offset = 0;
-
-	// 如果上面的文件存储打开，这里可以将捕获的数据content，写入文件里
-	if(pcap_dumper != NULL)
-	{
-		pcap_dump((char *)pcap_dumper, pack, content);
-	}
-	ethernet=(struct ETHERNET_FRAME_HEAD *)content;
-
-	ether_type = ntohs(ethernet->ether_type);
-	if (ether_type == ETHERTYPE_8021Q)
-	{
-		struct vlan_8021q_header *vptr = NULL;
-		vptr = (struct vlan_8021q_header*)(content+ETHERNET_HEADER);
-		ether_type = ntohs(vptr->ether_type);
-		ether_offset = sizeof(struct vlan_8021q_header);
-	}
-
-	if (ether_type == ETHERTYPE_IP)
-	{
-		ip=(struct iphdr*)(content+ETHERNET_HEADER + ether_offset);	
-		ipNtoA(src_bytes, ip->saddr);
-		ipNtoA(dst_bytes, ip->daddr);
+	boolean from_local = is_local_ip4(ip->saddr);
 
-		//网络连接事件、数据发送分析
-		switch(ip->protocol)
+	//网络连接事件、数据发送分析
+	switch(pkt->l4proto)
+	{
+		case IP_PROTCOL_TCP:
 		{
-			
-			case IP_PROTCOL_TCP:
+			if(tcp == NULL)break;
+			if (tcp->source == htons(21))//FTP port
 			{
-				tcp=(struct tcphdr*)(content+ ETHERNET_HEADER + IP_HEADER + ether_offset);
-
-				if (tcp->source == htons(21))//FTP port
-				{
-					int tcp_header_length = tcp->doff * 4;
-					char *data = (char*)(content + ETHERNET_HEADER + IP_HEADER + tcp_header_length + ether_offset);
-					// Check if the packet contains a FTP command
-					if (strncmp(data, "530", 3) == 0)
-					{
-						report_user_login_log(dst_bytes);
-					}
-				}
-
-				if(0 != memcmp(local_net_ip, src_bytes, strnlen(local_net_ip,sizeof(local_net_ip)) + 1))break;
-				if (tcp->syn != 1)break;
-				//ip 
-				ret = search_network_list(&pHeadNetList,(unsigned int)ip->daddr,0); 
-				if(ret == 0 || ret == 2)
+				u32 tcp_header_length = tcp->doff * 4;
+				// Check if the packet contains a FTP command
+				if (pkt->l4_caplen >= tcp_header_length + 3 && strncmp((char *)pkt->l4 + tcp_header_length, "530", 3) == 0)
 				{
-					on_IpConnectEvent_callback(IPV4_VERSION,src_bytes,ntohs(tcp->source),dst_bytes,ntohs(tcp->dest),IP_PROTCOL_TCP);
-					if(ret == 0)
-					{
-						append_network_list(&pHeadNetList,(unsigned int)ip->daddr);
-					}
-					change_network_list_state(&pHeadNetList,(unsigned int)ip->daddr,0);
+					ipNtoA(dst_bytes, ip->daddr);
+					report_user_login_log(dst_bytes);
 				}
-				//tcp
-				ret = search_network_list(&pHeadNetList,(unsigned int)ip->daddr,1); 
-				if(ret == 2)
-				{
-					on_TcpConnectEvent_callback(src_bytes,ntohs(tcp->source),dst_bytes,ntohs(tcp->dest));
-					change_network_list_state(&pHeadNetList,(unsigned int)ip->daddr,1);
-				}
-				break;
-			}
-			case IP_PROTCOL_UDP:
-			{
-				udp=(struct udphdr*)(content+ETHERNET_HEADER+IP_HEADER + ether_offset);
-					// dns
-				if(0 != memcmp(local_net_ip, src_bytes, strnlen(local_net_ip,sizeof(local_net_ip)) + 1))
-				{
-					dns_parser(src_bytes,dst_bytes,udp, 0);
-					break;
-				}
-				else
-				{
-					dns_parser(src_bytes,dst_bytes,udp, 1);
-				}
-				//ip
-				ret = search_network_list(&pHeadNetList,(unsigned int)ip->daddr,0); 
-				if(ret == 0 || ret == 2)
-				{
-					on_IpConnectEvent_callback(IPV4_VERSION,src_bytes,ntohs(udp->source),dst_bytes,ntohs(udp->dest),IP_PROTCOL_UDP);
-					if(ret == 0)
-					{
-						append_network_list(&pHeadNetList,(unsigned int)ip->daddr);
-					}
-					change_network_list_state(&pHeadNetList,(unsigned int)ip->daddr,0);
-				}
-				//udp
-				ret = search_network_list(&pHeadNetList,(unsigned int)ip->daddr,2); 
-				if(ret == 2)
-				{
-					on_UdpConnectEvent_callback(src_bytes,ntohs(udp->source),dst_bytes,ntohs(udp->dest));
-					change_network_list_state(&pHeadNetList,(unsigned int)ip->daddr,2);
-				}
-				break;
 			}
-			default:
+
+			if(conn_by_conntrack)break;
+			if(!from_local)break;
+			if (tcp->syn != 1)break;
+			report_connect_event(ip->saddr,pkt->sport,ip->daddr,pkt->dport,IP_PROTCOL_TCP);
+			break;
+		}
+		case IP_PROTCOL_UDP:
+		{
+			if(udp == NULL)break;
+			// dns, 只有53端口才需要地址字符串
+			if(pkt->sport == 53 || pkt->dport == 53)
 			{
-				if(0 != memcmp(local_net_ip, src_bytes, strnlen(local_net_ip,sizeof(local_net_ip)) + 1))break;
-				//ip
-				ret = search_network_list(&pHeadNetList,(unsigned int)ip->daddr,0); 
-				if(ret == 0 || ret == 2)
-				{
-					on_IpConnectEvent_callback(IPV4_VERSION,src_bytes,0,dst_bytes,0,ip->protocol);
-					if(ret == 0)
-					{
-						append_network_list(&pHeadNetList,(unsigned int)ip->daddr);
-					}
-					change_network_list_state(&pHeadNetList,(unsigned int)ip->daddr,0);
-				}
-				break;
+				ipNtoA(src_bytes, ip->saddr);
+				ipNtoA(dst_bytes, ip->daddr);
+				dns_parser(src_bytes,dst_bytes,udp, (from_local)?(1):(0), (int)pkt->l4_caplen);
 			}
+			if(!from_local)break;
+			if(conn_by_conntrack)break;
+			report_connect_event(ip->saddr,pkt->sport,ip->daddr,pkt->dport,IP_PROTCOL_UDP);
+			break;
+		}
+		default:
+		{
+			if(conn_by_conntrack)break;
+			if(!from_local)break;
+			report_connect_event(ip->saddr,0,ip->daddr,0,ip->protocol);
+			break;
 		}
+	}
 
-		//网络攻击事件和DNS事件、接收数据和部分发送数据分析
-		switch(ip->protocol)
+	//网络攻击事件和DNS事件、接收数据和部分发送数据分析
+	switch(pkt->l4proto)
+	{
+		case IP_PROTCOL_TCP:
 		{
-			case IP_PROTCOL_TCP:
-			{
-				tcp=(struct tcphdr*)(content+ ETHERNET_HEADER + IP_HEADER + ether_offset);//skip ether and ip header
-				if(0 != memcmp(local_net_ip, dst_bytes, strnlen(local_net_ip,sizeof(local_net_ip)) + 1)) return;
-				
-				tcp_parser(ip->saddr,ip->daddr,tcp,pack->len);
-				break;
-			}
-			case IP_PROTCOL_UDP:
-			{
-				udp=(struct udphdr*)(content+ETHERNET_HEADER+IP_HEADER + ether_offset);
+			if(tcp == NULL)return;
+			if(!is_local_ip4(ip->daddr)) return;
+			
+			tcp_parser(ip->saddr,ip->daddr,tcp,pack->len);
+			break;
+		}
+		case IP_PROTCOL_UDP:
+		{
+			if(udp == NULL)return;
+			
+			udp_parser(ip->saddr,ip->daddr,udp,pack->len);	 
+			break;
+		}
+		case IP_PROTCOL_ICMP:
+		{
+			// 非首片只看ip头, 死亡之ping靠它们累计长度
+			if(pkt->frag_off == 0 && pkt->l4_caplen < sizeof(struct icmphdr))return;
 				
-				udp_parser(ip->saddr,ip->daddr,udp,pack->len);	 
-				break;
-			}
-			case IP_PROTCOL_ICMP:
-			{
-				icmp=(struct icmphdr*)(content+ETHERNET_HEADER+IP_HEADER + ether_offset);
-					
-				icmp_parser(ip,icmp,pack->len); 
-				break;
-			}
-			case IP_PROTCOL_IGMP:
+			icmp_parser(ip,(struct icmphdr *)(pkt->l3 + pkt->l3_hlen),pack->len); 
+			break;
+		}
+		case IP_PROTCOL_IGMP:
+		{
+			igmp_parser();
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+/**
+ * @name:   dispatch_ipv6
+ * @Author: qihoo360
+ * @msg:    ipv6只做连接事件和dns, 攻击检测器的状态按ipv4地址建立
+ * @param   
+ * @return: 
+ */
+static void dispatch_ipv6(const pkt_decoded *pkt,const struct pcap_pkthdr* pack)
+{
+	boolean from_local = is_local_ip6(pkt->src);
+
+	switch(pkt->l4proto)
+	{
+		case IP_PROTCOL_TCP:
+		{
+			struct tcphdr *tcp = (struct tcphdr *)pkt->l4;
+			if(pkt->frag_off != 0 || pkt->l4_caplen < sizeof(struct tcphdr))break;
+			if(!from_local || tcp->syn != 1)break;
+			report_connect_event6(pkt->src,pkt->sport,pkt->dst,pkt->dport,IP_PROTCOL_TCP);
+			break;
+		}
+		case IP_PROTCOL_UDP:
+		{
+			if(pkt->frag_off != 0 || pkt->l4_caplen < sizeof(struct udphdr))break;
+			if(pkt->sport == 53 || pkt->dport == 53)
 			{
-				igmp=(struct igmphdr*)(content+ETHERNET_HEADER+IP_HEADER + ether_offset);
-				
-				igmp_parser();
-				break;
+				char src_bytes[INET6_ADDRSTRLEN] = {0};
+				char dst_bytes[INET6_ADDRSTRLEN] = {0};
+				pkt_addr_str(pkt, pkt->src, src_bytes, sizeof(src_bytes));
+				pkt_addr_str(pkt, pkt->dst, dst_bytes, sizeof(dst_bytes));
+				dns_parser(src_bytes,dst_bytes,(struct udphdr *)pkt->l4, (from_local)?(1):(0), (int)pkt->l4_caplen);
 			}
-			default:
-				break;
+			if(!from_local)break;
+			report_connect_event6(pkt->src,pkt->sport,pkt->dst,pkt->dport,IP_PROTCOL_UDP);
+			break;
 		}
+		case IPPROTO_ICMPV6:
+			break;		//邻居发现等链路本地报文, 不算连接
+		default:
+		{
+			if(!from_local)break;
+			report_connect_event6(pkt->src,0,pkt->dst,0,pkt->l4proto);
+			break;
+		}
+	}
+}
+
+/**
+ * @name:   data_dispatcher_decoded
+ * @Author: qihoo360
+ * @msg:    已解码的报文分发到各检测器, 抓包线程和离线回放共用
+ * @param   
+ * @return: 
+ */
+void data_dispatcher_decoded(const pkt_decoded *pkt,const struct pcap_pkthdr* pack)
+{
+	if(pkt->ip_version == 4)
+		dispatch_ipv4(pkt, pack);
+	else if(pkt->ip_version == 6)
+		dispatch_ipv6(pkt, pack);
+	else if(pkt->ether_type == ETHERTYPE_ARP && pkt->l3_caplen >= sizeof(struct arphdr) + 20)
+		arp_parser((struct arphdr *)pkt->l3);
+}
+
+void call(u_char *argument,const struct pcap_pkthdr* pack,const u_char *content)
+{	
+	capture_iface *iface = (capture_iface *)argument;
+	capture_flow_hook flow = NULL;
+	pkt_decoded pkt;
+
+	iface->counter.packets++;
+	iface->counter.bytes += pack->len;
+	// 如果上面的文件存储打开，这里可以将捕获的数据content，写入文件里
+	if(sniffer_writer_active() && iface == capture_manager_get(0))
+	{
+		sniffer_writer_push(pack, content);
 	}
-	else if(ether_type == ETHERTYPE_ARP)
+	if(pkt_decode(iface->linktype, content, pack->caplen, &pkt) != 0)
 	{
-		arp = (struct arphdr *)(content+ETHERNET_HEADER + ether_offset);
-		arp_parser(arp);
+		iface->counter.undecoded++;
+		return;
 	}
-//	api_data(argument,pack,content);//flow count
+	if(pkt.ip_version == 4)
+		iface->counter.ipv4++;
+	else if(pkt.ip_version == 6)
+		iface->counter.ipv6++;
+	else if(pkt.ether_type == ETHERTYPE_ARP)
+		iface->counter.arp++;
+	data_dispatcher_decoded(&pkt, pack);
+	// 流量统计与检测共用一次抓包和解码
+	if((flow = __atomic_load_n(&iface->flow, __ATOMIC_ACQUIRE)) != NULL)
+		flow(&pkt);
 	return;
 }
+/**
+ * @name:   data_dispatcher_tick
+ * @Author: qihoo360
+ * @msg:    1S一次，只处理由报文驱动的统计，离线回放按报文时间调用
+ * @param   
+ * @return: 
+ */
+void data_dispatcher_tick(void)
+{
+	udpport_value_consumer();
+	tcpport_value_consumer();
+	igmp_value_consumer();
+	icmp_value_consumer();
+	arp_parser_proc();
+	update_network_list_state(&pHeadNetList);
+	conn_table_expire();
+}
 /**
  * @name:   thread_parser
  * @Author: qihoo360
@@ -893,14 +946,9 @@ void call(u_char *argument,const struct pcap_pkthdr* pack,const u_char *content)
 static void *thread_parser(void *args){
 	for(;;){
 		sleep(1);
-		udpport_value_consumer();
-		tcpport_value_consumer();
-		//system_call_implthread();
+		system_call_implthread();//tcp connection census
 		pid_value_consumer();
-		igmp_value_consumer();
-		icmp_value_consumer();
-		arp_parser_proc();
-		update_network_list_state(&pHeadNetList);
+		data_dispatcher_tick();
 
 		if (exit_thread_parser_thd == TRUE)
 		{
@@ -942,32 +990,34 @@ void stop_pcap(void)
 {
 	int ret = 0;
 
-	if (thread_parser_thd)
-	{
-		exit_thread_parser_thd = TRUE;
-		ret = pthread_join(thread_parser_thd, NULL);
-		thread_parser_thd = 0;
-		exit_thread_parser_thd = FALSE;
-		log_i("thread_parser", "stop_pcap pthread_join thread_parser_thd\n");
-	}
-
+	if (thread_parser_thd)
+	{
+		exit_thread_parser_thd = TRUE;
+		ret = pthread_join(thread_parser_thd, NULL);
+		thread_parser_thd = 0;
+		exit_thread_parser_thd = FALSE;
+		log_i("thread_parser", "stop_pcap pthread_join thread_parser_thd\n");
+	}
+
 	system_call_free();
-
-	if (pcap_t_handle != NULL)
-	{
-		pcap_close(pcap_t_handle);
-		pcap_t_handle = NULL;
-		pcap_init_flag = FALSE;
-	}
-
-	if (ip_data_dispatcher_thd)
-	{
-		ret = pthread_join(ip_data_dispatcher_thd, NULL);
-		ip_data_dispatcher_thd = 0;
-		log_i("thread_parser", "stop_pcap pthread_join ip_data_dispatcher_thd\n");
-	}
+
+	// 抓包线程退出后再关闭各网卡的句柄
+	capture_manager_break();
+	if (ip_data_dispatcher_thd)
+	{
+		ret = pthread_join(ip_data_dispatcher_thd, NULL);
+		ip_data_dispatcher_thd = 0;
+		log_i("thread_parser", "stop_pcap pthread_join ip_data_dispatcher_thd\n");
+	}
+	capture_manager_close();
+	pcap_init_flag = FALSE;
 
 	sniffer_stop();
+	if(conn_by_conntrack)
+	{
+		ct_events_stop(CT_SOURCE_CONNECT);
+		conn_by_conntrack = FALSE;
+	}
 	destory_network_list(&pHeadNetList);
 
 	return;
@@ -1010,39 +1060,69 @@ static void *dispatcher(void *args)
 	static bool start_oneshot = false;
 	interface = args;
 	get_local_ip(interface);	
-	if((pcap_t_handle=pcap_open_live(interface,IF_INTERFACE_MAX_SIZE,1,100,error))==NULL){
+	// 主网卡和配置的其他网卡各一个句柄, 在本线程里epoll轮询
+	if(capture_manager_open(interface,call) < 0){
 		char log[256] = {0};
-		sprintf(log,"%s\n",error);
+		sprintf(log,"capture %s failed\n",interface);
 		log_v("networkmonitor", log);
 		return NULL;
 	}
-	//	pcap_setnonblock(pcap_t_handle, 1, error);
 	if(pcap_lookupnet(interface,&net_ip,&net_mask,error)==-1){
 		char log[256] = {0};
 		sprintf(log,"%s",error);
 		log_v("networkmonitor", log);
+		capture_manager_close();
 		return NULL;
 	}
 
-	create_crc_table();//from table
+	hashtableinit();//5-tuple table
+	dns_cache_init();//dns answers
 	tcp_scanner_init();//tcp init
 	udp_scanner_init();//udp init
-	//system_call_init();//you can delete it
+	system_call_init();//tcp connection census
+	if(ct_source_get(interface) & CT_SOURCE_CONNECT)
+		conn_by_conntrack = (ct_events_start(CT_SOURCE_CONNECT,interface,NULL) == 0)?(TRUE):(FALSE);
 	piddetection_scanner_init();//pid init
 	icmp_scan_init();//icmp init
 	//igmp no init
-	//arp  no init
 	create_parserthread();//thread create
-
+
 	get_local_mac(interface);
+	arp_table_init(TRUE);//arp bindings of every captured NIC, after the local mac is known
 	net_ip_addr.s_addr=net_ip;
 	net_ip_string  =inet_ntoa((struct in_addr){.s_addr=net_ip_addr.s_addr});
 	net_mask_string=inet_ntoa((struct in_addr){.s_addr=net_mask});
 	pcap_init_flag = TRUE;
-	pcap_loop(pcap_t_handle,-1,call,interface);
+	capture_manager_loop();
 	return NULL;
 }
 
+/**
+ * @name:   data_dispatcher_replay_init
+ * @Author: qihoo360
+ * @msg:    离线回放: 不打开网卡, 本机地址由调用者给出, 检测器按dispatcher()初始化
+ * @param   local_ip:本机ip字符串 local_mac:6字节, NULL为全0
+ * @return: 
+ */
+void data_dispatcher_replay_init(const s8 *local_ip, const u8 *local_mac)
+{
+	memset(local_net_ip, 0, sizeof(local_net_ip));
+	memset(local_net_ip_hex, 0, sizeof(local_net_ip_hex));
+	memset(local_net_mac_hex, 0, sizeof(local_net_mac_hex));
+	strncpy(local_net_ip, local_ip, sizeof(local_net_ip) - 1);
+	transfer_to_dex();
+	if(local_mac != NULL)
+		memcpy(local_net_mac_hex, local_mac, sizeof(local_net_mac_hex));
+
+	hashtableinit();//5-tuple table
+	dns_cache_init();//dns answers
+	tcp_scanner_init();//tcp init
+	udp_scanner_init();//udp init
+	icmp_scan_init();//icmp init
+	arp_table_init(FALSE);//arp bindings, local only
+	destory_network_list(&pHeadNetList);
+}
+
 void data_dispatcher_init(s8 *interface_name)
 {
 	static s8 tmp[IF_INTERFACE_NAME_MAX_SIZE];
@@ -0,0 +1,353 @@
+/*
+ * @Descripttion: bounded lru of dns answers, address -> domain
+ * @version: V0.0
+ * @Author: idps members
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "typedef.h"
+#include "dns_cache.h"
+
+static dns_cache_entry dns_entry[DNS_CACHE_ENTRIES];
+static u16 dns_bucket[DNS_CACHE_BUCKETS];
+static u16 dns_free = DNS_CACHE_NIL;
+static u16 dns_lru_head = DNS_CACHE_NIL;
+static u16 dns_lru_tail = DNS_CACHE_NIL;
+static boolean dns_cache_ready = FALSE;
+static pthread_mutex_t request_dnscache_lock = PTHREAD_MUTEX_INITIALIZER;
+static dns_cache_hook dns_hook = NULL;
+
+#define DNS_HEADER_LEN		(12)
+#define DNS_MAX_JUMPS		(16)
+#define DNS_TYPE_A			(1)
+#define DNS_TYPE_AAAA		(28)
+#define DNS_CLASS_IN		(1)
+
+static inline u32 dns_addr_len(int family)
+{
+	return (family == AF_INET6)?(16):(4);
+}
+
+static u32 dns_cache_hash(int family,const u8 *addr)
+{
+	u32 h = 0x811C9DC5u ^ (u32)family;
+	for(u32 i = 0;i < dns_addr_len(family);i ++){
+		h ^= addr[i];
+		h *= 0x01000193u;
+	}
+	h ^= h >> 15;
+	return h & (DNS_CACHE_BUCKETS - 1);
+}
+
+static u32 dns_cache_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (u32)ts.tv_sec;
+}
+
+static void dns_lru_unlink(u16 idx)
+{
+	dns_cache_entry *e = &dns_entry[idx];
+	if(e->prev != DNS_CACHE_NIL)
+		dns_entry[e->prev].next = e->next;
+	else
+		dns_lru_head = e->next;
+	if(e->next != DNS_CACHE_NIL)
+		dns_entry[e->next].prev = e->prev;
+	else
+		dns_lru_tail = e->prev;
+	e->prev = e->next = DNS_CACHE_NIL;
+}
+
+static void dns_lru_push(u16 idx)
+{
+	dns_cache_entry *e = &dns_entry[idx];
+	e->prev = DNS_CACHE_NIL;
+	e->next = dns_lru_head;
+	if(dns_lru_head != DNS_CACHE_NIL)
+		dns_entry[dns_lru_head].prev = idx;
+	dns_lru_head = idx;
+	if(dns_lru_tail == DNS_CACHE_NIL)
+		dns_lru_tail = idx;
+}
+/**
+ * @name:   dns_cache_remove
+ * @Author: qihoo360
+ * @msg:    lock held
+ * @param
+ * @return:
+ */
+static void dns_cache_remove(u16 idx)
+{
+	dns_cache_entry *e = &dns_entry[idx];
+	u16 *p = &dns_bucket[dns_cache_hash(e->family,e->addr)];
+	while(*p != DNS_CACHE_NIL && *p != idx)
+		p = &dns_entry[*p].hnext;
+	if(*p == idx)
+		*p = e->hnext;
+	dns_lru_unlink(idx);
+	e->used = 0;
+	e->hnext = dns_free;
+	dns_free = idx;
+}
+
+static u16 dns_cache_find(int family,const u8 *addr)
+{
+	u16 idx = dns_bucket[dns_cache_hash(family,addr)];
+	while(idx != DNS_CACHE_NIL){
+		dns_cache_entry *e = &dns_entry[idx];
+		if(e->family == family && memcmp(e->addr,addr,dns_addr_len(family)) == 0)
+			return idx;
+		idx = e->hnext;
+	}
+	return DNS_CACHE_NIL;
+}
+
+void dns_cache_init(void)
+{
+	pthread_mutex_lock(&request_dnscache_lock);
+	memset(dns_entry,0,sizeof(dns_entry));
+	for(int i = 0;i < DNS_CACHE_BUCKETS;i ++)
+		dns_bucket[i] = DNS_CACHE_NIL;
+	for(int i = 0;i < DNS_CACHE_ENTRIES;i ++){
+		dns_entry[i].hnext = (i + 1 < DNS_CACHE_ENTRIES)?(i + 1):(DNS_CACHE_NIL);
+		dns_entry[i].prev = dns_entry[i].next = DNS_CACHE_NIL;
+	}
+	dns_free = 0;
+	dns_lru_head = dns_lru_tail = DNS_CACHE_NIL;
+	dns_cache_ready = TRUE;
+	pthread_mutex_unlock(&request_dnscache_lock);
+}
+/**
+ * @name:   dns_cache_put
+ * @Author: qihoo360
+ * @msg:    O(1), the least recently used entry is recycled when full
+ * @param   addr:4 or 16 bytes, network order
+ * @return:
+ */
+void dns_cache_put(int family,const void *addr,const char *name,u32 ttl)
+{
+	u16 idx;
+	dns_cache_entry *e = NULL;
+
+	if(addr == NULL || name == NULL || name[0] == '\0')
+		return;
+	if(family != AF_INET && family != AF_INET6)
+		return;
+	if(ttl < DNS_CACHE_TTL_MIN)
+		ttl = DNS_CACHE_TTL_MIN;
+	if(ttl > DNS_CACHE_TTL_MAX)
+		ttl = DNS_CACHE_TTL_MAX;
+	pthread_mutex_lock(&request_dnscache_lock);
+	if(!dns_cache_ready){
+		pthread_mutex_unlock(&request_dnscache_lock);
+		return;
+	}
+	if((idx = dns_cache_find(family,addr)) != DNS_CACHE_NIL){
+		dns_lru_unlink(idx);
+	}
+	else{
+		if(dns_free == DNS_CACHE_NIL)
+			dns_cache_remove(dns_lru_tail);
+		idx = dns_free;
+		e = &dns_entry[idx];
+		dns_free = e->hnext;
+		memset(e->addr,0,sizeof(e->addr));
+		memcpy(e->addr,addr,dns_addr_len(family));
+		e->family = family;
+		e->used = 1;
+		e->hnext = dns_bucket[dns_cache_hash(family,e->addr)];
+		dns_bucket[dns_cache_hash(family,e->addr)] = idx;
+	}
+	e = &dns_entry[idx];
+	snprintf(e->name,sizeof(e->name),"%s",name);
+	e->expire = dns_cache_clock() + ttl;
+	dns_lru_push(idx);
+	pthread_mutex_unlock(&request_dnscache_lock);
+}
+
+boolean dns_cache_get(int family,const void *addr,char *name,int name_len)
+{
+	u16 idx;
+	boolean found = FALSE;
+
+	if(addr == NULL || name == NULL || name_len <= 0)
+		return FALSE;
+	if(family != AF_INET && family != AF_INET6)
+		return FALSE;
+	pthread_mutex_lock(&request_dnscache_lock);
+	if(dns_cache_ready && (idx = dns_cache_find(family,addr)) != DNS_CACHE_NIL){
+		if((int)(dns_entry[idx].expire - dns_cache_clock()) < 0){
+			dns_cache_remove(idx);
+		}
+		else{
+			snprintf(name,name_len,"%s",dns_entry[idx].name);
+			dns_lru_unlink(idx);
+			dns_lru_push(idx);
+			found = TRUE;
+		}
+	}
+	pthread_mutex_unlock(&request_dnscache_lock);
+	return found;
+}
+/**
+ * @name:   dns_read_name
+ * @Author: qihoo360
+ * @msg:    decode a possibly compressed name, every read is checked against len
+ * @param   next:offset right after the name in the record
+ * @return: 0:ok -1:malformed
+ */
+static int dns_read_name(const u8 *msg,u32 len,u32 off,char *out,u32 out_len,u32 *next)
+{
+	u32 pos = off,o = 0;
+	int jumps = 0;
+	boolean jumped = FALSE;
+
+	for(;;){
+		u8 l;
+		if(pos >= len)
+			return -1;
+		l = msg[pos];
+		if((l & 0xC0) == 0xC0){
+			if(pos + 1 >= len || ++ jumps > DNS_MAX_JUMPS)
+				return -1;
+			if(!jumped){
+				*next = pos + 2;
+				jumped = TRUE;
+			}
+			pos = ((u32)(l & 0x3F) << 8) | msg[pos + 1];
+			continue;
+		}
+		if(l & 0xC0)
+			return -1;
+		if(l == 0){
+			if(!jumped)
+				*next = pos + 1;
+			break;
+		}
+		if(pos + 1 + l > len)
+			return -1;
+		if(out != NULL){
+			if(o + l + 2 > out_len)
+				return -1;
+			if(o > 0)
+				out[o ++] = '.';
+			memcpy(&out[o],&msg[pos + 1],l);
+			o += l;
+		}
+		pos += 1 + l;
+	}
+	if(out != NULL)
+		out[o] = '\0';
+	return 0;
+}
+
+static inline u16 dns_get16(const u8 *p)
+{
+	return (u16)((p[0] << 8) | p[1]);
+}
+/**
+ * @name:   dns_cache_learn
+ * @Author: qihoo360
+ * @msg:    cname chains collapse to the queried name
+ * @param   msg:dns header onwards  len:bytes actually captured
+ * @return: addresses learned, -1:malformed
+ */
+int dns_cache_learn(const u8 *msg,u32 len)
+{
+	char qname[DNS_CACHE_NAME_MAX];
+	u32 off = DNS_HEADER_LEN;
+	u16 qdcount,ancount;
+	int learned = 0;
+	dns_cache_hook hook = __atomic_load_n(&dns_hook,__ATOMIC_ACQUIRE);
+
+	if(msg == NULL || len < DNS_HEADER_LEN)
+		return -1;
+	// QR=1 and RCODE=0 only
+	if(!(msg[2] & 0x80) || (msg[3] & 0x0F) != 0)
+		return -1;
+	qdcount = dns_get16(&msg[4]);
+	ancount = dns_get16(&msg[6]);
+	if(qdcount == 0)
+		return -1;
+	for(u16 i = 0;i < qdcount;i ++){
+		if(dns_read_name(msg,len,off,(i == 0)?(qname):(NULL),sizeof(qname),&off) != 0)
+			return -1;
+		if(off + 4 > len)
+			return -1;
+		off += 4;//qtype qclass
+	}
+	for(u16 i = 0;i < ancount;i ++){
+		u16 type,klass,rdlen;
+		u32 ttl;
+		if(dns_read_name(msg,len,off,NULL,0,&off) != 0)
+			return -1;
+		if(off + 10 > len)
+			return -1;
+		type  = dns_get16(&msg[off]);
+		klass = dns_get16(&msg[off + 2]);
+		ttl   = ((u32)msg[off + 4] << 24) | ((u32)msg[off + 5] << 16) | ((u32)msg[off + 6] << 8) | msg[off + 7];
+		rdlen = dns_get16(&msg[off + 8]);
+		off += 10;
+		if(off + rdlen > len)
+			return -1;
+		if(klass == DNS_CLASS_IN){
+			if(type == DNS_TYPE_A && rdlen == 4){
+				dns_cache_put(AF_INET,&msg[off],qname,ttl);
+				if(hook != NULL)
+					hook(AF_INET,&msg[off],qname,ttl);
+				learned ++;
+			}
+			else if(type == DNS_TYPE_AAAA && rdlen == 16){
+				dns_cache_put(AF_INET6,&msg[off],qname,ttl);
+				if(hook != NULL)
+					hook(AF_INET6,&msg[off],qname,ttl);
+				learned ++;
+			}
+		}
+		off += rdlen;
+	}
+	return learned;
+}
+/**
+ * @name:   dns_cache_set_hook
+ * @Author: qihoo360
+ * @msg:    the hook runs on the capture thread for every answer, keep it short
+ * @param   hook:NULL removes it
+ * @return:
+ */
+void dns_cache_set_hook(dns_cache_hook hook)
+{
+	__atomic_store_n(&dns_hook,hook,__ATOMIC_RELEASE);
+}
+/**
+ * @name:   dns_cache_replay
+ * @Author: qihoo360
+ * @msg:    snapshot under the lock, the hook runs without it
+ * @param   hook:called per entry
+ * @return:
+ */
+void dns_cache_replay(dns_cache_hook hook)
+{
+	static dns_cache_entry snapshot[DNS_CACHE_ENTRIES];
+	static pthread_mutex_t request_replay_lock = PTHREAD_MUTEX_INITIALIZER;
+	u32 count = 0,now = 0;
+
+	if(hook == NULL)
+		return;
+	pthread_mutex_lock(&request_replay_lock);
+	pthread_mutex_lock(&request_dnscache_lock);
+	now = dns_cache_clock();
+	for(u16 idx = dns_lru_head;idx != DNS_CACHE_NIL;idx = dns_entry[idx].next){
+		if((int)(dns_entry[idx].expire - now) > 0)
+			snapshot[count ++] = dns_entry[idx];
+	}
+	pthread_mutex_unlock(&request_dnscache_lock);
+	for(u32 i = 0;i < count;i ++)
+		hook(snapshot[i].family,snapshot[i].addr,snapshot[i].name,snapshot[i].expire - now);
+	pthread_mutex_unlock(&request_replay_lock);
+}
@@ -0,0 +1,286 @@
+/*
+ * @Descripttion: reversed label trie for dns allow/deny lists
+ * @version: V0.0
+ * @Author: idps members
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "typedef.h"
+#include "dns_trie.h"
+
+typedef struct dns_build_node{
+	char *label;
+	u16   label_len;
+	u16   child_count;
+	u32   exact;
+	u32   wildcard;
+	struct dns_build_node *child;
+	struct dns_build_node *sibling;
+}dns_build_node;
+
+struct dns_trie_builder{
+	dns_build_node root;
+	u32            nodes;
+	u32            pool_len;
+	u32            patterns;
+};
+
+/**
+ * @name:   dns_normalize
+ * @Author: qihoo360
+ * @msg:    lower case, trailing dot and spaces removed
+ * @param
+ * @return: length, -1 if too long
+ */
+static int dns_normalize(const char *in,char *out)
+{
+	int len = 0;
+	while(*in == ' ' || *in == '\t')
+		in ++;
+	while(in[len] != '\0'){
+		if(len >= DNS_TRIE_NAME_MAX - 1)
+			return -1;
+		out[len] = (char)tolower((unsigned char)in[len]);
+		len ++;
+	}
+	while(len > 0 && (out[len - 1] == ' ' || out[len - 1] == '\t' || out[len - 1] == '.'))
+		len --;
+	out[len] = '\0';
+	return len;
+}
+
+static int dns_label_cmp(const char *a,u16 alen,const char *b,u16 blen)
+{
+	if(alen != blen)
+		return (alen < blen)?(-1):(1);
+	return memcmp(a,b,alen);
+}
+
+dns_trie_builder *dns_trie_builder_new(void)
+{
+	dns_trie_builder *builder = (dns_trie_builder *)malloc(sizeof(dns_trie_builder));
+	if(builder == NULL)
+		return NULL;
+	memset(builder,0,sizeof(dns_trie_builder));
+	builder->nodes = 1;
+	return builder;
+}
+/**
+ * @name:   dns_trie_builder_add
+ * @Author: qihoo360
+ * @msg:    off the packet path, allocation per new label
+ * @param   pattern:"a.b.c" "*.b.c" or "*"
+ * @return: 0:ok -1:malformed or out of memory
+ */
+int dns_trie_builder_add(dns_trie_builder *builder,const char *pattern,u32 value)
+{
+	char name[DNS_TRIE_NAME_MAX];
+	int len = 0,end = 0;
+	boolean wildcard = FALSE;
+	dns_build_node *node = NULL;
+
+	if(builder == NULL || pattern == NULL || value == 0)
+		return -1;
+	if((len = dns_normalize(pattern,name)) <= 0)
+		return -1;
+	if(name[0] == '*'){
+		if(len == 1){
+			builder->root.wildcard = value;
+			builder->patterns ++;
+			return 0;
+		}
+		if(name[1] != '.')
+			return -1;
+		wildcard = TRUE;
+		memmove(name,name + 2,len - 1);
+		len -= 2;
+	}
+	node = &builder->root;
+	end = len;
+	while(end > 0){
+		int start = end;
+		dns_build_node *c = NULL;
+		while(start > 0 && name[start - 1] != '.')
+			start --;
+		if(end - start == 0 || end - start > DNS_TRIE_LABEL_MAX || name[start] == '*')
+			return -1;
+		for(c = node->child;c != NULL;c = c->sibling){
+			if(dns_label_cmp(c->label,c->label_len,&name[start],end - start) == 0)
+				break;
+		}
+		if(c == NULL){
+			c = (dns_build_node *)malloc(sizeof(dns_build_node));
+			if(c == NULL)
+				return -1;
+			memset(c,0,sizeof(dns_build_node));
+			if((c->label = (char *)malloc(end - start)) == NULL){
+				free(c);
+				return -1;
+			}
+			memcpy(c->label,&name[start],end - start);
+			c->label_len = end - start;
+			c->sibling = node->child;
+			node->child = c;
+			node->child_count ++;
+			builder->nodes ++;
+			builder->pool_len += end - start;
+		}
+		node = c;
+		end = start - 1;
+	}
+	if(end == 0)
+		return -1;//leading dot
+	if(wildcard)
+		node->wildcard = value;
+	else
+		node->exact = value;
+	builder->patterns ++;
+	return 0;
+}
+
+static void dns_build_free(dns_build_node *node)
+{
+	dns_build_node *c = node->child,*next = NULL;
+	while(c != NULL){
+		next = c->sibling;
+		dns_build_free(c);
+		free(c->label);
+		free(c);
+		c = next;
+	}
+	node->child = NULL;
+}
+
+void dns_trie_builder_free(dns_trie_builder *builder)
+{
+	if(builder == NULL)
+		return;
+	dns_build_free(&builder->root);
+	free(builder);
+}
+
+static int dns_build_cmp(const void *a,const void *b)
+{
+	const dns_build_node *x = *(dns_build_node * const *)a;
+	const dns_build_node *y = *(dns_build_node * const *)b;
+	return dns_label_cmp(x->label,x->label_len,y->label,y->label_len);
+}
+/**
+ * @name:   dns_trie_compile
+ * @Author: qihoo360
+ * @msg:    breadth first layout, siblings end up contiguous and sorted
+ * @param
+ * @return:
+ */
+dns_trie *dns_trie_compile(dns_trie_builder *builder)
+{
+	dns_trie *trie = NULL;
+	dns_build_node **order = NULL,**sorted = NULL;
+	u32 head = 0,tail = 1,pool = 0;
+
+	if(builder == NULL)
+		return NULL;
+	trie = (dns_trie *)malloc(sizeof(dns_trie));
+	order = (dns_build_node **)malloc(builder->nodes * sizeof(dns_build_node *));
+	sorted = (dns_build_node **)malloc(builder->nodes * sizeof(dns_build_node *));
+	if(trie != NULL){
+		memset(trie,0,sizeof(dns_trie));
+		trie->node = (dns_trie_node *)calloc(builder->nodes,sizeof(dns_trie_node));
+		trie->pool = (char *)malloc(builder->pool_len + 1);
+	}
+	if(trie == NULL || order == NULL || sorted == NULL || trie->node == NULL || trie->pool == NULL){
+		dns_trie_free(trie);
+		free(order);
+		free(sorted);
+		dns_trie_builder_free(builder);
+		return NULL;
+	}
+	order[0] = &builder->root;
+	while(head < tail){
+		dns_build_node *b = order[head];
+		dns_trie_node *n = &trie->node[head];
+		u32 count = 0;
+		n->label = pool;
+		n->label_len = b->label_len;
+		n->exact = b->exact;
+		n->wildcard = b->wildcard;
+		if(b->label_len > 0)
+			memcpy(&trie->pool[pool],b->label,b->label_len);
+		pool += b->label_len;
+		for(dns_build_node *c = b->child;c != NULL;c = c->sibling)
+			sorted[count ++] = c;
+		qsort(sorted,count,sizeof(dns_build_node *),dns_build_cmp);
+		n->child_start = tail;
+		n->child_count = count;
+		for(u32 i = 0;i < count;i ++)
+			order[tail ++] = sorted[i];
+		head ++;
+	}
+	trie->nodes = tail;
+	trie->patterns = builder->patterns;
+	free(order);
+	free(sorted);
+	dns_trie_builder_free(builder);
+	return trie;
+}
+
+void dns_trie_free(dns_trie *trie)
+{
+	if(trie == NULL)
+		return;
+	free(trie->node);
+	free(trie->pool);
+	free(trie);
+}
+
+static const dns_trie_node *dns_trie_child(const dns_trie *trie,const dns_trie_node *n,const char *label,u16 len)
+{
+	u32 lo = n->child_start,hi = n->child_start + n->child_count;
+	while(lo < hi){
+		u32 mid = (lo + hi) / 2;
+		const dns_trie_node *c = &trie->node[mid];
+		int r = dns_label_cmp(&trie->pool[c->label],c->label_len,label,len);
+		if(r == 0)
+			return c;
+		if(r < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+/**
+ * @name:   dns_trie_match
+ * @Author: qihoo360
+ * @msg:    walks the labels right to left, binary search among siblings
+ * @param
+ * @return: value of the matching pattern, 0:no match
+ */
+u32 dns_trie_match(const dns_trie *trie,const char *name)
+{
+	char buff[DNS_TRIE_NAME_MAX];
+	const dns_trie_node *n = NULL;
+	u32 best = 0;
+	int end = 0;
+
+	if(trie == NULL || name == NULL || trie->nodes == 0)
+		return 0;
+	if((end = dns_normalize(name,buff)) <= 0)
+		return 0;
+	n = &trie->node[0];
+	while(end > 0){
+		int start = end;
+		if(n->wildcard)
+			best = n->wildcard;
+		while(start > 0 && buff[start - 1] != '.')
+			start --;
+		if((n = dns_trie_child(trie,n,&buff[start],end - start)) == NULL)
+			return best;
+		end = start - 1;
+	}
+	if(end < 0 && n->exact)
+		return n->exact;
+	return best;
+}
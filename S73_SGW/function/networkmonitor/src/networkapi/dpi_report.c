@@ -24,6 +24,8 @@ unsigned int thresholdLog = 0;
 // 上报攻击开关
 #define TYPESATTACK_NUM    (100)
 static int netEventReportSwitch[TYPESATTACK_NUM] = {0};
+// 检测器产生的事件数, 不受上报开关影响(离线回放统计)
+static u32 netEventProduced[TYPESATTACK_NUM] = {0};
 
 #define MAXLENGTH (10240)
 #define SING_MUX  (2000)
@@ -128,6 +130,8 @@ void startlog(void)
 void report_log(u8 event,s8 *s_addr,s32 port, s8 *net_info)
 {
 	//on_NetEventReport_callback(event,s_addr,port);
+	if(event<TYPESATTACK_NUM)
+		__atomic_add_fetch(&netEventProduced[event],1,__ATOMIC_RELAXED);
 	// 判断是否上报
 	if(event<TYPESATTACK_NUM && !netEventReportSwitch[event])
 		return;
@@ -164,6 +168,16 @@ void setNetEventReportSwitch(int index, int para)
 		netEventReportSwitch[index] = para;
 } 
 
+// 各事件产生次数, reset后重新计数
+u32 report_log_count(u8 event)
+{
+	return (event<TYPESATTACK_NUM)?(netEventProduced[event]):(0);
+}
+void report_log_count_reset(void)
+{
+	memset(netEventProduced, 0, sizeof(netEventProduced));
+}
+
 // 记录攻击数值，1全部记录记录, index单独记录
 void value_log(int index, int value, int threshold)
 {
@@ -0,0 +1,574 @@
+/*
+ * @Descripttion: offline pcap replay and synthetic attack traffic for measuring the packet pipeline
+ * @version: V0.0
+ * @Author: idps members
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pcap.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <net/ethernet.h>
+#include <net/if_arp.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <netinet/ip_icmp.h>
+#include "typedef.h"
+#include "api_networkmonitor.h"
+#include "data_dispatcher.h"
+#include "dpi_report.h"
+#include "flow_init.h"
+#include "pcap_replay.h"
+#include "pkt_decode.h"
+#include "spdloglib.h"
+
+#define REPLAY_FRAME_MAX		(1514)
+#define REPLAY_TS_BASE			(1600000000)
+#define REPLAY_POD_FRAGS		(45)		//45 * 1480 > 65535
+#define REPLAY_POD_FRAG_LEN		(1480)
+
+typedef struct{
+	u32  local_ip;			//network order
+	u8   local_mac[6];
+	u32  rand;
+	u32  seq;
+	u8  *frame;				//frame_buf + 2, ip header 4-byte aligned as the capture ring delivers it
+	u8   frame_buf[REPLAY_FRAME_MAX + 2];
+}replay_gen_ctx;
+
+typedef int (*replay_gen_fn)(replay_gen_ctx *ctx);
+
+typedef struct{
+	const char    *name;
+	u32            pps;			//timestamps of the generated stream
+	replay_gen_fn  fn;			//fills ctx->frame, returns its length
+}replay_generator;
+
+static const u8 replay_local_mac[6] = {0x02,0x00,0x00,0x00,0x00,0x01};
+static const u8 replay_peer_mac[6]  = {0x02,0x66,0x00,0x00,0x00,0x01};
+static const char *replay_det_name[REPLAY_DET_MAX] = {"tcp","udp","dns","icmp","igmp","arp","other","decode","flow","tick"};
+static replay_stats *replay_cur = NULL;		//callbacks have no argument
+extern invokefunction callbackfunction;
+
+static unsigned long long replay_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static u32 replay_rand(replay_gen_ctx *ctx)
+{
+	// xorshift32, the same stream on every run
+	ctx->rand ^= ctx->rand << 13;
+	ctx->rand ^= ctx->rand >> 17;
+	ctx->rand ^= ctx->rand << 5;
+	return ctx->rand;
+}
+
+static u16 replay_csum(const u8 *data,int len)
+{
+	u32 sum = 0;
+	for(int i = 0;i + 1 < len;i += 2)
+		sum += (u32)((data[i] << 8) | data[i + 1]);
+	if(len & 1)
+		sum += (u32)(data[len - 1] << 8);
+	while(sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	return htons((u16)~sum);
+}
+
+static void replay_eth(u8 *frame,const u8 *dst,const u8 *src,u16 type)
+{
+	struct ether_header *eth = (struct ether_header *)frame;
+	memcpy(eth->ether_dhost,dst,6);
+	memcpy(eth->ether_shost,src,6);
+	eth->ether_type = htons(type);
+}
+
+// payload_len is what follows the ip header in this frame
+static struct iphdr *replay_ip(u8 *frame,u32 saddr,u32 daddr,u8 protocol,int payload_len,u16 frag_off)
+{
+	struct iphdr *ip = (struct iphdr *)(frame + sizeof(struct ether_header));
+	memset(ip,0,sizeof(*ip));
+	ip->version  = 4;
+	ip->ihl      = 5;
+	ip->ttl      = 64;
+	ip->protocol = protocol;
+	ip->tot_len  = htons((u16)(sizeof(struct iphdr) + payload_len));
+	ip->frag_off = htons(frag_off);
+	ip->saddr    = saddr;
+	ip->daddr    = daddr;
+	ip->check    = replay_csum((u8 *)ip,sizeof(struct iphdr));
+	return ip;
+}
+
+static u32 replay_attacker(replay_gen_ctx *ctx)
+{
+	u32 r = replay_rand(ctx);
+	return htonl(0x0A420000 | (r & 0xFFFF));		//10.66.0.0/16
+}
+
+// random sources, one SYN each, to local:80
+static int gen_syn_flood(replay_gen_ctx *ctx)
+{
+	u8 *frame = ctx->frame;
+	struct tcphdr *tcp = (struct tcphdr *)(frame + sizeof(struct ether_header) + sizeof(struct iphdr));
+
+	replay_eth(frame,replay_local_mac,replay_peer_mac,ETHERTYPE_IP);
+	replay_ip(frame,replay_attacker(ctx),ctx->local_ip,IPPROTO_TCP,sizeof(struct tcphdr),0);
+	memset(tcp,0,sizeof(*tcp));
+	tcp->source = htons((u16)(1024 + replay_rand(ctx) % 60000));
+	tcp->dest   = htons(80);
+	tcp->seq    = replay_rand(ctx);
+	tcp->doff   = 5;
+	tcp->syn    = 1;
+	tcp->window = htons(64240);
+	return sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct tcphdr);
+}
+
+// one source walking every destination port
+static int gen_udp_scan(replay_gen_ctx *ctx)
+{
+	u8 *frame = ctx->frame;
+	struct udphdr *udp = (struct udphdr *)(frame + sizeof(struct ether_header) + sizeof(struct iphdr));
+
+	replay_eth(frame,replay_local_mac,replay_peer_mac,ETHERTYPE_IP);
+	replay_ip(frame,htonl(0x0A420007),ctx->local_ip,IPPROTO_UDP,sizeof(struct udphdr),0);
+	udp->source = htons(40000);
+	udp->dest   = htons((u16)(1 + ctx->seq % 65535));
+	udp->len    = htons(sizeof(struct udphdr));
+	udp->check  = 0;
+	return sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct udphdr);
+}
+
+// echo request fragmented past 65535 bytes, REPLAY_POD_FRAGS frames per attack
+static int gen_ping_of_death(replay_gen_ctx *ctx)
+{
+	u8 *frame = ctx->frame;
+	u32 frag = ctx->seq % REPLAY_POD_FRAGS;
+	u16 frag_off = (u16)(frag * REPLAY_POD_FRAG_LEN / 8);
+	u8 *payload = frame + sizeof(struct ether_header) + sizeof(struct iphdr);
+
+	if(frag < REPLAY_POD_FRAGS - 1)
+		frag_off |= IP_MF;
+	replay_eth(frame,replay_local_mac,replay_peer_mac,ETHERTYPE_IP);
+	replay_ip(frame,htonl(0x0A420009),ctx->local_ip,IPPROTO_ICMP,REPLAY_POD_FRAG_LEN,frag_off);
+	memset(payload,0x5A,REPLAY_POD_FRAG_LEN);
+	if(frag == 0){
+		struct icmphdr *icmp = (struct icmphdr *)payload;
+		memset(icmp,0,sizeof(*icmp));
+		icmp->type = ICMP_ECHO;
+		icmp->un.echo.id = htons(0x360);
+		icmp->un.echo.sequence = htons((u16)(ctx->seq / REPLAY_POD_FRAGS));
+	}
+	return sizeof(struct ether_header) + sizeof(struct iphdr) + REPLAY_POD_FRAG_LEN;
+}
+
+// replies claiming the local address from a forged MAC, and replies to it with a wrong target MAC
+static int gen_arp_spoof(replay_gen_ctx *ctx)
+{
+	u8 *frame = ctx->frame;
+	struct arphdr *arp = (struct arphdr *)(frame + sizeof(struct ether_header));
+	u8 *body = (u8 *)(arp + 1);		//sha sip tha tip
+	u32 gateway = (ctx->local_ip & htonl(0xFFFFFF00)) | htonl(1);
+	u8 forged[6] = {0x02,0x66,0x00,0x00,0x00,0x00};
+
+	forged[5] = (u8)(replay_rand(ctx) | 2);
+	arp->ar_hrd = htons(ARPHRD_ETHER);
+	arp->ar_pro = htons(ETHERTYPE_IP);
+	arp->ar_hln = 6;
+	arp->ar_pln = 4;
+	arp->ar_op  = htons(ARPOP_REPLY);
+	if(ctx->seq & 1){
+		replay_eth(frame,replay_local_mac,forged,ETHERTYPE_ARP);
+		memcpy(body,forged,6);
+		memcpy(body + 6,&gateway,4);
+		memcpy(body + 10,forged,6);
+		memcpy(body + 16,&ctx->local_ip,4);
+	}
+	else{
+		static const u8 broadcast[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+		replay_eth(frame,broadcast,forged,ETHERTYPE_ARP);
+		memcpy(body,forged,6);
+		memcpy(body + 6,&ctx->local_ip,4);
+		memset(body + 10,0,6);
+		memcpy(body + 16,&gateway,4);
+	}
+	return sizeof(struct ether_header) + sizeof(struct arphdr) + 20;
+}
+
+// query from the device, then the answer, for a new name every pair
+static int gen_dns_storm(replay_gen_ctx *ctx)
+{
+	u8 *frame = ctx->frame;
+	struct udphdr *udp = (struct udphdr *)(frame + sizeof(struct ether_header) + sizeof(struct iphdr));
+	u8 *dns = (u8 *)(udp + 1);
+	u32 resolver = htonl(0x08080808);
+	u16 id = (u16)(ctx->seq >> 1);
+	int response = ctx->seq & 1;
+	char label[16];
+	int len = 12,label_len = 0;
+
+	label_len = snprintf(label,sizeof(label),"h%u",(ctx->seq >> 1) % 50000);
+	memset(dns,0,12);
+	dns[0] = (u8)(id >> 8);
+	dns[1] = (u8)id;
+	dns[2] = response ? 0x81 : 0x01;
+	dns[3] = response ? 0x80 : 0x00;
+	dns[5] = 1;								//qdcount
+	dns[7] = response ? 1 : 0;				//ancount
+	dns[len++] = (u8)label_len;
+	memcpy(dns + len,label,label_len);
+	len += label_len;
+	memcpy(dns + len,"\x05storm\x07""example\x00\x00\x01\x00\x01",19);
+	len += 19;
+	if(response){
+		u32 answer = htonl(0xC6336400 | (id & 0xFF));		//198.51.100.0/24
+		memcpy(dns + len,"\xC0\x0C\x00\x01\x00\x01\x00\x00\x00\x3C\x00\x04",12);
+		len += 12;
+		memcpy(dns + len,&answer,4);
+		len += 4;
+	}
+
+	if(response){
+		replay_eth(frame,replay_local_mac,replay_peer_mac,ETHERTYPE_IP);
+		replay_ip(frame,resolver,ctx->local_ip,IPPROTO_UDP,sizeof(struct udphdr) + len,0);
+		udp->source = htons(53);
+		udp->dest   = htons((u16)(30000 + id % 20000));
+	}
+	else{
+		replay_eth(frame,replay_peer_mac,replay_local_mac,ETHERTYPE_IP);
+		replay_ip(frame,ctx->local_ip,resolver,IPPROTO_UDP,sizeof(struct udphdr) + len,0);
+		udp->source = htons((u16)(30000 + id % 20000));
+		udp->dest   = htons(53);
+	}
+	udp->len   = htons((u16)(sizeof(struct udphdr) + len));
+	udp->check = 0;
+	return sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct udphdr) + len;
+}
+
+static const replay_generator replay_generators[] = {
+	{"syn_flood",		20000,	gen_syn_flood},
+	{"udp_scan",		5000,	gen_udp_scan},
+	{"ping_of_death",	2000,	gen_ping_of_death},
+	{"arp_spoof",		200,	gen_arp_spoof},
+	{"dns_storm",		5000,	gen_dns_storm},
+};
+
+/* event callbacks while replaying, counted instead of uploaded */
+static void replay_on_ip_connect(int ip_version,char *src_ip,int src_port,char *dst_ip,int dst_port,int protocol,char *domain)
+{
+	replay_cur->ip_connect++;
+}
+static void replay_on_tcp_connect(char* srcIp, int srcPort,char* desIp, int desPort)
+{
+	replay_cur->tcp_connect++;
+}
+static void replay_on_udp_connect(char* srcIp, int srcPort,char* desIp, int desPort)
+{
+	replay_cur->udp_connect++;
+}
+static void replay_on_dns_inquire(char* dns)
+{
+	replay_cur->dns_inquire++;
+}
+static void replay_on_dns_response(char* dns, char* ip_list)
+{
+	replay_cur->dns_response++;
+}
+
+/**
+ * @name:   replay_classify
+ * @Author: qihoo360
+ * @msg:    按call()的分发方式归到检测器
+ * @param
+ * @return: REPLAY_DET_*
+ */
+static int replay_classify(const pkt_decoded *pkt)
+{
+	if(pkt->ip_version == 0)
+		return (pkt->ether_type == ETHERTYPE_ARP) ? REPLAY_DET_ARP : REPLAY_DET_OTHER;
+	switch(pkt->l4proto)
+	{
+		case IPPROTO_TCP:
+			return REPLAY_DET_TCP;
+		case IPPROTO_UDP:
+			return (pkt->sport == 53 || pkt->dport == 53) ? REPLAY_DET_DNS : REPLAY_DET_UDP;
+		case IPPROTO_ICMP:
+		case IPPROTO_ICMPV6:
+			return REPLAY_DET_ICMP;
+		case IPPROTO_IGMP:
+			return REPLAY_DET_IGMP;
+		default:
+			return REPLAY_DET_OTHER;
+	}
+}
+
+typedef struct{
+	replay_stats *stats;
+	int  mode;
+	int  linktype;
+	long next_tick;
+	struct timeval first;
+	unsigned long long start_ns;
+}replay_run;
+
+static void replay_packet(replay_run *run,const struct pcap_pkthdr *hdr,const u8 *data)
+{
+	replay_stats *st = run->stats;
+	unsigned long long t0 = 0,t1 = 0,t2 = 0,t3 = 0;
+	pkt_decoded pkt;
+	int det = 0;
+
+	if(st->packets + st->skipped == 0){
+		run->first = hdr->ts;
+		run->next_tick = hdr->ts.tv_sec + 1;
+	}
+	if(run->mode == REPLAY_REALTIME){
+		long long due = ((long long)(hdr->ts.tv_sec - run->first.tv_sec) * 1000000LL + (hdr->ts.tv_usec - run->first.tv_usec)) * 1000LL;
+		long long lag = due - (long long)(replay_now_ns() - run->start_ns);
+		if(lag > 1000)
+			usleep((useconds_t)(lag / 1000));
+	}
+	// 统计线程按报文时间每秒运行一次, 空闲的间隔合并为一次
+	if(hdr->ts.tv_sec >= run->next_tick){
+		t0 = replay_now_ns();
+		data_dispatcher_tick();
+		t1 = replay_now_ns();
+		st->det_calls[REPLAY_DET_TICK]++;
+		st->det_ns[REPLAY_DET_TICK] += t1 - t0;
+		st->busy_ns += t1 - t0;
+		run->next_tick = hdr->ts.tv_sec + 1;
+	}
+	st->span_us = (unsigned long long)(hdr->ts.tv_sec - run->first.tv_sec) * 1000000ULL + hdr->ts.tv_usec - run->first.tv_usec;
+	// 与抓包线程一样每个报文只解码一次, 两条流水线共用
+	t0 = replay_now_ns();
+	if(pkt_decode(run->linktype,data,hdr->caplen,&pkt) != 0){
+		st->skipped++;
+		return;
+	}
+	t1 = replay_now_ns();
+	data_dispatcher_decoded(&pkt,hdr);
+	t2 = replay_now_ns();
+	flow_replay_decoded(&pkt);
+	t3 = replay_now_ns();
+
+	det = replay_classify(&pkt);
+	st->packets++;
+	st->bytes += hdr->len;
+	st->det_calls[REPLAY_DET_DECODE]++;
+	st->det_ns[REPLAY_DET_DECODE] += t1 - t0;
+	st->det_calls[det]++;
+	st->det_ns[det] += t2 - t1;
+	st->det_calls[REPLAY_DET_FLOW]++;
+	st->det_ns[REPLAY_DET_FLOW] += t3 - t2;
+	st->busy_ns += t3 - t0;
+}
+
+static int replay_file(replay_run *run,const char *path)
+{
+	char errbuf[PCAP_ERRBUF_SIZE] = {0};
+	struct pcap_pkthdr *hdr = NULL;
+	const u_char *data = NULL;
+	pcap_t *pd = pcap_open_offline(path,errbuf);
+	u32 *aligned = NULL;
+	int ret = 0;
+
+	if(pd == NULL){
+		char log[256] = {0};
+		snprintf(log,sizeof(log),"replay open %s: %s",path,errbuf);
+		log_e("networkmonitor", log);
+		return -1;
+	}
+	run->linktype = pcap_datalink(pd);
+	if(!pkt_decode_supported(run->linktype)){
+		char log[256] = {0};
+		snprintf(log,sizeof(log),"replay %s: datalink %d not supported",path,run->linktype);
+		log_e("networkmonitor", log);
+		pcap_close(pd);
+		return -1;
+	}
+	// 与抓包环形缓冲一致, ip头4字节对齐后送入
+	aligned = malloc(REPLAY_SNAPLEN + 4);
+	if(aligned == NULL){
+		pcap_close(pd);
+		return -1;
+	}
+	while((ret = pcap_next_ex(pd,&hdr,&data)) >= 0){
+		if(ret != 1 || hdr->caplen > REPLAY_SNAPLEN)
+			continue;
+		memcpy((u8 *)aligned + 2,data,hdr->caplen);
+		replay_packet(run,hdr,(u8 *)aligned + 2);
+	}
+	free(aligned);
+	pcap_close(pd);
+	return 0;
+}
+
+static int replay_generate(replay_run *run,const replay_generator *gen,u32 packets,const char *out,u32 local_ip)
+{
+	replay_gen_ctx *ctx = calloc(1,sizeof(replay_gen_ctx));
+	pcap_t *dead = NULL;
+	pcap_dumper_t *dumper = NULL;
+	struct pcap_pkthdr hdr;
+	unsigned long long step_us = 1000000ULL / gen->pps;
+
+	if(ctx == NULL)
+		return -1;
+	if(out != NULL && out[0] != '\0'){
+		dead = pcap_open_dead(DLT_EN10MB,REPLAY_SNAPLEN);
+		dumper = (dead != NULL) ? pcap_dump_open(dead,out) : NULL;
+		if(dumper == NULL){
+			char log[256] = {0};
+			snprintf(log,sizeof(log),"replay cannot write %s",out);
+			log_e("networkmonitor", log);
+		}
+	}
+	ctx->frame = ctx->frame_buf + 2;
+	ctx->local_ip = local_ip;
+	memcpy(ctx->local_mac,replay_local_mac,6);
+	ctx->rand = 0x36036036;
+	for(ctx->seq = 0;ctx->seq < packets;ctx->seq ++){
+		unsigned long long at = (unsigned long long)ctx->seq * step_us;
+		memset(ctx->frame,0,REPLAY_FRAME_MAX);
+		hdr.caplen = hdr.len = (bpf_u_int32)gen->fn(ctx);
+		hdr.ts.tv_sec  = REPLAY_TS_BASE + (long)(at / 1000000ULL);
+		hdr.ts.tv_usec = (long)(at % 1000000ULL);
+		if(dumper != NULL)
+			pcap_dump((u_char *)dumper,&hdr,ctx->frame);
+		replay_packet(run,&hdr,ctx->frame);
+	}
+	if(dumper != NULL)
+		pcap_dump_close(dumper);
+	if(dead != NULL)
+		pcap_close(dead);
+	free(ctx);
+	return 0;
+}
+
+/**
+ * @name:   pcap_replay_run
+ * @Author: qihoo360
+ * @msg:    离线驱动call()和流量统计, 检测器状态会被重置
+ * @param   source:文件或生成器 local_ip:被监测的本机地址 mode:REPLAY_AS_FAST/REPLAY_REALTIME
+ * @return: 0 ok, -1 source could not be opened
+ */
+int pcap_replay_run(const char *source,const char *local_ip,int mode,replay_stats *stats)
+{
+	invokefunction saved;
+	invokefunction counting;
+	replay_run run;
+	char name[32] = {0};
+	const char *colon = NULL;
+	const replay_generator *gen = NULL;
+	u32 packets = REPLAY_GEN_PACKETS;
+	const char *out = NULL;
+	struct in_addr addr;
+	int ret = 0;
+
+	if(source == NULL || stats == NULL)
+		return -1;
+	if(local_ip == NULL || inet_pton(AF_INET,local_ip,&addr) != 1){
+		local_ip = REPLAY_LOCAL_IP;
+		inet_pton(AF_INET,local_ip,&addr);
+	}
+	// "<generator>[:packets[:out.pcap]]"
+	colon = strchr(source,':');
+	snprintf(name,sizeof(name),"%.*s",(colon != NULL) ? (int)(colon - source) : (int)strlen(source),source);
+	for(int i = 0;i < (int)(sizeof(replay_generators) / sizeof(replay_generators[0]));i ++){
+		if(strcmp(replay_generators[i].name,name) == 0)
+			gen = &replay_generators[i];
+	}
+	if(gen != NULL && colon != NULL){
+		packets = (u32)strtoul(colon + 1,NULL,10);
+		out = strchr(colon + 1,':');
+		out = (out != NULL) ? out + 1 : NULL;
+		if(packets == 0)
+			packets = REPLAY_GEN_PACKETS;
+	}
+
+	memset(stats,0,sizeof(*stats));
+	memset(&run,0,sizeof(run));
+	run.stats = stats;
+	run.mode  = mode;
+	run.linktype = DLT_EN10MB;			//generators build ethernet frames
+	memcpy(&saved,&callbackfunction,sizeof(saved));
+	memset(&counting,0,sizeof(counting));
+	counting.onIpConnectEvent   = replay_on_ip_connect;
+	counting.onTcpConnectEvent  = replay_on_tcp_connect;
+	counting.onUdpConnectEvent  = replay_on_udp_connect;
+	counting.onDnsInquireEvent  = replay_on_dns_inquire;
+	counting.onDnsResponseEvent = replay_on_dns_response;
+	replay_cur = stats;
+	memcpy(&callbackfunction,&counting,sizeof(counting));
+
+	data_dispatcher_replay_init(local_ip,replay_local_mac);
+	flow_replay_init(addr.s_addr,inet_addr(REPLAY_NETMASK));
+	report_log_count_reset();
+	run.start_ns = replay_now_ns();
+	if(gen != NULL)
+		ret = replay_generate(&run,gen,packets,out,addr.s_addr);
+	else
+		ret = replay_file(&run,source);
+	// 最后一秒的统计
+	if(stats->packets > 0){
+		unsigned long long t0 = replay_now_ns(),t1 = 0;
+		data_dispatcher_tick();
+		t1 = replay_now_ns();
+		stats->det_calls[REPLAY_DET_TICK]++;
+		stats->det_ns[REPLAY_DET_TICK] += t1 - t0;
+		stats->busy_ns += t1 - t0;
+	}
+	stats->wall_ns = replay_now_ns() - run.start_ns;
+	for(int i = 0;i < REPLAY_EVENT_MAX;i ++)
+		stats->attack_events[i] = report_log_count((u8)i);
+
+	memcpy(&callbackfunction,&saved,sizeof(saved));
+	replay_cur = NULL;
+	return ret;
+}
+
+/**
+ * @name:   pcap_replay_print
+ * @Author: qihoo360
+ * @msg:    吞吐、各检测器耗时和事件数, 标准输出
+ * @param
+ * @return:
+ */
+void pcap_replay_print(const char *source,const replay_stats *stats)
+{
+	double busy_s = (double)stats->busy_ns / 1e9;
+	double wall_s = (double)stats->wall_ns / 1e9;
+	char log[256] = {0};
+
+	printf("replay %s\n",source);
+	printf("  packets %llu  bytes %llu  skipped %llu  capture span %.3f s\n",
+		stats->packets,stats->bytes,stats->skipped,(double)stats->span_us / 1e6);
+	printf("  wall %.3f s  pipeline %.3f s  %.0f pkt/s  %.1f Mbit/s\n",wall_s,busy_s,
+		(busy_s > 0) ? ((double)stats->packets / busy_s) : 0.0,
+		(busy_s > 0) ? ((double)stats->bytes * 8 / busy_s / 1e6) : 0.0);
+	printf("  %-8s %12s %14s %10s\n","detector","calls","total_us","ns/call");
+	for(int i = 0;i < REPLAY_DET_MAX;i ++){
+		if(stats->det_calls[i] == 0)
+			continue;
+		printf("  %-8s %12llu %14llu %10llu\n",replay_det_name[i],stats->det_calls[i],
+			stats->det_ns[i] / 1000,stats->det_ns[i] / stats->det_calls[i]);
+	}
+	printf("  events  ip_connect %u  tcp_connect %u  udp_connect %u  dns_inquire %u  dns_response %u\n",
+		stats->ip_connect,stats->tcp_connect,stats->udp_connect,stats->dns_inquire,stats->dns_response);
+	printf("  attack ");
+	for(int i = 0;i < REPLAY_EVENT_MAX;i ++){
+		if(stats->attack_events[i] != 0)
+			printf(" %d:%u",i,stats->attack_events[i]);
+	}
+	printf("\n");
+
+	snprintf(log,sizeof(log),"replay %s: %llu packets, %.0f pkt/s",source,stats->packets,
+		(busy_s > 0) ? ((double)stats->packets / busy_s) : 0.0);
+	log_i("networkmonitor", log);
+}
@@ -21,6 +21,7 @@
 #include <pthread.h>
 #include  <semaphore.h>
 #include "pid_detection.h"
+#include "sock_diag.h"
 #include "api_networkmonitor.h"
 
 #define  PORT_SCAN_TIME  (4)
@@ -565,6 +566,29 @@ static char* raw_info(int src_ip,int des_ip,int srcport,int desport,char type)
 		   tcpudpraw_do_one,src_ip,des_ip,srcport,desport,type);//raw 2
 }
 
+/**
+ * @name:   sockdiag_callback
+ * @Author: qihoo360
+ * @msg:    exact tuple lookup over NETLINK_SOCK_DIAG plus the inode->pid cache,
+ *          no /proc/net parsing and no full /proc/<pid>/fd walk per request
+ * @param   src_ip/des_ip:xxx.xxx.xxx.xxx
+ * @return: SOCKDIAG_UNSUPPORTED:use the /proc path
+ */
+static int sockdiag_callback(u8 protocol,char *src_ip,int src_port,char* des_ip,int des_port,char* str_pid,char *processname,char maxlength)
+{
+	struct in_addr src,dst;
+	s32 pid = 0;
+	int ret;
+	if(src_ip == NULL || des_ip == NULL)
+		return SOCKDIAG_NOT_FOUND;
+	if(inet_pton(AF_INET,src_ip,&src) != 1 || inet_pton(AF_INET,des_ip,&dst) != 1)
+		return SOCKDIAG_UNSUPPORTED;
+	ret = sockdiag_attribute(protocol,src.s_addr,(u16)src_port,dst.s_addr,(u16)des_port,&pid,processname,maxlength);
+	if(ret == SOCKDIAG_OK)
+		snprintf(str_pid,maxlength,"%d",pid);
+	return ret;
+}
+
 /*snprintf约占6%CPU**/
 /*#define tcpudpcallback(type)													\
 	char stringsrc[40] = {0},stringdst[40] = {0};											\
@@ -606,6 +630,8 @@ void tcppid_callback\
 	char*name = NULL, *Temp = NULL,*filepid = NULL,*filename = NULL,templen = 0;\
 	if(maxlength < PROGNAME_WIDTH)												\
 		return;																	\
+	if(sockdiag_callback(IPPROTO_TCP,src_ip,src_port,des_ip,des_port,str_pid,processname,maxlength) != SOCKDIAG_UNSUPPORTED)
+		return;
 	pthread_mutex_lock(&request_pid_lock);										\
 	if((name = ((TCP == TCP)?(tcp_info((long)src_ip,(long)des_ip,src_port,des_port,TCP)):(udp_info((long)src_ip,(long)des_ip,src_port,des_port,UDP)))) == NULL)\
 		name = raw_info((long)src_ip,(long)des_ip,src_port,des_port,TCP);		\
@@ -643,6 +669,8 @@ void udppid_callback\
 	char*name = NULL, *Temp = NULL,*filepid = NULL,*filename = NULL,templen = 0;\
 	if(maxlength < PROGNAME_WIDTH)												\
 		return;																	\
+	if(sockdiag_callback(IPPROTO_UDP,src_ip,src_port,des_ip,des_port,str_pid,processname,maxlength) != SOCKDIAG_UNSUPPORTED)
+		return;
 	pthread_mutex_lock(&request_pid_lock);										\
 	if((name = ((UDP == TCP)?(tcp_info((long)src_ip,(long)des_ip,src_port,des_port,TCP)):(udp_info((long)src_ip,(long)des_ip,src_port,des_port,UDP)))) == NULL)\
 		name = raw_info((long)src_ip,(long)des_ip,src_port,des_port,UDP);		\
@@ -0,0 +1,381 @@
+/*
+ * @Descripttion: one L2-L4 decode per packet, shared by call() and the flow counter
+ * @version: V0.0
+ * @Author: idps members
+ */
+#include <string.h>
+#include <pcap.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "typedef.h"
+#include "ethertype.h"
+#include "sll.h"
+#include "pkt_decode.h"
+
+#ifndef ETHERTYPE_8021AD
+	#define ETHERTYPE_8021AD		0x88a8	/* 802.1ad service tag */
+#endif
+#ifndef ETHERTYPE_QINQ_OLD
+	#define ETHERTYPE_QINQ_OLD		0x9100	/* pre-802.1ad QinQ */
+#endif
+#define PKT_ETHER_HDRLEN			(14)
+#define PKT_ETHER_MTU				(1500)	//type field below this is an 802.3 length
+#define PKT_TOKEN_HDRLEN			(14)
+#define PKT_SLL2_HDR_LEN			(20)
+#define PKT_PPP_IP					(0x0021)
+#define PKT_PPP_IPV6				(0x0057)
+
+static u16 pkt_get16(const u8 *p)
+{
+	return (u16)((p[0] << 8) | p[1]);
+}
+
+/**
+ * @name:   pkt_decode_l4
+ * @Author: qihoo360
+ * @msg:    l3_hlen已确定, 只取端口, 非首片没有l4头
+ * @param
+ * @return: 0
+ */
+static int pkt_decode_l4(pkt_decoded *pkt)
+{
+	if(pkt->l3_caplen <= pkt->l3_hlen)
+		return 0;
+	pkt->l4 = pkt->l3 + pkt->l3_hlen;
+	pkt->l4_caplen = pkt->l3_caplen - pkt->l3_hlen;
+	if(pkt->frag_off != 0 || pkt->l4_caplen < 4)
+		return 0;
+	switch(pkt->l4proto)
+	{
+		case IPPROTO_TCP:
+		case IPPROTO_UDP:
+		case IPPROTO_SCTP:
+		case IPPROTO_UDPLITE:
+			pkt->sport = pkt_get16(pkt->l4);
+			pkt->dport = pkt_get16(pkt->l4 + 2);
+			break;
+		default:
+			break;
+	}
+	return 0;
+}
+
+static int pkt_decode_ipv4(pkt_decoded *pkt)
+{
+	const u8 *ip = pkt->l3;
+	u32 hlen = 0;
+	u16 flags = 0;
+
+	if(pkt->l3_caplen < 20 || (ip[0] >> 4) != 4)
+		return -1;
+	hlen = (u32)(ip[0] & 0x0F) * 4;
+	if(hlen < 20 || pkt->l3_caplen < hlen)		//options truncated
+		return -1;
+	flags = pkt_get16(ip + 6);
+	pkt->ip_version = 4;
+	pkt->l3_hlen = (u16)hlen;
+	pkt->l4proto = ip[9];
+	pkt->ip_len = pkt_get16(ip + 2);
+	pkt->frag_off = (u16)((flags & 0x1FFF) << 3);
+	pkt->more_frags = (flags & 0x2000) ? 1 : 0;
+	pkt->fragment = (pkt->frag_off != 0 || pkt->more_frags) ? 1 : 0;
+	memcpy(pkt->src, ip + 12, 4);
+	memcpy(pkt->dst, ip + 16, 4);
+	return pkt_decode_l4(pkt);
+}
+
+/**
+ * @name:   pkt_decode_ipv6
+ * @Author: qihoo360
+ * @msg:    跳过扩展头找到上层协议, 扩展头没抓全时l4为NULL, l4proto停在该扩展头
+ * @param
+ * @return: 0 ok, -1 fixed header truncated
+ */
+static int pkt_decode_ipv6(pkt_decoded *pkt)
+{
+	const u8 *ip = pkt->l3;
+	u32 off = 40;
+	u8 next = 0;
+	int i = 0;
+
+	if(pkt->l3_caplen < 40 || (ip[0] >> 4) != 6)
+		return -1;
+	pkt->ip_version = 6;
+	pkt->ip_len = 40 + (u32)pkt_get16(ip + 4);
+	memcpy(pkt->src, ip + 8, 16);
+	memcpy(pkt->dst, ip + 24, 16);
+	next = ip[6];
+	for(i = 0;i < PKT_IPV6_EXT_MAX;i ++){
+		u32 elen = 0;
+
+		if(pkt->l3_caplen < off + 8)		//every extension header is at least 8 bytes
+			break;
+		switch(next)
+		{
+			case IPPROTO_HOPOPTS:
+			case IPPROTO_ROUTING:
+			case IPPROTO_DSTOPTS:
+			case 135:					//mobility
+			case 139:					//HIP
+			case 140:					//shim6
+				elen = ((u32)ip[off + 1] + 1) * 8;
+				break;
+			case IPPROTO_FRAGMENT:
+			{
+				u16 fo = pkt_get16(ip + off + 2);
+				pkt->frag_off = fo & 0xFFF8;
+				pkt->more_frags = fo & 0x0001;
+				pkt->fragment = 1;
+				elen = 8;
+				break;
+			}
+			case IPPROTO_AH:
+				elen = ((u32)ip[off + 1] + 2) * 4;
+				break;
+			default:
+				elen = 0;
+				break;
+		}
+		if(elen == 0)
+			break;
+		next = ip[off];
+		off += elen;
+	}
+	pkt->l4proto = next;
+	pkt->l3_hlen = (u16)off;
+	if(off > pkt->l3_caplen || i == PKT_IPV6_EXT_MAX)
+		return 0;
+	switch(next)
+	{
+		case IPPROTO_HOPOPTS:
+		case IPPROTO_ROUTING:
+		case IPPROTO_DSTOPTS:
+		case IPPROTO_FRAGMENT:
+		case IPPROTO_AH:
+		case 135:
+		case 139:
+		case 140:
+			return 0;					//chain not captured to the end
+		default:
+			return pkt_decode_l4(pkt);
+	}
+}
+
+static int pkt_decode_l3(const u8 *l3,u32 len,u16 type,pkt_decoded *pkt)
+{
+	pkt->ether_type = type;
+	pkt->l3 = l3;
+	pkt->l3_caplen = len;
+	if(type == ETHERTYPE_IP)
+		return pkt_decode_ipv4(pkt);
+	if(type == ETHERTYPE_IPV6)
+		return pkt_decode_ipv6(pkt);
+	return 0;							//arp and the rest, l3 only
+}
+
+// 没有链路层类型字段, 看版本号
+static int pkt_decode_ip(const u8 *l3,u32 len,pkt_decoded *pkt)
+{
+	if(len < 1)
+		return -1;
+	switch(l3[0] >> 4)
+	{
+		case 4:
+			return pkt_decode_l3(l3,len,ETHERTYPE_IP,pkt);
+		case 6:
+			return pkt_decode_l3(l3,len,ETHERTYPE_IPV6,pkt);
+		default:
+			return -1;
+	}
+}
+
+// 802.2 LLC, 只认SNAP封装的以太类型
+static int pkt_decode_llc(const u8 *data,u32 caplen,u32 off,pkt_decoded *pkt)
+{
+	if(caplen < off + 8)
+		return 0;
+	if(data[off] != 0xAA || data[off + 1] != 0xAA || data[off + 2] != 0x03)
+		return 0;
+	return pkt_decode_l3(data + off + 8,caplen - off - 8,pkt_get16(data + off + 6),pkt);
+}
+
+/**
+ * @name:   pkt_decode_ethertype
+ * @Author: qihoo360
+ * @msg:    剥掉任意层802.1Q/802.1ad标签, off指向type字段之后
+ * @param
+ * @return:
+ */
+static int pkt_decode_ethertype(const u8 *data,u32 caplen,u32 off,u16 type,pkt_decoded *pkt)
+{
+	while(type == ETHERTYPE_8021Q || type == ETHERTYPE_8021AD || type == ETHERTYPE_QINQ_OLD){
+		if(pkt->vlan_depth >= PKT_VLAN_MAX || caplen < off + 4)
+			return -1;
+		pkt->vlan_id[pkt->vlan_depth++] = pkt_get16(data + off) & 0x0FFF;
+		type = pkt_get16(data + off + 2);
+		off += 4;
+	}
+	if(type <= PKT_ETHER_MTU)
+		return pkt_decode_llc(data,caplen,off,pkt);
+	return pkt_decode_l3(data + off,caplen - off,type,pkt);
+}
+
+static int pkt_decode_ppp(const u8 *data,u32 caplen,pkt_decoded *pkt)
+{
+	u32 off = 0;
+	u16 proto = 0;
+
+	if(caplen < 2)
+		return -1;
+	if(data[0] == 0xFF && data[1] == 0x03)		//address/control, may be compressed away
+		off = 2;
+	if(caplen < off + 1)
+		return -1;
+	if(data[off] & 0x01){						//compressed protocol field
+		proto = data[off];
+		off += 1;
+	}
+	else{
+		if(caplen < off + 2)
+			return -1;
+		proto = pkt_get16(data + off);
+		off += 2;
+	}
+	if(proto == PKT_PPP_IP || proto == ETHERTYPE_IP)
+		return pkt_decode_l3(data + off,caplen - off,ETHERTYPE_IP,pkt);
+	if(proto == PKT_PPP_IPV6 || proto == ETHERTYPE_IPV6)
+		return pkt_decode_l3(data + off,caplen - off,ETHERTYPE_IPV6,pkt);
+	return 0;
+}
+
+static int pkt_decode_tokenring(const u8 *data,u32 caplen,pkt_decoded *pkt)
+{
+	u32 off = PKT_TOKEN_HDRLEN;
+
+	if(caplen < PKT_TOKEN_HDRLEN)
+		return -1;
+	pkt->dst_mac = data + 2;
+	pkt->src_mac = data + 8;
+	if(data[8] & 0x80){							//source routed, skip the RIF
+		if(caplen < off + 1)
+			return -1;
+		off += data[off] & 0x1F;
+	}
+	if((data[1] & 0xC0) != 0x40)				//only LLC frames carry ip
+		return 0;
+	return pkt_decode_llc(data,caplen,off,pkt);
+}
+
+static int pkt_sll_dir(u16 pkttype)
+{
+	switch(pkttype)
+	{
+		case LINUX_SLL_HOST:
+			return PKT_DIR_IN;
+		case LINUX_SLL_OUTGOING:
+			return PKT_DIR_OUT;
+		default:
+			return PKT_DIR_UNKNOWN;
+	}
+}
+
+/**
+ * @name:   pkt_decode
+ * @Author: qihoo360
+ * @msg:    按datalink解出各层位置, 每个报文只解一次, 所有读取都在caplen内
+ * @param   linktype:pcap_datalink() data/caplen:抓到的报文 pkt:输出
+ * @return: 0 ok, -1 datalink not supported or l2/l3 header truncated
+ */
+int pkt_decode(int linktype,const u8 *data,u32 caplen,pkt_decoded *pkt)
+{
+	memset(pkt,0,sizeof(*pkt));
+	pkt->linktype = linktype;
+	pkt->hw_dir = PKT_DIR_UNKNOWN;
+	switch(linktype)
+	{
+		case DLT_EN10MB:
+			if(caplen < PKT_ETHER_HDRLEN)
+				return -1;
+			pkt->dst_mac = data;
+			pkt->src_mac = data + 6;
+			return pkt_decode_ethertype(data,caplen,PKT_ETHER_HDRLEN,pkt_get16(data + 12),pkt);
+#ifdef DLT_LINUX_SLL
+		case DLT_LINUX_SLL:
+			if(caplen < SLL_HDR_LEN)
+				return -1;
+			pkt->hw_dir = pkt_sll_dir(pkt_get16(data));
+			return pkt_decode_ethertype(data,caplen,SLL_HDR_LEN,pkt_get16(data + 14),pkt);
+#endif
+#ifdef DLT_LINUX_SLL2
+		case DLT_LINUX_SLL2:
+			if(caplen < PKT_SLL2_HDR_LEN)
+				return -1;
+			pkt->hw_dir = pkt_sll_dir(data[10]);
+			return pkt_decode_ethertype(data,caplen,PKT_SLL2_HDR_LEN,pkt_get16(data),pkt);
+#endif
+		case DLT_NULL:
+#ifdef DLT_LOOP
+		case DLT_LOOP:
+#endif
+			if(caplen < 4)
+				return -1;
+			return pkt_decode_ip(data + 4,caplen - 4,pkt);
+		case DLT_RAW:
+#ifdef DLT_IPV4
+		case DLT_IPV4:
+#endif
+#ifdef DLT_IPV6
+		case DLT_IPV6:
+#endif
+			return pkt_decode_ip(data,caplen,pkt);
+		case DLT_PPP:
+			return pkt_decode_ppp(data,caplen,pkt);
+		case DLT_IEEE802:
+			return pkt_decode_tokenring(data,caplen,pkt);
+		default:
+			return -1;
+	}
+}
+
+boolean pkt_decode_supported(int linktype)
+{
+	switch(linktype)
+	{
+		case DLT_EN10MB:
+#ifdef DLT_LINUX_SLL
+		case DLT_LINUX_SLL:
+#endif
+#ifdef DLT_LINUX_SLL2
+		case DLT_LINUX_SLL2:
+#endif
+		case DLT_NULL:
+#ifdef DLT_LOOP
+		case DLT_LOOP:
+#endif
+		case DLT_RAW:
+#ifdef DLT_IPV4
+		case DLT_IPV4:
+#endif
+#ifdef DLT_IPV6
+		case DLT_IPV6:
+#endif
+		case DLT_PPP:
+		case DLT_IEEE802:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+u32 pkt_addr4(const u8 *addr)
+{
+	u32 v = 0;
+	memcpy(&v,addr,4);
+	return v;
+}
+
+void pkt_addr_str(const pkt_decoded *pkt,const u8 *addr,char *buf,int len)
+{
+	if(inet_ntop((pkt->ip_version == 6) ? AF_INET6 : AF_INET,addr,buf,(socklen_t)len) == NULL && len > 0)
+		buf[0] = '\0';
+}
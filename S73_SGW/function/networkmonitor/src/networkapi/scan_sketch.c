@@ -0,0 +1,201 @@
+/*
+ * @Descripttion: fixed memory structures for scan and flood detection
+ * @version: V0.0
+ * @Author: idps members
+ */
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include "typedef.h"
+#include "scan_sketch.h"
+
+/* odd multipliers, one per cms row (multiply-shift hashing) */
+static const unsigned long long cms_seed[SKETCH_CMS_DEPTH] = {
+	0x9E3779B97F4A7C15ULL,
+	0xC2B2AE3D27D4EB4FULL,
+	0x165667B19E3779F9ULL,
+	0xD6E8FEB86659FD93ULL,
+};
+/* 64*ln(64/V), V = number of zero registers, small range correction */
+static const u16 hll_linear[SKETCH_HLL_REGS + 1] = {
+	0, 266, 222, 196, 177, 163, 151, 142, 133, 126, 119, 113, 107, 102, 97, 93, 89,
+	85, 81, 78, 74, 71, 68, 65, 63, 60, 58, 55, 53, 51, 48, 46, 44, 42, 40, 39, 37,
+	35, 33, 32, 30, 28, 27, 25, 24, 23, 21, 20, 18, 17, 16, 15, 13, 12, 11, 10, 9,
+	7, 6, 5, 4, 3, 2, 1, 0
+};
+
+static inline u32 sketch_mix32(u32 h)
+{
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h;
+}
+
+static inline u32 cms_index(unsigned long long key,int row)
+{
+	return (u32)(((key + 1) * cms_seed[row]) >> (64 - SKETCH_CMS_WIDTH_BITS));
+}
+/**
+ * @name:   sketch_cms_add
+ * @msg:    conservative update, only the minimum rows grow
+ * @return: estimate after the update
+ */
+u32 sketch_cms_add(sketch_window *window,unsigned long long key,u32 inc)
+{
+	u32 idx[SKETCH_CMS_DEPTH];
+	u32 est = 0xFFFFFFFF;
+	for(int i = 0;i < SKETCH_CMS_DEPTH;i ++){
+		idx[i] = cms_index(key,i);
+		if(window->cms[i][idx[i]] < est)
+			est = window->cms[i][idx[i]];
+	}
+	est += inc;
+	for(int i = 0;i < SKETCH_CMS_DEPTH;i ++){
+		if(window->cms[i][idx[i]] < est)
+			window->cms[i][idx[i]] = est;
+	}
+	return est;
+}
+
+u32 sketch_cms_query(const sketch_window *window,unsigned long long key)
+{
+	u32 est = 0xFFFFFFFF;
+	for(int i = 0;i < SKETCH_CMS_DEPTH;i ++){
+		u32 v = window->cms[i][cms_index(key,i)];
+		if(v < est)
+			est = v;
+	}
+	return est;
+}
+/**
+ * @name:   sketch_source_get
+ * @msg:    find or admit a source, NULL once the table is full
+ */
+sketch_source *sketch_source_get(sketch_window *window,u32 addr)
+{
+	u32 idx = sketch_mix32(addr) & (SKETCH_SOURCES - 1);
+	for(int probe = 0;probe < SKETCH_SOURCES;probe ++){
+		sketch_source *s = &window->source[idx];
+		if(!s->used){
+			if(window->source_used >= SKETCH_SOURCES_LIMIT)
+				return NULL;
+			s->used = 1;
+			s->addr = addr;
+			window->source_used ++;
+			return s;
+		}
+		if(s->addr == addr)
+			return s;
+		idx = (idx + 1) & (SKETCH_SOURCES - 1);
+	}
+	return NULL;
+}
+/**
+ * @name:   sketch_source_port
+ * @msg:    low ports go to the bitmap, the rest to the hyperloglog
+ */
+void sketch_source_port(sketch_source *source,u16 port)
+{
+	if(port < SKETCH_LOW_PORTS){
+		source->lowport[port >> 3] |= (u8)(1 << (port & 7));
+		return;
+	}
+	u32 h = sketch_mix32(port * 0x9E3779B1u);
+	u32 reg = h & (SKETCH_HLL_REGS - 1);
+	u32 w = h >> 6;
+	u8 rank = w ? (u8)(__builtin_ctz(w) + 1) : 27;
+	if(source->hll[reg] < rank)
+		source->hll[reg] = rank;
+}
+/**
+ * @name:   sketch_source_ports
+ * @msg:    distinct destination ports, exact below SKETCH_LOW_PORTS
+ */
+u32 sketch_source_ports(const sketch_source *source)
+{
+	u32 low = 0,zero = 0,est = 0;
+	double sum = 0;
+	for(int i = 0;i < SKETCH_LOW_PORTS / 8;i ++)
+		low += __builtin_popcount(source->lowport[i]);
+	for(int i = 0;i < SKETCH_HLL_REGS;i ++){
+		sum += 1.0 / (double)(1ULL << source->hll[i]);
+		if(source->hll[i] == 0)
+			zero ++;
+	}
+	est = (u32)(0.709 * SKETCH_HLL_REGS * SKETCH_HLL_REGS / sum);
+	if(est <= SKETCH_HLL_REGS * 5 / 2 && zero > 0)
+		est = hll_linear[zero];
+	return low + est;
+}
+/**
+ * @name:   sketch_source_top
+ * @msg:    busiest tracked source, NULL if none
+ */
+sketch_source *sketch_source_top(sketch_window *window)
+{
+	sketch_source *top = NULL;
+	for(int i = 0;i < SKETCH_SOURCES;i ++){
+		sketch_source *s = &window->source[i];
+		if(s->used && (top == NULL || s->packets > top->packets))
+			top = s;
+	}
+	return top;
+}
+
+void sketch_candidate_add(sketch_window *window,u16 port,u32 src_addr)
+{
+	for(u32 i = 0;i < window->candidate_used;i ++){
+		if(window->candidate[i].port == port)
+			return;
+	}
+	if(window->candidate_used >= SKETCH_CANDIDATES)
+		return;
+	window->candidate[window->candidate_used].port = port;
+	window->candidate[window->candidate_used].src_addr = src_addr;
+	window->candidate_used ++;
+}
+
+void sketch_window_clear(sketch_window *window)
+{
+	memset(window,0,sizeof(sketch_window));
+}
+
+void sketch_init(sketch_detector *detector)
+{
+	sketch_window_clear(&detector->window[0]);
+	sketch_window_clear(&detector->window[1]);
+	__atomic_store_n(&detector->active,0,__ATOMIC_SEQ_CST);
+	__atomic_store_n(&detector->seq,0,__ATOMIC_SEQ_CST);
+}
+/**
+ * @name:   sketch_begin/sketch_end
+ * @msg:    same handshake as flow_worker_add, seq is odd during an update
+ */
+sketch_window *sketch_begin(sketch_detector *detector)
+{
+	__atomic_add_fetch(&detector->seq,1,__ATOMIC_SEQ_CST);
+	return &detector->window[__atomic_load_n(&detector->active,__ATOMIC_SEQ_CST)];
+}
+
+void sketch_end(sketch_detector *detector)
+{
+	__atomic_add_fetch(&detector->seq,1,__ATOMIC_RELEASE);
+}
+
+sketch_window *sketch_swap(sketch_detector *detector)
+{
+	u32 old = __atomic_load_n(&detector->active,__ATOMIC_RELAXED);
+	u32 seq = 0;
+
+	__atomic_store_n(&detector->active,old ^ 1,__ATOMIC_SEQ_CST);
+	seq = __atomic_load_n(&detector->seq,__ATOMIC_SEQ_CST);
+	if(seq & 1){
+		while(__atomic_load_n(&detector->seq,__ATOMIC_ACQUIRE) == seq)
+			sched_yield();
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return &detector->window[old];
+}
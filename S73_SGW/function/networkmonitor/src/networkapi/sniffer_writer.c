@@ -0,0 +1,433 @@
+/*
+ * @Descripttion: sniffer writer thread, capture thread only copies into a ring
+ * @version: V0.0
+ * @Author: idps members
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <pcap.h>
+#include "typedef.h"
+#include "sniffer_writer.h"
+#include "spdloglib.h"
+
+#define SNIFFER_RING_MASK			(SNIFFER_RING_BYTES - 1)
+#define SNIFFER_ALIGN(n)			(((n) + 7U) & ~7U)
+#define SNIFFER_NAME_MAX			(320)
+#define SNIFFER_FILE_BUFFER			(64 * 1024)
+
+/* pcapng block types */
+#define PCAPNG_SHB					(0x0A0D0D0A)
+#define PCAPNG_IDB					(0x00000001)
+#define PCAPNG_EPB					(0x00000006)
+#define PCAPNG_BYTE_ORDER			(0x1A2B3C4D)
+
+typedef struct{
+	u32 reclen;			//header and data, 8-byte aligned. 0:skip to the start of the ring
+	u32 caplen;
+	u32 len;
+	u32 ts_sec;
+	u32 ts_usec;
+	u32 reserved;
+}sniffer_rec;
+
+typedef struct{
+	u32  snaplen;
+	unsigned long long rotate_bytes;
+	u32  rotate_seconds;
+	u32  max_files;
+	char filter[SNIFFER_FILTER_MAX];
+}sniffer_config;
+
+static sniffer_config sniffer_conf = {0,(unsigned long long)SNIFFER_ROTATE_MB * 1024 * 1024,0,SNIFFER_ROTATE_FILES,{0}};
+static sniffer_config sniffer_run;		//copy taken at start, the writer thread reads this one
+static u8 *sniffer_ring = NULL;
+static u32 sniffer_head = 0;			//written by the capture thread
+static u32 sniffer_tail = 0;			//written by the writer thread
+static u32 sniffer_users = 0;			//capture threads inside push
+static boolean sniffer_on = FALSE;
+static boolean sniffer_exit = FALSE;
+static pthread_t sniffer_thd = 0;
+static pthread_mutex_t request_sniffer_lock = PTHREAD_MUTEX_INITIALIZER;
+static sniffer_writer_stats sniffer_stat;
+
+/* writer thread state */
+static FILE *sniffer_fp = NULL;
+static char  sniffer_path[SNIFFER_NAME_MAX];
+static char  sniffer_base[SNIFFER_NAME_MAX];
+static char  sniffer_names[SNIFFER_FILES_MAX][SNIFFER_NAME_MAX];
+static u32   sniffer_name_count = 0;
+static u32   sniffer_seq = 0;
+static time_t sniffer_opened = 0;
+static unsigned long long sniffer_file_bytes = 0;
+static int   sniffer_linktype = 0;
+static boolean sniffer_has_filter = FALSE;
+static struct bpf_program sniffer_prog;
+
+void sniffer_writer_config(int snaplen,int rotate_mb,int rotate_seconds,int max_files,const char *filter)
+{
+	pthread_mutex_lock(&request_sniffer_lock);
+	sniffer_conf.snaplen = (snaplen > 0) ? (u32)snaplen : 0;
+	sniffer_conf.rotate_bytes = (rotate_mb > 0) ? (unsigned long long)rotate_mb * 1024 * 1024 : 0;
+	sniffer_conf.rotate_seconds = (rotate_seconds > 0) ? (u32)rotate_seconds : 0;
+	if(max_files <= 0)
+		max_files = SNIFFER_ROTATE_FILES;
+	sniffer_conf.max_files = (max_files > SNIFFER_FILES_MAX) ? SNIFFER_FILES_MAX : (u32)max_files;
+	snprintf(sniffer_conf.filter,sizeof(sniffer_conf.filter),"%s",(filter != NULL) ? filter : "");
+	pthread_mutex_unlock(&request_sniffer_lock);
+}
+
+static boolean sniffer_rotating(void)
+{
+	return (sniffer_run.rotate_bytes != 0 || sniffer_run.rotate_seconds != 0) ? TRUE : FALSE;
+}
+
+static void sniffer_put(const void *data,u32 len)
+{
+	if(fwrite(data,1,len,sniffer_fp) == len)
+		sniffer_file_bytes += len;
+}
+
+static void sniffer_put32(u32 value)
+{
+	sniffer_put(&value,sizeof(value));
+}
+
+// section header and the single interface, timestamps in microseconds (if_tsresol default)
+static void sniffer_write_header(void)
+{
+	u32 shb[7] = {PCAPNG_SHB,28,PCAPNG_BYTE_ORDER,0x00000001,0xFFFFFFFF,0xFFFFFFFF,28};
+	u32 idb[5] = {PCAPNG_IDB,20,0,0,20};
+
+	idb[2] = (u32)(sniffer_linktype & 0xFFFF);
+	idb[3] = (sniffer_run.snaplen != 0) ? sniffer_run.snaplen : 65535;
+	sniffer_put(shb,sizeof(shb));
+	sniffer_put(idb,sizeof(idb));
+}
+
+static void sniffer_close_file(void)
+{
+	if(sniffer_fp != NULL)
+		fclose(sniffer_fp);
+	sniffer_fp = NULL;
+}
+
+/**
+ * @name:   sniffer_open_next
+ * @Author: qihoo360
+ * @msg:    不轮转时写配置的路径, 轮转时<path>_日期_序号.pcapng, 超出max_files删除最旧的
+ * @param
+ * @return: 0 ok, -1 open failed
+ */
+static int sniffer_open_next(void)
+{
+	char name[SNIFFER_NAME_MAX] = {0};
+
+	sniffer_close_file();
+	sniffer_opened = time(NULL);
+	sniffer_file_bytes = 0;
+	if(sniffer_rotating()){
+		struct tm tm;
+		localtime_r(&sniffer_opened,&tm);
+		snprintf(name,sizeof(name),"%s_%04d%02d%02d_%02d%02d%02d_%u.pcapng",sniffer_base,
+			tm.tm_year + 1900,tm.tm_mon + 1,tm.tm_mday,tm.tm_hour,tm.tm_min,tm.tm_sec,sniffer_seq++);
+	}
+	else{
+		snprintf(name,sizeof(name),"%s",sniffer_path);
+	}
+	sniffer_fp = fopen(name,"wb");
+	if(sniffer_fp == NULL){
+		char log[SNIFFER_NAME_MAX + 32] = {0};
+		snprintf(log,sizeof(log),"sniffer cannot open %s",name);
+		log_e("networkmonitor", log);
+		return -1;
+	}
+	setvbuf(sniffer_fp,NULL,_IOFBF,SNIFFER_FILE_BUFFER);
+	sniffer_write_header();
+	sniffer_stat.files++;
+
+	if(sniffer_rotating()){
+		u32 slot = sniffer_name_count % SNIFFER_FILES_MAX;
+		if(sniffer_name_count >= sniffer_run.max_files){
+			u32 oldest = (sniffer_name_count - sniffer_run.max_files) % SNIFFER_FILES_MAX;
+			unlink(sniffer_names[oldest]);
+		}
+		snprintf(sniffer_names[slot],sizeof(sniffer_names[slot]),"%s",name);
+		sniffer_name_count++;
+	}
+	return 0;
+}
+
+static boolean sniffer_rotate_due(time_t now)
+{
+	if(!sniffer_rotating() || sniffer_fp == NULL)
+		return FALSE;
+	if(sniffer_run.rotate_bytes != 0 && sniffer_file_bytes >= sniffer_run.rotate_bytes)
+		return TRUE;
+	if(sniffer_run.rotate_seconds != 0 && now - sniffer_opened >= (time_t)sniffer_run.rotate_seconds)
+		return TRUE;
+	return FALSE;
+}
+
+// enhanced packet block, interface 0
+static void sniffer_write_rec(const sniffer_rec *rec)
+{
+	const u8 *data = (const u8 *)(rec + 1);
+	unsigned long long ts = (unsigned long long)rec->ts_sec * 1000000ULL + rec->ts_usec;
+	u32 padded = (rec->caplen + 3U) & ~3U;
+	u32 total = 32 + padded;
+	static const u8 zero[4] = {0};
+
+	if(sniffer_has_filter){
+		struct pcap_pkthdr hdr;
+		hdr.ts.tv_sec = rec->ts_sec;
+		hdr.ts.tv_usec = rec->ts_usec;
+		hdr.caplen = rec->caplen;
+		hdr.len = rec->len;
+		if(pcap_offline_filter(&sniffer_prog,&hdr,data) == 0){
+			sniffer_stat.filtered++;
+			return;
+		}
+	}
+	if(sniffer_rotate_due(time(NULL)))
+		sniffer_open_next();
+	if(sniffer_fp == NULL)
+		return;
+	sniffer_put32(PCAPNG_EPB);
+	sniffer_put32(total);
+	sniffer_put32(0);
+	sniffer_put32((u32)(ts >> 32));
+	sniffer_put32((u32)ts);
+	sniffer_put32(rec->caplen);
+	sniffer_put32(rec->len);
+	sniffer_put(data,rec->caplen);
+	sniffer_put(zero,padded - rec->caplen);
+	sniffer_put32(total);
+	sniffer_stat.written++;
+	sniffer_stat.bytes += total;
+}
+
+static u32 sniffer_drain(void)
+{
+	u32 head = __atomic_load_n(&sniffer_head,__ATOMIC_ACQUIRE);
+	u32 tail = sniffer_tail;
+	u32 count = 0;
+
+	while(tail != head){
+		u32 toend = SNIFFER_RING_BYTES - (tail & SNIFFER_RING_MASK);
+		const sniffer_rec *rec = (const sniffer_rec *)(sniffer_ring + (tail & SNIFFER_RING_MASK));
+		if(toend < sizeof(sniffer_rec) || rec->reclen == 0){
+			tail += toend;
+			continue;
+		}
+		sniffer_write_rec(rec);
+		tail += rec->reclen;
+		count++;
+		// 每条释放, 抓包线程尽早拿回空间
+		__atomic_store_n(&sniffer_tail,tail,__ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&sniffer_tail,tail,__ATOMIC_RELEASE);
+	return count;
+}
+
+static void *sniffer_writer_thread(void *args)
+{
+	for(;;){
+		boolean leaving = __atomic_load_n(&sniffer_exit,__ATOMIC_ACQUIRE);
+		if(sniffer_drain() == 0){
+			if(leaving)
+				break;
+			if(sniffer_rotate_due(time(NULL)))
+				sniffer_open_next();
+			if(sniffer_fp != NULL)
+				fflush(sniffer_fp);
+			usleep(SNIFFER_IDLE_US);
+		}
+	}
+	sniffer_close_file();
+	return NULL;
+}
+
+/**
+ * @name:   sniffer_writer_push
+ * @Author: qihoo360
+ * @msg:    抓包线程调用, 只做一次拷贝, 环满时丢弃计数, 从不等待写盘
+ * @param
+ * @return:
+ */
+void sniffer_writer_push(const struct pcap_pkthdr *hdr,const u8 *data)
+{
+	u32 caplen = 0,need = 0,head = 0,tail = 0,toend = 0;
+	sniffer_rec *rec = NULL;
+
+	__atomic_add_fetch(&sniffer_users,1,__ATOMIC_SEQ_CST);
+	if(!__atomic_load_n(&sniffer_on,__ATOMIC_SEQ_CST))
+		goto out;
+	caplen = hdr->caplen;
+	if(sniffer_run.snaplen != 0 && caplen > sniffer_run.snaplen)
+		caplen = sniffer_run.snaplen;
+	need = SNIFFER_ALIGN((u32)sizeof(sniffer_rec) + caplen);
+	head = __atomic_load_n(&sniffer_head,__ATOMIC_RELAXED);
+	tail = __atomic_load_n(&sniffer_tail,__ATOMIC_ACQUIRE);
+	toend = SNIFFER_RING_BYTES - (head & SNIFFER_RING_MASK);
+	if(toend < need){
+		// 尾部放不下, 补齐后从头写
+		if(SNIFFER_RING_BYTES - (head - tail) < toend + need)
+			goto drop;
+		if(toend >= sizeof(sniffer_rec))
+			((sniffer_rec *)(sniffer_ring + (head & SNIFFER_RING_MASK)))->reclen = 0;
+		head += toend;
+	}
+	else if(SNIFFER_RING_BYTES - (head - tail) < need){
+		goto drop;
+	}
+	rec = (sniffer_rec *)(sniffer_ring + (head & SNIFFER_RING_MASK));
+	rec->reclen  = need;
+	rec->caplen  = caplen;
+	rec->len     = hdr->len;
+	rec->ts_sec  = (u32)hdr->ts.tv_sec;
+	rec->ts_usec = (u32)hdr->ts.tv_usec;
+	memcpy(rec + 1,data,caplen);
+	__atomic_store_n(&sniffer_head,head + need,__ATOMIC_RELEASE);
+	__atomic_add_fetch(&sniffer_stat.pushed,1,__ATOMIC_RELAXED);
+	goto out;
+drop:
+	__atomic_add_fetch(&sniffer_stat.dropped,1,__ATOMIC_RELAXED);
+out:
+	__atomic_sub_fetch(&sniffer_users,1,__ATOMIC_SEQ_CST);
+}
+
+/**
+ * @name:   sniffer_writer_start
+ * @Author: qihoo360
+ * @msg:    打开第一个文件并启动写线程, 配置在此刻生效
+ * @param   path:sniffer保存路径 linktype:pcap_datalink()
+ * @return: 0 ok, -1 bad filter, no memory or cannot open the file
+ */
+int sniffer_writer_start(const char *path,int linktype)
+{
+	char *dot = NULL;
+	int stacksize = 256*1024;
+	pthread_attr_t attr;
+
+	if(path == NULL)
+		return -1;
+	pthread_mutex_lock(&request_sniffer_lock);
+	if(sniffer_thd != 0){
+		pthread_mutex_unlock(&request_sniffer_lock);
+		return 0;
+	}
+	if(sniffer_ring == NULL && (sniffer_ring = malloc(SNIFFER_RING_BYTES)) == NULL){
+		pthread_mutex_unlock(&request_sniffer_lock);
+		return -1;
+	}
+	memcpy(&sniffer_run,&sniffer_conf,sizeof(sniffer_run));
+	memset(&sniffer_stat,0,sizeof(sniffer_stat));
+	sniffer_head = sniffer_tail = 0;
+	sniffer_linktype = linktype;
+	sniffer_name_count = 0;
+	sniffer_seq = 0;
+
+	sniffer_has_filter = FALSE;
+	if(sniffer_run.filter[0] != '\0'){
+		pcap_t *dead = pcap_open_dead(linktype,65535);
+		int ret = (dead != NULL) ? pcap_compile(dead,&sniffer_prog,sniffer_run.filter,1,PCAP_NETMASK_UNKNOWN) : -1;
+		if(ret != 0){
+			char log[SNIFFER_FILTER_MAX + 64] = {0};
+			snprintf(log,sizeof(log),"sniffer filter \"%s\": %s",sniffer_run.filter,(dead != NULL) ? pcap_geterr(dead) : "pcap_open_dead");
+			log_e("networkmonitor", log);
+			if(dead != NULL)
+				pcap_close(dead);
+			pthread_mutex_unlock(&request_sniffer_lock);
+			return -1;
+		}
+		pcap_close(dead);
+		sniffer_has_filter = TRUE;
+	}
+
+	snprintf(sniffer_path,sizeof(sniffer_path),"%s",path);
+	snprintf(sniffer_base,sizeof(sniffer_base),"%s",path);
+	dot = strrchr(sniffer_base,'.');
+	if(dot != NULL && (strcmp(dot,".pcap") == 0 || strcmp(dot,".pcapng") == 0))
+		*dot = '\0';
+	if(sniffer_open_next() != 0){
+		if(sniffer_has_filter)
+			pcap_freecode(&sniffer_prog);
+		sniffer_has_filter = FALSE;
+		pthread_mutex_unlock(&request_sniffer_lock);
+		return -1;
+	}
+
+	pthread_attr_init(&attr);
+	if(pthread_attr_setstacksize(&attr, stacksize) != 0){
+		log_i("networkmonitor", "statcksize set error");
+	}
+	sniffer_exit = FALSE;
+	if(pthread_create(&sniffer_thd,&attr,sniffer_writer_thread,NULL) != 0){
+		sniffer_thd = 0;
+		sniffer_close_file();
+		if(sniffer_has_filter)
+			pcap_freecode(&sniffer_prog);
+		sniffer_has_filter = FALSE;
+		pthread_attr_destroy(&attr);
+		pthread_mutex_unlock(&request_sniffer_lock);
+		return -1;
+	}
+	pthread_attr_destroy(&attr);
+	__atomic_store_n(&sniffer_on,TRUE,__ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&request_sniffer_lock);
+	return 0;
+}
+
+/**
+ * @name:   sniffer_writer_stop
+ * @Author: qihoo360
+ * @msg:    先挡住新报文, 等抓包线程离开push, 写线程排空环后退出
+ * @param
+ * @return:
+ */
+void sniffer_writer_stop(void)
+{
+	char log[256] = {0};
+
+	pthread_mutex_lock(&request_sniffer_lock);
+	if(sniffer_thd == 0){
+		pthread_mutex_unlock(&request_sniffer_lock);
+		return;
+	}
+	__atomic_store_n(&sniffer_on,FALSE,__ATOMIC_SEQ_CST);
+	while(__atomic_load_n(&sniffer_users,__ATOMIC_SEQ_CST) != 0)
+		usleep(100);
+	__atomic_store_n(&sniffer_exit,TRUE,__ATOMIC_RELEASE);
+	pthread_join(sniffer_thd,NULL);
+	sniffer_thd = 0;
+	sniffer_exit = FALSE;
+	if(sniffer_has_filter)
+		pcap_freecode(&sniffer_prog);
+	sniffer_has_filter = FALSE;
+
+	snprintf(log,sizeof(log),"sniffer stopped, written:%llu dropped:%llu filtered:%llu files:%u",
+		sniffer_stat.written,sniffer_stat.dropped,sniffer_stat.filtered,sniffer_stat.files);
+	log_i("networkmonitor", log);
+	pthread_mutex_unlock(&request_sniffer_lock);
+}
+
+boolean sniffer_writer_active(void)
+{
+	return __atomic_load_n(&sniffer_on,__ATOMIC_RELAXED);
+}
+
+void sniffer_writer_get_stats(sniffer_writer_stats *stats)
+{
+	if(stats == NULL)
+		return;
+	stats->pushed   = __atomic_load_n(&sniffer_stat.pushed,__ATOMIC_RELAXED);
+	stats->dropped  = __atomic_load_n(&sniffer_stat.dropped,__ATOMIC_RELAXED);
+	stats->filtered = sniffer_stat.filtered;
+	stats->written  = sniffer_stat.written;
+	stats->bytes    = sniffer_stat.bytes;
+	stats->files    = sniffer_stat.files;
+}
@@ -0,0 +1,422 @@
+/*
+ * @Descripttion: socket -> process attribution through NETLINK_SOCK_DIAG
+ * @version: V0.0
+ * @Author: idps members
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include "typedef.h"
+#include "sock_diag.h"
+
+static int sockdiag_fd = -1;
+static u32 sockdiag_seq = 0;
+static pthread_mutex_t sockdiag_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static sockpid_slot sockpid_table[SOCKPID_SLOTS];
+static u32 sockpid_used = 0;
+static u32 sockpid_scan_tokens = SOCKPID_RESCAN_BURST;
+static u32 sockpid_scan_refill = 0;
+static pthread_mutex_t sockpid_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static u32 sockpid_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (u32)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/**
+ * @name:   sockdiag_open
+ * @Author: qihoo360
+ * @msg:    one netlink socket kept open, sockdiag_lock held
+ * @param
+ * @return: 0:ok -1:no sock_diag support
+ */
+static int sockdiag_open(void)
+{
+	struct timeval tv = {.tv_sec = 0,.tv_usec = 100000};
+	if(sockdiag_fd >= 0)
+		return 0;
+	sockdiag_fd = socket(AF_NETLINK,SOCK_DGRAM | SOCK_CLOEXEC,NETLINK_SOCK_DIAG);
+	if(sockdiag_fd < 0)
+		return -1;
+	setsockopt(sockdiag_fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+	return 0;
+}
+/**
+ * @name:   sockdiag_query
+ * @Author: qihoo360
+ * @msg:    single exact lookup, no dump, sockdiag_lock held
+ * @param   id src/dst as the kernel expects them for this protocol
+ * @return: SOCKDIAG_OK/SOCKDIAG_NOT_FOUND/SOCKDIAG_UNSUPPORTED
+ */
+static int sockdiag_query(u8 protocol,u32 src_ip,u16 src_port,u32 dst_ip,u16 dst_port,u32 *inode,u32 *uid)
+{
+	struct{
+		struct nlmsghdr        nlh;
+		struct inet_diag_req_v2 r;
+	}req;
+	struct sockaddr_nl nladdr;
+	long buf[8192 / sizeof(long)];
+	u32 seq = 0;
+
+	memset(&req,0,sizeof(req));
+	memset(&nladdr,0,sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	seq = ++ sockdiag_seq;
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.nlh.nlmsg_seq = seq;
+	req.r.sdiag_family = AF_INET;
+	req.r.sdiag_protocol = protocol;
+	req.r.idiag_states = ~0U;
+	req.r.id.idiag_src[0] = src_ip;
+	req.r.id.idiag_sport = htons(src_port);
+	req.r.id.idiag_dst[0] = dst_ip;
+	req.r.id.idiag_dport = htons(dst_port);
+	req.r.id.idiag_cookie[0] = INET_DIAG_NOCOOKIE;
+	req.r.id.idiag_cookie[1] = INET_DIAG_NOCOOKIE;
+	if(sendto(sockdiag_fd,&req,sizeof(req),0,(struct sockaddr *)&nladdr,sizeof(nladdr)) < 0){
+		close(sockdiag_fd);
+		sockdiag_fd = -1;
+		return SOCKDIAG_UNSUPPORTED;
+	}
+	for(;;){
+		ssize_t len = recv(sockdiag_fd,buf,sizeof(buf),0);
+		struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		if(len < 0){
+			if(errno == EINTR)
+				continue;
+			return SOCKDIAG_NOT_FOUND;
+		}
+		for(;NLMSG_OK(h,(u32)len);h = NLMSG_NEXT(h,len)){
+			if(h->nlmsg_seq != seq)
+				continue;//late answer of a timed out request
+			if(h->nlmsg_type == NLMSG_ERROR || h->nlmsg_type == NLMSG_DONE)
+				return SOCKDIAG_NOT_FOUND;
+			if(h->nlmsg_type == SOCK_DIAG_BY_FAMILY && h->nlmsg_len >= NLMSG_LENGTH(sizeof(struct inet_diag_msg))){
+				struct inet_diag_msg *m = (struct inet_diag_msg *)NLMSG_DATA(h);
+				*inode = m->idiag_inode;
+				if(uid)
+					*uid = m->idiag_uid;
+				return (m->idiag_inode != 0)?(SOCKDIAG_OK):(SOCKDIAG_NOT_FOUND);
+			}
+		}
+	}
+}
+/**
+ * @name:   sockdiag_find_inode
+ * @Author: qihoo360
+ * @msg:    tcp/raw expect id.src=local, udp expects id.src=remote; the caller
+ *          does not know which end is local, so both orders are tried
+ * @param
+ * @return:
+ */
+int sockdiag_find_inode(u8 protocol,u32 src_ip,u16 src_port,u32 dst_ip,u16 dst_port,u32 *inode,u32 *uid)
+{
+	int ret = SOCKDIAG_UNSUPPORTED;
+	if(inode == NULL)
+		return SOCKDIAG_NOT_FOUND;
+	pthread_mutex_lock(&sockdiag_lock);
+	if(sockdiag_open() == 0){
+		ret = sockdiag_query(protocol,src_ip,src_port,dst_ip,dst_port,inode,uid);
+		if(ret == SOCKDIAG_NOT_FOUND)
+			ret = sockdiag_query(protocol,dst_ip,dst_port,src_ip,src_port,inode,uid);
+	}
+	pthread_mutex_unlock(&sockdiag_lock);
+	return ret;
+}
+
+/**
+ * @name:   sockdiag_dump
+ * @Author: qihoo360
+ * @msg:    one family, sockdiag_lock held
+ * @param
+ * @return: sockets walked, SOCKDIAG_UNSUPPORTED on a socket or kernel error
+ */
+static int sockdiag_dump(u8 family,u32 states,sockdiag_walk_cb cb,void *arg)
+{
+	struct{
+		struct nlmsghdr        nlh;
+		struct inet_diag_req_v2 r;
+	}req;
+	struct sockaddr_nl nladdr;
+	long buf[16384 / sizeof(long)];
+	u32 seq = 0;
+	int walked = 0;
+
+	memset(&req,0,sizeof(req));
+	memset(&nladdr,0,sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	seq = ++ sockdiag_seq;
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = seq;
+	req.r.sdiag_family = family;
+	req.r.sdiag_protocol = IPPROTO_TCP;
+	req.r.idiag_states = states;
+	if(sendto(sockdiag_fd,&req,sizeof(req),0,(struct sockaddr *)&nladdr,sizeof(nladdr)) < 0){
+		close(sockdiag_fd);
+		sockdiag_fd = -1;
+		return SOCKDIAG_UNSUPPORTED;
+	}
+	for(;;){
+		ssize_t len = recv(sockdiag_fd,buf,sizeof(buf),0);
+		struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		if(len < 0){
+			if(errno == EINTR)
+				continue;
+			// a timed out dump leaves its tail queued, the next request skips it by seq
+			return SOCKDIAG_UNSUPPORTED;
+		}
+		for(;NLMSG_OK(h,(u32)len);h = NLMSG_NEXT(h,len)){
+			struct inet_diag_msg *m = NULL;
+			if(h->nlmsg_seq != seq)
+				continue;
+			if(h->nlmsg_type == NLMSG_DONE)
+				return walked;
+			if(h->nlmsg_type == NLMSG_ERROR)
+				return SOCKDIAG_UNSUPPORTED;
+			if(h->nlmsg_type != SOCK_DIAG_BY_FAMILY || h->nlmsg_len < NLMSG_LENGTH(sizeof(*m)))
+				continue;
+			m = (struct inet_diag_msg *)NLMSG_DATA(h);
+			cb(m->idiag_family,m->idiag_state,(const u8 *)m->id.idiag_dst,ntohs(m->id.idiag_dport),arg);
+			walked ++;
+		}
+	}
+}
+
+int sockdiag_tcp_walk(u32 states,sockdiag_walk_cb cb,void *arg)
+{
+	int v4 = SOCKDIAG_UNSUPPORTED,v6 = SOCKDIAG_UNSUPPORTED;
+	if(cb == NULL)
+		return SOCKDIAG_UNSUPPORTED;
+	pthread_mutex_lock(&sockdiag_lock);
+	if(sockdiag_open() == 0 && (v4 = sockdiag_dump(AF_INET,states,cb,arg)) >= 0){
+		v6 = sockdiag_dump(AF_INET6,states,cb,arg);
+		// ipv6 may be compiled out, v4 alone is still a full answer then
+		v4 += (v6 > 0)?(v6):(0);
+	}
+	pthread_mutex_unlock(&sockdiag_lock);
+	return v4;
+}
+
+static inline u32 sockpid_hash(u32 inode)
+{
+	inode ^= inode >> 16;
+	inode *= 0x7FEB352Du;
+	inode ^= inode >> 15;
+	return inode & (SOCKPID_SLOTS - 1);
+}
+/**
+ * @name:   sockpid_find
+ * @Author: qihoo360
+ * @msg:    sockpid_lock held
+ * @param
+ * @return: slot of inode, or the free slot where it would go, NULL if full
+ */
+static sockpid_slot *sockpid_find(u32 inode)
+{
+	u32 idx = sockpid_hash(inode);
+	for(int probe = 0;probe < SOCKPID_SLOTS;probe ++){
+		sockpid_slot *s = &sockpid_table[idx];
+		if(!s->used || s->inode == inode)
+			return s;
+		idx = (idx + 1) & (SOCKPID_SLOTS - 1);
+	}
+	return NULL;
+}
+
+static void sockpid_add(u32 inode,s32 pid,const char *name,u32 now)
+{
+	sockpid_slot *s = NULL;
+	if(sockpid_used >= SOCKPID_LIMIT){
+		memset(sockpid_table,0,sizeof(sockpid_table));
+		sockpid_used = 0;
+	}
+	if((s = sockpid_find(inode)) == NULL)
+		return;
+	if(!s->used){
+		s->used = 1;
+		s->inode = inode;
+		sockpid_used ++;
+	}
+	s->pid = pid;
+	s->stamp = now;
+	snprintf(s->name,sizeof(s->name),"%s",name);
+}
+/**
+ * @name:   sockpid_scan_pid
+ * @Author: qihoo360
+ * @msg:    add every socket fd of one process, sockpid_lock held
+ * @param
+ * @return:
+ */
+static void sockpid_scan_pid(const char *pid_str,u32 now)
+{
+	char path[64],link[64],cmdline[256];
+	const char *name = NULL;
+	struct dirent *de = NULL;
+	DIR *dir = NULL;
+	s32 pid = atoi(pid_str);
+	int fd,len;
+
+	snprintf(path,sizeof(path),"/proc/%s/fd",pid_str);
+	if((dir = opendir(path)) == NULL)
+		return;
+	while((de = readdir(dir)) != NULL){
+		char *end = NULL;
+		unsigned long inode;
+		if(de->d_name[0] == '.')
+			continue;
+		snprintf(path,sizeof(path),"/proc/%s/fd/%s",pid_str,de->d_name);
+		if((len = readlink(path,link,sizeof(link) - 1)) <= 0)
+			continue;
+		link[len] = '\0';
+		if(strncmp(link,"socket:[",8) != 0)
+			continue;
+		inode = strtoul(link + 8,&end,10);
+		if(end == NULL || *end != ']' || inode == 0)
+			continue;
+		if(name == NULL){
+			snprintf(path,sizeof(path),"/proc/%s/cmdline",pid_str);
+			cmdline[0] = '\0';
+			if((fd = open(path,O_RDONLY)) >= 0){
+				len = read(fd,cmdline,sizeof(cmdline) - 1);
+				cmdline[(len > 0)?(len):(0)] = '\0';
+				close(fd);
+			}
+			name = strrchr(cmdline,'/');
+			name = (name != NULL)?(name + 1):(cmdline);
+		}
+		sockpid_add((u32)inode,pid,name,now);
+	}
+	closedir(dir);
+}
+
+static void sockpid_scan(u32 now)
+{
+	struct dirent *de = NULL;
+	DIR *dir = opendir("/proc");
+	if(dir == NULL)
+		return;
+	while((de = readdir(dir)) != NULL){
+		const char *c = de->d_name;
+		while(isdigit((unsigned char)*c))
+			c ++;
+		if(*c != '\0' || c == de->d_name)
+			continue;
+		sockpid_scan_pid(de->d_name,now);
+	}
+	closedir(dir);
+}
+static boolean sockpid_scan_allowed(u32 now)
+{
+	u32 gained = (now - sockpid_scan_refill) / SOCKPID_RESCAN_MS;
+	if(gained > 0){
+		sockpid_scan_tokens += gained;
+		if(sockpid_scan_tokens > SOCKPID_RESCAN_BURST)
+			sockpid_scan_tokens = SOCKPID_RESCAN_BURST;
+		sockpid_scan_refill += gained * SOCKPID_RESCAN_MS;
+	}
+	if(sockpid_scan_tokens == 0)
+		return FALSE;
+	sockpid_scan_tokens --;
+	return TRUE;
+}
+
+static void sockpid_forget_locked(s32 pid)
+{
+	for(int i = 0;i < SOCKPID_SLOTS;i ++){
+		if(sockpid_table[i].used && sockpid_table[i].pid == pid)
+			sockpid_table[i].pid = -1;
+	}
+}
+/**
+ * @name:   sockpid_lookup
+ * @Author: qihoo360
+ * @msg:    hits cost a hash probe and kill(pid,0); a miss rescans /proc within
+ *          the token budget, inodes nobody owned (kernel sockets, already
+ *          closed) back off for SOCKPID_NEGATIVE_MS
+ * @param
+ * @return: TRUE:found
+ */
+boolean sockpid_lookup(u32 inode,s32 *pid,char *name,int name_len)
+{
+	sockpid_slot *s = NULL;
+	boolean found = FALSE;
+	u32 now = sockpid_now_ms();
+
+	pthread_mutex_lock(&sockpid_lock);
+	s = sockpid_find(inode);
+	if(s != NULL && s->used && s->pid > 0){
+		if(kill(s->pid,0) == 0 || errno == EPERM)
+			found = TRUE;
+		else
+			sockpid_forget_locked(s->pid);
+	}
+	if(!found && !(s != NULL && s->used && s->pid == 0 && (int)(now - s->stamp) < SOCKPID_NEGATIVE_MS)
+		&& sockpid_scan_allowed(now)){
+		sockpid_scan(now);
+		s = sockpid_find(inode);
+		if(s != NULL && s->used && s->pid > 0)
+			found = TRUE;
+		else
+			sockpid_add(inode,0,"",now);
+	}
+	if(found){
+		if(pid)
+			*pid = s->pid;
+		if(name && name_len > 0)
+			snprintf(name,name_len,"%s",s->name);
+	}
+	pthread_mutex_unlock(&sockpid_lock);
+	return found;
+}
+/**
+ * @name:   sockpid_forget_pid
+ * @Author: qihoo360
+ * @msg:    entries stay as tombstones so probe chains are kept
+ * @param
+ * @return:
+ */
+void sockpid_forget_pid(s32 pid)
+{
+	pthread_mutex_lock(&sockpid_lock);
+	sockpid_forget_locked(pid);
+	pthread_mutex_unlock(&sockpid_lock);
+}
+
+void sockpid_clear(void)
+{
+	pthread_mutex_lock(&sockpid_lock);
+	memset(sockpid_table,0,sizeof(sockpid_table));
+	sockpid_used = 0;
+	sockpid_scan_tokens = SOCKPID_RESCAN_BURST;
+	pthread_mutex_unlock(&sockpid_lock);
+}
+
+int sockdiag_attribute(u8 protocol,u32 src_ip,u16 src_port,u32 dst_ip,u16 dst_port,s32 *pid,char *name,int name_len)
+{
+	u32 inode = 0;
+	int ret = sockdiag_find_inode(protocol,src_ip,src_port,dst_ip,dst_port,&inode,NULL);
+	if(ret != SOCKDIAG_OK)
+		return ret;
+	return sockpid_lookup(inode,pid,name,name_len)?(SOCKDIAG_OK):(SOCKDIAG_NOT_FOUND);
+}
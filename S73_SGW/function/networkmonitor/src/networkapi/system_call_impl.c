@@ -25,54 +25,177 @@
 #include "dpi_report.h"
 #include "system_call_impl.h"
 #include "spdloglib.h"
+#include "sock_diag.h"
 
 //#define TCP_CONNECT_ATTACK_THRESHOLD   64
-static FILE *_file = NULL;
-static u8 readBuf[4];
+#define TCP_STATE_NUM			(12)		//ESTABLISHED(1) .. CLOSING(11)
+#define TCP_STATE_ESTABLISHED	(1)
+#define TCP_STATE_LISTEN		(10)
+#define TCP_STATE_SYN_RECV		(3)
+#define TCP_STATE_TIME_WAIT		(6)
+#define TCP_PEER_SLOTS			(256)		//power of two
+#define TCP_PEER_TOP			(3)
+
+typedef struct{
+	u8  family;
+	u8  addr[16];
+	u32 count;
+}tcp_peer;
+
+typedef struct{
+	u32 state[TCP_STATE_NUM];
+	u32 peers;
+	u32 peer_overflow;		//connections whose peer did not fit
+	tcp_peer peer[TCP_PEER_SLOTS];
+}tcp_census;
+
+static tcp_census census;
+static char procBuf[16384];
 static long tcpConnectAttachThreshold = 64;
 
 void setTcpConnectAttachThreshold (long para)
 {
     tcpConnectAttachThreshold = para;
 }
+
+static u32 census_peer_hash(u8 family,const u8 *addr)
+{
+	u32 h = 0x811C9DC5u ^ family;
+	for(int i = 0;i < ((family == AF_INET6)?(16):(4));i ++){
+		h ^= addr[i];
+		h *= 0x01000193u;
+	}
+	return h & (TCP_PEER_SLOTS - 1);
+}
 /**
- * @name:   system_call_implthread
+ * @name:   census_add
  * @Author: qihoo360
- * @msg:    loop 1S 
- * @param  
+ * @msg:    per state count, peers only for established and half open
+ * @param   dst:remote address, ipv4 mapped ipv6 is folded into ipv4
  * @return: 
  */
-void system_call_implthread(void){
-	if (!_file)
-	{
+static void census_add(u8 family,u8 state,const u8 *dst,u16 dst_port,void *arg)
+{
+	static const u8 v4mapped[12] = {0,0,0,0,0,0,0,0,0,0,0xFF,0xFF};
+	tcp_census *c = (tcp_census *)arg;
+	u8 addr[16] = {0};
+	u32 idx;
+
+	if(state >= TCP_STATE_NUM)
+		return;
+	c->state[state] ++;
+	if(state != TCP_STATE_ESTABLISHED && state != TCP_STATE_SYN_RECV)
 		return;
+	if(family == AF_INET6 && memcmp(dst,v4mapped,sizeof(v4mapped)) == 0){
+		family = AF_INET;
+		dst += 12;
 	}
-	memset(readBuf,0,sizeof(readBuf));
-	 /*we can use popen*/
-	system("netstat -an | grep ESTABLISHED | wc -l > /tmp/estab");
-	fflush(_file);
-	fseek(_file,0,SEEK_SET); 
-	s32 res = fread (readBuf, 1, sizeof(readBuf),_file);
-	if(res>1)
-	{
-		res--;
-		s32 c = 0;
-		/*This function is similar to 'atoi(readBuf)'*/
-		for(u8 i=0;i<res;i++)
-		{
-			c *= 10;
-			readBuf[i]-='0';
-			c += readBuf[i];
+	memcpy(addr,dst,(family == AF_INET6)?(16):(4));
+	idx = census_peer_hash(family,addr);
+	for(int probe = 0;probe < TCP_PEER_SLOTS;probe ++){
+		tcp_peer *p = &c->peer[idx];
+		if(p->count == 0){
+			p->family = family;
+			memcpy(p->addr,addr,sizeof(p->addr));
+			c->peers ++;
+		}
+		if(p->family == family && memcmp(p->addr,addr,sizeof(p->addr)) == 0){
+			p->count ++;
+			return;
 		}
-		if(c>tcpConnectAttachThreshold)
-		{
-			value_log(TCP_CONNECT_ATTACK, c, tcpConnectAttachThreshold);
+		idx = (idx + 1) & (TCP_PEER_SLOTS - 1);
+	}
+	c->peer_overflow ++;
+}
+/**
+ * @name:   census_proc
+ * @Author: qihoo360
+ * @msg:    fallback without sock_diag, one pass over /proc/net/tcp{,6} through a reused buffer
+ * @param   
+ * @return: 
+ */
+static void census_proc(const char *path,u8 family,tcp_census *c)
+{
+	char line[256],rem[33];
+	u32 port,state;
+	FILE *fp = fopen(path,"r");
+	if(fp == NULL)
+		return;
+	setvbuf(fp,procBuf,_IOFBF,sizeof(procBuf));
+	while(fgets(line,sizeof(line),fp) != NULL){
+		u8 addr[16] = {0};
+		u32 words = (family == AF_INET6)?(4):(1);
+		// "  0: 0100007F:0035 0200007F:C3A2 01 ..."
+		if(sscanf(line,"%*d: %*[0-9A-Fa-f]:%*X %32[0-9A-Fa-f]:%X %X",rem,&port,&state) != 3)
+			continue;
+		if(strlen(rem) != words * 8)
+			continue;
+		for(u32 w = 0;w < words;w ++){
+			char hex[9];
+			u32 v;
+			memcpy(hex,&rem[w * 8],8);
+			hex[8] = '\0';
+			v = (u32)strtoul(hex,NULL,16);//kernel prints the in-memory word
+			memcpy(&addr[w * 4],&v,4);
+		}
+		census_add(family,(u8)state,addr,(u16)port,c);
+	}
+	fclose(fp);
+}
 
-			char net_info[128] = {0};
-			snprintf(net_info, sizeof(net_info), "Value:%d, Threshold:%ld", c, tcpConnectAttachThreshold);
-			report_log(TCP_CONNECT_ATTACK,NONE_SRC_IDENTIFIER,NONE_PORT_IDENTIFIER, net_info);
+static void census_top(const tcp_census *c,const tcp_peer **top,int n)
+{
+	for(int i = 0;i < n;i ++)
+		top[i] = NULL;
+	for(int i = 0;i < TCP_PEER_SLOTS;i ++){
+		const tcp_peer *p = &c->peer[i];
+		if(p->count == 0)
+			continue;
+		for(int j = 0;j < n;j ++){
+			if(top[j] == NULL || p->count > top[j]->count){
+				memmove(&top[j + 1],&top[j],(n - j - 1) * sizeof(top[0]));
+				top[j] = p;
+				break;
+			}
 		}
 	}
+}
+/**
+ * @name:   system_call_implthread
+ * @Author: qihoo360
+ * @msg:    loop 1S, established connection census without forking netstat
+ * @param  
+ * @return: 
+ */
+void system_call_implthread(void){
+	const tcp_peer *top[TCP_PEER_TOP];
+	char net_info[128] = {0},peer[INET6_ADDRSTRLEN] = {0};
+	u32 c = 0;
+	int off = 0;
+
+	memset(&census,0,sizeof(census));
+	if(sockdiag_tcp_walk(~(1U << TCP_STATE_LISTEN),census_add,&census) < 0){
+		memset(&census,0,sizeof(census));
+		census_proc("/proc/net/tcp",AF_INET,&census);
+		census_proc("/proc/net/tcp6",AF_INET6,&census);
+	}
+	c = census.state[TCP_STATE_ESTABLISHED];
+	if(c <= tcpConnectAttachThreshold)
+		return;
+
+	value_log(TCP_CONNECT_ATTACK, c, tcpConnectAttachThreshold);
+	census_top(&census,top,TCP_PEER_TOP);
+	off = snprintf(net_info, sizeof(net_info), "Value:%u, Threshold:%ld, SynRecv:%u, TimeWait:%u, Peers:%u",
+		c, tcpConnectAttachThreshold, census.state[TCP_STATE_SYN_RECV], census.state[TCP_STATE_TIME_WAIT], census.peers);
+	for(int i = 0;i < TCP_PEER_TOP && top[i] != NULL && off > 0 && off < (int)sizeof(net_info);i ++){
+		char addr[INET6_ADDRSTRLEN] = {0};
+		inet_ntop(top[i]->family,top[i]->addr,addr,sizeof(addr));
+		if(i == 0)
+			memcpy(peer,addr,sizeof(peer));
+		off += snprintf(net_info + off, sizeof(net_info) - off, "%s%s(%u)", (i == 0)?(", Top:"):(","), addr, top[i]->count);
+	}
+	// the busiest peer is the event source
+	report_log(TCP_CONNECT_ATTACK,(top[0] != NULL)?(peer):(NONE_SRC_IDENTIFIER),NONE_PORT_IDENTIFIER, net_info);
 } 
 /**
  * @name:   system_call_initpro
@@ -82,27 +205,9 @@ void system_call_implthread(void){
  * @return: 
  */
 void system_call_init(void){
-	if (_file)
-	{
-		fclose(_file);
-		_file = NULL;
-	}
-
-	_file = fopen("/tmp/estab","w+");
-	if(_file == NULL)
-	{
-		char log[256] = {0};
-		sprintf(log,"%s","open failed");
-		log_i("networkmonitor", log);
-		return;
-	}
-	
+	memset(&census,0,sizeof(census));
 }
  
 void system_call_free(void){
-	if (_file)
-	{
-		fclose(_file);
-		_file = NULL;
-	}
+	memset(&census,0,sizeof(census));
 }
@@ -14,6 +14,7 @@
 #include "common_fun.h"
 #include "data_dispatcher.h"
 #include "api_networkmonitor.h"
+#include "scan_sketch.h"
 #define IP_SOURCE_MAX_SIZE			(8)  //pacp抓取数据每个端口最多可以对应ip源数目
 
 struct tcp_body{
@@ -46,6 +47,23 @@ static list list_tcp_packet;
 	list_destroy(&list_tcp_packet);\
 	list_init(&list_tcp_packet,free);
 
+// 概率数据结构检测，内存固定，与攻击源地址数量无关
+static sketch_detector tcp_sketch;
+enum{
+	TCP_SK_SYN = 0,
+	TCP_SK_FIN,
+	TCP_SK_ACK,
+	TCP_SK_RST,
+	TCP_SK_PSH,
+	TCP_SK_URG,
+	TCP_SK_NULL,
+	TCP_SK_SYNONLY,
+	TCP_SK_MAX
+};
+// 端口泛洪统计只需要前5种标志
+#define  TCP_SK_PORT_FLAGS		(TCP_SK_PSH + 1)
+#define  TCP_PORT_KEY(flag,port)	SKETCH_KEY(SKETCH_KEY_PORT + 1 + (flag),port)
+
 ///just calc port number
 struct tcp_portcalc{
 	u32 ipaddr;
@@ -90,6 +108,151 @@ u32 getmaxfreip(void){
 	}
 	return _localip;
 }
+static void tcp_sketch_report(u8 event,u32 src_addr,s32 port,u32 value,u32 threshold)
+{
+	s8 *ip_str = NONE_SRC_IDENTIFIER;
+	char net_info[128] = {0};
+	if(src_addr != 0)
+		ip_str = inet_ntoa((struct in_addr){.s_addr=src_addr});
+	value_log(event, value, threshold);
+	snprintf(net_info, sizeof(net_info), "Value:%d, Threshold:%d", value, threshold);
+	report_log(event,ip_str,port, net_info);
+}
+/**
+ * @name:   tcp_sketch_update
+ * @msg:    O(1) per packet, capture thread only
+ * @param  
+ * @return: 
+ */
+static void tcp_sketch_update(u32 src_addr,u16 dst_port,struct tcphdr* tcp)
+{
+	u8 flag[TCP_SK_MAX] = {0};
+	flag[TCP_SK_SYN] = tcp->syn;
+	flag[TCP_SK_FIN] = tcp->fin;
+	flag[TCP_SK_ACK] = tcp->ack;
+	flag[TCP_SK_RST] = tcp->rst;
+	flag[TCP_SK_PSH] = tcp->psh;
+	flag[TCP_SK_URG] = tcp->urg;
+	flag[TCP_SK_NULL] = !(tcp->syn|tcp->fin|tcp->ack|tcp->rst|tcp->psh|tcp->urg);
+	flag[TCP_SK_SYNONLY] = tcp->syn && !(tcp->fin|tcp->ack|tcp->rst|tcp->psh|tcp->urg);
+
+	sketch_window *w = sketch_begin(&tcp_sketch);
+	sketch_source *s = NULL;
+	w->packets ++;
+	if(sketch_cms_add(w,SKETCH_KEY(SKETCH_KEY_SRC,src_addr),1) >= SKETCH_SOURCE_ADMIT)
+		s = sketch_source_get(w,src_addr);
+	if(sketch_cms_add(w,SKETCH_KEY(SKETCH_KEY_PORT,dst_port),1) > tcpDosRetryTimesThreshold)
+		sketch_candidate_add(w,dst_port,src_addr);
+	for(int i = 0;i < TCP_SK_MAX;i ++){
+		if(!flag[i])
+			continue;
+		if(i < TCP_SK_PORT_FLAGS)
+			sketch_cms_add(w,TCP_PORT_KEY(i,dst_port),1);
+		w->global.counter[i] ++;
+		if(s)
+			s->counter[i] ++;
+	}
+	w->global.packets ++;
+	sketch_source_port(&w->global,dst_port);
+	if(s){
+		s->packets ++;
+		sketch_source_port(s,dst_port);
+	}
+	sketch_end(&tcp_sketch);
+}
+/**
+ * @name:   tcp_sketch_flood
+ * @msg:    same flag rules as the list based consumer, per candidate port
+ * @param  
+ * @return: 
+ */
+static void tcp_sketch_flood(const sketch_window *w,const sketch_candidate *c)
+{
+	u32 count = sketch_cms_query(w,SKETCH_KEY(SKETCH_KEY_PORT,c->port));
+	u32 threshold = (u32)(count*tcpConnectOrScanWeight);
+	u32 syn = sketch_cms_query(w,TCP_PORT_KEY(TCP_SK_SYN,c->port));
+	u32 fin = sketch_cms_query(w,TCP_PORT_KEY(TCP_SK_FIN,c->port));
+	u32 ack = sketch_cms_query(w,TCP_PORT_KEY(TCP_SK_ACK,c->port));
+	u32 rst = sketch_cms_query(w,TCP_PORT_KEY(TCP_SK_RST,c->port));
+	u32 psh = sketch_cms_query(w,TCP_PORT_KEY(TCP_SK_PSH,c->port));
+
+	if(count <= tcpDosRetryTimesThreshold)
+		return;
+	if(ack >= threshold && fin >= threshold)
+		tcp_sketch_report(TCP_ACK_FIN_DOS,c->src_addr,c->port,ack,threshold);
+	if(ack >= threshold && rst >= threshold)
+		tcp_sketch_report(TCP_ACK_RST_DOS,c->src_addr,c->port,ack,threshold);
+	if(fin >= threshold && rst >= threshold)
+		tcp_sketch_report(TCP_FIN_RST_DOS,c->src_addr,c->port,fin,threshold);
+	if(ack >= threshold && psh >= threshold)
+		tcp_sketch_report(TCP_ACK_PSH_FLOOD,c->src_addr,c->port,ack,threshold);
+	if(syn >= threshold){
+		if(fin >= threshold)
+			tcp_sketch_report(TCP_FIN_SYN_DOS,c->src_addr,c->port,fin,threshold);
+		else if(ack >= threshold)
+			tcp_sketch_report(TCP_SYN_ACK_FLOOD,c->src_addr,c->port,ack,threshold);
+		else
+			tcp_sketch_report(TCP_SYN_FLOOD,c->src_addr,c->port,syn,threshold);
+	}
+}
+/**
+ * @name:   tcp_sketch_scan
+ * @msg:    classify a scanning source by the flags it used
+ * @param   ports:distinct destination ports of this source
+ * @return: 
+ */
+static void tcp_sketch_scan(const sketch_source *s,u32 ports,u32 src_addr)
+{
+	u32 threshold = (u32)(ports*tcpConnectOrScanWeight);
+	const u32 *c = s->counter;
+
+	if(c[TCP_SK_SYNONLY] >= ports*tcpScanConnectRetrytimesThreshold)
+		tcp_sketch_report(TCP_CONNECT_SCAN,src_addr,NONE_PORT_IDENTIFIER,c[TCP_SK_SYNONLY],threshold);
+	else if(c[TCP_SK_SYN] > threshold)
+		tcp_sketch_report(TCP_SYN_SCAN,src_addr,NONE_PORT_IDENTIFIER,c[TCP_SK_SYN],threshold);
+	if(c[TCP_SK_FIN] > threshold){
+		if(c[TCP_SK_PSH] > threshold && c[TCP_SK_URG] > threshold)
+			tcp_sketch_report(TCP_XMAS_SCAN,src_addr,NONE_PORT_IDENTIFIER,c[TCP_SK_PSH],threshold);
+		else
+			tcp_sketch_report(TCP_FIN_SCAN,src_addr,NONE_PORT_IDENTIFIER,c[TCP_SK_FIN],threshold);
+	}
+	if(c[TCP_SK_ACK] > threshold)
+		tcp_sketch_report(TCP_ACK_SCAN,src_addr,NONE_PORT_IDENTIFIER,c[TCP_SK_ACK],threshold);
+	if(c[TCP_SK_NULL] > threshold)
+		tcp_sketch_report(TCP_NULL_SCAN,src_addr,NONE_PORT_IDENTIFIER,c[TCP_SK_NULL],threshold);
+}
+/**
+ * @name:   tcp_sketch_consumer
+ * @msg:    evaluate the retired window, parser thread only
+ * @param  
+ * @return: 
+ */
+static void tcp_sketch_consumer(void)
+{
+	sketch_window *w = sketch_swap(&tcp_sketch);
+	boolean reported = FALSE;
+	u32 ports = 0;
+
+	if(w->packets == 0)
+		return;
+	for(u32 i = 0;i < w->candidate_used;i ++)
+		tcp_sketch_flood(w,&w->candidate[i]);
+	for(int i = 0;i < SKETCH_SOURCES;i ++){
+		const sketch_source *s = &w->source[i];
+		if(!s->used)
+			continue;
+		if((ports = sketch_source_ports(s)) > tcpPortsPerSecThreshold){
+			tcp_sketch_scan(s,ports,s->addr);
+			reported = TRUE;
+		}
+	}
+	// 分散源地址的扫描按全局统计，归属到最活跃的源
+	if(!reported && (ports = sketch_source_ports(&w->global)) > tcpPortsPerSecThreshold){
+		sketch_source *top = sketch_source_top(w);
+		tcp_sketch_scan(&w->global,ports,(top != NULL)?(top->addr):(0));
+	}
+	sketch_window_clear(w);
+}
 /**
  * @name:   tcpport_value_consumer
  * @Author: qihoo360
@@ -113,6 +276,11 @@ void tcpport_value_consumer(void)
 
 	if(l_loop ++ >= 2)
 	{	
+#if SKETCH_SCAN_DETECTION
+		l_loop = 0;
+		tcp_sketch_consumer();
+		return;
+#endif
 		clearall()
 		l_loop = 0;
 		pthread_mutex_lock(&request_tcp_lock);
@@ -359,6 +527,7 @@ void tcp_scanner_init()
 	pthread_mutex_lock(&request_tcp_lock);		
 	TCP_INIT_VALUE();
 	pthread_mutex_unlock(&request_tcp_lock);
+	sketch_init(&tcp_sketch);
 }
 /**
  * @name:   tcp_search_elmt
@@ -414,6 +583,10 @@ void tcp_parser(u32 src_addr,u32 dest_addr,struct tcphdr* tcp,u32 pack_length)
 		report_log(TCP_FIN_SYN_STACK_ABNORMAL,tmp,dst_port, NULL);//7%
 		//return;
 	}
+#if SKETCH_SCAN_DETECTION
+	tcp_sketch_update(src_addr,dst_port,tcp);
+	return;
+#endif
 	// 在原先的tcp数据队列里找出对应的数据，以port号为key，并统计相同ip地址数量。
 	long localtime = get_timestamp();
 	pthread_mutex_lock(&request_tcp_lock);
@@ -7,12 +7,17 @@
 #include <semaphore.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sched.h>
 #include "typedef.h"
 #include "udp_detection.h"
 #include "dpi_report.h"
 #include "common_fun.h"
 #include "data_dispatcher.h"
 #include "api_networkmonitor.h"
+#include "scan_sketch.h"
+#include "dns_trie.h"
+#include "dns_cache.h"
+#include "spdloglib.h"
 
 #define SWAP16BIT(num) ((num>>8)&0xFF + ((num&0xFF)<<8)) // 16位高低位交换
 #define DNS_DATA_MAX_SIZE  (0x40)
@@ -40,7 +45,11 @@ static list list_udp_packet;
 #define UDP_INIT_VALUE()\
 	list_destroy(&list_udp_packet);\
 	list_init(&list_udp_packet,free);
-static list *whiteDNS = NULL;
+// 编译后的DNS白名单，抓包线程只读，更新时整体替换
+static dns_trie *whiteDNSTrie = NULL;
+static u32 whiteDNSSeq = 0;//odd while dns_parser is matching
+static pthread_mutex_t request_dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static boolean DNSWhiteMatch(const char *name);
 
 static struct udp_body *udp_search_elmt(list *_list,u16 port)
 {
@@ -63,6 +72,99 @@ static struct udp_body *udp_search_elmt(list *_list,u16 port)
 
 static boolean src_port_zero_flag = FALSE;
 static u32 fraggle_attack_count = 0;
+
+// 概率数据结构检测，内存固定，与攻击源地址数量无关
+static sketch_detector udp_sketch;
+enum{
+	UDP_SK_FRAGGLE = 0,
+	UDP_SK_SRC_ZERO,
+};
+
+static void udp_sketch_report(u8 event,u32 src_addr,u32 value,long threshold)
+{
+	s8 *ip_str = NONE_SRC_IDENTIFIER;
+	char net_info[128] = {0};
+	if(src_addr != 0)
+		ip_str = inet_ntoa((struct in_addr){.s_addr=src_addr});
+	value_log(event, value, threshold);
+	snprintf(net_info, sizeof(net_info), "Value:%d, Threshold:%ld", value, threshold);
+	report_log(event,ip_str,NONE_PORT_IDENTIFIER, net_info);
+}
+/**
+ * @name:   udp_sketch_update
+ * @Author: qihoo360
+ * @msg:    O(1) per packet, capture thread only
+ * @param  
+ * @return: 
+ */
+static void udp_sketch_update(u32 src_addr,u16 src_port,u16 dst_port)
+{
+	sketch_window *w = sketch_begin(&udp_sketch);
+	sketch_source *s = NULL;
+	w->packets ++;
+	if(src_port == 0){
+		w->global.counter[UDP_SK_SRC_ZERO] ++;
+		sketch_end(&udp_sketch);
+		return;
+	}
+	if((dst_port == 7) || (dst_port == 19))
+		w->global.counter[UDP_SK_FRAGGLE] ++;
+	if(sketch_cms_add(w,SKETCH_KEY(SKETCH_KEY_SRC,src_addr),1) >= SKETCH_SOURCE_ADMIT)
+		s = sketch_source_get(w,src_addr);
+	if(sketch_cms_add(w,SKETCH_KEY(SKETCH_KEY_PORT,dst_port),1) > udpDosRetrytimesThreshold)
+		sketch_candidate_add(w,dst_port,src_addr);
+	w->global.packets ++;
+	sketch_source_port(&w->global,dst_port);
+	if(s){
+		s->packets ++;
+		sketch_source_port(s,dst_port);
+	}
+	sketch_end(&udp_sketch);
+}
+/**
+ * @name:   udp_sketch_consumer
+ * @Author: qihoo360
+ * @msg:    evaluate the retired window, parser thread only
+ * @param  
+ * @return: 
+ */
+static void udp_sketch_consumer(void)
+{
+	sketch_window *w = sketch_swap(&udp_sketch);
+	sketch_source *top = NULL;
+	boolean reported = FALSE;
+	u32 ports = 0;
+
+	if(w->packets == 0)
+		return;
+	top = sketch_source_top(w);
+	for(int i = 0;i < SKETCH_SOURCES;i ++){
+		const sketch_source *s = &w->source[i];
+		if(!s->used)
+			continue;
+		if((ports = sketch_source_ports(s)) > udpPortsPerSecThreshold){
+			udp_sketch_report(UDP_PORT_SCAN,s->addr,ports,udpPortsPerSecThreshold);
+			reported = TRUE;
+		}
+	}
+	// 分散源地址的扫描按全局统计，归属到最活跃的源
+	if(!reported && (ports = sketch_source_ports(&w->global)) > udpPortsPerSecThreshold)
+		udp_sketch_report(UDP_PORT_SCAN,(top != NULL)?(top->addr):(0),ports,udpPortsPerSecThreshold);
+	if(w->global.counter[UDP_SK_FRAGGLE] > fraggleAttemptPerSecThreshold)
+		udp_sketch_report(FRAGGLE_ATTACK,(top != NULL)?(top->addr):(0),w->global.counter[UDP_SK_FRAGGLE],fraggleAttemptPerSecThreshold);
+	if(w->global.counter[UDP_SK_SRC_ZERO] > 0){
+		s8 *ip_str = NONE_SRC_IDENTIFIER;
+		if(top != NULL)
+			ip_str = inet_ntoa((struct in_addr){.s_addr=top->addr});
+		report_log(UDP_SRC_PORT_ZERO,ip_str,NONE_PORT_IDENTIFIER, NULL);
+	}
+	for(u32 i = 0;i < w->candidate_used;i ++){
+		u32 count = sketch_cms_query(w,SKETCH_KEY(SKETCH_KEY_PORT,w->candidate[i].port));
+		if(count > udpDosRetrytimesThreshold)
+			udp_sketch_report(UDP_PORT_FLOOD,w->candidate[i].src_addr,count,udpDosRetrytimesThreshold);
+	}
+	sketch_window_clear(w);
+}
 /**
  * @name:   udp_scanner_init
  * @Author: qihoo360
@@ -75,6 +177,7 @@ void udp_scanner_init(void){
 	UDP_INIT_VALUE();
 	fraggle_attack_count = 0;
 	pthread_mutex_unlock(&request_udp_lock);
+	sketch_init(&udp_sketch);
 }
 /**
  * @name:   udpport_value_con
@@ -84,6 +187,10 @@ void udp_scanner_init(void){
  * @return: 
  */
 void udpport_value_consumer(void){
+#if SKETCH_SCAN_DETECTION
+	udp_sketch_consumer();
+	return;
+#endif
 	u32 ports_count = 0;
 	ports_count = list_size(&list_udp_packet);
 	list_elmt *cur_elmt = list_head(&list_udp_packet);
@@ -222,6 +329,10 @@ void udp_parser(u32 src_addr,u32 dest_addr,struct udphdr* udp,u32 pack_length)
 	u16 src_port = ntohs(udp->source);
 	u16 dst_port = ntohs(udp->dest);
 	
+#if SKETCH_SCAN_DETECTION
+	udp_sketch_update(src_addr,src_port,dst_port);
+	return;
+#endif
 	if(src_port==0)
 	{
 		src_port_zero_flag = TRUE;
@@ -481,7 +592,7 @@ void dns_print(struct dns_hdr *dnshdr, int len)
 	}printf("\n");
 }
 
-void dns_parser(char* src_addr,char* dest_addr,struct udphdr* udp, int action)
+void dns_parser(char* src_addr,char* dest_addr,struct udphdr* udp, int action, int cap_len)
 {
 	u16 dst_port = ntohs(udp->dest);
 	u16 src_port = ntohs(udp->source);
@@ -490,6 +601,16 @@ void dns_parser(char* src_addr,char* dest_addr,struct udphdr* udp, int action)
 	{
 		struct dns_hdr *dnshdr = (struct dns_hdr *)((u8 *)udp + sizeof(struct udphdr));
 		int payload_total_len = SWAP16BIT(udp->len)-8-12;
+		// udp长度不可信，不能超过实际抓到的长度
+		if(payload_total_len > cap_len-8-12)
+			payload_total_len = cap_len-8-12;
+		if(!action && cap_len > (int)sizeof(struct udphdr))
+		{
+			// 应答地址缓存，IP连接事件据此关联域名
+			dns_cache_learn((u8 *)dnshdr, cap_len - sizeof(struct udphdr));
+			if(!get_DnsResponseReport())
+				return;
+		}
 		char dns_data_tmp_buff[DNS_DATA_MAX_SIZE], ip_data_tmp_buff[IP_DATA_MAX_SIZE];
 		int dns_data_tmp_buff_len = 0;
 
@@ -514,17 +635,9 @@ void dns_parser(char* src_addr,char* dest_addr,struct udphdr* udp, int action)
 		}
 
 		/*Whitelists are used for filtering*/
-		if (whiteDNS)
+		if (DNSWhiteMatch(dns_data_tmp_buff))
 		{
-			list_elmt *element = whiteDNS->head;
-			while (element)
-			{
-				if(strcmp(element->data, dns_data_tmp_buff) == 0)
-				{
-					return;
-				}
-				element = element->next;
-			}
+			return;
 		}
 
 		if(action)
@@ -580,7 +693,65 @@ void dns_parser(char* src_addr,char* dest_addr,struct udphdr* udp, int action)
 		}
 	}
 }
-void DNSWhiteCheckInit(list *listName)
-{
-	whiteDNS = listName;
+/**
+ * @name:   DNSWhiteMatch
+ * @Author: qihoo360
+ * @msg:    capture thread only, O(label count)
+ * @param  
+ * @return: TRUE:name is whitelisted
+ */
+static boolean DNSWhiteMatch(const char *name)
+{
+	boolean hit = FALSE;
+	dns_trie *trie = NULL;
+	// seq must be odd before the trie is read, pairs with DNSWhiteCheckInit
+	__atomic_add_fetch(&whiteDNSSeq,1,__ATOMIC_SEQ_CST);
+	trie = __atomic_load_n(&whiteDNSTrie,__ATOMIC_SEQ_CST);
+	if(trie != NULL)
+		hit = (dns_trie_match(trie,name) != 0);
+	__atomic_add_fetch(&whiteDNSSeq,1,__ATOMIC_RELEASE);
+	return hit;
+}
+/**
+ * @name:   DNSWhiteCheckInit
+ * @Author: qihoo360
+ * @msg:    compile the list ("name" or "*.suffix") and swap it in, call again after every change
+ * @param  
+ * @return: 
+ */
+void DNSWhiteCheckInit(list *listName)
+{
+	dns_trie_builder *builder = NULL;
+	dns_trie *trie = NULL,*old = NULL;
+	u32 seq = 0;
+
+	if(listName == NULL)
+		return;
+	if((builder = dns_trie_builder_new()) == NULL)
+		return;
+	for(list_elmt *element = list_head(listName);element != NULL;element = element->next)
+	{
+		if(dns_trie_builder_add(builder,element->data,1) != 0)
+		{
+			char log[256] = {0};
+			snprintf(log,sizeof(log),"invalid dns white list entry %s",(char *)element->data);
+			log_i("networkmonitor", log);
+		}
+	}
+	if((trie = dns_trie_compile(builder)) == NULL)
+	{
+		log_e("networkmonitor", "dns white list compile failed");
+		return;
+	}
+	pthread_mutex_lock(&request_dns_lock);
+	old = __atomic_exchange_n(&whiteDNSTrie,trie,__ATOMIC_SEQ_CST);
+	// wait for a match still running on the old trie
+	seq = __atomic_load_n(&whiteDNSSeq,__ATOMIC_SEQ_CST);
+	if(seq & 1)
+	{
+		while(__atomic_load_n(&whiteDNSSeq,__ATOMIC_ACQUIRE) == seq)
+			sched_yield();
+	}
+	pthread_mutex_unlock(&request_dns_lock);
+	dns_trie_free(old);
 }
@@ -0,0 +1,17 @@
+#ifndef __PROCTRACKER_H
+#define __PROCTRACKER_H
+#include "processInfo.h"
+
+#define PROC_TRACK_BUCKETS   256     // power of two
+#define PROC_TRACK_EXITED    256     // exited but not yet reaped pids
+#define PROC_TRACK_RCVBUF    (256 * 1024)
+
+// called from the tracker thread after an exec, once per new path
+typedef void (*procExecHook)(processNode_t *node);
+
+int  procTrackerStart(procExecHook hook);   // 0:kernel events flowing  -1:no proc connector, keep polling
+bool procTrackerRunning(void);
+int  procTrackerSnapshot(processNode_t *h); // same list getProcessInfo builds, -1 if not running
+void procTrackerZombies(void (*report)(int pid, int ppid, char *name));
+
+#endif
@@ -10,4 +10,5 @@ void checkProcessLocal();
 void checkProcessChange();
 void checkProcessList();
 void checkZombieProcess();
+void checkProcessEvents(bool enable);
 #endif
\ No newline at end of file
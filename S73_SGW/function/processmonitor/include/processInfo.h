@@ -15,6 +15,7 @@ bool judgeWhiteList(list* list, char* name);
 void append_process_list(processNode_t *h, int pid, int ppid, int uid, int gid, char *path);
 int  search_process_list(processNode_t *h,char *path);
 void destory_process_list(processNode_t *h);
+int  readProcessNode(int pid, processNode_t *node);
 void getProcessInfo(processNode_t *h);
 
 #endif
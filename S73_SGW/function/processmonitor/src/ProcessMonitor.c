@@ -187,6 +187,7 @@ void startProcessMonitor(void)
       timerObj.setInterval(mProcessCollectPeriod, timerProcessMonitor);
       timerObj.starttime(timerProcessMonitor);
    }
+   checkProcessEvents(true);
 }
 /**
  * @name:   stopProcessMonitor
@@ -199,6 +200,7 @@ void stopProcessMonitor(void)
 {
    if(timerProcessMonitor)
       timerObj.stoptimer(timerProcessMonitor);
+   checkProcessEvents(false);
 }
 /**
  * @name:   killProcess
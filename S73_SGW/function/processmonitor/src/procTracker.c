@@ -0,0 +1,432 @@
+// 进程事件跟踪 (netlink proc connector)
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include "util.h"
+#include "spdloglib.h"
+#include "processInfo.h"
+#include "procTracker.h"
+
+static processNode_t *procBucket[PROC_TRACK_BUCKETS];
+static int procExited[PROC_TRACK_EXITED];
+static int procExitedCnt = 0;
+static bool procExitedLost = true;   // zombie list incomplete, scan /proc once
+static int procNlFd = -1;
+static volatile bool procTracking = false;
+static procExecHook procHook = NULL;
+static pthread_t procTrackThread;
+static pthread_mutex_t procTrackLock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline unsigned int procHash(int pid)
+{
+	return ((unsigned int)pid * 2654435761u) >> 24 & (PROC_TRACK_BUCKETS - 1);
+}
+
+// lock held
+static processNode_t *procFind(int pid)
+{
+	processNode_t *i = procBucket[procHash(pid)];
+	while(i != NULL && i->pid != pid)
+		i = i->next;
+	return i;
+}
+
+static void procRemove(int pid)
+{
+	processNode_t **p = &procBucket[procHash(pid)];
+	while(*p != NULL)
+	{
+		if((*p)->pid == pid)
+		{
+			processNode_t *temp = *p;
+			*p = temp->next;
+			free(temp);
+			return;
+		}
+		p = &(*p)->next;
+	}
+}
+
+static processNode_t *procInsert(processNode_t *node)
+{
+	processNode_t *n = procFind(node->pid);
+	if(n == NULL)
+	{
+		if((n = malloc(sizeof(processNode_t))) == NULL)
+			return NULL;
+		n->next = procBucket[procHash(node->pid)];
+		procBucket[procHash(node->pid)] = n;
+	}
+	processNode_t *next = n->next;
+	*n = *node;
+	n->next = next;
+	return n;
+}
+
+static bool procPathLive(const char *path, int except)
+{
+	for(int b = 0; b < PROC_TRACK_BUCKETS; b++)
+		for(processNode_t *i = procBucket[b]; i != NULL; i = i->next)
+			if(i->pid != except && strcmp(i->path, path) == 0)
+				return true;
+	return false;
+}
+
+static void procClear(void)
+{
+	for(int b = 0; b < PROC_TRACK_BUCKETS; b++)
+	{
+		while(procBucket[b] != NULL)
+		{
+			processNode_t *temp = procBucket[b];
+			procBucket[b] = temp->next;
+			free(temp);
+		}
+	}
+}
+
+/**
+ * @name:   procRescan
+ * @Author: qihoo360
+ * @msg:    full /proc walk, only at start and after the kernel dropped events
+ * @param
+ * @return:
+ */
+static void procRescan(void)
+{
+	DIR *dirproc = opendir("/proc");
+	struct dirent *direproc = NULL;
+	processNode_t node;
+
+	pthread_mutex_lock(&procTrackLock);
+	procClear();
+	procExitedLost = true;
+	if(dirproc == NULL)
+	{
+		pthread_mutex_unlock(&procTrackLock);
+		log_e("processmonitor","open proc error");
+		return;
+	}
+	while((direproc = readdir(dirproc)) != NULL)
+	{
+		const char *cs = direproc->d_name;
+		while(isdigit(*cs))
+			cs++;
+		if(*cs || cs == direproc->d_name)
+			continue;
+		if(readProcessNode(atoi(direproc->d_name), &node) == 0)
+			procInsert(&node);
+	}
+	closedir(dirproc);
+	pthread_mutex_unlock(&procTrackLock);
+}
+
+static void procOnExec(int pid)
+{
+	processNode_t node;
+	bool fresh = false;
+
+	if(readProcessNode(pid, &node) != 0)
+	{
+		pthread_mutex_lock(&procTrackLock);
+		procRemove(pid);
+		pthread_mutex_unlock(&procTrackLock);
+		return;
+	}
+	pthread_mutex_lock(&procTrackLock);
+	fresh = !procPathLive(node.path, pid);
+	procInsert(&node);
+	pthread_mutex_unlock(&procTrackLock);
+	if(fresh && procHook)
+		procHook(&node);
+}
+
+static void procOnEvent(struct proc_event *ev)
+{
+	processNode_t *n = NULL, node;
+
+	switch(ev->what)
+	{
+	case PROC_EVENT_FORK:
+		if(ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid)
+			break;    // thread
+		pthread_mutex_lock(&procTrackLock);
+		if((n = procFind(ev->event_data.fork.parent_tgid)) != NULL)
+		{
+			node = *n;
+			node.pid = ev->event_data.fork.child_tgid;
+			node.ppid = ev->event_data.fork.parent_tgid;
+			procInsert(&node);
+		}
+		pthread_mutex_unlock(&procTrackLock);
+		break;
+	case PROC_EVENT_EXEC:
+		procOnExec(ev->event_data.exec.process_tgid);
+		break;
+	case PROC_EVENT_UID:
+		pthread_mutex_lock(&procTrackLock);
+		if((n = procFind(ev->event_data.id.process_tgid)) != NULL)
+			n->uid = ev->event_data.id.r.ruid;
+		pthread_mutex_unlock(&procTrackLock);
+		break;
+	case PROC_EVENT_GID:
+		pthread_mutex_lock(&procTrackLock);
+		if((n = procFind(ev->event_data.id.process_tgid)) != NULL)
+			n->gid = ev->event_data.id.r.rgid;
+		pthread_mutex_unlock(&procTrackLock);
+		break;
+	case PROC_EVENT_EXIT:
+		if(ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid)
+			break;
+		pthread_mutex_lock(&procTrackLock);
+		procRemove(ev->event_data.exit.process_tgid);
+		if(procExitedCnt < PROC_TRACK_EXITED)
+			procExited[procExitedCnt++] = ev->event_data.exit.process_tgid;
+		else
+			procExitedLost = true;
+		pthread_mutex_unlock(&procTrackLock);
+		break;
+	default:
+		break;
+	}
+}
+
+static int procListen(int fd, enum proc_cn_mcast_op op)
+{
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct cn_msg *cn = (struct cn_msg *)NLMSG_DATA(nlh);
+
+	memset(buf, 0, sizeof(buf));
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+	nlh->nlmsg_type = NLMSG_DONE;
+	nlh->nlmsg_pid = 0;
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(op);
+	memcpy(cn->data, &op, sizeof(op));
+	return (send(fd, buf, nlh->nlmsg_len, 0) < 0) ? -1 : 0;
+}
+
+static void *procTrackRun(void *arg)
+{
+	char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+	procRescan();
+	while(procTracking)
+	{
+		int len = recv(procNlFd, buf, sizeof(buf), 0);
+		if(len < 0)
+		{
+			if(errno == ENOBUFS)  // socket overrun, events are gone
+			{
+				log_i("processmonitor","proc connector overrun, rescan");
+				procRescan();
+			}
+			else if(errno != EINTR)
+			{
+				usleep(100 * 1000);
+			}
+			continue;
+		}
+		for(struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (unsigned int)len); nlh = NLMSG_NEXT(nlh, len))
+		{
+			struct cn_msg *cn = (struct cn_msg *)NLMSG_DATA(nlh);
+			struct proc_event ev;
+			if(nlh->nlmsg_type == NLMSG_NOOP)
+				continue;
+			if(nlh->nlmsg_type == NLMSG_ERROR || nlh->nlmsg_type == NLMSG_OVERRUN)
+			{
+				procRescan();
+				break;
+			}
+			if(cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+				continue;
+			if(nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(struct proc_event)))
+				continue;
+			memcpy(&ev, cn->data, sizeof(ev));   // cn->data is only 4 byte aligned
+			procOnEvent(&ev);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @name:   procTrackerStart
+ * @Author: qihoo360
+ * @msg:    needs CAP_NET_ADMIN and CONFIG_PROC_EVENTS, otherwise the caller keeps
+ *          the periodic /proc scan
+ * @param   hook:new process callback, may be NULL
+ * @return: 0:ok -1:unavailable
+ */
+int procTrackerStart(procExecHook hook)
+{
+	struct sockaddr_nl sa;
+	int rcvbuf = PROC_TRACK_RCVBUF;
+
+	if(procTracking)
+		return 0;
+	procHook = hook;
+	if((procNlFd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR)) < 0)
+		goto fail;
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = CN_IDX_PROC;
+	sa.nl_pid = 0;    // kernel assigns the port, other netlink users in this process may hold getpid()
+	setsockopt(procNlFd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	if(bind(procNlFd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		goto fail;
+	if(procListen(procNlFd, PROC_CN_MCAST_LISTEN) < 0)
+		goto fail;
+	procTracking = true;
+	if(pthread_create(&procTrackThread, NULL, procTrackRun, NULL) != 0)
+	{
+		procTracking = false;
+		goto fail;
+	}
+	pthread_detach(procTrackThread);
+	log_i("processmonitor","proc connector tracking started");
+	return 0;
+fail:
+	if(procNlFd >= 0)
+		close(procNlFd);
+	procNlFd = -1;
+	log_i("processmonitor","proc connector unavailable, polling /proc");
+	return -1;
+}
+
+bool procTrackerRunning(void)
+{
+	return procTracking;
+}
+
+/**
+ * @name:   procTrackerSnapshot
+ * @Author: qihoo360
+ * @msg:    one node per path like getProcessInfo, no /proc access
+ * @param
+ * @return: 0:ok -1:not running
+ */
+int procTrackerSnapshot(processNode_t *h)
+{
+	if(!procTracking)
+		return -1;
+	pthread_mutex_lock(&procTrackLock);
+	for(int b = 0; b < PROC_TRACK_BUCKETS; b++)
+		for(processNode_t *i = procBucket[b]; i != NULL; i = i->next)
+			if(!search_process_list(h, i->path))
+				append_process_list(h, i->pid, i->ppid, i->uid, i->gid, i->path);
+	pthread_mutex_unlock(&procTrackLock);
+	return 0;
+}
+
+// 0:zombie 1:alive -1:gone
+static int procZombieState(int pid, int *ppid, char *name, int len)
+{
+	char path[64], buf[512], *l = NULL, *r = NULL, state = 0;
+	FILE *fp = NULL;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	if((fp = fopen(path, "r")) == NULL)
+		return -1;
+	if(fgets(buf, sizeof(buf), fp) == NULL)
+		buf[0] = '\0';
+	fclose(fp);
+	// pid (comm) S ppid ...   comm may contain spaces and ')'
+	if((l = strchr(buf, '(')) == NULL || (r = strrchr(buf, ')')) == NULL || r < l)
+		return -1;
+	if(sscanf(r + 1, " %c %d", &state, ppid) != 2)
+		return -1;
+	if(state != 'Z' && state != 'z')
+		return 1;
+	*r = '\0';
+	snprintf(name, len, "%s", l + 1);
+	return 0;
+}
+
+/**
+ * @name:   procTrackerZombies
+ * @Author: qihoo360
+ * @msg:    only pids the kernel reported as exited are looked at; a /proc walk
+ *          is done when that list is incomplete or the tracker is not running
+ * @param
+ * @return:
+ */
+void procTrackerZombies(void (*report)(int pid, int ppid, char *name))
+{
+	int pids[PROC_TRACK_EXITED], cnt = 0, ppid = 0;
+	char name[64];
+	bool scan = !procTracking;
+
+	pthread_mutex_lock(&procTrackLock);
+	if(procTracking)
+	{
+		scan = procExitedLost;
+		procExitedLost = false;
+		if(scan)
+			procExitedCnt = 0;
+		cnt = procExitedCnt;
+		memcpy(pids, procExited, cnt * sizeof(int));
+	}
+	pthread_mutex_unlock(&procTrackLock);
+
+	if(scan)
+	{
+		DIR *dirproc = opendir("/proc");
+		struct dirent *direproc = NULL;
+		while(dirproc != NULL && (direproc = readdir(dirproc)) != NULL)
+		{
+			const char *cs = direproc->d_name;
+			int pid = atoi(cs);
+			while(isdigit(*cs))
+				cs++;
+			if(*cs || cs == direproc->d_name)
+				continue;
+			if(procZombieState(pid, &ppid, name, sizeof(name)) == 0)
+			{
+				report(pid, ppid, name);
+				if(procTracking)
+				{
+					pthread_mutex_lock(&procTrackLock);
+					if(procExitedCnt < PROC_TRACK_EXITED)
+						procExited[procExitedCnt++] = pid;
+					pthread_mutex_unlock(&procTrackLock);
+				}
+			}
+		}
+		if(dirproc)
+			closedir(dirproc);
+		return;
+	}
+
+	for(int i = 0; i < cnt; i++)
+	{
+		int st = procZombieState(pids[i], &ppid, name, sizeof(name));
+		if(st == 0)
+			report(pids[i], ppid, name);
+		if(st < 0)
+		{
+			// reaped, forget it
+			pthread_mutex_lock(&procTrackLock);
+			for(int j = 0; j < procExitedCnt; j++)
+			{
+				if(procExited[j] == pids[i])
+				{
+					procExited[j] = procExited[--procExitedCnt];
+					break;
+				}
+			}
+			pthread_mutex_unlock(&procTrackLock);
+		}
+	}
+}
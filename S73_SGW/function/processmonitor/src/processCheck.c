@@ -15,6 +15,7 @@
 #include "websocketmanager.h"
 #include "processCheck.h"
 #include "processInfo.h"
+#include "procTracker.h"
 
 #define PROCESS_CHANGE_MODE 1
 #define PROCESS_OPEN_MODE   2
@@ -23,6 +24,7 @@
 
 static processNode_t pHead2 = {.next=NULL}, oldHead2 = {.next = NULL};
 static list *whiteProcessName = NULL;
+static volatile bool processEventOn = false;
 
 void processCheckInit(list *listName)
 {
@@ -400,52 +402,36 @@ void checkProcessList()
 	processCompareEx();
 }
 
-void checkZombieProcess()
+static void reportZombieProcess(int pid, int ppid, char *name)
 {
 //Z+     33292   33293 [jingzhi] <defunct>
+    cJSON *cjson_data = processCompose(pid, ppid, 0, 0, name, PROCESS_ZOMBIE);
+    char *s = cJSON_PrintUnformatted(cjson_data);
+    websocketMangerMethodobj.sendEventData(EVENT_TYPE_PROCESS_CHANGED, s);
+    if(s)
+        free(s);
+    if(cjson_data)
+        cJSON_Delete(cjson_data);
+}
 
-    FILE *fp = NULL;
-    char buffer[1024] = {0};
-    int ret = 0;
-    int i = 0, j = 0;
-
-    fp = popen("ps -A -ostat,ppid,pid,cmd | grep -e '^[Zz]'", "r");
-    if (NULL == fp)
-    {
-        printf("popen\" ps -A -ostat,ppid,pid,cmd | grep -e '^[Zz]' \" error\n");
-        return ;
-    }
-
-    ret = fread(buffer, 1, sizeof(buffer), fp);
-    if (ret > 0)
-    {
-
-        char ostat_name[24] = {0};
-        char space[24] = {0};
-        char ppid[24] = {0};
-        char pid[24] = {0};
-        char path_temp[64] = {0};
-        char path[64] = {0};
-
-        sscanf(buffer, "%[^ ]%[ ]%[^ ]%[ ]%[^ ]%[ ]%[^ ]", ostat_name, space, ppid, space, pid, space, path_temp);
-
-        for (i = 0; i < sizeof(path_temp); i++)
-        {
-            if (path_temp[i] != '[' && path_temp[i] != ']')
-            {
-                path[j++] = path_temp[i];
-            }
-        }
-        cJSON *cjson_data = processCompose(atoi(pid), atoi(ppid), 0, 0, path, PROCESS_ZOMBIE);
-        char *s = cJSON_PrintUnformatted(cjson_data);
-        websocketMangerMethodobj.sendEventData(EVENT_TYPE_PROCESS_CHANGED, s);
-        if(s)
-            free(s);
-        if(cjson_data)
-            cJSON_Delete(cjson_data);
-    }
-    pclose(fp);
+void checkZombieProcess()
+{
+    procTrackerZombies(reportZombieProcess);
+}
 
-    return;
+// exec事件, 非白名单新进程立即上报
+static void processExecEvent(processNode_t *node)
+{
+    if(!processEventOn || whiteProcessName == NULL)
+        return;
+    if(judgeWhiteList(whiteProcessName, node->path))
+        return;
+    uploadProcessEvent(node->pid, node->ppid, node->uid, node->gid, node->path, PROCESS_OPEN_MODE);
 }
 
+void checkProcessEvents(bool enable)
+{
+    processEventOn = enable;
+    if(enable)
+        procTrackerStart(processExecEvent);
+}
@@ -16,13 +16,12 @@
 #include "util.h"
 #include "spdloglib.h"
 #include "processInfo.h"
+#include "procTracker.h"
 
 
 #define PATH_PROC	   		"/proc"
 #define PATH_CMDLINE		"cmdline"
 #define PATH_STATUS			"status"
-#define PATH_PROC_CMDLINE    PATH_PROC "/%s/" PATH_CMDLINE
-#define PATH_PROC_STATUS     PATH_PROC "/%s/" PATH_STATUS
 
 
 //拦截白名单里内容不上报
@@ -92,96 +91,80 @@ void destory_process_list(processNode_t *h)
 	h->pid = 0;
 }
 
-// 检测的进程放入pHead2
-void getProcessInfo(processNode_t *h)
+/**
+ * @name:   readProcessNode
+ * @Author: qihoo360
+ * @msg:    path from cmdline, ids from status, for one pid
+ * @param
+ * @return: 0:ok -1:gone or kernel thread
+ */
+int readProcessNode(int pid, processNode_t *node)
 {
-	char line[2048];
+	char line[64], cmdlbuf[512], statusbuf[512];
+	char *processName = NULL;
+	int fd, cmdllen, flags = 0;
 	FILE *fp = NULL;
-	int fd,cmdllen;
-	char cmdlbuf[512],statusbuf[512],finbuf[256];
-	const char *cs = NULL;
-	char *cmdlp = NULL,*processName = NULL,*p1 = NULL,*p2 = NULL,*p3 = NULL,*p4 = NULL;
-	DIR *dirproc=NULL;
-	struct dirent *direproc,*direfd;
-	cmdlbuf[sizeof(cmdlbuf)-1]='\0';
 
-	int pid,ppid,uid,gid,mode;
-	int pidflag,ppidflag,uidflag,gidflag;
+	snprintf(line, sizeof(line), PATH_PROC "/%d/" PATH_CMDLINE, pid);
+	if((fd = open(line, O_RDONLY)) < 0)
+		return -1;
+	cmdllen = read(fd, cmdlbuf, sizeof(cmdlbuf) - 1);
+	close(fd);
+	if(cmdllen <= 0)
+		return -1;
+	cmdlbuf[cmdllen] = '\0';
+	if((processName = strchr(cmdlbuf, '/')) == NULL)
+		processName = cmdlbuf;
+
+	snprintf(line, sizeof(line), PATH_PROC "/%d/" PATH_STATUS, pid);
+	if((fp = fopen(line, "r")) == NULL)
+		return -1;
+	while(flags != 0xF && fgets(statusbuf, sizeof(statusbuf), fp) != NULL)
+	{
+		if(sscanf(statusbuf, "Pid: %d", &node->pid) == 1)
+			flags |= 1;
+		else if(sscanf(statusbuf, "PPid: %d", &node->ppid) == 1)
+			flags |= 2;
+		else if(sscanf(statusbuf, "Uid: %d", &node->uid) == 1)
+			flags |= 4;
+		else if(sscanf(statusbuf, "Gid: %d", &node->gid) == 1)
+			flags |= 8;
+	}
+	fclose(fp);
+	if(flags != 0xF)
+		return -1;
+	memset(node->path, 0, sizeof(node->path));
+	strncpy(node->path, processName, sizeof(node->path) - 1);
+	node->next = NULL;
+	return 0;
+}
 
+// 检测的进程放入pHead2, proc connector在运行时直接取内存进程表
+void getProcessInfo(processNode_t *h)
+{
+	DIR *dirproc = NULL;
+	struct dirent *direproc = NULL;
+	const char *cs = NULL;
+	processNode_t node;
+
+	if(procTrackerSnapshot(h) == 0)
+		return;
 	if (!(dirproc=opendir(PATH_PROC))) goto fail;
-	while (direproc=readdir(dirproc)) 
+	while ((direproc=readdir(dirproc)) != NULL)
 	{
-		pidflag = 0;
-		ppidflag = 0;
-		uidflag = 0;
-		gidflag = 0;
-		for (cs=direproc->d_name;*cs;cs++)        
-			if (!isdigit(*cs))  
+		for (cs=direproc->d_name;*cs;cs++)
+			if (!isdigit(*cs))
 				break;
-		if (*cs) 
-			continue;
-		snprintf(line,sizeof(line),PATH_PROC_CMDLINE,direproc->d_name);
-		fd = open(line, O_RDONLY);
-		if (fd < 0) 
+		if (*cs)
 			continue;
-		cmdllen = read(fd, cmdlbuf, sizeof(cmdlbuf) - 1);
-		if (close(fd)) 
+		if (readProcessNode(atoi(direproc->d_name), &node) != 0)
 			continue;
-		if ((cmdllen == -1) || (cmdllen == 0))  
-			continue;
-		if (cmdllen < sizeof(cmdlbuf) - 1) 
-			cmdlbuf[cmdllen]='\0';
-		if ((cmdlp = strchr(cmdlbuf, '/'))) 
-			processName = cmdlp;
-		else
-			processName = cmdlbuf;
-		if(search_process_list(h,processName))
-			continue;
-		else
-		{
-			snprintf(line,sizeof(line),PATH_PROC_STATUS,direproc->d_name);
-			fp = fopen(line, "r");
-			if(fp == NULL) continue;
-			while(fgets(statusbuf,sizeof(statusbuf),fp)!=NULL)
-			{
-				p1 = strtok(statusbuf,":");
-				p2 = strtok(NULL,":");
-				if(strcmp("Pid",p1) == 0)
-				{
-					pidflag = 1;
-					pid = atoi(p2);	
-				}
-				if(strcmp("PPid",p1) == 0)
-				{
-                    ppidflag = 1;
-					ppid = atoi(p2);
-				}
-				if(strcmp("Uid",p1) == 0)
-				{
-                	uidflag = 1;
-                	p3 = strtok(p2+1," ");
-            		uid = atoi(p3);					
-				}
-				if(strcmp("Gid",p1) == 0)
-				{
-                    gidflag = 1;
-                    p3 = strtok(p2+1," ");
-                	gid = atoi(p3);
-				}
-				if(pidflag && ppidflag && uidflag && gidflag)
-				{
-					append_process_list(h, pid,ppid,uid,gid,processName);
-					break;
-				}
-			}
-				fclose(fp);
-			}
+		if (!search_process_list(h, node.path))
+			append_process_list(h, node.pid, node.ppid, node.uid, node.gid, node.path);
 	}
-	if(dirproc) 
-		closedir(dirproc);
+	closedir(dirproc);
 	return;
 fail:
 	printf("some error happen \n");
     log_e("processmonitor","open proc error");
 }
-